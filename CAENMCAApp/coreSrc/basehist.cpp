@@ -0,0 +1,216 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file basehist.cpp Implementation of #BaseHistogram class
+
+#include <algorithm>
+#include <iostream>
+
+#include "basehist.h"
+
+/// pending events merged at a time when the histogram is small, above this compact() is called
+/// when as many events are pending as there are bins so each event is sorted a bounded number of times
+static const size_t MIN_COMPACT_EVENTS = 1 << 20;
+
+/// LSD radix sort of keys on the bits that are set in any of them, tmp is used as the second buffer
+static void radixSort(std::vector<uint64_t>& keys, std::vector<uint64_t>& tmp)
+{
+    static const int RADIX_BITS = 11;
+    static const size_t NBUCKETS = (size_t)1 << RADIX_BITS;
+    size_t n = keys.size();
+    if (n < 4096)
+    {
+        std::sort(keys.begin(), keys.end());
+        return;
+    }
+    uint64_t all = 0;
+    for(size_t i=0; i<n; ++i)
+    {
+        all |= keys[i];
+    }
+    int nbits = 0;
+    while(nbits < 64 && (all >> nbits) != 0)
+    {
+        ++nbits;
+    }
+    tmp.resize(n);
+    std::vector<size_t> offset(NBUCKETS);
+    uint64_t* src = keys.data();
+    uint64_t* dst = tmp.data();
+    for(int shift=0; shift<nbits; shift+=RADIX_BITS)
+    {
+        std::fill(offset.begin(), offset.end(), 0);
+        for(size_t i=0; i<n; ++i)
+        {
+            ++offset[(src[i] >> shift) & (NBUCKETS - 1)];
+        }
+        size_t sum = 0;
+        for(size_t b=0; b<NBUCKETS; ++b)
+        {
+            size_t c = offset[b];
+            offset[b] = sum;
+            sum += c;
+        }
+        for(size_t i=0; i<n; ++i)
+        {
+            dst[offset[(src[i] >> shift) & (NBUCKETS - 1)]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+    if (src != keys.data())
+    {
+        keys.swap(tmp);
+    }
+}
+
+BaseHistogram::BaseHistogram() : m_tbinw(1), m_shift(0), m_max_mem(0), m_complete(false), m_nevents(0),
+    m_compact_at(MIN_COMPACT_EVENTS)
+{
+}
+
+/// set the time bin width in ns and the memory limit in bytes, 0 disables the histogram. Changing
+/// the width discards the bins, the histogram is then incomplete until the next clear()
+void BaseHistogram::configure(uint64_t tbinw, size_t max_bytes)
+{
+    tbinw = std::max<uint64_t>(tbinw, 1);
+    m_max_mem = max_bytes;
+    if (tbinw != m_tbinw || m_max_mem == 0)
+    {
+        m_tbinw = tbinw;
+        m_shift = -1;
+        for(int i=0; i<64; ++i)
+        {
+            if (m_tbinw == ((uint64_t)1 << i))
+            {
+                m_shift = i;
+            }
+        }
+        invalidate(NULL);
+    }
+    else if (memoryUsed() > m_max_mem)
+    {
+        invalidate("memory limit reached");
+    }
+}
+
+/// discard all events, the histogram is then complete() again if it is enabled
+void BaseHistogram::clear()
+{
+    std::vector<uint64_t>().swap(m_keys);
+    std::vector<int32_t>().swap(m_counts);
+    std::vector<uint64_t>().swap(m_pending);
+    std::vector<uint64_t>().swap(m_sort_tmp);
+    m_compact_at = MIN_COMPACT_EVENTS;
+    m_nevents = 0;
+    m_complete = (m_max_mem > 0);
+}
+
+/// stop adding events, reason is reported if not NULL. The histogram stays incomplete until the next clear()
+void BaseHistogram::invalidate(const char* reason)
+{
+    if (m_complete && reason != NULL)
+    {
+        std::cerr << "BaseHistogram: " << reason << ", spectra will need to be rebuilt from events on a binning change" << std::endl;
+    }
+    clear();
+    m_complete = false;
+}
+
+size_t BaseHistogram::memoryUsed() const
+{
+    return (m_keys.capacity() + m_pending.capacity() + m_sort_tmp.capacity()) * sizeof(uint64_t) +
+        m_counts.capacity() * sizeof(int32_t);
+}
+
+/// merge the pending events into the bins
+void BaseHistogram::compact()
+{
+    if (m_pending.empty())
+    {
+        return;
+    }
+    radixSort(m_pending, m_sort_tmp);
+    // run length encode the sorted keys in place
+    std::vector<int32_t> counts;
+    counts.reserve(m_pending.size());
+    size_t n = 0;
+    for(size_t i=0; i<m_pending.size(); ++i)
+    {
+        if (n > 0 && m_pending[n - 1] == m_pending[i])
+        {
+            ++counts[n - 1];
+        }
+        else
+        {
+            m_pending[n++] = m_pending[i];
+            counts.push_back(1);
+        }
+    }
+    merge(m_pending.data(), counts.data(), n);
+    m_pending.clear();
+    m_compact_at = std::max(MIN_COMPACT_EVENTS, m_keys.size());
+    if (memoryUsed() > m_max_mem)
+    {
+        invalidate("memory limit reached");
+    }
+}
+
+/// merge n bins with ascending keys into the bins
+void BaseHistogram::merge(const uint64_t* keys, const int32_t* counts, size_t n)
+{
+    std::vector<uint64_t> keys_out;
+    std::vector<int32_t> counts_out;
+    keys_out.reserve(m_keys.size() + n);
+    counts_out.reserve(m_keys.size() + n);
+    size_t i = 0, j = 0;
+    while(i < m_keys.size() || j < n)
+    {
+        if (j == n || (i < m_keys.size() && m_keys[i] < keys[j]))
+        {
+            keys_out.push_back(m_keys[i]);
+            counts_out.push_back(m_counts[i++]);
+        }
+        else if (i == m_keys.size() || keys[j] < m_keys[i])
+        {
+            keys_out.push_back(keys[j]);
+            counts_out.push_back(counts[j++]);
+        }
+        else
+        {
+            keys_out.push_back(keys[j]);
+            counts_out.push_back(m_counts[i++] + counts[j++]);
+        }
+    }
+    m_keys.swap(keys_out);
+    m_counts.swap(counts_out);
+}
+
+/// add the events of other, which must have the same time bin width, and clear it
+void BaseHistogram::merge(BaseHistogram& other)
+{
+    if (m_complete && other.m_tbinw == m_tbinw && other.m_complete)
+    {
+        other.compact();
+    }
+    if (m_complete && (other.m_tbinw != m_tbinw || !other.m_complete))
+    {
+        // other reports going over its own limit, one of 0 means it had no memory to use
+        invalidate(other.m_max_mem == 0 ? "memory limit reached" : NULL);
+    }
+    if (m_complete)
+    {
+        compact();
+        merge(other.m_keys.data(), other.m_counts.data(), other.m_keys.size());
+        m_nevents += other.m_nevents;
+        m_compact_at = std::max(MIN_COMPACT_EVENTS, m_keys.size());
+        if (memoryUsed() > m_max_mem)
+        {
+            invalidate("memory limit reached");
+        }
+    }
+    other.clear();
+}
@@ -0,0 +1,93 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file basehist.h Sparse fine grained time v energy histogram of list mode events.
+
+#ifndef BASEHIST_H
+#define BASEHIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Counts of histogrammed events in bins of time since frame start, of a width set by configure(),
+/// by full resolution energy. Only bins holding events are stored, as a key sorted list of
+/// (time bin, energy) and count, so user facing spectra of any coarser binning can be derived by
+/// summing bins with forEach() rather than re-binning every event. With the default width of 1 ns
+/// a derived spectrum is identical to one binned from the events. Events are appended to a pending
+/// list that is sorted and merged into the bins by compact(), which add() calls as the list grows.
+/// If the memory used exceeds the limit, or an event cannot be represented, complete() returns
+/// false until the next clear().
+class BaseHistogram
+{
+public:
+    static const int ENERGY_BITS = 15;  ///< list mode energy is a positive int16
+    static const uint64_t MAX_TIME_BINS = (uint64_t)1 << (64 - ENERGY_BITS);
+
+    BaseHistogram();
+    void configure(uint64_t tbinw, size_t max_bytes);
+    void clear();
+    void compact();
+    void merge(BaseHistogram& other);
+    bool complete() const { return m_complete; }
+    uint64_t timeBinWidth() const { return m_tbinw; } ///< ns
+    size_t maxMemory() const { return m_max_mem; }
+    size_t numBins() const { return m_keys.size(); } ///< bins holding events, as of the last compact()
+    int64_t nevents() const { return m_nevents; }    ///< events added since clear()
+    size_t memoryUsed() const;
+
+    /// add an event, tdiff is the time since frame start in ns and energy is below 2^ENERGY_BITS
+    void add(uint64_t tdiff, int energy)
+    {
+        if (!m_complete)
+        {
+            return;
+        }
+        uint64_t t = (m_shift >= 0 ? tdiff >> m_shift : tdiff / m_tbinw);
+        if (t >= MAX_TIME_BINS)
+        {
+            invalidate("event time beyond range");
+            return;
+        }
+        m_pending.push_back((t << ENERGY_BITS) | (uint64_t)energy);
+        ++m_nevents;
+        if (m_pending.size() >= m_compact_at)
+        {
+            compact();
+        }
+    }
+
+    /// call f(t0, t1, energy, count) for each bin in order of time then energy, the bin holds events
+    /// with times from t0 to t1 ns inclusive. Events added since the last compact() are not included
+    template <typename F>
+    void forEach(F f) const
+    {
+        const uint64_t emask = ((uint64_t)1 << ENERGY_BITS) - 1;
+        for(size_t i=0; i<m_keys.size(); ++i)
+        {
+            uint64_t t0 = (m_keys[i] >> ENERGY_BITS) * m_tbinw;
+            f(t0, t0 + m_tbinw - 1, (int)(m_keys[i] & emask), m_counts[i]);
+        }
+    }
+
+private:
+    uint64_t m_tbinw;
+    int m_shift;                    ///< log2(m_tbinw), or -1 if that is not a power of two
+    size_t m_max_mem;
+    bool m_complete;
+    int64_t m_nevents;
+    std::vector<uint64_t> m_keys;   ///< (time bin << ENERGY_BITS) | energy, ascending
+    std::vector<int32_t> m_counts;  ///< events in each bin of m_keys
+    std::vector<uint64_t> m_pending; ///< keys of events not yet merged into m_keys
+    std::vector<uint64_t> m_sort_tmp;
+    size_t m_compact_at;            ///< size of m_pending at which add() calls compact()
+
+    void merge(const uint64_t* keys, const int32_t* counts, size_t n);
+    void invalidate(const char* reason);
+};
+
+#endif /* BASEHIST_H */
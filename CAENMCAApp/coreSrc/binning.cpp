@@ -0,0 +1,75 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file binning.cpp Implementation of #UniformBinner class
+
+#include <cmath>
+
+#include "binning.h"
+
+/// precompute the binning of nbins over [xmin, xmax), an empty or invalid axis bins nothing
+void UniformBinner::set(double xmin, double xmax, int nbins)
+{
+    static const uint64_t scales[] = { 1, 1000 };
+    m_mode = ModeNone;
+    m_nbins = 0;
+    m_xlimit = 0;
+    m_scale = 1;
+    m_xmin = m_range = 0;
+    m_width = 1;
+    m_shift = 0;
+    m_recip = 0;
+    m_fxmin = m_fscale = 0.0;
+    if (nbins <= 0 || !(xmax > xmin))
+    {
+        return;
+    }
+    m_nbins = nbins;
+    m_mode = ModeFloat;
+    m_fxmin = xmin;
+    m_fscale = nbins / (xmax - xmin);
+    if (xmin < 0.0)
+    {
+        return;
+    }
+    for(size_t i=0; i<sizeof(scales) / sizeof(scales[0]); ++i)
+    {
+        double a = xmin * scales[i], b = xmax * scales[i];
+        if (a != floor(a) || b != floor(b) || b > 4.0e18)
+        {
+            continue;
+        }
+        uint64_t range = (uint64_t)b - (uint64_t)a;
+        if (range % nbins != 0)
+        {
+            continue;
+        }
+        m_xlimit = (uint64_t)ceil(xmax);
+        m_scale = scales[i];
+        m_xmin = (uint64_t)a;
+        m_range = range;
+        m_width = range / nbins;
+        if ((m_width & (m_width - 1)) == 0)
+        {
+            m_mode = ModeShift;
+            while ((1ULL << m_shift) < m_width)
+            {
+                ++m_shift;
+            }
+        }
+        else if (m_range < 0x100000000ULL)
+        {
+            m_mode = ModeReciprocal;
+            m_recip = 0x100000000ULL / m_width;
+        }
+        else
+        {
+            m_mode = ModeDivide;
+        }
+        return;
+    }
+}
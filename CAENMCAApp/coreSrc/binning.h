@@ -0,0 +1,75 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file binning.h Integer binning of event times and energies onto a uniform axis.
+
+#ifndef BINNING_H
+#define BINNING_H
+
+#include <cstdint>
+
+/// Maps a non-negative integer value, such as a time in ns or an energy channel, onto
+/// an axis of nbins equal bins covering [xmin, xmax). When xmin, xmax and the bin width are
+/// whole numbers of ns, or of ps, the bin is found with integer arithmetic only: a shift
+/// if the width is a power of two, otherwise a multiply by a precomputed 32 bit fixed point
+/// reciprocal followed by one correction step, so the result is exactly floor((x - xmin) / width).
+/// Any other axis falls back to floating point. There is no constructor so that it can
+/// live in structures that are zeroed with memset, the zeroed state bins nothing; call set() before use.
+class UniformBinner
+{
+public:
+    enum Mode { ModeNone = 0, ModeShift, ModeReciprocal, ModeDivide, ModeFloat };
+
+    void set(double xmin, double xmax, int nbins);
+    int nbins() const { return m_nbins; }
+    int mode() const { return m_mode; } ///< a #Mode value
+    bool integer() const { return m_mode != ModeFloat; }
+
+    /// bin of x, or -1 if x is outside the axis
+    int bin(uint64_t x) const
+    {
+        if (m_mode == ModeFloat)
+        {
+            double d = ((double)x - m_fxmin) * m_fscale;
+            return (d >= 0.0 && d < m_nbins ? (int)d : -1);
+        }
+        if (x >= m_xlimit) // always true for ModeNone, and x * m_scale cannot overflow below it
+        {
+            return -1;
+        }
+        uint64_t d = x * m_scale - m_xmin; // wraps to beyond m_range if x is below xmin
+        if (d >= m_range)
+        {
+            return -1;
+        }
+        if (m_mode == ModeShift)
+        {
+            return (int)(d >> m_shift);
+        }
+        if (m_mode == ModeReciprocal)
+        {
+            uint64_t q = (d * m_recip) >> 32; // either the quotient or one less
+            q += (d - q * m_width >= m_width ? 1 : 0);
+            return (int)q;
+        }
+        return (int)(d / m_width);
+    }
+
+private:
+    int m_mode;
+    int m_nbins;
+    uint64_t m_xlimit;  ///< no value at or above this, in input units, is on the axis
+    uint64_t m_scale;   ///< axis units per input unit, 1 or 1000 (ns to ps)
+    uint64_t m_xmin;    ///< in axis units
+    uint64_t m_range;   ///< xmax - xmin in axis units
+    uint64_t m_width;   ///< bin width in axis units
+    unsigned m_shift;   ///< log2(m_width) for ModeShift
+    uint64_t m_recip;   ///< floor(2^32 / m_width) for ModeReciprocal, m_range is below 2^32
+    double m_fxmin, m_fscale; ///< for ModeFloat
+};
+
+#endif /* BINNING_H */
@@ -0,0 +1,99 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file binningTest.cpp Checks #UniformBinner against a floating point reference.
+
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "binning.h"
+
+/// floor((x - xmin) * nbins / (xmax - xmin)), or -1 off the axis, in long double so it is exact
+/// for the whole numbers of ns or ps the integer modes handle
+static int referenceBin(uint64_t x, double xmin, double xmax, int nbins)
+{
+    long double d = ((long double)x - xmin) * nbins / ((long double)xmax - xmin);
+    return (d >= 0.0L && d < nbins ? (int)floorl(d) : -1);
+}
+
+/// compare the binner with the reference at, and either side of, every bin edge up to max_edges
+/// edges, and at random values over and around the axis. Returns the number of mismatches
+static int checkAxis(double xmin, double xmax, int nbins, int expected_mode)
+{
+    UniformBinner b;
+    b.set(xmin, xmax, nbins);
+    if (b.mode() != expected_mode)
+    {
+        testDiag("axis [%g, %g) %d bins: mode %d, expected %d", xmin, xmax, nbins, b.mode(), expected_mode);
+        return 1;
+    }
+    static const int max_edges = 20000;
+    std::vector<uint64_t> xs;
+    double width = (xmax - xmin) / nbins;
+    int step = std::max(nbins / max_edges, 1);
+    for(int k=0; k<=nbins; k+=step)
+    {
+        uint64_t edge = (uint64_t)ceil(xmin + k * width);
+        for(int j=-2; j<=2; ++j)
+        {
+            if ((int64_t)edge + j >= 0)
+            {
+                xs.push_back(edge + j);
+            }
+        }
+    }
+    std::mt19937_64 rng(12345);
+    std::uniform_int_distribution<uint64_t> dist(0, (uint64_t)(xmax + (xmax - xmin)));
+    for(int i=0; i<100000; ++i)
+    {
+        xs.push_back(dist(rng));
+    }
+    xs.push_back(0);
+    xs.push_back(~(uint64_t)0);
+    int nbad = 0;
+    for(size_t i=0; i<xs.size(); ++i)
+    {
+        int got = b.bin(xs[i]), want = referenceBin(xs[i], xmin, xmax, nbins);
+        if (got != want)
+        {
+            if (nbad < 5)
+            {
+                testDiag("axis [%g, %g) %d bins: x %llu bin %d, expected %d", xmin, xmax, nbins,
+                    (unsigned long long)xs[i], got, want);
+            }
+            ++nbad;
+        }
+    }
+    return nbad;
+}
+
+MAIN(binningTest)
+{
+    testPlan(12);
+    testOk(checkAxis(0.0, 1048576.0, 1024, UniformBinner::ModeShift) == 0, "power of two width");
+    testOk(checkAxis(1000.0, 1000.0 + 4096.0, 4096, UniformBinner::ModeShift) == 0, "unit width with offset");
+    testOk(checkAxis(0.0, 3.0e6, 1000000, UniformBinner::ModeReciprocal) == 0, "width 3");
+    testOk(checkAxis(17.0, 17.0 + 7.0 * 9999.0, 9999, UniformBinner::ModeReciprocal) == 0, "width 7 with offset");
+    testOk(checkAxis(0.0, 4294967295.0, 65535, UniformBinner::ModeReciprocal) == 0, "width 65537 over nearly 2^32");
+    testOk(checkAxis(0.0, 4294967295.0, 3, UniformBinner::ModeReciprocal) == 0, "width 1431655765, largest reciprocal correction");
+    testOk(checkAxis(0.5, 1000.5, 1000, UniformBinner::ModeReciprocal) == 0, "half ns edges, width 1000 ps");
+    testOk(checkAxis(0.25, 300.25, 100, UniformBinner::ModeReciprocal) == 0, "quarter ns edges, width 3000 ps");
+    testOk(checkAxis(0.0, 1.0e10, 1000, UniformBinner::ModeDivide) == 0, "range beyond 2^32");
+    testOk(checkAxis(0.0, 1000.0, 3, UniformBinner::ModeFloat) == 0, "width not a whole number of ps");
+
+    UniformBinner none;
+    none.set(10.0, 10.0, 100);
+    testOk(none.mode() == UniformBinner::ModeNone && none.bin(10) == -1, "empty axis bins nothing");
+    none.set(0.0, 100.0, 0);
+    testOk(none.mode() == UniformBinner::ModeNone && none.bin(0) == -1, "no bins bins nothing");
+    return testDone();
+}
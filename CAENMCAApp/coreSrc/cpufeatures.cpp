@@ -0,0 +1,41 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file cpufeatures.cpp Implementation of CPU feature detection, see cpufeatures.h
+
+#include "cpufeatures.h"
+
+#if defined(CPUFEATURES_AVX2) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+/// true if the CPU and OS support AVX2, so kernels marked AVX2_TARGET can be called
+bool cpuHasAVX2()
+{
+#if !defined(CPUFEATURES_AVX2)
+    return false;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(r, 1);
+    const int OSXSAVE = (1 << 27), AVX = (1 << 28);
+    if ((r[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX) || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false; // the OS does not save the ymm registers
+    }
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#endif
+}
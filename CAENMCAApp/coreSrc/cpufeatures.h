@@ -0,0 +1,25 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file cpufeatures.h Run time CPU feature detection for the SIMD kernels of the core library.
+
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+/// CPUFEATURES_AVX2 is defined where the compiler can build AVX2 kernels. AVX2_TARGET marks such a
+/// kernel so it is compiled for AVX2 while the rest of the library still runs on any x86 CPU
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPUFEATURES_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define CPUFEATURES_AVX2 1
+#define AVX2_TARGET
+#endif
+
+bool cpuHasAVX2();
+
+#endif /* CPUFEATURES_H */
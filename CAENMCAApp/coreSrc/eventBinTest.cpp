@@ -0,0 +1,237 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventBinTest.cpp Checks that binEvents() split across worker threads and summed gives the same spectra as one thread.
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "eventbin.h"
+
+static const int ENERGY_BINS = 4096;
+
+/// the spectra one thread bins into, as held by the driver for a channel or a histogram worker
+struct Spectra
+{
+    std::vector<double> event_spec_y;
+    TiledHistogram2D event_spec_2d;
+    GatedHistogramEngine hists;
+    BaseHistogram base;
+    ListModeCounters counters;
+
+    Spectra(const EventBinning& binning, const std::vector<GatedHistogramDef>& defs) : event_spec_y(binning.ev_tbin.nbins(), 0.0)
+    {
+        event_spec_2d.resize(binning.ev2d_nx, binning.ev2d_tbin.nbins());
+        hists.configure(defs);
+        base.configure(1, (size_t)1 << 30);
+        base.clear();
+    }
+    void bin(const EventBinning& binning, const ListModeBatch& batch, const std::vector<uint64_t>& tdiff, size_t begin, size_t end)
+    {
+        binEvents(binning, batch, tdiff.data(), begin, end, event_spec_y.data(), event_spec_2d, hists, base, counters);
+    }
+    /// sum the spectra of a worker into these, as the driver does at the end of a pass
+    void merge(Spectra& p)
+    {
+        for(size_t j=0; j<event_spec_y.size(); ++j)
+        {
+            event_spec_y[j] += p.event_spec_y[j];
+        }
+        event_spec_2d.merge(p.event_spec_2d);
+        hists.merge(p.hists);
+        base.merge(p.base);
+        counters.add(p.counters);
+    }
+};
+
+/// made up events with frame starts, fake events, overflows, energies beyond ENERGY_BINS and times off both time axes
+static void makeEvents(size_t n, ListModeBatch& batch, std::vector<uint64_t>& tdiff)
+{
+    std::mt19937 rng(1234);
+    batch.clear();
+    tdiff.clear();
+    for(size_t i=0; i<n; ++i)
+    {
+        int16_t energy;
+        uint32_t extras = 0;
+        for(int b=0; b<32; ++b)
+        {
+            extras |= (rng() % 20 == 0 ? 1u : 0u) << b;
+        }
+        switch(rng() % 20)
+        {
+        case 0:
+            energy = 0;
+            extras = ListModeEvent::FAKE_EVENT;
+            break;
+        case 1:
+            energy = ListModeEvent::ENERGY_OVERFLOW;
+            break;
+        case 2:
+            energy = (int16_t)(ENERGY_BINS + rng() % 1000);
+            break;
+        case 3:
+            energy = -(int16_t)(rng() % 100);
+            break;
+        default:
+            energy = (int16_t)(rng() % ENERGY_BINS);
+            break;
+        }
+        batch.trigger_time.push_back(i * 1000);
+        batch.energy.push_back(energy);
+        batch.extras.push_back(extras);
+        tdiff.push_back(rng() % 25000);
+    }
+}
+
+/// the gated histograms cover every kind of gate and axis
+static std::vector<GatedHistogramDef> makeHistograms()
+{
+    std::vector<GatedHistogramDef> defs(5);
+    defs[0].enabled = true;
+    defs[0].xmax = ENERGY_BINS;
+    defs[0].nbins = ENERGY_BINS;
+    defs[1] = defs[0];
+    defs[1].tmin = 5000.0;
+    defs[1].tmax = 15000.0;
+    defs[2].enabled = true;
+    defs[2].axis = GatedHistogramDef::AxisTime;
+    defs[2].xmin = 1000.0;
+    defs[2].xmax = 21000.0;
+    defs[2].nbins = 333;
+    defs[2].emin = 100;
+    defs[2].emax = 3000;
+    defs[3] = defs[0];
+    defs[3].flag_mask = 1u << FlagCounts::PILE_UP;
+    defs[3].flag_value = 0;
+    defs[4].enabled = true;
+    defs[4].tmin = 2000.0;
+    defs[4].tmax = 4000.0;
+    return defs;
+}
+
+/// sorted (time bin, energy, count) of a base histogram
+static std::vector< std::tuple<uint64_t, int, int32_t> > baseBins(BaseHistogram& base)
+{
+    std::vector< std::tuple<uint64_t, int, int32_t> > bins;
+    base.compact();
+    base.forEach([&](uint64_t t0, uint64_t, int energy, int32_t count) {
+        bins.push_back(std::make_tuple(t0, energy, count));
+    });
+    return bins;
+}
+
+/// every spectrum and counter of a and b is the same
+static bool sameSpectra(Spectra& a, Spectra& b)
+{
+    if (a.event_spec_y != b.event_spec_y)
+    {
+        testDiag("event spectra differ");
+        return false;
+    }
+    std::vector<int32_t> da, db;
+    a.event_spec_2d.toDense(da);
+    b.event_spec_2d.toDense(db);
+    if (da != db)
+    {
+        testDiag("2D spectra differ");
+        return false;
+    }
+    for(size_t j=0; j<a.hists.size(); ++j)
+    {
+        if (a.hists.counts(j) != b.hists.counts(j) || a.hists.nevents(j) != b.hists.nevents(j))
+        {
+            testDiag("gated histogram %lu differs", (unsigned long)j);
+            return false;
+        }
+    }
+    if (!a.base.complete() || !b.base.complete() || a.base.nevents() != b.base.nevents() || baseBins(a.base) != baseBins(b.base))
+    {
+        testDiag("base histograms differ");
+        return false;
+    }
+    if (!(a.counters == b.counters))
+    {
+        testDiag("counters differ");
+        return false;
+    }
+    return true;
+}
+
+/// bin the batch on one thread and split between nworkers threads, as the driver's histogram workers do
+static bool checkWorkers(int eng_bin_group, int nworkers)
+{
+    ListModeBatch batch;
+    std::vector<uint64_t> tdiff;
+    makeEvents(300001, batch, tdiff);
+    std::vector<GatedHistogramDef> defs = makeHistograms();
+    EventBinning binning;
+    binning.ev_tbin.set(1000.0, 20000.0, 1900);
+    binning.ev2d_tbin.set(0.0, 24000.0, 300);
+    binning.setEnergy(ENERGY_BINS, eng_bin_group);
+    Spectra single(binning, defs);
+    single.bin(binning, batch, tdiff, 0, batch.size());
+    Spectra reduced(binning, defs);
+    // built in place, a copied GatedHistogramEngine would point into the original's tables
+    std::vector< std::unique_ptr<Spectra> > partials;
+    std::vector<std::thread> threads;
+    size_t n = batch.size();
+    for(int i=0; i<nworkers; ++i)
+    {
+        partials.push_back(std::unique_ptr<Spectra>(new Spectra(binning, defs)));
+        threads.push_back(std::thread(&Spectra::bin, partials[i].get(), std::cref(binning), std::cref(batch), std::cref(tdiff),
+            i * n / nworkers, (i + 1) * n / nworkers));
+    }
+    for(int i=0; i<nworkers; ++i)
+    {
+        threads[i].join();
+        reduced.merge(*partials[i]);
+    }
+    const ListModeCounters& c = single.counters;
+    if (c.nevents_real_ev == 0 || c.neventnotbinned == 0 || c.neventenergydiscard == 0 || c.npileupevent == 0)
+    {
+        testDiag("the events do not reach every path through binEvents()");
+        return false;
+    }
+    return sameSpectra(single, reduced);
+}
+
+MAIN(eventBinTest)
+{
+    testPlan(8);
+    EventBinning binning;
+    binning.setEnergy(ENERGY_BINS, 8);
+    testOk(binning.ev2d_nx == 512 && binning.ev2d_eng_shift == 3, "power of two energy bin group");
+    binning.setEnergy(ENERGY_BINS, 3);
+    testOk(binning.ev2d_nx == 1366 && binning.ev2d_eng_shift == -1, "energy bin group rounded up");
+
+    ListModeCounters a, b;
+    a.nevents = 1; a.nevents_real_ev = 2; a.nframes = 3; a.ntimerollover = 4; a.ntimereset = 5;
+    a.neventenergysat = 6; a.nfakeevent = 7; a.nimpdynamsatevent = 8; a.npileupevent = 9;
+    a.neventenergyoutsca = 10; a.neventdursatinhibit = 11; a.neventnotbinned = 12;
+    a.neventenergydiscard = 13; a.neventenergygt0 = 14;
+    b.add(a);
+    b.add(a);
+    testOk(b.nevents == 2 && b.nevents_real_ev == 4 && b.nframes == 6 && b.ntimerollover == 8 && b.ntimereset == 10 &&
+        b.neventenergysat == 12 && b.nfakeevent == 14 && b.nimpdynamsatevent == 16 && b.npileupevent == 18 &&
+        b.neventenergyoutsca == 20 && b.neventdursatinhibit == 22 && b.neventnotbinned == 24 &&
+        b.neventenergydiscard == 26 && b.neventenergygt0 == 28, "counters added field by field");
+    b.reset();
+    testOk(b == ListModeCounters(), "counters reset");
+
+    testOk(checkWorkers(8, 2), "2 workers, energy bin group 8");
+    testOk(checkWorkers(8, 7), "7 workers, energy bin group 8");
+    testOk(checkWorkers(3, 3), "3 workers, energy bin group 3");
+    testOk(checkWorkers(1, 8), "8 workers, no energy grouping");
+    return testDone();
+}
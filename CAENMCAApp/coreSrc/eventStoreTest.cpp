@@ -0,0 +1,132 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventStoreTest.cpp Checks that events replayed from an #EventStore, in memory or spilled, are those appended.
+
+#include <algorithm>
+#include <random>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "eventstore.h"
+
+static const size_t CHUNK_BYTES = EventStore::CHUNK_EVENTS * EventStore::EVENT_BYTES;
+
+/// append n made up events to both the store and all, in batches of random size
+static bool appendEvents(EventStore& store, ListModeBatch& all, size_t n, std::mt19937& rng)
+{
+    bool ok = true;
+    while (n > 0)
+    {
+        ListModeBatch batch;
+        size_t nb = std::min<size_t>(n, 1 + rng() % 40000);
+        for(size_t i=0; i<nb; ++i)
+        {
+            batch.trigger_time.push_back(((uint64_t)rng() << 20) + all.size());
+            batch.energy.push_back((int16_t)(rng() % 32768));
+            batch.extras.push_back(rng());
+        }
+        ok = store.append(batch) && ok;
+        all.trigger_time.insert(all.trigger_time.end(), batch.trigger_time.begin(), batch.trigger_time.end());
+        all.energy.insert(all.energy.end(), batch.energy.begin(), batch.energy.end());
+        all.extras.insert(all.extras.end(), batch.extras.begin(), batch.extras.end());
+        n -= nb;
+    }
+    return ok;
+}
+
+/// replay every chunk of the store and compare with all
+static bool replayMatches(EventStore& store, const ListModeBatch& all)
+{
+    size_t k = 0;
+    ListModeBatch batch;
+    for(size_t c=0; c<store.numChunks(); ++c)
+    {
+        if (!store.readChunk(c, batch))
+        {
+            testDiag("chunk %lu cannot be read", (unsigned long)c);
+            return false;
+        }
+        for(size_t i=0; i<batch.size(); ++i, ++k)
+        {
+            if (k >= all.size() || batch.trigger_time[i] != all.trigger_time[k] || batch.energy[i] != all.energy[k] ||
+                batch.extras[i] != all.extras[k])
+            {
+                testDiag("event %lu of chunk %lu differs", (unsigned long)i, (unsigned long)c);
+                return false;
+            }
+        }
+    }
+    if (k != all.size() || store.size() != all.size())
+    {
+        testDiag("replayed %lu of %lu events", (unsigned long)k, (unsigned long)all.size());
+        return false;
+    }
+    return true;
+}
+
+MAIN(eventStoreTest)
+{
+    testPlan(14);
+    std::mt19937 rng(42);
+    {
+        EventStore store;
+        ListModeBatch all;
+        store.setMaxMemory(16 * CHUNK_BYTES);
+        store.clear();
+        testOk(appendEvents(store, all, 3 * EventStore::CHUNK_EVENTS + 123, rng), "events held in memory");
+        testOk(store.spillUsed() == 0, "nothing spilled");
+        testOk(replayMatches(store, all), "replay from memory");
+    }
+    {
+        EventStore store;
+        ListModeBatch all;
+        store.setSpillDirectory(".");
+        store.setMaxMemory(2 * CHUNK_BYTES);
+        store.clear();
+        testOk(appendEvents(store, all, 5 * EventStore::CHUNK_EVENTS + 4567, rng), "events spilled past the limit");
+        testOk(store.spillUsed() == (int64_t)(4 * CHUNK_BYTES) && store.memoryUsed() <= 2 * CHUNK_BYTES,
+            "all but the newest chunks spilled");
+        testOk(replayMatches(store, all), "replay from spill file");
+        // spilling after a replay has read the file must append at the end of the chunks already there
+        testOk(appendEvents(store, all, 2 * EventStore::CHUNK_EVENTS, rng) && replayMatches(store, all),
+            "replay after more events are spilled");
+        store.clear();
+        all.clear();
+        testOk(store.complete() && store.size() == 0 && store.spillUsed() == 0, "clear empties the store");
+        testOk(appendEvents(store, all, 3 * EventStore::CHUNK_EVENTS, rng) && replayMatches(store, all),
+            "replay after clear");
+    }
+    {
+        EventStore store;
+        ListModeBatch all;
+        store.setSpillDirectory(".");
+        store.setMaxMemory(16 * CHUNK_BYTES);
+        store.clear();
+        appendEvents(store, all, 4 * EventStore::CHUNK_EVENTS + 1, rng);
+        store.setMaxMemory(CHUNK_BYTES);
+        testOk(store.complete() && store.spillUsed() == (int64_t)(4 * CHUNK_BYTES), "lowering the limit spills");
+        testOk(replayMatches(store, all), "replay after lowering the limit");
+    }
+    {
+        EventStore store;
+        ListModeBatch all;
+        store.clear();
+        testOk(!appendEvents(store, all, 10, rng) && !store.complete(), "a store with a zero memory limit stores nothing");
+    }
+    {
+        EventStore store;
+        ListModeBatch all;
+        store.setSpillDirectory("./no/such/directory");
+        store.setMaxMemory(CHUNK_BYTES);
+        store.clear();
+        testOk(!appendEvents(store, all, 3 * EventStore::CHUNK_EVENTS, rng), "append fails when the spill file cannot be created");
+        testOk(!store.complete() && store.spillError(), "store is incomplete with a spill error");
+    }
+    return testDone();
+}
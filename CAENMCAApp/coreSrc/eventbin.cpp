@@ -0,0 +1,121 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventbin.cpp Implementation of binEvents() and #ListModeCounters
+
+#include <algorithm>
+
+#include "eventbin.h"
+
+void ListModeCounters::add(const ListModeCounters& c)
+{
+    nevents += c.nevents;
+    nevents_real_ev += c.nevents_real_ev;
+    nframes += c.nframes;
+    ntimerollover += c.ntimerollover;
+    ntimereset += c.ntimereset;
+    neventenergysat += c.neventenergysat;
+    nfakeevent += c.nfakeevent;
+    nimpdynamsatevent += c.nimpdynamsatevent;
+    npileupevent += c.npileupevent;
+    neventenergyoutsca += c.neventenergyoutsca;
+    neventdursatinhibit += c.neventdursatinhibit;
+    neventnotbinned += c.neventnotbinned;
+    neventenergydiscard += c.neventenergydiscard;
+    neventenergygt0 += c.neventenergygt0;
+}
+
+/// add the counts of the flags tracked individually
+void ListModeCounters::addFlags(const FlagCounts& f)
+{
+    ntimerollover += f.bits[FlagCounts::TIME_ROLLOVER];
+    ntimereset += f.bits[FlagCounts::TIME_RESET];
+    nfakeevent += f.bits[FlagCounts::FAKE_EVENT];
+    neventenergysat += f.bits[FlagCounts::ENERGY_SATURATED];
+    nimpdynamsatevent += f.bits[FlagCounts::INPUT_DYNAMICS_SATURATED];
+    npileupevent += f.bits[FlagCounts::PILE_UP];
+    neventenergyoutsca += f.bits[FlagCounts::OUTSIDE_SCA];
+    neventdursatinhibit += f.bits[FlagCounts::SATURATION_INHIBIT];
+}
+
+bool ListModeCounters::operator==(const ListModeCounters& c) const
+{
+    return nevents == c.nevents && nevents_real_ev == c.nevents_real_ev && nframes == c.nframes &&
+           ntimerollover == c.ntimerollover && ntimereset == c.ntimereset && neventenergysat == c.neventenergysat &&
+           nfakeevent == c.nfakeevent && nimpdynamsatevent == c.nimpdynamsatevent && npileupevent == c.npileupevent &&
+           neventenergyoutsca == c.neventenergyoutsca && neventdursatinhibit == c.neventdursatinhibit &&
+           neventnotbinned == c.neventnotbinned && neventenergydiscard == c.neventenergydiscard &&
+           neventenergygt0 == c.neventenergygt0;
+}
+
+/// set the energy binning, the 2D spectrum columns are rounded up so every energy below energy_bins has one
+void EventBinning::setEnergy(int energy_bins_, int eng_bin_group)
+{
+    energy_bins = energy_bins_;
+    ev2d_eng_bin_group = eng_bin_group;
+    ev2d_nx = (eng_bin_group > 0 ? std::max((energy_bins + eng_bin_group - 1) / eng_bin_group, 1) : 1);
+    ev2d_eng_shift = -1;
+    for(int i=0; i<16; ++i)
+    {
+        if (eng_bin_group == (1 << i))
+        {
+            ev2d_eng_shift = i;
+        }
+    }
+}
+
+/// bin events [begin, end) of batch, whose times since frame start (ns) are in tdiff[begin, end),
+/// into the given spectra. Every event is added to exactly one set of spectra so the result does
+/// not depend on how a batch is split between histogram workers
+void binEvents(const EventBinning& binning, const ListModeBatch& batch, const uint64_t* tdiff, size_t begin, size_t end,
+               double* event_spec_y, TiledHistogram2D& event_spec_2d, GatedHistogramEngine& hists, BaseHistogram& base,
+               ListModeCounters& counters)
+{
+    // local copies so the compiler can keep them in registers, the counts written below could otherwise alias them
+    const UniformBinner ev_tbin = binning.ev_tbin, ev2d_tbin = binning.ev2d_tbin;
+    const int energy_bins = binning.energy_bins, eng_shift = binning.ev2d_eng_shift, eng_bin_group = binning.ev2d_eng_bin_group;
+    int16_t energy;
+    uint32_t extras;
+    FlagCounts flags;
+    if (end > begin)
+    {
+        flags.count(&(batch.extras[begin]), end - begin);
+        counters.addFlags(flags);
+    }
+    for(size_t i=begin; i<end; ++i)
+    {
+        energy = batch.energy[i];
+        extras = batch.extras[i];
+        if ( ListModeEvent::isDetector(energy, extras) )
+        {
+            uint64_t t = tdiff[i];
+            ++counters.neventenergygt0;
+            // energies beyond the board's bits, which have no bin in the energy spectra, are discarded like overflows
+            if (energy != ListModeEvent::ENERGY_OVERFLOW && energy < energy_bins) {
+                int n = ev_tbin.bin(t);
+                if (n >= 0)
+                {
+                    event_spec_y[n] += 1.0;
+                    ++counters.nevents_real_ev;
+                }
+                else
+                {
+                    ++counters.neventnotbinned;
+                }
+                n = ev2d_tbin.bin(t);
+                if (n >= 0)
+                {
+                    event_spec_2d.add(eng_shift >= 0 ? energy >> eng_shift : energy / eng_bin_group, n);
+                }
+                hists.add(t, energy, extras);
+                base.add(t, energy);
+            } else {
+                ++counters.neventenergydiscard;
+            }
+        }
+    }
+}
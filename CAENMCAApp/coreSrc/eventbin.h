@@ -0,0 +1,66 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventbin.h Binning of list mode events into the event spectra, shared by the serial and worker thread paths.
+
+#ifndef EVENTBIN_H
+#define EVENTBIN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "listmode.h"
+#include "binning.h"
+#include "flagstats.h"
+#include "tiledhist.h"
+#include "histengine.h"
+#include "basehist.h"
+
+/// running totals of list mode events since the list file was (re)opened
+struct ListModeCounters
+{
+    int64_t nevents;            ///< all records read
+    int64_t nevents_real_ev;    ///< events in time spectrum
+    int64_t nframes;
+    int64_t ntimerollover;
+    int64_t ntimereset;
+    int64_t neventenergysat;
+    int64_t nfakeevent;
+    int64_t nimpdynamsatevent;
+    int64_t npileupevent;
+    int64_t neventenergyoutsca;
+    int64_t neventdursatinhibit;
+    int64_t neventnotbinned;
+    int64_t neventenergydiscard;
+    int64_t neventenergygt0;
+    ListModeCounters() { reset(); }
+    void reset() { memset(this, 0, sizeof(ListModeCounters)); }
+    void add(const ListModeCounters& c);
+    void addFlags(const FlagCounts& f);
+    bool operator==(const ListModeCounters& c) const;
+};
+
+/// how binEvents() bins events into the event spectra. Has no constructor so it may be
+/// zeroed with memset as part of an enclosing struct
+struct EventBinning
+{
+    UniformBinner ev_tbin;      ///< event time spectrum
+    UniformBinner ev2d_tbin;    ///< time axis of 2D time v energy spectrum
+    int energy_bins;            ///< events with a higher energy are discarded
+    int ev2d_eng_bin_group;     ///< energy channels summed into each column of the 2D spectrum
+    int ev2d_eng_shift;         ///< log2(ev2d_eng_bin_group), or -1 if that is not a power of two
+    int ev2d_nx;                ///< columns of the 2D spectrum
+
+    void setEnergy(int energy_bins, int eng_bin_group);
+};
+
+void binEvents(const EventBinning& binning, const ListModeBatch& batch, const uint64_t* tdiff, size_t begin, size_t end,
+               double* event_spec_y, TiledHistogram2D& event_spec_2d, GatedHistogramEngine& hists, BaseHistogram& base,
+               ListModeCounters& counters);
+
+#endif /* EVENTBIN_H */
@@ -0,0 +1,73 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventring.h Bounded lock free single producer single consumer ring buffer.
+
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+/// A fixed size ring of preallocated slots passed from one producer thread to one
+/// consumer thread without locking. The producer fills the slot returned by beginPush()
+/// and makes it visible with endPush(), the consumer processes front() and releases
+/// it with pop(). Slots are reused so any storage they own is allocated only once.
+template <typename T>
+class SPSCRing
+{
+public:
+    explicit SPSCRing(size_t capacity) : m_slots(capacity + 1), m_head(0), m_tail(0) { }
+
+    /// slot for the producer to fill, or NULL if the ring is full
+    T* beginPush()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (next(head) == m_tail.load(std::memory_order_acquire))
+        {
+            return NULL;
+        }
+        return &(m_slots[head]);
+    }
+    /// publish the slot returned by beginPush() to the consumer
+    void endPush()
+    {
+        m_head.store(next(m_head.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+    /// oldest filled slot, or NULL if the ring is empty
+    T* front()
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+        {
+            return NULL;
+        }
+        return &(m_slots[tail]);
+    }
+    /// return the slot from front() to the producer
+    void pop()
+    {
+        m_tail.store(next(m_tail.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+    /// number of filled slots, exact only when called from the producer or consumer thread
+    size_t size() const
+    {
+        size_t head = m_head.load(std::memory_order_acquire), tail = m_tail.load(std::memory_order_acquire);
+        return (head >= tail ? head - tail : head + m_slots.size() - tail);
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return m_slots.size() - 1; }
+
+private:
+    std::vector<T> m_slots;
+    std::atomic<size_t> m_head; ///< next slot to fill, written by producer only
+    std::atomic<size_t> m_tail; ///< next slot to consume, written by consumer only
+    size_t next(size_t i) const { return (i + 1 == m_slots.size() ? 0 : i + 1); }
+};
+
+#endif /* EVENTRING_H */
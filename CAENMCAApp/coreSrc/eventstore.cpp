@@ -0,0 +1,208 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventstore.cpp Implementation of #EventStore class
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "eventstore.h"
+#include "fileio.h"
+
+EventStore::EventStore() : m_first_in_memory(0), m_max_mem(0), m_mem_used(0), m_spill_file(NULL),
+    m_spill_error(false), m_spill_size(0), m_nevents(0), m_complete(false)
+{
+}
+
+EventStore::~EventStore()
+{
+    closeSpillFile();
+}
+
+/// create a spill file with a name unique to this process and store in the spill directory. An explicit
+/// path is used rather than tmpfile(), which on Windows creates the file in the root of the current drive
+bool EventStore::openSpillFile()
+{
+    static std::atomic<int> nfiles(0);
+    std::ostringstream name;
+    name << (m_spill_dir.empty() ? std::string(".") : m_spill_dir) << "/CAENMCA_spill_" << getpid() << "_" << nfiles++ << ".tmp";
+    m_spill_path = name.str();
+    if ( (m_spill_file = fopen(m_spill_path.c_str(), "w+b")) == NULL )
+    {
+        if (!m_spill_error)
+        {
+            std::cerr << "EventStore: unable to create spill file \"" << m_spill_path << "\"" << std::endl;
+        }
+        m_spill_error = true;
+        return false;
+    }
+    m_spill_error = false;
+    return true;
+}
+
+/// close and delete the spill file
+void EventStore::closeSpillFile()
+{
+    if (m_spill_file != NULL)
+    {
+        fclose(m_spill_file);
+        remove(m_spill_path.c_str());
+        m_spill_file = NULL;
+    }
+}
+
+/// discard all events, the store is then complete() again if storage is enabled
+void EventStore::clear()
+{
+    m_chunks.clear();
+    m_first_in_memory = 0;
+    m_mem_used = 0;
+    m_nevents = 0;
+    m_spill_size = 0;
+    closeSpillFile();
+    m_complete = (m_max_mem > 0);
+}
+
+/// set memory limit in bytes, 0 disables the store
+void EventStore::setMaxMemory(size_t max_bytes)
+{
+    if (max_bytes == m_max_mem)
+    {
+        return;
+    }
+    m_max_mem = max_bytes;
+    if (m_max_mem == 0)
+    {
+        invalidate();
+        return;
+    }
+    while (m_mem_used > m_max_mem && spill())
+        ;
+}
+
+/// stop storing events, the store stays incomplete until the next clear()
+void EventStore::invalidate()
+{
+    if (m_complete && m_max_mem > 0)
+    {
+        std::cerr << "EventStore: unable to store events, spectra will need to be rebuilt from the list file" << std::endl;
+    }
+    size_t max_mem = m_max_mem;
+    clear();
+    m_max_mem = max_mem;
+    m_complete = false;
+}
+
+/// add events to the store, returns false if they could not be stored
+bool EventStore::append(const ListModeBatch& batch)
+{
+    if (!m_complete)
+    {
+        return false;
+    }
+    size_t n = batch.size(), done = 0;
+    while (done < n)
+    {
+        if (m_chunks.empty() || m_chunks.back().nevents == CHUNK_EVENTS)
+        {
+            m_chunks.push_back(Chunk());
+            Chunk& c = m_chunks.back();
+            c.trigger_time.resize(CHUNK_EVENTS);
+            c.energy.resize(CHUNK_EVENTS);
+            c.extras.resize(CHUNK_EVENTS);
+            m_mem_used += CHUNK_EVENTS * EVENT_BYTES;
+            while (m_mem_used > m_max_mem && m_first_in_memory + 1 < m_chunks.size())
+            {
+                if (!spill())
+                {
+                    invalidate();
+                    return false;
+                }
+            }
+        }
+        Chunk& c = m_chunks.back();
+        size_t ncopy = std::min(n - done, CHUNK_EVENTS - c.nevents);
+        memcpy(c.trigger_time.data() + c.nevents, batch.trigger_time.data() + done, ncopy * sizeof(uint64_t));
+        memcpy(c.energy.data() + c.nevents, batch.energy.data() + done, ncopy * sizeof(int16_t));
+        memcpy(c.extras.data() + c.nevents, batch.extras.data() + done, ncopy * sizeof(uint32_t));
+        c.nevents += ncopy;
+        done += ncopy;
+    }
+    m_nevents += n;
+    return true;
+}
+
+/// move the oldest in memory chunk to the spill file, the chunk being filled is never spilled
+bool EventStore::spill()
+{
+    if (m_first_in_memory + 1 >= m_chunks.size())
+    {
+        return false;
+    }
+    if (m_spill_file == NULL && !openSpillFile())
+    {
+        return false;
+    }
+    Chunk& c = m_chunks[m_first_in_memory];
+    // write at the end of the chunks spilled so far, not the end of file, so the part of a failed write is overwritten
+    if (seekFile(m_spill_file, m_spill_size, SEEK_SET) != 0 ||
+        fwrite(c.trigger_time.data(), sizeof(uint64_t), c.nevents, m_spill_file) != c.nevents ||
+        fwrite(c.energy.data(), sizeof(int16_t), c.nevents, m_spill_file) != c.nevents ||
+        fwrite(c.extras.data(), sizeof(uint32_t), c.nevents, m_spill_file) != c.nevents)
+    {
+        m_spill_error = true;
+        return false;
+    }
+    c.spill_offset = m_spill_size;
+    m_spill_size += c.nevents * EVENT_BYTES;
+    std::vector<uint64_t>().swap(c.trigger_time);
+    std::vector<int16_t>().swap(c.energy);
+    std::vector<uint32_t>().swap(c.extras);
+    m_mem_used -= CHUNK_EVENTS * EVENT_BYTES;
+    ++m_first_in_memory;
+    return true;
+}
+
+/// replace contents of batch with the events of a chunk, chunks are in the order appended
+bool EventStore::readChunk(size_t index, ListModeBatch& batch)
+{
+    if (index >= m_chunks.size())
+    {
+        return false;
+    }
+    const Chunk& c = m_chunks[index];
+    batch.file_offset = -1;
+    batch.trigger_time.resize(c.nevents);
+    batch.energy.resize(c.nevents);
+    batch.extras.resize(c.nevents);
+    if (c.spill_offset < 0)
+    {
+        memcpy(batch.trigger_time.data(), c.trigger_time.data(), c.nevents * sizeof(uint64_t));
+        memcpy(batch.energy.data(), c.energy.data(), c.nevents * sizeof(int16_t));
+        memcpy(batch.extras.data(), c.extras.data(), c.nevents * sizeof(uint32_t));
+        return true;
+    }
+    if (fflush(m_spill_file) != 0 || seekFile(m_spill_file, c.spill_offset, SEEK_SET) != 0 ||
+        fread(batch.trigger_time.data(), sizeof(uint64_t), c.nevents, m_spill_file) != c.nevents ||
+        fread(batch.energy.data(), sizeof(int16_t), c.nevents, m_spill_file) != c.nevents ||
+        fread(batch.extras.data(), sizeof(uint32_t), c.nevents, m_spill_file) != c.nevents)
+    {
+        batch.clear();
+        return false;
+    }
+    return true;
+}
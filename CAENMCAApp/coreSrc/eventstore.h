@@ -0,0 +1,74 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file eventstore.h In memory columnar copy of the list mode events of a run.
+
+#ifndef EVENTSTORE_H
+#define EVENTSTORE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "listmode.h"
+
+/// Holds every event appended since the last clear() in fixed size columnar chunks so
+/// spectra can be rebuilt without re-reading the list file. When the memory used exceeds
+/// the limit set by setMaxMemory() the oldest chunks are spilled to a temporary file in the
+/// directory set by setSpillDirectory(), which is deleted when the store is cleared, and read
+/// back from there on replay. If events cannot be stored, e.g. the limit is 0 or the spill file
+/// cannot be written, complete() returns false until the next clear().
+class EventStore
+{
+public:
+    static const size_t CHUNK_EVENTS = 65536;
+    static const size_t EVENT_BYTES = sizeof(uint64_t) + sizeof(int16_t) + sizeof(uint32_t);
+
+    EventStore();
+    ~EventStore();
+    void clear();
+    void setMaxMemory(size_t max_bytes);
+    void setSpillDirectory(const std::string& dir) { m_spill_dir = dir; }
+    bool append(const ListModeBatch& batch);
+    bool readChunk(size_t index, ListModeBatch& batch);
+    size_t numChunks() const { return m_chunks.size(); }
+    uint64_t size() const { return m_nevents; }  ///< number of events stored
+    bool complete() const { return m_complete; }
+    size_t memoryUsed() const { return m_mem_used; } ///< bytes held in memory
+    int64_t spillUsed() const { return m_spill_size; } ///< bytes held in spill file
+    bool spillError() const { return m_spill_error; } ///< the last attempt to create or write the spill file failed
+
+private:
+    struct Chunk
+    {
+        std::vector<uint64_t> trigger_time;
+        std::vector<int16_t> energy;
+        std::vector<uint32_t> extras;
+        size_t nevents;
+        int64_t spill_offset; ///< -1 if chunk is in memory
+        Chunk() : nevents(0), spill_offset(-1) { }
+    };
+    std::vector<Chunk> m_chunks;
+    size_t m_first_in_memory; ///< chunks before this have been spilled
+    size_t m_max_mem;
+    size_t m_mem_used;
+    FILE* m_spill_file;
+    std::string m_spill_dir;
+    std::string m_spill_path;   ///< name of m_spill_file
+    bool m_spill_error;
+    int64_t m_spill_size;
+    uint64_t m_nevents;
+    bool m_complete;
+
+    bool spill();
+    bool openSpillFile();
+    void closeSpillFile();
+    void invalidate();
+};
+
+#endif /* EVENTSTORE_H */
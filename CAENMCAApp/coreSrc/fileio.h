@@ -0,0 +1,26 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file fileio.h File helpers shared by the core library sources.
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstdio>
+#include <cstdint>
+
+/// 64 bit safe fseek(), list and spill files can exceed 2GB
+inline int seekFile(FILE* f, int64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(f, offset, origin);
+#else
+    return fseeko(f, offset, origin);
+#endif
+}
+
+#endif /* FILEIO_H */
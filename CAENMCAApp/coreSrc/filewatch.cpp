@@ -0,0 +1,218 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file filewatch.cpp Wait for a list file being written by the board to grow.
+
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/vfs.h>
+#endif /* __linux__ */
+
+#include "filewatch.h"
+
+FileWatcher::FileWatcher(double min_interval, double max_interval) : m_min_interval(min_interval),
+    m_max_interval(std::max(max_interval, min_interval)), m_interval(m_max_interval), m_fd(-1), m_wake_fd(-1), m_wd(-1), m_woken(false)
+{
+#ifdef __linux__
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif /* __linux__ */
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+    if (m_wake_fd >= 0)
+    {
+        close(m_wake_fd);
+    }
+#endif /* __linux__ */
+}
+
+void FileWatcher::watch(const std::string& path)
+{
+    if (path == m_path)
+    {
+        return;
+    }
+    removeWatch();
+    m_path = path;
+    m_interval = m_max_interval;
+#ifdef _WIN32
+    size_t sep = m_path.find_last_of("/\\");
+#else
+    size_t sep = m_path.find_last_of('/');
+#endif /* _WIN32 */
+    m_name = (sep == std::string::npos ? m_path : m_path.substr(sep + 1));
+    addWatch();
+}
+
+#ifdef __linux__
+/// filesystems whose files can be written by another host without inotify seeing it
+static bool isRemoteFilesystem(long f_type)
+{
+    switch((unsigned long)f_type & 0xffffffffUL)
+    {
+        case 0x6969UL:          // NFS
+        case 0x517BUL:          // SMB
+        case 0xFF534D42UL:      // CIFS
+        case 0xFE534D42UL:      // SMB2
+        case 0x65735546UL:      // FUSE, e.g. sshfs
+        case 0x564C:            // NCP
+        case 0x5346414FUL:      // AFS
+            return true;
+        default:
+            return false;
+    }
+}
+#endif /* __linux__ */
+
+void FileWatcher::addWatch()
+{
+#ifdef __linux__
+    if (m_fd < 0 || m_wake_fd < 0 || m_path.empty())
+    {
+        return;
+    }
+    size_t sep = m_path.find_last_of('/');
+    std::string dir = (sep == std::string::npos ? "." : (sep == 0 ? "/" : m_path.substr(0, sep)));
+    struct statfs fs;
+    if (statfs(dir.c_str(), &fs) != 0 || isRemoteFilesystem(fs.f_type))
+    {
+        return;
+    }
+    m_wd = inotify_add_watch(m_fd, dir.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE |
+                             IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF);
+#endif /* __linux__ */
+}
+
+void FileWatcher::removeWatch()
+{
+#ifdef __linux__
+    if (m_wd >= 0)
+    {
+        inotify_rm_watch(m_fd, m_wd);
+        m_wd = -1;
+    }
+#endif /* __linux__ */
+}
+
+bool FileWatcher::wait(bool found_data)
+{
+    m_interval = (found_data ? std::max(m_min_interval, m_interval * 0.5) : std::min(m_max_interval, m_interval * 2.0));
+    // hold off for the minimum interval since the last wait, so a burst of
+    // writes is read in one pass rather than a pass per notification
+    std::chrono::duration<double> since = std::chrono::steady_clock::now() - m_last_wait;
+    if (since.count() < m_min_interval)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(m_min_interval - since.count()));
+    }
+    if (!notifying())
+    {
+        addWatch(); // the directory may have appeared since
+    }
+    bool changed = (notifying() ? waitNotify(m_max_interval) : waitPoll(m_path.empty() ? m_max_interval : (double)m_interval));
+    m_last_wait = std::chrono::steady_clock::now();
+    return changed;
+}
+
+void FileWatcher::wake()
+{
+    {
+        std::lock_guard<std::mutex> _lock(m_wake_lock);
+        m_woken = true;
+    }
+    m_wake_cond.notify_all();
+#ifdef __linux__
+    if (m_wake_fd >= 0)
+    {
+        uint64_t one = 1;
+        if (write(m_wake_fd, &one, sizeof(one)) != sizeof(one))
+        {
+            ; // counter is already non zero, the reader will wake anyway
+        }
+    }
+#endif /* __linux__ */
+}
+
+bool FileWatcher::waitPoll(double timeout)
+{
+    std::unique_lock<std::mutex> _lock(m_wake_lock);
+    bool woken = m_wake_cond.wait_for(_lock, std::chrono::duration<double>(timeout), [this] { return m_woken; });
+    m_woken = false;
+    return woken;
+}
+
+bool FileWatcher::waitNotify(double timeout)
+{
+#ifdef __linux__
+    bool changed = false;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    {
+        std::lock_guard<std::mutex> _lock(m_wake_lock);
+        changed = m_woken;
+        m_woken = false;
+    }
+    // events for other files in the directory are drained and the wait carries on
+    while (!changed && notifying())
+    {
+        std::chrono::milliseconds remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        struct pollfd fds[2] = { { m_fd, POLLIN, 0 }, { m_wake_fd, POLLIN, 0 } };
+        if (remaining.count() <= 0 || poll(fds, 2, (int)remaining.count()) <= 0)
+        {
+            break;
+        }
+        uint64_t count;
+        if (read(m_wake_fd, &count, sizeof(count)) == sizeof(count))
+        {
+            std::lock_guard<std::mutex> _lock(m_wake_lock);
+            m_woken = false;
+            changed = true;
+        }
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t n;
+        while( (n = read(m_fd, buffer, sizeof(buffer))) > 0 )
+        {
+            for(char* p = buffer; p < buffer + n; )
+            {
+                const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+                if (ev->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT))
+                {
+                    if ((ev->mask & IN_Q_OVERFLOW) != 0 || ev->wd == m_wd)
+                    {
+                        changed = true;
+                    }
+                    if ((ev->mask & IN_Q_OVERFLOW) == 0 && ev->wd == m_wd)
+                    {
+                        removeWatch(); // directory has gone, poll until it reappears
+                    }
+                }
+                else if (ev->len > 0 && m_name == ev->name)
+                {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+    return changed;
+#else
+    return waitPoll(timeout);
+#endif /* __linux__ */
+}
@@ -0,0 +1,64 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file filewatch.h Wait for a list file being written by the board to grow.
+
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+/// Lets a reader tailing a file sleep until the file may have changed. On Linux a file on a
+/// local filesystem is watched with inotify, so a write wakes the reader within the minimum
+/// interval. Otherwise, or for a network filesystem whose remote writes inotify does not see,
+/// the file is polled at an interval that halves each time the reader finds new data and
+/// doubles each time it does not, between the minimum and maximum intervals. The parent
+/// directory is watched so a file that does not exist yet, or is replaced, is picked up.
+/// watch() and wait() must be called from the reader thread, wake() can be called from any.
+class FileWatcher
+{
+public:
+    explicit FileWatcher(double min_interval = 0.02, double max_interval = 1.0);
+    ~FileWatcher();
+    /// set the file to watch, an empty path stops watching and wait() then sleeps the maximum interval
+    void watch(const std::string& path);
+    /// report whether the last read found new data, then block until the file may have changed.
+    /// Returns true if woken by a change notification or wake() rather than a timeout
+    bool wait(bool found_data);
+    /// make the current or next wait() return at once, e.g. when the reader's settings change
+    void wake();
+    /// change notification is active for the watched file, rather than polling
+    bool notifying() const { return m_wd >= 0; }
+    /// current poll interval (s)
+    double interval() const { return m_interval; }
+    const std::string& path() const { return m_path; }
+private:
+    double m_min_interval;
+    double m_max_interval;
+    std::atomic<double> m_interval;
+    std::string m_path;
+    std::string m_name;         ///< file name part of #m_path
+    std::chrono::steady_clock::time_point m_last_wait;
+    int m_fd;                   ///< inotify instance, -1 if unavailable
+    int m_wake_fd;              ///< eventfd written by wake(), -1 if unavailable
+    int m_wd;                   ///< inotify watch on the parent directory, -1 if polling
+    std::mutex m_wake_lock;
+    std::condition_variable m_wake_cond;
+    bool m_woken;
+    void addWatch();
+    void removeWatch();
+    bool waitNotify(double timeout);
+    bool waitPoll(double timeout);
+    FileWatcher(const FileWatcher&);
+    FileWatcher& operator=(const FileWatcher&);
+};
+
+#endif /* FILEWATCH_H */
@@ -0,0 +1,182 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file flagstats.cpp Implementation of #FlagCounts class
+
+#include <cstring>
+#include <algorithm>
+
+#include "flagstats.h"
+#include "cpufeatures.h"
+
+#ifdef CPUFEATURES_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/// index of the lowest set bit of x, x must not be 0
+static inline int lowestBit(uint32_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(x);
+#elif defined(_MSC_VER)
+    unsigned long b;
+    _BitScanForward(&b, x);
+    return (int)b;
+#else
+    int b = 0;
+    while ((x & 1) == 0)
+    {
+        x >>= 1;
+        ++b;
+    }
+    return b;
+#endif
+}
+
+/// add weight to the count of each bit set in x
+static inline void addBits(int64_t* bits, uint32_t x, int64_t weight)
+{
+    while (x != 0)
+    {
+        bits[lowestBit(x)] += weight;
+        x &= x - 1;
+    }
+}
+
+/// most events have few flags set so visiting only the set bits is cheaper than testing each one
+static void countScalar(const uint32_t* extras, size_t n, int64_t* bits)
+{
+    for(size_t i=0; i<n; ++i)
+    {
+        addBits(bits, extras[i], 1);
+    }
+}
+
+#ifdef CPUFEATURES_AVX2
+
+/// add carry, of weight 1, to the bit sliced counter held in plane, leaving the carry out in carry
+#define RIPPLE(plane, carry) { __m256i c_ = _mm256_and_si256(plane, carry); plane = _mm256_xor_si256(plane, carry); carry = c_; }
+
+/// Count 8 events at a time with bit sliced counters: bit b of lane j of plane k is bit k
+/// of the number of events in lane j that had bit b set. Vectors of extras words are added
+/// in pairs with a full adder into plane 0 whose carry then ripples through the higher planes,
+/// so there is no per bit work at all. With 8 planes the counters are read out into bits
+/// every 127 pairs of vectors, before they can overflow.
+AVX2_TARGET static void countAVX2(const uint32_t* extras, size_t n, int64_t* bits)
+{
+    static const size_t FLUSH_PAIRS = 127;
+    size_t npairs = n / 16, i = 0;
+    while (i < npairs)
+    {
+        __m256i p0 = _mm256_setzero_si256(), p1 = p0, p2 = p0, p3 = p0, p4 = p0, p5 = p0, p6 = p0, p7 = p0;
+        size_t end = i + std::min(npairs - i, FLUSH_PAIRS);
+        for(; i<end; ++i)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(extras + 16 * i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(extras + 16 * i + 8));
+            __m256i ab = _mm256_xor_si256(a, b);
+            __m256i carry = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(p0, ab));
+            p0 = _mm256_xor_si256(p0, ab);
+            RIPPLE(p1, carry);
+            RIPPLE(p2, carry);
+            RIPPLE(p3, carry);
+            RIPPLE(p4, carry);
+            RIPPLE(p5, carry);
+            RIPPLE(p6, carry);
+            RIPPLE(p7, carry);
+        }
+        __m256i planes[8] = { p0, p1, p2, p3, p4, p5, p6, p7 };
+        uint32_t lanes[8];
+        for(int k=0; k<8; ++k)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), planes[k]);
+            for(int j=0; j<8; ++j)
+            {
+                addBits(bits, lanes[j], (int64_t)1 << k);
+            }
+        }
+    }
+    countScalar(extras + 16 * npairs, n - 16 * npairs, bits);
+}
+
+#undef RIPPLE
+
+static const bool s_use_avx2 = cpuHasAVX2();
+
+#endif /* CPUFEATURES_AVX2 */
+
+void FlagCounts::reset()
+{
+    memset(bits, 0, sizeof(bits));
+}
+
+void FlagCounts::add(const FlagCounts& c)
+{
+    for(int i=0; i<NBITS; ++i)
+    {
+        bits[i] += c.bits[i];
+    }
+}
+
+/// add the flags of n events to the counts
+void FlagCounts::count(const uint32_t* extras, size_t n)
+{
+#ifdef CPUFEATURES_AVX2
+    if (s_use_avx2)
+    {
+        countAVX2(extras, n, bits);
+        return;
+    }
+#endif
+    countScalar(extras, n, bits);
+}
+
+/// true if count() uses the AVX2 kernel on this CPU
+bool FlagCounts::usingAVX2()
+{
+#ifdef CPUFEATURES_AVX2
+    return s_use_avx2;
+#else
+    return false;
+#endif
+}
+
+/// write the count of each flag seen, one per line
+void FlagCounts::print(std::ostream& os) const
+{
+    static const struct { int bit; const char* desc; } names[] = {
+        { DEAD_TIME, "First event after a dead time occurrence" },
+        { TIME_ROLLOVER, "Time tag rollover" },
+        { TIME_RESET, "Time tag reset" },
+        { FAKE_EVENT, "Fake event" },
+        { ENERGY_SATURATED, "Event energy saturated" },
+        { INPUT_DYNAMICS_SATURATED, "Input dynamics saturated event" },
+        { PILE_UP, "Pile up event" },
+        { DEADTIME_CALC, "Deadtime calc event" },
+        { OUTSIDE_SCA, "Event outside SCA interval" },
+        { SATURATION_INHIBIT, "Event occurred during saturation inhibit" }
+    };
+    for(int i=0; i<NBITS; ++i)
+    {
+        if (bits[i] == 0)
+        {
+            continue;
+        }
+        const char* desc = "Unknown flag";
+        for(size_t j=0; j<sizeof(names) / sizeof(names[0]); ++j)
+        {
+            if (names[j].bit == i)
+            {
+                desc = names[j].desc;
+            }
+        }
+        os << desc << " (0x" << std::hex << (1u << i) << std::dec << "): " << bits[i] << std::endl;
+    }
+}
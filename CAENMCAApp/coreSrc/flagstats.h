@@ -0,0 +1,44 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file flagstats.h Per bit counts of the flags (extras) word of list mode events.
+
+#ifndef FLAGSTATS_H
+#define FLAGSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/// Number of events with each bit of the extras word set. The counts for all 32 bits are
+/// accumulated in one pass over a batch, using AVX2 when the CPU supports it.
+struct FlagCounts
+{
+    enum {
+        DEAD_TIME = 0,          ///< first event after a dead time occurrence
+        TIME_ROLLOVER = 1,
+        TIME_RESET = 2,
+        FAKE_EVENT = 3,
+        ENERGY_SATURATED = 7,
+        INPUT_DYNAMICS_SATURATED = 10,
+        PILE_UP = 15,
+        DEADTIME_CALC = 16,
+        OUTSIDE_SCA = 17,
+        SATURATION_INHIBIT = 18,
+        NBITS = 32
+    };
+    int64_t bits[NBITS];   ///< bits[i] is the number of events with bit i of extras set
+
+    FlagCounts() { reset(); }
+    void reset();
+    void add(const FlagCounts& c);
+    void count(const uint32_t* extras, size_t n);
+    void print(std::ostream& os) const;
+    static bool usingAVX2();
+};
+
+#endif /* FLAGSTATS_H */
@@ -0,0 +1,100 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file frameIndexTest.cpp Checks saving, appending to and reloading the sidecar file of a #FrameIndex.
+
+#include <cstdio>
+#include <string>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "frameindex.h"
+
+static const char* SIDECAR = "frameIndexTest.fidx";
+static const long HEADER_BYTES = 16; ///< magic and stride
+
+static void addFrames(FrameIndex& index, int64_t first, int64_t last)
+{
+    for(int64_t k=first; k<=last; ++k)
+    {
+        index.addFrame(48 + k * 240, (uint64_t)k * 1000000);
+    }
+}
+
+static long fileSize(const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+/// both indexes hold the same entries
+static bool sameEntries(const FrameIndex& a, const FrameIndex& b)
+{
+    if (a.size() != b.size() || a.stride() != b.stride())
+    {
+        testDiag("%lu entries of stride %d, expected %lu of stride %d", (unsigned long)b.size(), b.stride(),
+            (unsigned long)a.size(), a.stride());
+        return false;
+    }
+    for(int64_t k=0; k<(int64_t)a.size() * a.stride(); ++k)
+    {
+        const FrameIndexEntry* ea = a.findFrame(k);
+        const FrameIndexEntry* eb = b.findFrame(k);
+        if (ea == NULL || eb == NULL || ea->frame != eb->frame || ea->offset != eb->offset || ea->time != eb->time)
+        {
+            testDiag("entries for frame %lld differ", (long long)k);
+            return false;
+        }
+    }
+    return true;
+}
+
+MAIN(frameIndexTest)
+{
+    testPlan(11);
+    remove(SIDECAR);
+    FrameIndex a(10);
+    addFrames(a, 0, 999);
+    testOk(a.size() == 100 && a.numFrames() == 1000, "every 10th frame indexed");
+    testOk(a.save(SIDECAR) && fileSize(SIDECAR) == HEADER_BYTES + 100 * (long)sizeof(FrameIndexEntry), "sidecar saved");
+
+    FrameIndex b;
+    testOk(b.load(SIDECAR) && sameEntries(a, b), "sidecar reloaded");
+    testOk(b.numFrames() == 990 && b.scanned() == 48 + 990 * 240, "reloaded index resumes from its last entry");
+
+    addFrames(a, 1000, 1499);
+    testOk(a.save(SIDECAR) && fileSize(SIDECAR) == HEADER_BYTES + 150 * (long)sizeof(FrameIndexEntry), "new entries appended");
+    testOk(a.save(SIDECAR) && fileSize(SIDECAR) == HEADER_BYTES + 150 * (long)sizeof(FrameIndexEntry), "save with no new entries writes nothing");
+    FrameIndex c;
+    testOk(c.load(SIDECAR) && sameEntries(a, c), "appended sidecar reloaded");
+
+    // carrying on from the reloaded index, as a rescan of the list file would, gives the same index
+    addFrames(b, 990, 1499);
+    testOk(sameEntries(a, b), "reloaded index extended");
+
+    // an entry out of order ends the valid part of the file, the next save rewrites the file
+    FILE* f = fopen(SIDECAR, "ab");
+    FrameIndexEntry bad = { 7, 0, 0 };
+    fwrite(&bad, sizeof(bad), 1, f);
+    fclose(f);
+    FrameIndex d;
+    testOk(d.load(SIDECAR) && sameEntries(a, d), "corrupt entry ignored");
+    testOk(d.save(SIDECAR) && fileSize(SIDECAR) == HEADER_BYTES + 150 * (long)sizeof(FrameIndexEntry), "damaged sidecar rewritten");
+
+    remove(SIDECAR);
+    FrameIndex e;
+    testOk(!e.load(SIDECAR), "missing sidecar not loaded");
+    return testDone();
+}
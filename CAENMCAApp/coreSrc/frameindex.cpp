@@ -0,0 +1,251 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file frameindex.cpp Implementation of #FrameIndex class
+
+#include <cstring>
+#include <algorithm>
+
+#include "listmode.h"
+#include "frameindex.h"
+#include "fileio.h"
+
+static const char SIDECAR_MAGIC[8] = { 'H', 'X', 'F', 'I', 'D', 'X', '1', '\0' };
+
+FrameIndex::FrameIndex(int stride) : m_stride(stride > 0 ? stride : 1), m_nframes(0), m_scanned(0), m_nsaved(0)
+{
+}
+
+/// forget all frames, e.g. when a new list file is opened
+void FrameIndex::clear()
+{
+    m_entries.clear();
+    m_nframes = 0;
+    m_scanned = 0;
+    m_nsaved = 0;
+}
+
+/// set how often frames are indexed, the index is cleared if this changes
+void FrameIndex::setStride(int stride)
+{
+    if (stride <= 0)
+    {
+        stride = 1;
+    }
+    if (stride != m_stride)
+    {
+        m_stride = stride;
+        clear();
+    }
+}
+
+/// last indexed frame at or before frame, or NULL if there is none
+const FrameIndexEntry* FrameIndex::findFrame(int64_t frame) const
+{
+    size_t lo = 0, hi = m_entries.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_entries[mid].frame <= frame)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo > 0 ? &(m_entries[lo - 1]) : NULL);
+}
+
+/// last indexed frame starting at or before time (ps), or NULL if there is none
+const FrameIndexEntry* FrameIndex::findTime(uint64_t time) const
+{
+    size_t lo = 0, hi = m_entries.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_entries[mid].time <= time)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo > 0 ? &(m_entries[lo - 1]) : NULL);
+}
+
+/// read f from the indexed frame nearest before the target, given by frame if that is not
+/// negative and otherwise by time, adding any frames not yet indexed. Returns the byte offset
+/// of the first frame start at or after the target, or -1 if it is not in the file
+int64_t FrameIndex::scanTo(FILE* f, int64_t frame, uint64_t time, int64_t* found_frame)
+{
+    const size_t EVENT_SIZE = ListModeDecoder::EVENT_SIZE;
+    const FrameIndexEntry* e = (frame >= 0 ? findFrame(frame) : findTime(time));
+    int64_t offset = (e != NULL ? e->offset : 0), k = (e != NULL ? e->frame : 0), nread;
+    if (seekFile(f, offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    ListModeDecoder decoder(256 * 1024);
+    ListModeBatch batch;
+    decoder.reset(offset);
+    while( (nread = decoder.read(f, INT64_MAX, batch)) > 0 )
+    {
+        for(size_t i=0; i<batch.size(); ++i)
+        {
+            if (!ListModeEvent::isFrameStart(batch.energy[i], batch.extras[i]))
+            {
+                continue;
+            }
+            int64_t pos = batch.file_offset + i * EVENT_SIZE;
+            uint64_t t = batch.trigger_time[i];
+            if (pos >= m_scanned && k == m_nframes)
+            {
+                addFrame(pos, t);
+            }
+            if ((frame >= 0 && k >= frame) || (frame < 0 && t >= time))
+            {
+                setScanned(pos + EVENT_SIZE);
+                if (found_frame != NULL)
+                {
+                    *found_frame = k;
+                }
+                return pos;
+            }
+            ++k;
+        }
+        setScanned(batch.file_offset + batch.size() * EVENT_SIZE);
+    }
+    return -1;
+}
+
+/// extend the index to cover f up to end, or to the end of the file if end is negative
+bool FrameIndex::scan(FILE* f, int64_t end)
+{
+    const size_t EVENT_SIZE = ListModeDecoder::EVENT_SIZE;
+    int64_t offset = (m_entries.empty() ? 0 : m_entries.back().offset), nread;
+    int64_t k = (m_entries.empty() ? 0 : m_entries.back().frame);
+    if (seekFile(f, offset, SEEK_SET) != 0)
+    {
+        return false;
+    }
+    ListModeDecoder decoder(256 * 1024);
+    ListModeBatch batch;
+    decoder.reset(offset);
+    while( (nread = decoder.read(f, (end >= 0 ? end - offset : INT64_MAX), batch)) > 0 )
+    {
+        for(size_t i=0; i<batch.size(); ++i)
+        {
+            if (ListModeEvent::isFrameStart(batch.energy[i], batch.extras[i]))
+            {
+                int64_t pos = batch.file_offset + i * EVENT_SIZE;
+                if (pos >= m_scanned && k == m_nframes)
+                {
+                    addFrame(pos, batch.trigger_time[i]);
+                }
+                ++k;
+            }
+        }
+        offset += nread;
+        setScanned(batch.file_offset + batch.size() * EVENT_SIZE);
+    }
+    return (nread == 0);
+}
+
+/// byte offset in f of the start of frame, or -1 if the file does not contain it
+int64_t FrameIndex::locateFrame(FILE* f, int64_t frame)
+{
+    return scanTo(f, std::max(frame, (int64_t)0), 0, NULL);
+}
+
+/// byte offset in f of the first frame starting at or after time (ps), whose
+/// number is returned in frame, or -1 if there is no such frame in the file
+int64_t FrameIndex::locateTime(FILE* f, uint64_t time, int64_t* frame)
+{
+    return scanTo(f, -1, time, frame);
+}
+
+/// replace the index with the contents of a sidecar file, returns false if it cannot be read
+bool FrameIndex::load(const std::string& filename)
+{
+    char magic[sizeof(SIDECAR_MAGIC)];
+    int32_t header[2];
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL)
+    {
+        return false;
+    }
+    clear();
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, SIDECAR_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(header), 1, f) != 1 || header[0] <= 0)
+    {
+        fclose(f);
+        return false;
+    }
+    m_stride = header[0];
+    FrameIndexEntry e;
+    bool valid = true;
+    while (fread(&e, sizeof(e), 1, f) == 1)
+    {
+        if ( e.frame % m_stride != 0 || (!m_entries.empty() &&
+             (e.frame <= m_entries.back().frame || e.offset <= m_entries.back().offset)) )
+        {
+            valid = false; // a corrupt entry, ignore the rest
+            break;
+        }
+        m_entries.push_back(e);
+    }
+    fclose(f);
+    if (!m_entries.empty())
+    {
+        // rescanning from the last entry will count it again and carry on from there
+        m_nframes = m_entries.back().frame;
+        m_scanned = m_entries.back().offset;
+    }
+    m_saved_name = filename;
+    m_nsaved = (valid ? m_entries.size() : 0); // so a save() rewrites a damaged file rather than appending to it
+    return true;
+}
+
+/// write the index to a sidecar file, only entries added since the last save() to the same file are written
+bool FrameIndex::save(const std::string& filename)
+{
+    if (filename != m_saved_name || m_nsaved > m_entries.size())
+    {
+        m_nsaved = 0;
+    }
+    if (m_nsaved > 0 && m_nsaved == m_entries.size())
+    {
+        return true;
+    }
+    FILE* f = fopen(filename.c_str(), (m_nsaved == 0 ? "wb" : "ab"));
+    if (f == NULL)
+    {
+        return false;
+    }
+    bool ok = true;
+    if (m_nsaved == 0)
+    {
+        int32_t header[2] = { m_stride, 0 };
+        ok = (fwrite(SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC), 1, f) == 1 && fwrite(header, sizeof(header), 1, f) == 1);
+    }
+    size_t n = m_entries.size() - m_nsaved;
+    if (ok && n > 0)
+    {
+        ok = (fwrite(&(m_entries[m_nsaved]), sizeof(FrameIndexEntry), n, f) == n);
+    }
+    if (fclose(f) != 0)
+    {
+        ok = false;
+    }
+    m_saved_name = filename;
+    m_nsaved = (ok ? m_entries.size() : 0);
+    return ok;
+}
@@ -0,0 +1,72 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file frameindex.h Index of frame start positions in a Hexagon binary list mode file.
+
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// position of a frame start record in a list file
+struct FrameIndexEntry
+{
+    int64_t frame;      ///< frame number, the first frame start record in the file is frame 0
+    int64_t offset;     ///< byte offset of the frame start record
+    uint64_t time;      ///< time tag of the frame start (ps)
+};
+
+/// Byte offset and time of every stride'th frame of a list file, so a reader can seek close to
+/// a frame or time and only scan the records from there rather than from the start of the file.
+/// Frames are added in file order as a reader meets them; scan() extends the index from
+/// the file itself. The index can be kept in a sidecar file next to the list file, entries
+/// are only ever appended to it so save() can be called cheaply as the list file grows.
+class FrameIndex
+{
+public:
+    explicit FrameIndex(int stride = 100);
+    void clear();
+    void setStride(int stride);
+    int stride() const { return m_stride; }
+    int64_t numFrames() const { return m_nframes; } ///< frames seen so far
+    size_t size() const { return m_entries.size(); }
+    int64_t scanned() const { return m_scanned; }   ///< bytes of the file covered by the index
+    void setScanned(int64_t offset) { if (offset > m_scanned) m_scanned = offset; }
+    const FrameIndexEntry* findFrame(int64_t frame) const;
+    const FrameIndexEntry* findTime(uint64_t time) const;
+    bool scan(FILE* f, int64_t end = -1);
+    int64_t locateFrame(FILE* f, int64_t frame);
+    int64_t locateTime(FILE* f, uint64_t time, int64_t* frame = NULL);
+    bool load(const std::string& filename);
+    bool save(const std::string& filename);
+    static std::string sidecarName(const std::string& list_filename) { return list_filename + ".fidx"; }
+
+    /// record a frame start, frames must be added in file order starting from frame 0 at the start of the file
+    void addFrame(int64_t offset, uint64_t time)
+    {
+        if (m_nframes % m_stride == 0 && (m_entries.empty() || offset > m_entries.back().offset))
+        {
+            FrameIndexEntry e = { m_nframes, offset, time };
+            m_entries.push_back(e);
+        }
+        ++m_nframes;
+    }
+
+private:
+    int m_stride;
+    int64_t m_nframes;
+    int64_t m_scanned;
+    size_t m_nsaved;        ///< entries already written to the sidecar file m_saved_name
+    std::string m_saved_name;
+    std::vector<FrameIndexEntry> m_entries;
+    int64_t scanTo(FILE* f, int64_t frame, uint64_t time, int64_t* found_frame);
+};
+
+#endif /* FRAMEINDEX_H */
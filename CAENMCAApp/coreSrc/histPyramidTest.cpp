@@ -0,0 +1,125 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file histPyramidTest.cpp Checks incremental updates of #HistPyramid2D against a full rebuild and direct sums.
+
+#include <random>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "histpyramid.h"
+
+/// level k of a dense nx by ny map summed directly from its bins
+static std::vector<int32_t> directLevel(const std::vector<int32_t>& dense, size_t nx, size_t ny, int k)
+{
+    size_t f = (size_t)1 << k, lnx = nx, lny = ny;
+    for(int i=0; i<k; ++i)
+    {
+        lnx = (lnx + 1) / 2;
+        lny = (lny + 1) / 2;
+    }
+    std::vector<int32_t> lev(lnx * lny, 0);
+    for(size_t y=0; y<ny; ++y)
+    {
+        for(size_t x=0; x<nx; ++x)
+        {
+            lev[(y / f) * lnx + x / f] += dense[y * nx + x];
+        }
+    }
+    return lev;
+}
+
+/// every level of pyr matches a pyramid rebuilt from base and the direct sums of base
+static bool levelsMatch(const HistPyramid2D& pyr, TiledHistogram2D& base)
+{
+    TiledHistogram2D copy;
+    copy.resize(base.nx(), base.ny());
+    copy.merge(base);
+    HistPyramid2D full;
+    full.update(copy);
+    std::vector<int32_t> dense;
+    base.toDense(dense);
+    for(int k=1; k<=HistPyramid2D::NLEVELS; ++k)
+    {
+        if (pyr.level(k) != full.level(k) || pyr.nx(k) != full.nx(k) || pyr.ny(k) != full.ny(k))
+        {
+            testDiag("level %d differs from a full rebuild", k);
+            return false;
+        }
+        if (pyr.level(k) != directLevel(dense, base.nx(), base.ny(), k))
+        {
+            testDiag("level %d differs from the direct sums", k);
+            return false;
+        }
+    }
+    return true;
+}
+
+/// add n events clustered around a random bin, so only some tiles change
+static void addEvents(TiledHistogram2D& h, size_t n, std::mt19937& rng)
+{
+    size_t cx = rng() % h.nx(), cy = rng() % h.ny();
+    for(size_t i=0; i<n; ++i)
+    {
+        size_t x = (cx + rng() % 100) % h.nx(), y = (cy + rng() % 20) % h.ny();
+        h.add(x, y, 1 + rng() % 3);
+    }
+}
+
+MAIN(histPyramidTest)
+{
+    testPlan(8);
+    std::mt19937 rng(7);
+    TiledHistogram2D base;
+    HistPyramid2D pyr;
+    base.resize(1000, 77); // neither a whole number of tiles nor of top level bins
+    addEvents(base, 5000, rng);
+    pyr.update(base);
+    testOk(pyr.valid() && levelsMatch(pyr, base), "initial build");
+    bool ok = true;
+    for(int i=0; i<20 && ok; ++i)
+    {
+        addEvents(base, 500, rng);
+        pyr.update(base);
+        ok = levelsMatch(pyr, base);
+    }
+    testOk(ok, "incremental updates");
+    pyr.update(base);
+    testOk(levelsMatch(pyr, base), "update with no changes");
+    base.clear();
+    addEvents(base, 100, rng);
+    pyr.update(base);
+    testOk(levelsMatch(pyr, base), "update after clear");
+    base.resize(513, 33);
+    addEvents(base, 3000, rng);
+    pyr.update(base);
+    testOk(levelsMatch(pyr, base), "rebuild after resize");
+    pyr.release();
+    testOk(!pyr.valid() && pyr.memoryUsed() == 0, "release frees the levels");
+    addEvents(base, 100, rng);
+    pyr.update(base);
+    testOk(levelsMatch(pyr, base), "rebuild after release");
+
+    std::vector<double> spec(1001);
+    for(size_t i=0; i<spec.size(); ++i)
+    {
+        spec[i] = (double)(rng() % 1000);
+    }
+    HistPyramid1D<double> pyr1;
+    pyr1.update(spec.data(), spec.size());
+    std::vector<int32_t> spec_i(spec.begin(), spec.end());
+    ok = true;
+    for(int k=1; k<=HistPyramid1D<double>::NLEVELS; ++k)
+    {
+        std::vector<int32_t> want = directLevel(spec_i, spec.size(), 1, k);
+        ok = ok && std::vector<double>(want.begin(), want.end()) == pyr1.level(k);
+    }
+    testOk(ok, "1D levels match the direct sums");
+    return testDone();
+}
@@ -0,0 +1,133 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file histengine.cpp Implementation of #GatedHistogramEngine class
+
+#include <cmath>
+#include <algorithm>
+
+#include "histengine.h"
+
+/// set the histogram table, a histogram whose definition has changed is zeroed
+void GatedHistogramEngine::configure(const std::vector<GatedHistogramDef>& defs)
+{
+    m_counts.resize(defs.size());
+    m_nevents.resize(defs.size(), 0);
+    m_defs.resize(defs.size());
+    for(size_t i=0; i<defs.size(); ++i)
+    {
+        size_t nbins = (defs[i].enabled && defs[i].nbins > 0 ? defs[i].nbins : 0);
+        if (defs[i] != m_defs[i] || m_counts[i].size() != nbins)
+        {
+            m_defs[i] = defs[i];
+            m_counts[i].assign(nbins, 0);
+            m_nevents[i] = 0;
+        }
+    }
+    m_active.clear();
+    m_active_index.assign(m_defs.size(), -1);
+    for(size_t i=0; i<m_defs.size(); ++i)
+    {
+        const GatedHistogramDef& d = m_defs[i];
+        if (!d.enabled)
+        {
+            continue;
+        }
+        Active a;
+        a.time_gate = (d.tmin < d.tmax);
+        a.tmin = (d.tmin > 0.0 ? (uint64_t)ceil(d.tmin) : 0);
+        a.tmax = (d.tmax >= 0.0 ? (uint64_t)floor(d.tmax) : 0);
+        if (a.time_gate && d.tmax < 0.0)
+        {
+            a.tmin = 1; // nothing accepted
+        }
+        a.energy_gate = (d.emin < d.emax);
+        a.emin = d.emin;
+        a.emax = d.emax;
+        a.flag_mask = d.flag_mask;
+        a.flag_value = d.flag_value & d.flag_mask;
+        a.axis = d.axis;
+        a.binner.set(d.xmin, d.xmax, (int)m_counts[i].size());
+        a.counts = m_counts[i].data();
+        a.nevents = &(m_nevents[i]);
+        m_active_index[i] = (int)m_active.size();
+        m_active.push_back(a);
+    }
+}
+
+/// zero all histograms
+void GatedHistogramEngine::clear()
+{
+    for(size_t i=0; i<m_counts.size(); ++i)
+    {
+        std::fill(m_counts[i].begin(), m_counts[i].end(), 0);
+        m_nevents[i] = 0;
+    }
+}
+
+/// add the counts of other, which must have been configured with the same definitions
+void GatedHistogramEngine::merge(const GatedHistogramEngine& other)
+{
+    for(size_t i=0; i<m_counts.size() && i<other.m_counts.size(); ++i)
+    {
+        const std::vector<int32_t>& c = other.m_counts[i];
+        for(size_t j=0; j<m_counts[i].size() && j<c.size(); ++j)
+        {
+            m_counts[i][j] += c[j];
+        }
+        m_nevents[i] += other.m_nevents[i];
+    }
+}
+
+/// axis value at the lower edge of each bin of histogram i
+void GatedHistogramEngine::binEdges(size_t i, std::vector<double>& x) const
+{
+    const GatedHistogramDef& d = m_defs[i];
+    x.resize(m_counts[i].size());
+    double binw = (x.size() > 0 ? (d.xmax - d.xmin) / x.size() : 0.0);
+    for(size_t j=0; j<x.size(); ++j)
+    {
+        x[j] = d.xmin + j * binw;
+    }
+}
+
+/// events at times t0 and t1 ns, and so any time between, are treated the same by the time gate and
+/// any time axis of histogram i, so a count of events anywhere in [t0, t1] can be added by add(i, ...)
+bool GatedHistogramEngine::sameTimeBin(size_t i, uint64_t t0, uint64_t t1) const
+{
+    if (m_active_index[i] < 0)
+    {
+        return true;
+    }
+    const Active& a = m_active[m_active_index[i]];
+    bool pass = a.timePasses(t0);
+    if (pass != a.timePasses(t1))
+    {
+        return false;
+    }
+    return !pass || a.axis != GatedHistogramDef::AxisTime || a.binner.bin(t0) == a.binner.bin(t1);
+}
+
+/// add n events of the same time and energy to histogram i only, its flag gate is not applied
+void GatedHistogramEngine::add(size_t i, uint64_t tdiff, int energy, int32_t n)
+{
+    if (m_active_index[i] < 0)
+    {
+        return;
+    }
+    const Active& a = m_active[m_active_index[i]];
+    if ( !a.timePasses(tdiff) || (a.energy_gate && (energy < a.emin || energy > a.emax)) )
+    {
+        return;
+    }
+    *a.nevents += n;
+    int k = a.binner.bin(a.axis == GatedHistogramDef::AxisTime ? tdiff : (uint64_t)energy);
+    if (k >= 0)
+    {
+        a.counts[k] += n;
+    }
+}
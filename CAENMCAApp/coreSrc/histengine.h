@@ -0,0 +1,106 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file histengine.h Table driven histogramming of list mode events through time, energy and flag gates.
+
+#ifndef HISTENGINE_H
+#define HISTENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "binning.h"
+
+/// definition of one gated histogram
+struct GatedHistogramDef
+{
+    enum Axis { AxisEnergy = 0, AxisTime = 1 };
+    bool enabled;
+    double tmin, tmax;      ///< time since frame start gate (ns), no gate if tmin >= tmax
+    int emin, emax;         ///< energy gate (channels), no gate if emin >= emax
+    uint32_t flag_mask;     ///< event accepted if (flags & flag_mask) == flag_value
+    uint32_t flag_value;
+    int axis;               ///< quantity histogrammed, an #Axis value
+    double xmin, xmax;      ///< axis range
+    int nbins;              ///< 0 to just count events passing the gates
+
+    GatedHistogramDef() : enabled(false), tmin(0.0), tmax(0.0), emin(0), emax(0), flag_mask(0), flag_value(0),
+        axis(AxisEnergy), xmin(0.0), xmax(0.0), nbins(0) { }
+    bool operator==(const GatedHistogramDef& d) const
+    {
+        return enabled == d.enabled && tmin == d.tmin && tmax == d.tmax && emin == d.emin && emax == d.emax &&
+               flag_mask == d.flag_mask && flag_value == d.flag_value && axis == d.axis &&
+               xmin == d.xmin && xmax == d.xmax && nbins == d.nbins;
+    }
+    bool operator!=(const GatedHistogramDef& d) const { return !(*this == d); }
+};
+
+/// Fills a table of gated histograms in a single pass over each event. Only enabled
+/// histograms are kept in the table evaluated per event, so a disabled definition costs nothing.
+class GatedHistogramEngine
+{
+public:
+    void configure(const std::vector<GatedHistogramDef>& defs);
+    void clear();
+    void merge(const GatedHistogramEngine& other);
+    const std::vector<GatedHistogramDef>& definitions() const { return m_defs; }
+    size_t size() const { return m_defs.size(); }
+    const GatedHistogramDef& definition(size_t i) const { return m_defs[i]; }
+    const std::vector<int32_t>& counts(size_t i) const { return m_counts[i]; }
+    int64_t nevents(size_t i) const { return m_nevents[i]; } ///< events that passed all gates of histogram i
+    void binEdges(size_t i, std::vector<double>& x) const;
+    /// histogram i does not gate on event flags, so can be filled from a #BaseHistogram with add(i, ...)
+    bool derivable(size_t i) const { return m_defs[i].flag_mask == 0; }
+    bool sameTimeBin(size_t i, uint64_t t0, uint64_t t1) const;
+    void add(size_t i, uint64_t tdiff, int energy, int32_t n);
+
+    /// add an event, tdiff is the time since frame start in ns and energy is not negative
+    void add(uint64_t tdiff, int energy, uint32_t flags)
+    {
+        for(size_t i=0; i<m_active.size(); ++i)
+        {
+            const Active& a = m_active[i];
+            if ( (a.time_gate && (tdiff < a.tmin || tdiff > a.tmax)) ||
+                 (a.energy_gate && (energy < a.emin || energy > a.emax)) ||
+                 ((flags & a.flag_mask) != a.flag_value) )
+            {
+                continue;
+            }
+            ++(*a.nevents);
+            int n = a.binner.bin(a.axis == GatedHistogramDef::AxisTime ? tdiff : (uint64_t)energy);
+            if (n >= 0)
+            {
+                ++(a.counts[n]);
+            }
+        }
+    }
+
+private:
+    /// flattened form of an enabled definition used in the per event loop, the time
+    /// gate is held as the range of whole ns it accepts so it can be compared as an integer
+    struct Active
+    {
+        bool time_gate;
+        uint64_t tmin, tmax;
+        bool energy_gate;
+        int emin, emax;
+        uint32_t flag_mask, flag_value;
+        int axis;
+        UniformBinner binner;
+        int32_t* counts;
+        int64_t* nevents;
+        bool timePasses(uint64_t tdiff) const { return !time_gate || (tdiff >= tmin && tdiff <= tmax); }
+    };
+    std::vector<GatedHistogramDef> m_defs;
+    std::vector< std::vector<int32_t> > m_counts;
+    std::vector<int64_t> m_nevents;
+    std::vector<Active> m_active;
+    std::vector<int> m_active_index; ///< entry of m_active for each definition, -1 if disabled
+};
+
+#endif /* HISTENGINE_H */
@@ -0,0 +1,144 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file histpyramid.cpp Implementation of #HistPyramid2D class
+
+#include <algorithm>
+
+#include "histpyramid.h"
+
+/// bring the levels up to date with base and mark all its tiles unchanged. If the levels are
+/// not valid, or base has been resized, they are rebuilt from all the tiles of base
+void HistPyramid2D::update(TiledHistogram2D& base)
+{
+    const size_t TILE_X = TiledHistogram2D::TILE_X, TILE_Y = TiledHistogram2D::TILE_Y;
+    m_tiles.clear();
+    if (!m_valid || base.nx() != m_base_nx || base.ny() != m_base_ny)
+    {
+        m_base_nx = base.nx();
+        m_base_ny = base.ny();
+        size_t nx = m_base_nx, ny = m_base_ny;
+        for(int k=0; k<NLEVELS; ++k)
+        {
+            nx = (nx + 1) / 2;
+            ny = (ny + 1) / 2;
+            m_levels[k].nx = nx;
+            m_levels[k].ny = ny;
+            m_levels[k].counts.assign(nx * ny, 0);
+        }
+        for(size_t t=0; t<base.numTiles(); ++t)
+        {
+            if (base.tile(t) != NULL)
+            {
+                m_tiles.push_back(t);
+            }
+        }
+        m_valid = true;
+    }
+    else
+    {
+        for(size_t t=0; t<base.numTiles(); ++t)
+        {
+            if (base.dirty(t))
+            {
+                m_tiles.push_back(t);
+            }
+        }
+    }
+    for(size_t i=0; i<m_tiles.size(); ++i)
+    {
+        updateLevel1(base, m_tiles[i]);
+    }
+    // a bin of level k is summed from the 2 by 2 bins of level k-1 below it, so levels are
+    // done in order and at each only the bins above a changed tile are recomputed
+    for(int k=2; k<=NLEVELS; ++k)
+    {
+        for(size_t i=0; i<m_tiles.size(); ++i)
+        {
+            size_t t = m_tiles[i];
+            size_t x0 = (t % base.tilesX()) * TILE_X, y0 = (t / base.tilesX()) * TILE_Y;
+            size_t x1 = std::min(x0 + TILE_X, m_base_nx), y1 = std::min(y0 + TILE_Y, m_base_ny);
+            updateLevel(k, x0 >> k, y0 >> k, (x1 - 1) >> k, (y1 - 1) >> k);
+        }
+    }
+    base.clearDirty();
+}
+
+/// free the levels, the next update() rebuilds them
+void HistPyramid2D::release()
+{
+    for(int k=0; k<NLEVELS; ++k)
+    {
+        std::vector<int32_t>().swap(m_levels[k].counts);
+        m_levels[k].nx = m_levels[k].ny = 0;
+    }
+    std::vector<size_t>().swap(m_tiles);
+    m_valid = false;
+}
+
+size_t HistPyramid2D::memoryUsed() const
+{
+    size_t n = 0;
+    for(int k=0; k<NLEVELS; ++k)
+    {
+        n += m_levels[k].counts.size() * sizeof(int32_t);
+    }
+    return n;
+}
+
+/// recompute the level 1 bins of base tile t, a tile has an even number of rows and
+/// columns so these are not shared with any other tile. Tile bins beyond the edge of
+/// the histogram are always zero
+void HistPyramid2D::updateLevel1(const TiledHistogram2D& base, size_t t)
+{
+    const size_t TILE_X = TiledHistogram2D::TILE_X, TILE_Y = TiledHistogram2D::TILE_Y;
+    Level& lev = m_levels[0];
+    const int32_t* src = base.tile(t);
+    size_t cx0 = (t % base.tilesX()) * TILE_X / 2, cy0 = (t / base.tilesX()) * TILE_Y / 2;
+    size_t ncx = std::min(TILE_X / 2, lev.nx - cx0), ncy = std::min(TILE_Y / 2, lev.ny - cy0);
+    for(size_t r=0; r<ncy; ++r)
+    {
+        int32_t* out = lev.counts.data() + (cy0 + r) * lev.nx + cx0;
+        if (src == NULL)
+        {
+            std::fill(out, out + ncx, 0);
+            continue;
+        }
+        const int32_t* row0 = src + 2 * r * TILE_X;
+        const int32_t* row1 = row0 + TILE_X;
+        for(size_t c=0; c<ncx; ++c)
+        {
+            out[c] = row0[2 * c] + row0[2 * c + 1] + row1[2 * c] + row1[2 * c + 1];
+        }
+    }
+}
+
+/// recompute bins (cx0, cy0) to (cx1, cy1) inclusive of level k > 1 from level k-1
+void HistPyramid2D::updateLevel(int k, size_t cx0, size_t cy0, size_t cx1, size_t cy1)
+{
+    Level& lev = m_levels[k - 1];
+    const Level& src = m_levels[k - 2];
+    cx1 = std::min(cx1, lev.nx - 1);
+    cy1 = std::min(cy1, lev.ny - 1);
+    for(size_t cy=cy0; cy<=cy1; ++cy)
+    {
+        const int32_t* row0 = src.counts.data() + 2 * cy * src.nx;
+        const int32_t* row1 = (2 * cy + 1 < src.ny ? row0 + src.nx : NULL);
+        int32_t* out = lev.counts.data() + cy * lev.nx;
+        for(size_t cx=cx0; cx<=cx1; ++cx)
+        {
+            size_t sx = 2 * cx;
+            bool pair = (sx + 1 < src.nx);
+            int32_t sum = row0[sx] + (pair ? row0[sx + 1] : 0);
+            if (row1 != NULL)
+            {
+                sum += row1[sx] + (pair ? row1[sx + 1] : 0);
+            }
+            out[cx] = sum;
+        }
+    }
+}
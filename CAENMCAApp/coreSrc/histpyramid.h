@@ -0,0 +1,99 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file histpyramid.h Down binned levels of spectra and 2D maps for overview displays.
+
+#ifndef HISTPYRAMID_H
+#define HISTPYRAMID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "tiledhist.h"
+
+/// Levels 1 to NLEVELS of a 1D spectrum, level k has bins of 2^k base bins so a display can
+/// fetch the level with about as many bins as it has pixels rather than the whole spectrum.
+/// A final partial bin holds what is left of the base. Each level is summed from the one below,
+/// so updating all of them costs about as much as one pass over the base.
+template <typename T>
+class HistPyramid1D
+{
+public:
+    static const int NLEVELS = 5;
+
+    /// recompute the levels from the n bins of base
+    void update(const T* base, size_t n)
+    {
+        for(int k=1; k<=NLEVELS; ++k)
+        {
+            std::vector<T>& lev = m_levels[k - 1];
+            lev.resize((n + 1) / 2);
+            for(size_t i=0; i<n / 2; ++i)
+            {
+                lev[i] = base[2 * i] + base[2 * i + 1];
+            }
+            if (n % 2 != 0)
+            {
+                lev[n / 2] = base[n - 1];
+            }
+            base = lev.data();
+            n = lev.size();
+        }
+    }
+    void clear()
+    {
+        for(int k=0; k<NLEVELS; ++k)
+        {
+            m_levels[k].clear();
+        }
+    }
+    /// level k, where 1 <= k <= NLEVELS
+    const std::vector<T>& level(int k) const { return m_levels[k - 1]; }
+
+private:
+    std::vector<T> m_levels[NLEVELS];
+};
+
+/// Levels 1 to NLEVELS of a #TiledHistogram2D, level k has bins of 2^k by 2^k base bins.
+/// update() only recomputes the bins of each level covering base tiles marked dirty since
+/// the last update, so the levels follow the base as events are added for a cost that depends
+/// on where the events fell rather than on the size of the map. The levels are dense and so
+/// together need about a third of the memory of a dense copy of the base; release() frees them
+/// when no overview is wanted.
+class HistPyramid2D
+{
+public:
+    static const int NLEVELS = 5;
+
+    HistPyramid2D() : m_base_nx(0), m_base_ny(0), m_valid(false) { }
+    void update(TiledHistogram2D& base);
+    void release();
+    /// the levels match the base as of the last update()
+    bool valid() const { return m_valid; }
+    /// level k, where 1 <= k <= NLEVELS, as ny(k) rows of nx(k) bins
+    const std::vector<int32_t>& level(int k) const { return m_levels[k - 1].counts; }
+    size_t nx(int k) const { return m_levels[k - 1].nx; }
+    size_t ny(int k) const { return m_levels[k - 1].ny; }
+    size_t memoryUsed() const;
+
+private:
+    struct Level
+    {
+        size_t nx, ny;
+        std::vector<int32_t> counts;
+        Level() : nx(0), ny(0) { }
+    };
+    Level m_levels[NLEVELS];
+    size_t m_base_nx, m_base_ny;
+    bool m_valid;
+    std::vector<size_t> m_tiles; ///< base tiles to update, kept to avoid reallocation
+    void updateLevel1(const TiledHistogram2D& base, size_t t);
+    void updateLevel(int k, size_t x0, size_t y0, size_t x1, size_t y1);
+};
+
+#endif /* HISTPYRAMID_H */
@@ -0,0 +1,160 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file imagekernel.cpp SIMD kernel for float images, see imagekernel.h
+
+#include <cmath>
+
+#include "imagekernel.h"
+#include "cpufeatures.h"
+
+#ifdef CPUFEATURES_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+template <int TransMode>
+static void transformScalar(const int32_t* data, size_t n, float gain, float* pMono)
+{
+    if (gain == 1.0f)
+    {
+        transformMonoT<float, TransMode, true>(data, n, 1.0f, pMono);
+    }
+    else
+    {
+        transformMonoT<float, TransMode, false>(data, n, gain, pMono);
+    }
+}
+
+#ifdef CPUFEATURES_AVX2
+
+/// natural log of 8 floats x >= 1, the Cephes logf polynomial with the mantissa reduced to [sqrt(0.5), sqrt(2))
+AVX2_TARGET static inline __m256 log8(__m256 x)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f000000)));
+    // m is in [0.5, 1), below sqrt(0.5) double it and take one from the exponent
+    __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+    m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(m, small)), one);
+    __m256 z = _mm256_mul_ps(m, m);
+    __m256 y = _mm256_set1_ps(7.0376836292E-2f);
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-1.1514610310E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(1.1676998740E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-1.2420140846E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(1.4249322787E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-1.6668057665E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(2.0000714765E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-2.4999993993E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(3.3333331174E-1f));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+    y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(-2.12194440e-4f)));
+    y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    return _mm256_add_ps(_mm256_add_ps(m, y), _mm256_mul_ps(e, _mm256_set1_ps(0.693359375f)));
+}
+
+/// log(1 + x) of 8 floats x >= 0. 1 + x loses the low bits of a small x, so the log of the
+/// rounded sum u is scaled by x / (u - 1) to correct for it, and u == 1 gives x
+AVX2_TARGET static inline __m256 log1p8(__m256 x)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 u = _mm256_add_ps(one, x);
+    __m256 d = _mm256_sub_ps(u, one);
+    __m256 exact = _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    __m256 r = _mm256_mul_ps(log8(u), _mm256_div_ps(x, _mm256_blendv_ps(d, one, exact)));
+    return _mm256_blendv_ps(r, x, exact);
+}
+
+/// 8 pixels at a time, the tail is done by the scalar loop
+template <int TransMode, bool UnitGain>
+AVX2_TARGET static void transformAVX2(const int32_t* data, size_t n, float gain, float* pMono)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t n8 = n / 8;
+    for(size_t i=0; i<n8; ++i)
+    {
+        __m256 v = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 8 * i)));
+        if (!UnitGain)
+        {
+            v = _mm256_mul_ps(v, g);
+        }
+        if (TransMode == IMAGE_TRANS_SQRT)
+        {
+            v = _mm256_sqrt_ps(v);
+        }
+        else if (TransMode == IMAGE_TRANS_LOG)
+        {
+            v = log1p8(v);
+        }
+        _mm256_storeu_ps(pMono + 8 * i, v);
+    }
+    transformMonoT<float, TransMode, UnitGain>(data + 8 * n8, n - 8 * n8, gain, pMono + 8 * n8);
+}
+
+template <int TransMode>
+static void transformVector(const int32_t* data, size_t n, float gain, float* pMono)
+{
+    if (gain == 1.0f)
+    {
+        transformAVX2<TransMode, true>(data, n, gain, pMono);
+    }
+    else
+    {
+        transformAVX2<TransMode, false>(data, n, gain, pMono);
+    }
+}
+
+static const bool s_use_avx2 = cpuHasAVX2();
+
+#endif /* CPUFEATURES_AVX2 */
+
+/// The log kernel needs 1 + gain * count >= 1, a negative or infinite gain goes through the scalar loop
+void transformMonoFloat(const int32_t* data, size_t n, float gain, int trans_mode, float* pMono)
+{
+#ifdef CPUFEATURES_AVX2
+    if (s_use_avx2 && gain >= 0.0f && std::isfinite(gain))
+    {
+        switch(trans_mode)
+        {
+            case IMAGE_TRANS_SQRT:
+                transformVector<IMAGE_TRANS_SQRT>(data, n, gain, pMono);
+                return;
+            case IMAGE_TRANS_LOG:
+                transformVector<IMAGE_TRANS_LOG>(data, n, gain, pMono);
+                return;
+            default:
+                transformVector<IMAGE_TRANS_NONE>(data, n, gain, pMono);
+                return;
+        }
+    }
+#endif
+    switch(trans_mode)
+    {
+        case IMAGE_TRANS_SQRT:
+            transformScalar<IMAGE_TRANS_SQRT>(data, n, gain, pMono);
+            break;
+        case IMAGE_TRANS_LOG:
+            transformScalar<IMAGE_TRANS_LOG>(data, n, gain, pMono);
+            break;
+        default:
+            transformScalar<IMAGE_TRANS_NONE>(data, n, gain, pMono);
+            break;
+    }
+}
+
+bool imageKernelUsingAVX2()
+{
+#ifdef CPUFEATURES_AVX2
+    return s_use_avx2;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,140 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file imagekernel.h Conversion of 2D histogram counts to image pixels.
+///
+/// The intensity transform and whether the gain is 1 are template parameters of the pixel loops,
+/// so the loops have no per pixel branch and vectorise. transformMono() and transformRGB() pick
+/// the loop once per image from the runtime transform mode and gain. Float images from integer
+/// counts use the SIMD kernel in imagekernel.cpp.
+
+#ifndef IMAGEKERNEL_H
+#define IMAGEKERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+
+/// intensity transform applied to a pixel, the values of the image trans_mode parameter
+enum ImageTransform { IMAGE_TRANS_NONE = 0, IMAGE_TRANS_SQRT = 1, IMAGE_TRANS_LOG = 2 };
+
+/// type the gain and transform are calculated in for an output pixel type. Float is exact enough
+/// for float and 8 or 16 bit integer pixels, wider integers and double need double
+template <typename epicsTypeOut>
+struct ImageCalcType
+{
+    typedef typename std::conditional<std::is_same<epicsTypeOut, float>::value ||
+        (std::is_integral<epicsTypeOut>::value && sizeof(epicsTypeOut) <= 2), float, double>::type type;
+};
+
+/// value of one pixel. As before the gain is applied and the result converted to the pixel
+/// type, then the transform is applied to that pixel value
+template <typename epicsTypeOut, int TransMode, bool UnitGain>
+struct ImagePixel
+{
+    typedef typename ImageCalcType<epicsTypeOut>::type calc_t;
+    template <typename epicsTypeIn>
+    static inline epicsTypeOut value(epicsTypeIn count, calc_t gain)
+    {
+        epicsTypeOut v = (UnitGain ? static_cast<epicsTypeOut>(count) : static_cast<epicsTypeOut>(gain * static_cast<calc_t>(count)));
+        switch(TransMode) // resolved at compile time
+        {
+            case IMAGE_TRANS_SQRT:
+                return static_cast<epicsTypeOut>(std::sqrt(static_cast<calc_t>(v)));
+            case IMAGE_TRANS_LOG:
+                return static_cast<epicsTypeOut>(std::log1p(static_cast<calc_t>(v)));
+            default:
+                return v;
+        }
+    }
+};
+
+/// fill n pixels from histogram counts, the counts are copied if neither gain nor transform change them
+template <typename epicsTypeOut, int TransMode, bool UnitGain, typename epicsTypeIn>
+void transformMonoT(const epicsTypeIn* data, size_t n, typename ImageCalcType<epicsTypeOut>::type gain, epicsTypeOut* pMono)
+{
+    if (UnitGain && TransMode == IMAGE_TRANS_NONE && std::is_same<epicsTypeOut, epicsTypeIn>::value)
+    {
+        memcpy(pMono, data, n * sizeof(epicsTypeOut));
+        return;
+    }
+    for (size_t k=0; k<n; ++k) {
+        pMono[k] = ImagePixel<epicsTypeOut, TransMode, UnitGain>::value(data[k], gain);
+    }
+}
+
+/// float pixels from integer counts, uses AVX2 where the CPU has it
+void transformMonoFloat(const int32_t* data, size_t n, float gain, int trans_mode, float* pMono);
+
+/// true if transformMonoFloat() uses the AVX2 kernel on this CPU
+bool imageKernelUsingAVX2();
+
+/// fill a mono image of n pixels from histogram counts scaled by gain
+template <typename epicsTypeOut, typename epicsTypeIn>
+void transformMono(const epicsTypeIn* data, size_t n, double gain, int trans_mode, epicsTypeOut* pMono)
+{
+    typedef typename ImageCalcType<epicsTypeOut>::type calc_t;
+    if (std::is_same<epicsTypeOut, float>::value && std::is_same<epicsTypeIn, int32_t>::value)
+    {
+        transformMonoFloat(reinterpret_cast<const int32_t*>(data), n, static_cast<float>(gain), trans_mode, reinterpret_cast<float*>(pMono));
+        return;
+    }
+    bool unit_gain = (gain == 1.0);
+    switch(trans_mode)
+    {
+        case IMAGE_TRANS_SQRT:
+            unit_gain ? transformMonoT<epicsTypeOut, IMAGE_TRANS_SQRT, true>(data, n, calc_t(1), pMono) :
+                        transformMonoT<epicsTypeOut, IMAGE_TRANS_SQRT, false>(data, n, static_cast<calc_t>(gain), pMono);
+            break;
+        case IMAGE_TRANS_LOG:
+            unit_gain ? transformMonoT<epicsTypeOut, IMAGE_TRANS_LOG, true>(data, n, calc_t(1), pMono) :
+                        transformMonoT<epicsTypeOut, IMAGE_TRANS_LOG, false>(data, n, static_cast<calc_t>(gain), pMono);
+            break;
+        default:
+            unit_gain ? transformMonoT<epicsTypeOut, IMAGE_TRANS_NONE, true>(data, n, calc_t(1), pMono) :
+                        transformMonoT<epicsTypeOut, IMAGE_TRANS_NONE, false>(data, n, static_cast<calc_t>(gain), pMono);
+            break;
+    }
+}
+
+/// fill the three colour planes of a sizeX by sizeY image from histogram counts scaled by gain,
+/// the layout of the planes is given by their start and the column and row steps of NDColorMode.
+/// Every pixel of every plane is written. Where a row of a plane is contiguous the red row is
+/// made with transformMono() and copied to green and blue
+template <typename epicsTypeOut, typename epicsTypeIn>
+void transformRGB(const epicsTypeIn* data, int sizeX, int sizeY, double gain, int trans_mode,
+                  epicsTypeOut* pRed, epicsTypeOut* pGreen, epicsTypeOut* pBlue, int columnStep, int rowStep)
+{
+    if (columnStep == 1)
+    {
+        for (int i=0; i<sizeY; i++) {
+            transformMono(data + (size_t)i * sizeX, sizeX, gain, trans_mode, pRed);
+            memcpy(pGreen, pRed, sizeX * sizeof(epicsTypeOut));
+            memcpy(pBlue, pRed, sizeX * sizeof(epicsTypeOut));
+            pRed   += sizeX + rowStep;
+            pGreen += sizeX + rowStep;
+            pBlue  += sizeX + rowStep;
+        }
+        return;
+    }
+    // interleaved colours, the row is made into the red plane then spread out in place from the end
+    // so no value is overwritten before it is read
+    for (int i=0; i<sizeY; i++) {
+        transformMono(data + (size_t)i * sizeX, sizeX, gain, trans_mode, pRed);
+        for (int j=sizeX-1; j>=0; j--) {
+            epicsTypeOut v = pRed[j];
+            pRed[j * columnStep] = pGreen[j * columnStep] = pBlue[j * columnStep] = v;
+        }
+        pRed   += sizeX * columnStep + rowStep;
+        pGreen += sizeX * columnStep + rowStep;
+        pBlue  += sizeX * columnStep + rowStep;
+    }
+}
+
+#endif /* IMAGEKERNEL_H */
@@ -0,0 +1,166 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file listmode.cpp Implementation of #ListModeDecoder and #ListModeEvent classes
+
+#include <cstring>
+#include <algorithm>
+
+#include "listmode.h"
+
+ListModeDecoder::ListModeDecoder(size_t block_size) : m_buffer(std::max(block_size, 4 * EVENT_SIZE)), m_carry(0), m_file_offset(0)
+{
+}
+
+/// discard any partially read record, next read() is from file position file_offset
+void ListModeDecoder::reset(int64_t file_offset)
+{
+    m_carry = 0;
+    m_file_offset = file_offset;
+}
+
+/// append the complete records in data to batch, returns number of records decoded
+size_t ListModeDecoder::decode(const char* data, size_t nbytes, ListModeBatch& batch)
+{
+    size_t n = nbytes / EVENT_SIZE;
+    size_t offset = batch.size();
+    batch.trigger_time.resize(offset + n);
+    batch.energy.resize(offset + n);
+    batch.extras.resize(offset + n);
+    uint64_t* trigger_time = batch.trigger_time.data() + offset;
+    int16_t* energy = batch.energy.data() + offset;
+    uint32_t* extras = batch.extras.data() + offset;
+    for(size_t i=0; i<n; ++i, data += EVENT_SIZE)
+    {
+        memcpy(trigger_time + i, data, sizeof(uint64_t));
+        memcpy(energy + i, data + 8, sizeof(int16_t));
+        memcpy(extras + i, data + 10, sizeof(uint32_t));
+    }
+    return n;
+}
+
+/// read at most max_bytes (and at most one block) from the current position of f and
+/// replace the contents of batch with the complete records now available.
+/// Returns the number of bytes read from the file, 0 at end of file or -1 on error
+int64_t ListModeDecoder::read(FILE* f, int64_t max_bytes, ListModeBatch& batch)
+{
+    batch.clear();
+    batch.file_offset = m_file_offset;
+    size_t to_read = m_buffer.size() - m_carry;
+    if (max_bytes < (int64_t)to_read)
+    {
+        to_read = (max_bytes > 0 ? (size_t)max_bytes : 0);
+    }
+    if (to_read == 0)
+    {
+        return 0;
+    }
+    size_t nread = fread(m_buffer.data() + m_carry, 1, to_read, f);
+    if (nread == 0)
+    {
+        return (ferror(f) ? -1 : 0);
+    }
+    size_t navail = m_carry + nread;
+    size_t nevents = decode(m_buffer.data(), navail, batch);
+    size_t used = nevents * EVENT_SIZE;
+    m_carry = navail - used;
+    if (m_carry > 0)
+    {
+        memmove(m_buffer.data(), m_buffer.data() + used, m_carry);
+    }
+    m_file_offset += used;
+    return nread;
+}
+
+/// set types[i - begin] to the ListModeEvent::Type of event i of batch, for i in [begin, end)
+void ListModeEvent::classify(const ListModeBatch& batch, size_t begin, size_t end, std::vector<uint8_t>& types)
+{
+    types.resize(end - begin);
+    const int16_t* energy = batch.energy.data();
+    const uint32_t* extras = batch.extras.data();
+    for(size_t i=begin; i<end; ++i)
+    {
+        types[i - begin] = (uint8_t)classify(energy[i], extras[i]);
+    }
+}
+
+/// append to starts the indexes in batch of the frame start records in [begin, end), returns the number found
+size_t ListModeEvent::findFrameStarts(const ListModeBatch& batch, size_t begin, size_t end, std::vector<size_t>& starts)
+{
+    size_t n = starts.size();
+    const int16_t* energy = batch.energy.data();
+    const uint32_t* extras = batch.extras.data();
+    for(size_t i=begin; i<end; ++i)
+    {
+        if (isFrameStart(energy[i], extras[i]))
+        {
+            starts.push_back(i);
+        }
+    }
+    return starts.size() - n;
+}
+
+/// text description of the flags set in an extras word
+std::string ListModeEvent::describeFlags(uint32_t flags)
+{
+    std::string s;
+    if (flags & 0x1)
+    {
+        s += "First event after a dead time occurrence, ";
+        flags &= ~0x1;
+    }
+    if (flags & 0x2)
+    {
+        s += "Time tag rollover, ";
+        flags &= ~0x2;
+    }
+    if (flags & 0x4)
+    {
+        s += "Time tag reset, ";
+        flags &= ~0x4;
+    }
+    if (flags & 0x8)
+    {
+        s += "Fake event, ";
+        flags &= ~0x8;
+    }
+    if (flags & 0x80)
+    {
+        s += "Event energy saturated, ";
+        flags &= ~0x80;
+    }
+    if (flags & 0x400)
+    {
+        s += "Input dynamics saturated event, ";
+        flags &= ~0x400;
+    }
+    if (flags & 0x8000)
+    {
+        s += "Pile up event, ";
+        flags &= ~0x8000;
+    }
+    if (flags & 0x10000)
+    {
+        s += "Deadtime calc event, ";
+        flags &= ~0x10000;
+    }
+    if (flags & 0x20000)
+    {
+        s += "Event outside SCA interval, ";
+        flags &= ~0x20000;
+    }
+    if (flags & 0x40000)
+    {
+        s += "Event occurred during saturation inhibit, ";
+        flags &= ~0x40000;
+    }
+    if (flags != 0)
+    {
+        s += "Unknown flag";
+    }
+    return s;
+}
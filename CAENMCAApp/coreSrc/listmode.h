@@ -0,0 +1,109 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file listmode.h Block buffered decoding of Hexagon binary list mode files.
+
+#ifndef LISTMODE_H
+#define LISTMODE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// A batch of decoded list mode events held as a structure of arrays
+struct ListModeBatch
+{
+    std::vector<uint64_t> trigger_time; ///< time tag in picoseconds
+    std::vector<int16_t> energy;
+    std::vector<uint32_t> extras;       ///< event flags
+    int64_t file_offset;                ///< byte offset in list file of first event in batch
+
+    ListModeBatch() : file_offset(0) { }
+    size_t size() const { return trigger_time.size(); }
+    void clear()
+    {
+        trigger_time.clear();
+        energy.clear();
+        extras.clear();
+    }
+    void reserve(size_t n)
+    {
+        trigger_time.reserve(n);
+        energy.reserve(n);
+        extras.reserve(n);
+    }
+};
+
+/// Rules for interpreting a list mode record, shared by the IOC and the offline tools
+struct ListModeEvent
+{
+    static const uint32_t FAKE_EVENT = 0x8;        ///< extras flag of a record not from the detector
+    static const int16_t ENERGY_OVERFLOW = 32767;  ///< energy of an event beyond the ADC range
+
+    enum Type
+    {
+        OTHER = 0,          ///< a fake event, or no energy
+        FRAME_START,        ///< frame (trigger) start record
+        DETECTOR,           ///< detector event to be histogrammed
+        DETECTOR_OVERFLOW   ///< detector event with an overflowed energy, counted but not histogrammed
+    };
+
+    /// a fake event with no energy marks the start of a frame
+    static bool isFrameStart(int16_t energy, uint32_t extras)
+    {
+        return extras == FAKE_EVENT && energy == 0;
+    }
+    /// a real detector event, whether or not its energy overflowed
+    static bool isDetector(int16_t energy, uint32_t extras)
+    {
+        return energy > 0 && (extras & FAKE_EVENT) == 0;
+    }
+    /// a detector event that should be histogrammed
+    static bool isValid(int16_t energy, uint32_t extras)
+    {
+        return isDetector(energy, extras) && energy != ENERGY_OVERFLOW;
+    }
+    static Type classify(int16_t energy, uint32_t extras)
+    {
+        if (isFrameStart(energy, extras))
+        {
+            return FRAME_START;
+        }
+        if (!isDetector(energy, extras))
+        {
+            return OTHER;
+        }
+        return (energy != ENERGY_OVERFLOW ? DETECTOR : DETECTOR_OVERFLOW);
+    }
+    static void classify(const ListModeBatch& batch, size_t begin, size_t end, std::vector<uint8_t>& types);
+    static size_t findFrameStarts(const ListModeBatch& batch, size_t begin, size_t end, std::vector<size_t>& starts);
+    static std::string describeFlags(uint32_t flags);
+};
+
+/// Reads a list mode file in large blocks and unpacks the packed little endian
+/// <QhI (trigger_time, energy, extras) records into a ListModeBatch. A record
+/// split across a block boundary is carried over to the next read.
+class ListModeDecoder
+{
+public:
+    static const size_t EVENT_SIZE = 14; ///< bytes per record in the file
+
+    explicit ListModeDecoder(size_t block_size = 1024 * 1024);
+    void reset(int64_t file_offset = 0);
+    int64_t read(FILE* f, int64_t max_bytes, ListModeBatch& batch);
+    static size_t decode(const char* data, size_t nbytes, ListModeBatch& batch);
+    /// bytes of an incomplete record read from the file but not yet decoded
+    size_t pending() const { return m_carry; }
+
+private:
+    std::vector<char> m_buffer;
+    size_t m_carry;
+    int64_t m_file_offset; ///< file offset of the next record to be decoded
+};
+
+#endif /* LISTMODE_H */
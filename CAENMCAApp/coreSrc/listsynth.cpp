@@ -0,0 +1,223 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file listsynth.cpp Synthetic Hexagon list mode event generation.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "listmode.h"
+#include "listsynth.h"
+
+AliasTable::AliasTable(const std::vector<double>& weights) : m_prob(weights.size(), 0), m_alias(weights.size(), 0)
+{
+    size_t n = weights.size();
+    double sum = 0.0;
+    for(size_t i=0; i<n; ++i)
+    {
+        sum += weights[i];
+    }
+    std::vector<double> p(n);
+    std::vector<size_t> small, large;
+    for(size_t i=0; i<n; ++i)
+    {
+        p[i] = (sum > 0.0 ? weights[i] * n / sum : 1.0);
+        (p[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        size_t s = small.back(), l = large.back();
+        small.pop_back();
+        large.pop_back();
+        m_prob[s] = (uint64_t)(p[s] * 4294967296.0);
+        m_alias[s] = (uint32_t)l;
+        p[l] += p[s] - 1.0;
+        (p[l] < 1.0 ? small : large).push_back(l);
+    }
+    for(size_t i=0; i<small.size(); ++i)
+    {
+        m_prob[small[i]] = 4294967296ULL;
+    }
+    for(size_t i=0; i<large.size(); ++i)
+    {
+        m_prob[large[i]] = 4294967296ULL;
+    }
+}
+
+TimeTable::TimeTable(double frame_ps, double decay_ps, double flat) : m_t(SIZE + 1)
+{
+    if (decay_ps <= 0.0)
+    {
+        flat = 1.0;
+        decay_ps = 1.0;
+    }
+    double norm = 1.0 - exp(-frame_ps / decay_ps);
+    for(size_t k=0; k<=SIZE; ++k)
+    {
+        double target = (double)k / SIZE, lo = 0.0, hi = frame_ps;
+        for(int it=0; it<60; ++it)
+        {
+            double t = 0.5 * (lo + hi);
+            double cdf = flat * t / frame_ps + (1.0 - flat) * (1.0 - exp(-t / decay_ps)) / norm;
+            (cdf < target ? lo : hi) = t;
+        }
+        m_t[k] = 0.5 * (lo + hi);
+    }
+}
+
+std::vector<EnergyLine> ListModeSynthSettings::parseLines(const std::string& s)
+{
+    std::vector<EnergyLine> lines;
+    size_t start = 0;
+    while (start < s.size())
+    {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = s.size();
+        }
+        EnergyLine l = { 0.0, 0.0, 1.0 };
+        if (sscanf(s.substr(start, end - start).c_str(), "%lf:%lf:%lf", &l.channel, &l.sigma, &l.weight) >= 1 && l.weight > 0.0)
+        {
+            lines.push_back(l);
+        }
+        start = end + 1;
+    }
+    return lines;
+}
+
+/// channels 1 to 32766 are used as energy 0 is a frame sync and 32767 an overflow
+std::vector<double> ListModeSynth::energyWeights(const std::vector<EnergyLine>& lines, double continuum)
+{
+    std::vector<double> w(32767, 0.0);
+    double line_sum = 0.0;
+    for(size_t i=0; i<lines.size(); ++i)
+    {
+        line_sum += lines[i].weight;
+    }
+    if (line_sum <= 0.0)
+    {
+        continuum = 1.0;
+    }
+    for(int c=1; c<32767; ++c)
+    {
+        w[c] = continuum / 32766.0;
+    }
+    for(size_t i=0; i<lines.size() && line_sum > 0.0; ++i)
+    {
+        const EnergyLine& l = lines[i];
+        double scale = (1.0 - continuum) * l.weight / line_sum;
+        if (l.sigma <= 0.0)
+        {
+            w[std::min(std::max((int)l.channel, 1), 32766)] += scale;
+            continue;
+        }
+        // an event of energy e is recorded in channel (int)e, clamped to the ADC range
+        for(int c=1; c<32767; ++c)
+        {
+            double lo = (c == 1 ? -1.0e30 : c), hi = (c == 32766 ? 1.0e30 : c + 1.0);
+            w[c] += scale * 0.5 * (erf((hi - l.channel) / (l.sigma * sqrt(2.0))) - erf((lo - l.channel) / (l.sigma * sqrt(2.0))));
+        }
+    }
+    return w;
+}
+
+char* ListModeSynth::putRecord(char* p, uint64_t trigger_time, int16_t energy, uint32_t extras)
+{
+    memcpy(p, &trigger_time, sizeof(trigger_time));
+    memcpy(p + 8, &energy, sizeof(energy));
+    memcpy(p + 10, &extras, sizeof(extras));
+    return p + ListModeDecoder::EVENT_SIZE;
+}
+
+ListModeSynth::ListModeSynth(const ListModeSynthSettings& settings, uint64_t first_frame_time) :
+    m_settings(settings), m_frame_ps((uint64_t)(1.0e12 / settings.frame_rate)),
+    m_rollover_ps((uint64_t)(settings.rollover_s * 1.0e12)), m_frame_start(first_frame_time), m_next_rollover(0),
+    m_rng(settings.seed), m_nevents_dist(settings.event_rate > 0.0 ? settings.event_rate / settings.frame_rate : 1.0),
+    m_energy_dist(energyWeights(settings.lines, settings.continuum)),
+    m_time_dist((double)m_frame_ps, settings.decay_ns * 1000.0, settings.flat)
+{
+    if (m_rollover_ps > 0)
+    {
+        m_next_rollover = (m_frame_start / m_rollover_ps + 1) * m_rollover_ps;
+    }
+}
+
+/// fill m_sorted with n uniform 64 bit values in ascending order. A counting sort on their top bits leaves
+/// only values in the same bucket out of order, about one per bucket, so the insertion sort is linear
+void ListModeSynth::sortedUniforms(size_t n)
+{
+    int bits = 1;
+    while (bits < 20 && ((size_t)1 << (bits + 1)) <= n)
+    {
+        ++bits;
+    }
+    const int shift = 64 - bits;
+    m_raw.resize(n);
+    m_sorted.resize(n);
+    m_counts.assign(((size_t)1 << bits) + 1, 0);
+    for(size_t i=0; i<n; ++i)
+    {
+        m_raw[i] = m_rng();
+        ++m_counts[(m_raw[i] >> shift) + 1];
+    }
+    for(size_t b=1; b<m_counts.size(); ++b)
+    {
+        m_counts[b] += m_counts[b - 1];
+    }
+    for(size_t i=0; i<n; ++i)
+    {
+        m_sorted[m_counts[m_raw[i] >> shift]++] = m_raw[i];
+    }
+    for(size_t i=1; i<n; ++i)
+    {
+        uint64_t v = m_sorted[i];
+        size_t j = i;
+        while (j > 0 && m_sorted[j - 1] > v)
+        {
+            m_sorted[j] = m_sorted[j - 1];
+            --j;
+        }
+        m_sorted[j] = v;
+    }
+}
+
+int ListModeSynth::appendFrame(std::vector<char>& data, size_t& data_size)
+{
+    int nev = (m_settings.event_rate > 0.0 ? m_nevents_dist(m_rng) : 0);
+    sortedUniforms(nev);
+    data.resize(std::max(data.size(), data_size + (nev + 1) * ListModeDecoder::EVENT_SIZE));
+    char* p = putRecord(&(data[data_size]), m_frame_start, 0, ListModeEvent::FAKE_EVENT);
+    for(int i=0; i<nev; ++i)
+    {
+        uint64_t trigger_time = m_frame_start + (uint64_t)m_time_dist.time(m_sorted[i]);
+        int energy = (int)m_energy_dist.sample(m_rng);
+        uint32_t extras = 0;
+        double r = m_rng.uniform();
+        if (r < m_settings.saturated)
+        {
+            extras |= 0x80;
+            energy = ListModeEvent::ENERGY_OVERFLOW;
+        }
+        else if (r < m_settings.saturated + m_settings.pileup)
+        {
+            extras |= 0x8000;
+            energy = std::min(energy + (int)m_energy_dist.sample(m_rng), (int)ListModeEvent::ENERGY_OVERFLOW);
+        }
+        if (m_next_rollover > 0 && trigger_time >= m_next_rollover)
+        {
+            extras |= 0x2;
+            m_next_rollover += m_rollover_ps;
+        }
+        p = putRecord(p, trigger_time, (int16_t)energy, extras);
+    }
+    data_size = p - data.data();
+    m_frame_start += m_frame_ps;
+    return nev;
+}
@@ -0,0 +1,141 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file listsynth.h Synthetic Hexagon list mode event generation.
+///
+/// Used by the listgen tool and by the simulated CAEN device to produce list mode data with a
+/// realistic frame and energy structure at high event rates.
+
+#ifndef LISTSYNTH_H
+#define LISTSYNTH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <random>
+
+/// splitmix64 generator, cheap enough to make several draws per event at the target rates
+class GenRandom
+{
+public:
+    typedef uint64_t result_type;
+    explicit GenRandom(uint64_t seed) : m_state(seed) { }
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return UINT64_MAX; }
+    uint64_t operator()()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    /// uniform in [0, 1)
+    double uniform() { return ((*this)() >> 11) * (1.0 / 9007199254740992.0); }
+private:
+    uint64_t m_state;
+};
+
+/// Walker alias table, draws an index with probability proportional to its weight in constant time
+class AliasTable
+{
+public:
+    explicit AliasTable(const std::vector<double>& weights);
+    size_t sample(GenRandom& rng) const
+    {
+        uint64_t r = rng();
+        size_t i = (size_t)(((r >> 32) * m_prob.size()) >> 32);
+        return ((r & 0xffffffffULL) < m_prob[i] ? i : m_alias[i]);
+    }
+private:
+    std::vector<uint64_t> m_prob;   ///< probability of keeping index i rather than its alias, scaled by 2^32
+    std::vector<uint32_t> m_alias;
+};
+
+/// tabulated inverse of the cumulative distribution of the time of an event since frame start,
+/// a truncated exponential decay plus a flat fraction
+class TimeTable
+{
+public:
+    TimeTable(double frame_ps, double decay_ps, double flat);
+    /// time (ps) for a uniform 64 bit value, increasing with u so sorted values give sorted times
+    double time(uint64_t u) const
+    {
+        double x = (u >> 11) * ((double)SIZE / 9007199254740992.0);
+        size_t i = (size_t)x;
+        return m_t[i] + (x - i) * (m_t[i + 1] - m_t[i]);
+    }
+private:
+    static const size_t SIZE = 65536;
+    std::vector<double> m_t;
+};
+
+/// an energy line, a gaussian of the given centre and width in ADC channels
+struct EnergyLine
+{
+    double channel;
+    double sigma;
+    double weight;
+};
+
+/// shape of the generated data
+struct ListModeSynthSettings
+{
+    double frame_rate;      ///< frame triggers per second
+    double event_rate;      ///< mean detector events per second
+    double decay_ns;        ///< decay time constant of the event time structure, 0 for flat
+    double flat;            ///< fraction of events spread uniformly over the frame
+    double continuum;       ///< fraction of energies spread uniformly over the ADC range
+    double pileup;          ///< probability of an event being flagged pile up, with summed energy
+    double saturated;       ///< probability of an event being saturated
+    double rollover_s;      ///< time tag rollover flagged every rollover_s seconds, 0 for none
+    std::vector<EnergyLine> lines;
+    uint64_t seed;
+    ListModeSynthSettings() : frame_rate(50.0), event_rate(1.0e6), decay_ns(2.0e6), flat(0.1), continuum(0.2),
+        pileup(0.01), saturated(0.001), rollover_s(0.0), lines(parseLines(defaultLines())), seed(1) { }
+    /// parse lines given as channel:sigma:weight separated by commas
+    static std::vector<EnergyLine> parseLines(const std::string& s);
+    static const char* defaultLines() { return "1000:20:1,5000:50:0.5,12000:80:0.2"; }
+};
+
+/// Generates list mode records a frame at a time. Frames start with a frame sync fake event
+/// (extras 0x8, energy 0) and hold a Poisson distributed number of detector events whose times
+/// since the frame start follow an exponential decay on top of a flat background, and whose
+/// energies are drawn from a line spectrum. Pile up, saturation and rollover flags are injected
+/// at the given rates. The same settings and seed always give the same records.
+class ListModeSynth
+{
+public:
+    /// first_frame_time is the time tag (ps) of the first frame, to continue on from existing data
+    explicit ListModeSynth(const ListModeSynthSettings& settings, uint64_t first_frame_time = 0);
+    /// append the records of the next frame to data at data_size, growing data as needed and
+    /// advancing data_size, returns the number of detector events in the frame
+    int appendFrame(std::vector<char>& data, size_t& data_size);
+    /// time tag (ps) of the start of the next frame
+    uint64_t frameStart() const { return m_frame_start; }
+    /// frame period in ps
+    uint64_t framePeriod() const { return m_frame_ps; }
+    /// write one record, returns the position after it
+    static char* putRecord(char* p, uint64_t trigger_time, int16_t energy, uint32_t extras);
+    /// probability of each energy channel for the line spectrum and continuum
+    static std::vector<double> energyWeights(const std::vector<EnergyLine>& lines, double continuum);
+private:
+    ListModeSynthSettings m_settings;
+    uint64_t m_frame_ps;
+    uint64_t m_rollover_ps;
+    uint64_t m_frame_start;
+    uint64_t m_next_rollover;
+    GenRandom m_rng;
+    std::poisson_distribution<int> m_nevents_dist;
+    AliasTable m_energy_dist;
+    TimeTable m_time_dist;
+    std::vector<uint64_t> m_raw, m_sorted;  ///< work space for sortedUniforms()
+    std::vector<size_t> m_counts;
+    void sortedUniforms(size_t n);
+};
+
+#endif /* LISTSYNTH_H */
@@ -0,0 +1,108 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file simdKernelTest.cpp Checks the AVX2 kernels of #FlagCounts and transformMonoFloat() against scalar loops.
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "flagstats.h"
+#include "imagekernel.h"
+
+/// count() of n random extras words, with about one bit in density set, against a bit by bit loop
+static bool checkFlagCounts(size_t n, unsigned density)
+{
+    std::mt19937 rng(n + density);
+    std::vector<uint32_t> extras(n);
+    for(size_t i=0; i<n; ++i)
+    {
+        uint32_t v = 0;
+        for(int b=0; b<32; ++b)
+        {
+            v |= (rng() % density == 0 ? 1u : 0u) << b;
+        }
+        extras[i] = v;
+    }
+    int64_t want[FlagCounts::NBITS] = { 0 };
+    for(size_t i=0; i<n; ++i)
+    {
+        for(int b=0; b<FlagCounts::NBITS; ++b)
+        {
+            want[b] += (extras[i] >> b) & 1;
+        }
+    }
+    FlagCounts fc;
+    fc.count(extras.data(), n);
+    for(int b=0; b<FlagCounts::NBITS; ++b)
+    {
+        if (fc.bits[b] != want[b])
+        {
+            testDiag("%lu events: bit %d counted %lld, expected %lld", (unsigned long)n, b, (long long)fc.bits[b], (long long)want[b]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/// transformMonoFloat() against the scalar template loop, max_rel is the relative error allowed
+template <int TransMode>
+static bool checkTransform(float gain, double max_rel)
+{
+    std::mt19937 rng(TransMode);
+    std::vector<int32_t> data(8 * 1000 + 5);
+    for(size_t i=0; i<data.size(); ++i)
+    {
+        // small counts, where log1p loses bits, as well as large ones
+        data[i] = (i % 3 == 0 ? (int32_t)(rng() % 4) : (int32_t)(rng() % 100000000));
+    }
+    std::vector<float> got(data.size()), want(data.size());
+    transformMonoFloat(data.data(), data.size(), gain, TransMode, got.data());
+    if (gain == 1.0f)
+    {
+        transformMonoT<float, TransMode, true>(data.data(), data.size(), gain, want.data());
+    }
+    else
+    {
+        transformMonoT<float, TransMode, false>(data.data(), data.size(), gain, want.data());
+    }
+    for(size_t i=0; i<data.size(); ++i)
+    {
+        double err = fabs((double)got[i] - want[i]);
+        if (err > max_rel * fabs(want[i]))
+        {
+            testDiag("mode %d gain %g: count %d gave %.9g, expected %.9g", TransMode, gain, data[i], got[i], want[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+MAIN(simdKernelTest)
+{
+    testPlan(13);
+    testDiag("flag counts %s AVX2, image kernel %s AVX2", (FlagCounts::usingAVX2() ? "use" : "do not use"),
+        (imageKernelUsingAVX2() ? "uses" : "does not use"));
+    testOk(checkFlagCounts(0, 2), "flag counts of no events");
+    testOk(checkFlagCounts(15, 2), "flag counts of a partial vector pair");
+    testOk(checkFlagCounts(16 * 127, 2), "flag counts up to a counter flush");
+    testOk(checkFlagCounts(16 * 127 + 16, 1), "flag counts past a counter flush, all bits set");
+    testOk(checkFlagCounts(100003, 2), "flag counts of a large batch");
+    testOk(checkFlagCounts(100003, 50), "flag counts of a large batch, sparse bits");
+    // conversion, multiply and sqrt are correctly rounded in both, the log kernel is a polynomial
+    testOk(checkTransform<IMAGE_TRANS_NONE>(1.0f, 0.0), "no transform, unit gain");
+    testOk(checkTransform<IMAGE_TRANS_NONE>(0.37f, 0.0), "no transform, gain");
+    testOk(checkTransform<IMAGE_TRANS_SQRT>(1.0f, 0.0), "sqrt, unit gain");
+    testOk(checkTransform<IMAGE_TRANS_SQRT>(2.5f, 0.0), "sqrt, gain");
+    testOk(checkTransform<IMAGE_TRANS_LOG>(1.0f, 4.0e-7), "log, unit gain");
+    testOk(checkTransform<IMAGE_TRANS_LOG>(1.0e-6f, 4.0e-7), "log, small gain");
+    testOk(checkTransform<IMAGE_TRANS_LOG>(-1.0e-9f, 0.0), "log, negative gain uses the scalar loop");
+    return testDone();
+}
@@ -0,0 +1,103 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file tiledhist.cpp Implementation of #TiledHistogram2D class
+
+#include <cstring>
+#include <algorithm>
+
+#include "tiledhist.h"
+
+/// set the number of bins, the histogram is cleared if this changes
+void TiledHistogram2D::resize(size_t nx, size_t ny)
+{
+    if (nx == m_nx && ny == m_ny)
+    {
+        return;
+    }
+    m_nx = nx;
+    m_ny = ny;
+    m_ntx = (nx + TILE_X - 1) / TILE_X;
+    size_t nty = (ny + TILE_Y - 1) / TILE_Y;
+    m_tiles.clear();
+    m_tiles.resize(m_ntx * nty);
+    m_dirty.assign(m_tiles.size(), 0);
+    m_ntiles_used = 0;
+}
+
+/// zero the histogram, releasing all tiles
+void TiledHistogram2D::clear()
+{
+    if (m_ntiles_used == 0)
+    {
+        return;
+    }
+    for(size_t i=0; i<m_tiles.size(); ++i)
+    {
+        if (!m_tiles[i].empty())
+        {
+            std::vector<int32_t>().swap(m_tiles[i]);
+            m_dirty[i] = 1;
+        }
+    }
+    m_ntiles_used = 0;
+}
+
+/// mark all tiles as unchanged
+void TiledHistogram2D::clearDirty()
+{
+    std::fill(m_dirty.begin(), m_dirty.end(), 0);
+}
+
+/// add the counts of other, which must have the same number of bins
+void TiledHistogram2D::merge(const TiledHistogram2D& other)
+{
+    if (other.m_nx != m_nx || other.m_ny != m_ny)
+    {
+        return;
+    }
+    for(size_t i=0; i<m_tiles.size(); ++i)
+    {
+        const std::vector<int32_t>& src = other.m_tiles[i];
+        if (src.empty())
+        {
+            continue;
+        }
+        std::vector<int32_t>& dst = m_tiles[i];
+        m_dirty[i] = 1;
+        if (dst.empty())
+        {
+            dst = src;
+            ++m_ntiles_used;
+            continue;
+        }
+        for(size_t j=0; j<src.size(); ++j)
+        {
+            dst[j] += src[j];
+        }
+    }
+}
+
+/// write the histogram to out as ny rows of nx bins
+void TiledHistogram2D::toDense(int32_t* out) const
+{
+    memset(out, 0, size() * sizeof(int32_t));
+    for(size_t i=0; i<m_tiles.size(); ++i)
+    {
+        const std::vector<int32_t>& tile = m_tiles[i];
+        if (tile.empty())
+        {
+            continue;
+        }
+        size_t x0 = (i % m_ntx) * TILE_X, y0 = (i / m_ntx) * TILE_Y;
+        size_t ncols = std::min(m_nx - x0, (size_t)TILE_X), nrows = std::min(m_ny - y0, (size_t)TILE_Y);
+        for(size_t r=0; r<nrows; ++r)
+        {
+            memcpy(out + (y0 + r) * m_nx + x0, tile.data() + r * TILE_X, ncols * sizeof(int32_t));
+        }
+    }
+}
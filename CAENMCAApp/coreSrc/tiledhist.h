@@ -0,0 +1,69 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file tiledhist.h Sparse 2D histogram stored as tiles allocated on first hit.
+
+#ifndef TILEDHIST_H
+#define TILEDHIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// A 2D histogram of nx by ny bins divided into tiles of TILE_X by TILE_Y bins, a tile
+/// is only allocated when a count is first added to it so a mostly empty map uses little
+/// memory and clearing it only needs to release the tiles in use. The dense form, with
+/// x varying fastest, is produced by toDense() when it is needed for display or saving.
+/// Tiles whose counts change are marked dirty until clearDirty(), so derived views such
+/// as #HistPyramid2D only need to update the regions that have changed.
+class TiledHistogram2D
+{
+public:
+    static const size_t TILE_X = 64;
+    static const size_t TILE_Y = 16;
+
+    TiledHistogram2D() : m_nx(0), m_ny(0), m_ntx(0), m_ntiles_used(0) { }
+    void resize(size_t nx, size_t ny);
+    void clear();
+    size_t nx() const { return m_nx; }
+    size_t ny() const { return m_ny; }
+    size_t size() const { return m_nx * m_ny; }
+    size_t memoryUsed() const { return m_ntiles_used * TILE_X * TILE_Y * sizeof(int32_t); } ///< bytes in allocated tiles
+    void merge(const TiledHistogram2D& other);
+    void toDense(int32_t* out) const;
+    void toDense(std::vector<int32_t>& out) const { out.resize(size()); toDense(out.data()); }
+    size_t numTiles() const { return m_tiles.size(); }
+    size_t tilesX() const { return m_ntx; }
+    /// counts of tile t as TILE_Y rows of TILE_X bins, NULL if no count has been added to it
+    const int32_t* tile(size_t t) const { return (m_tiles[t].empty() ? NULL : m_tiles[t].data()); }
+    /// the counts of tile t have changed since clearDirty()
+    bool dirty(size_t t) const { return m_dirty[t] != 0; }
+    void clearDirty();
+
+    /// add n counts to bin (ix, iy), which must be within the histogram
+    void add(size_t ix, size_t iy, int32_t n = 1)
+    {
+        size_t t = (iy / TILE_Y) * m_ntx + ix / TILE_X;
+        std::vector<int32_t>& tile = m_tiles[t];
+        if (tile.empty())
+        {
+            tile.resize(TILE_X * TILE_Y, 0);
+            ++m_ntiles_used;
+        }
+        m_dirty[t] = 1;
+        tile[(iy % TILE_Y) * TILE_X + ix % TILE_X] += n;
+    }
+
+private:
+    size_t m_nx, m_ny;
+    size_t m_ntx;           ///< number of tiles in x
+    size_t m_ntiles_used;
+    std::vector< std::vector<int32_t> > m_tiles; ///< an empty vector is an unallocated tile
+    std::vector<uint8_t> m_dirty; ///< non zero for a tile changed since clearDirty()
+};
+
+#endif /* TILEDHIST_H */
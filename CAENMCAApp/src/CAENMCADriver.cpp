@@ -48,12 +48,14 @@
 #include <asynPortDriver.h>
 
 #include <CAENMCA.h>
+#include "CAENMCASim.h"
 
 #include <highfive/highfive.hpp>
 namespace hf = HighFive;
 
 #include <h5nexus.h>
 
+#include "listmode.h"
 
 #include <epicsExport.h>
 
@@ -61,7 +63,7 @@ namespace hf = HighFive;
 
 static std::vector<CAENMCADriver*> g_drivers;
 
-#define MAX_ENERGY_BINS  32768   /* need to check energy bin bits? */
+#define MAX_ENERGY_BINS  32768   /* list mode energy is a positive int16, the board may use fewer, see energyBins() */
 
 static const char *driverName = "CAENMCADriver"; ///< Name of driver for use in message printing 
 
@@ -94,6 +96,24 @@ static int spawnCommand(const std::string& program, const std::string& args)
 
 #endif
 
+/// local directory for event store spill files: $CAENMCA_SPILL_DIR if set, otherwise the user's
+/// temporary directory. The list file share is not used as the spill file is written at ingestion rate
+static std::string eventSpillDirectory()
+{
+    static const char* vars[] = { "CAENMCA_SPILL_DIR", "TEMP", "TMP", "TMPDIR" };
+    for(size_t i=0; i<sizeof(vars) / sizeof(vars[0]); ++i) {
+        const char* dir = getenv(vars[i]);
+        if (dir != NULL && *dir != '\0') {
+            return dir;
+        }
+    }
+#ifdef _WIN32
+    return ".";
+#else
+    return "/tmp";
+#endif
+}
+
 /// EPICS driver report function for iocsh dbior command
 void CAENMCADriver::report(FILE* fp, int details)
 {
@@ -101,6 +121,23 @@ void CAENMCADriver::report(FILE* fp, int details)
     readRegister(0x10B8, val0);
     readRegister(0x11B8, val1);
     fprintf(fp, "0x10B8 and 0x11B8 registers for setting timing are: %u %u\n", val0, val1);
+    {
+        epicsGuard<epicsMutex> _lock(m_handles.lock);
+        fprintf(fp, "handle cache: %u by index, %u by name, %llu hits, %llu misses, cleared %llu times\n",
+                (unsigned)m_handles.by_index.size(), (unsigned)m_handles.by_name.size(), (unsigned long long)m_handles.hits,
+                (unsigned long long)m_handles.misses, (unsigned long long)m_handles.clears);
+    }
+    lock();
+    fprintf(fp, "settings shadow: %u values, %llu writes, %llu skipped as unchanged, cleared %llu times\n",
+            (unsigned)m_shadow.values.size(), (unsigned long long)m_shadow.writes, (unsigned long long)m_shadow.skipped,
+            (unsigned long long)m_shadow.clears);
+    unlock();
+    for(int i=0; i<2; ++i)
+    {
+        const FileWatcher& watcher = m_list_mode[i].watcher;
+        fprintf(fp, "channel %d list file is %s, poll interval %g s\n", i,
+                (watcher.notifying() ? "watched for changes" : "polled"), watcher.interval());
+    }
     ADDriver::report(fp, details);
 }
 
@@ -235,6 +272,8 @@ class CAENMCAException : public std::runtime_error
         throw CAENMCAException(__func, __ret); \
     }
 
+/// wrapper for the CAEN MCA library calls, converting errors to exceptions. When simulate is set
+/// the calls go to an in process simulated device instead, see CAENMCASim
 struct CAENMCA
 {
     static bool simulate;
@@ -242,13 +281,14 @@ struct CAENMCA
     static CAEN_MCA_HANDLE OpenDevice(const std::string& path, int32_t* index)
     {
         CAEN_MCA_HANDLE h = NULL;
+        int32_t retcode;
         if (!simulate) {
-            int32_t retcode;
             h = CAEN_MCA_OpenDevice(path.c_str(), &retcode, index);
-            ERROR_CHECK("CAENMCA::OpenDevice()", retcode);
         } else {
             std::cerr << "Opening simulated device for " << path << std::endl;
+            h = CAENMCASim::OpenDevice(path, &retcode, index);
         }
+        ERROR_CHECK("CAENMCA::OpenDevice()", retcode);
         return h;
     }
 
@@ -256,64 +296,59 @@ struct CAENMCA
     {
         if (!simulate) {
             CAEN_MCA_CloseDevice(handle);
+        } else {
+            CAENMCASim::CloseDevice(handle);
         }
     }
 
     static void GetData(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, ...)
     {
-        if (!simulate) {
-            va_list args;
-            va_start(args, dataMask);
-            int32_t retcode = CAEN_MCA_GetDataV(handle, dataType, dataMask, args);
-            va_end(args);
-            ERROR_CHECK("CAENMCA::GetData()", retcode);
-        }
+        va_list args;
+        va_start(args, dataMask);
+        int32_t retcode = (simulate ? CAENMCASim::GetDataV(handle, dataType, dataMask, args) :
+                                      CAEN_MCA_GetDataV(handle, dataType, dataMask, args));
+        va_end(args);
+        ERROR_CHECK("CAENMCA::GetData()", retcode);
     }
 
     static void SetData(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, ...)
     {
-        if (!simulate) {
-            va_list args;
-            va_start(args, dataMask);
-            int32_t retcode = CAEN_MCA_SetDataV(handle, dataType, dataMask, args);
-            va_end(args);
-            ERROR_CHECK("CAENMCA::SetData()", retcode);
-        }
+        va_list args;
+        va_start(args, dataMask);
+        int32_t retcode = (simulate ? CAENMCASim::SetDataV(handle, dataType, dataMask, args) :
+                                      CAEN_MCA_SetDataV(handle, dataType, dataMask, args));
+        va_end(args);
+        ERROR_CHECK("CAENMCA::SetData()", retcode);
     }
     
     static void SendCommand(CAEN_MCA_HANDLE handle, CAEN_MCA_CommandType_t cmdType, uint64_t cmdMaskIn, uint64_t cmdMaskOut, ...)
     {
-        if (!simulate) {
-            va_list args;
-            va_start(args, cmdMaskOut);
-            int32_t retcode = CAEN_MCA_SendCommandV(handle, cmdType, cmdMaskIn, cmdMaskOut, args);
-            va_end(args);
-            ERROR_CHECK("CAENMCA::SendCommand()", retcode);
-        }            
+        va_list args;
+        va_start(args, cmdMaskOut);
+        int32_t retcode = (simulate ? CAENMCASim::SendCommandV(handle, cmdType, cmdMaskIn, cmdMaskOut, args) :
+                                      CAEN_MCA_SendCommandV(handle, cmdType, cmdMaskIn, cmdMaskOut, args));
+        va_end(args);
+        ERROR_CHECK("CAENMCA::SendCommand()", retcode);
     }
 
     static CAEN_MCA_HANDLE GetChildHandle(CAEN_MCA_HANDLE handle, CAEN_MCA_HandleType_t handleType, int32_t index)
     {
-        CAEN_MCA_HANDLE h = NULL;
-        if (!simulate) {
-            h = CAEN_MCA_GetChildHandle(handle, handleType, index);
-            if (h == NULL)
-            {
-                throw CAENMCAException("GetChildHandle(): failed");
-            }
+        CAEN_MCA_HANDLE h = (simulate ? CAENMCASim::GetChildHandle(handle, handleType, index) :
+                                        CAEN_MCA_GetChildHandle(handle, handleType, index));
+        if (h == NULL)
+        {
+            throw CAENMCAException("GetChildHandle(): failed");
         }
         return h;
     }
     
     static CAEN_MCA_HANDLE GetChildHandleByName(CAEN_MCA_HANDLE handle, CAEN_MCA_HandleType_t handleType, const std::string& name)
     {
-        CAEN_MCA_HANDLE h = NULL;
-        if (!simulate) {
-            h = CAEN_MCA_GetChildHandleByName(handle, handleType, name.c_str());
-            if (h == NULL)
-            {
-                throw CAENMCAException("GetChildHandleByName(): failed for name \"" + name + "\"");
-            }
+        CAEN_MCA_HANDLE h = (simulate ? CAENMCASim::GetChildHandleByName(handle, handleType, name.c_str()) :
+                                        CAEN_MCA_GetChildHandleByName(handle, handleType, name.c_str()));
+        if (h == NULL)
+        {
+            throw CAENMCAException("GetChildHandleByName(): failed for name \"" + name + "\"");
         }
         return h;
     }
@@ -321,11 +356,6 @@ struct CAENMCA
     static void getHandlesFromCollection(CAEN_MCA_HANDLE parent, CAEN_MCA_HandleType_t handleType, std::vector<CAEN_MCA_HANDLE>& handles)
     {
         handles.resize(0);
-        if (simulate) {
-            handles.push_back(NULL);
-            handles.push_back(NULL);
-            return;
-        }
         CAEN_MCA_HANDLE collection = CAENMCA::GetChildHandle(parent, CAEN_MCA_HANDLE_COLLECTION, handleType);
         uint32_t collection_length = 0;
         std::vector<CAEN_MCA_HANDLE> collection_handles(COLLECTION_MAXLEN, NULL);
@@ -352,9 +382,6 @@ struct CAENMCA
 	
     static void getHandleDetails(CAEN_MCA_HANDLE handle, int32_t& type, int32_t& index, std::string& name)
 	{
-        if (simulate) {
-            return;
-        }
 		std::vector<char> name_c(HANDLE_NAME_MAXLEN, '\0');
 		CAENMCA::GetData(
 			handle,
@@ -379,7 +406,7 @@ bool CAENMCA::simulate = false;
 /// \param[in] portName @copydoc initArg0
 CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const char* deviceName)
 	: ADDriver(portName,
-		2, /* maxAddr */
+		NUM_AD_ADDR, /* maxAddr */
 		NUM_CAEN_PARAMS,
 					0, // maxBuffers
 					0, // maxMemory
@@ -389,8 +416,7 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
 		1, /* Autoconnect */
 		0, /* Default priority */
 		0),	/* Default stack size*/
-	m_famcode(CAEN_MCA_FAMILY_CODE_UNKNOWN),m_device_h(NULL),m_old_list_filename(2),m_file_fd(2, std::tuple<FILE*, FILE*>{NULL,NULL}),
-    m_event_file_last_pos(2, 0),m_frame_time(2, 0),m_max_event_time(2, 0),m_pRaw(NULL), m_file_dir("ibex")
+	m_famcode(CAEN_MCA_FAMILY_CODE_UNKNOWN),m_device_h(NULL), m_file_dir("ibex")
 {
 	const char *functionName = "CAENMCADriver";
 
@@ -464,6 +490,25 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
     createParam(P_eventsSpecNTimeTagResetString, asynParamInt32, &P_eventsSpecNTimeTagReset);
     createParam(P_eventsSpecNEventEnergySatString, asynParamInt32, &P_eventsSpecNEventEnergySat);
     createParam(P_eventsSpecMaxEventTimeString, asynParamFloat64, &P_eventsSpecMaxEventTime);
+    createParam(P_eventsDecodeRateString, asynParamFloat64, &P_eventsDecodeRate);
+    createParam(P_eventRingMaxOccString, asynParamFloat64, &P_eventRingMaxOcc);
+    createParam(P_eventRingReadStallsString, asynParamInt32, &P_eventRingReadStalls);
+    createParam(P_eventRingHistStallsString, asynParamInt32, &P_eventRingHistStalls);
+    createParam(P_eventStoreMaxMemString, asynParamFloat64, &P_eventStoreMaxMem);
+    createParam(P_eventStoreMemString, asynParamFloat64, &P_eventStoreMem);
+    createParam(P_eventStoreSpillString, asynParamFloat64, &P_eventStoreSpill);
+    createParam(P_eventStoreNEventsString, asynParamFloat64, &P_eventStoreNEvents);
+    createParam(P_eventStoreSpillErrorString, asynParamInt32, &P_eventStoreSpillError);
+    createParam(P_histThreadsString, asynParamInt32, &P_histThreads);
+    createParam(P_eventSpec_2DMemString, asynParamFloat64, &P_eventSpec_2DMem);
+    createParam(P_histWorkersString, asynParamInt32, &P_histWorkers);
+    createParam(P_eventsEnergyBinsString, asynParamInt32, &P_eventsEnergyBins);
+    createParam(P_frameIndexStrideString, asynParamInt32, &P_frameIndexStride);
+    createParam(P_frameIndexSidecarString, asynParamInt32, &P_frameIndexSidecar);
+    createParam(P_frameIndexNFramesString, asynParamInt32, &P_frameIndexNFrames);
+    for(int i=0; i<ListModeChannel::MAX_USER_HISTS; ++i) {
+        createGatedHistParams(i, P_gatedHist[i]);
+    }
     createParam(P_nFakeEventsString, asynParamInt32, &P_nFakeEvents);
     createParam(P_nImpDynamSatEventString, asynParamInt32, &P_nImpDynamSatEvent);
     createParam(P_nPileupEventString, asynParamInt32, &P_nPileupEvent);
@@ -482,6 +527,8 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
     createParam(P_loadDataFileNameString, asynParamOctet, &P_loadDataFileName);
     createParam(P_eventSpec_2DTransModeString, asynParamInt32, &P_eventSpec_2DTransMode);
     createParam(P_reloadLiveDataString, asynParamInt32, &P_reloadLiveData);
+    createParam(P_loadDataFirstFrameString, asynParamInt32, &P_loadDataFirstFrame);
+    createParam(P_loadDataNFramesString, asynParamInt32, &P_loadDataNFrames);
     createParam(P_runNumberString, asynParamOctet,  &P_runNumber);
     createParam(P_iRunNumberString,  asynParamInt32, &P_iRunNumber);
     createParam(P_filePrefixString, asynParamOctet,  &P_filePrefix);
@@ -512,11 +559,34 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
     createParam(P_sampleGeometryString, asynParamOctet, &P_sampleGeometry);
     createParam(P_sampleNameString, asynParamOctet, &P_sampleName);
     createParam(P_fileDirPrefixString, asynParamOctet, &P_fileDirPrefix);
+    createParam(P_pollSpecPeriodString, asynParamFloat64, &P_pollSpecPeriod);
+    createParam(P_pollSpecIdlePeriodString, asynParamFloat64, &P_pollSpecIdlePeriod);
+    createParam(P_pollHVPeriodString, asynParamFloat64, &P_pollHVPeriod);
+    createParam(P_pollHVRampPeriodString, asynParamFloat64, &P_pollHVRampPeriod);
+    createParam(P_pollChanPeriodString, asynParamFloat64, &P_pollChanPeriod);
+    createParam(P_pollListsPeriodString, asynParamFloat64, &P_pollListsPeriod);
+    createParam(P_pollConfigPeriodString, asynParamFloat64, &P_pollConfigPeriod);
+    createParam(P_configRefreshString, asynParamInt32, &P_configRefresh);
+    createParam(P_energySpecPubPeriodString, asynParamFloat64, &P_energySpecPubPeriod);
+    createParam(P_eventsSpecPubPeriodString, asynParamFloat64, &P_eventsSpecPubPeriod);
+    createParam(P_energySpecEventPubPeriodString, asynParamFloat64, &P_energySpecEventPubPeriod);
+    createParam(P_energySpec2EventPubPeriodString, asynParamFloat64, &P_energySpec2EventPubPeriod);
+    createParam(P_specOverviewLevelString, asynParamInt32, &P_specOverviewLevel);
+    createParam(P_eventsSpecOvXString, asynParamFloat64Array, &P_eventsSpecOvX);
+    createParam(P_eventsSpecOvYString, asynParamFloat64Array, &P_eventsSpecOvY);
+    createParam(P_energySpecEventOvString, asynParamInt32Array, &P_energySpecEventOv);
+    createParam(P_energySpec2EventOvString, asynParamInt32Array, &P_energySpec2EventOv);
+    createParam(P_eventSpec_2DOvLevelString, asynParamInt32, &P_eventSpec_2DOvLevel);
+    createParam(P_baseTBinWidthString, asynParamInt32, &P_baseTBinWidth);
+    createParam(P_baseMaxMemString, asynParamFloat64, &P_baseMaxMem);
+    createParam(P_baseMemString, asynParamFloat64, &P_baseMem);
 
     // don't initialise P_iRunNumber as we want it to come from PINI and we also have asyn:READBACK
 
     NDDataType_t dataType = NDInt32; // data type for each frame
     int status = 0;
+    // histogram worker threads per channel, these are only busy when a large backlog of events is being processed
+    int nworkers = std::max(1, std::min((int)ListModeChannel::MAX_HIST_WORKERS, (int)epicsThreadGetCPUs() / 2));
     for(int i=0; i<maxAddr; ++i)
     {
         //int maxSizeX = maxSizes[i][0];
@@ -551,8 +621,60 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
         status |= setDoubleParam(i, P_eventSpecRateTMin, 0.0);
         status |= setDoubleParam(i, P_eventSpecRateTMax, 0.0);
         status |= setDoubleParam(i, P_eventSpecRate, 0.0);
+        status |= setDoubleParam(i, P_eventsDecodeRate, 0.0);
+        status |= setDoubleParam(i, P_eventRingMaxOcc, 0.0);
+        status |= setIntegerParam(i, P_eventRingReadStalls, 0);
+        status |= setIntegerParam(i, P_eventRingHistStalls, 0);
+        status |= setDoubleParam(i, P_eventStoreMaxMem, 512.0);
+        status |= setDoubleParam(i, P_eventStoreMem, 0.0);
+        status |= setDoubleParam(i, P_eventStoreSpill, 0.0);
+        status |= setDoubleParam(i, P_eventStoreNEvents, 0.0);
+        status |= setIntegerParam(i, P_eventStoreSpillError, 0);
+        status |= setIntegerParam(i, P_histThreads, nworkers);
+        status |= setDoubleParam(i, P_eventSpec_2DMem, 0.0);
+        status |= setIntegerParam(i, P_histWorkers, nworkers);
+        status |= setIntegerParam(i, P_eventsEnergyBins, 0);
+        status |= setIntegerParam(i, P_frameIndexStride, 100);
+        status |= setIntegerParam(i, P_frameIndexSidecar, 0);
+        status |= setIntegerParam(i, P_frameIndexNFrames, 0);
+        status |= setIntegerParam(i, P_loadDataFirstFrame, 0);
+        status |= setIntegerParam(i, P_loadDataNFrames, 0);
+        status |= setDoubleParam(i, P_energySpecPubPeriod, 0.0);
+        status |= setDoubleParam(i, P_eventsSpecPubPeriod, 0.0);
+        status |= setDoubleParam(i, P_energySpecEventPubPeriod, 0.0);
+        status |= setDoubleParam(i, P_energySpec2EventPubPeriod, 0.0);
+        status |= setIntegerParam(i, P_specOverviewLevel, 4);
+        status |= setIntegerParam(i, P_eventSpec_2DOvLevel, 2);
+        status |= setIntegerParam(i, P_baseTBinWidth, 1);
+        status |= setDoubleParam(i, P_baseMaxMem, 0.0);
+        status |= setDoubleParam(i, P_baseMem, 0.0);
+        for(int j=0; j<ListModeChannel::MAX_USER_HISTS; ++j) {
+            const GatedHistParams& hp = P_gatedHist[j];
+            status |= setIntegerParam(i, hp.enable, 0);
+            status |= setDoubleParam(i, hp.tmin, 0.0);
+            status |= setDoubleParam(i, hp.tmax, 0.0);
+            status |= setIntegerParam(i, hp.emin, 0);
+            status |= setIntegerParam(i, hp.emax, 0);
+            status |= setIntegerParam(i, hp.flagMask, 0);
+            status |= setIntegerParam(i, hp.flagValue, 0);
+            status |= setIntegerParam(i, hp.axis, GatedHistogramDef::AxisEnergy);
+            status |= setDoubleParam(i, hp.xmin, 0.0);
+            status |= setDoubleParam(i, hp.xmax, MAX_ENERGY_BINS);
+            status |= setIntegerParam(i, hp.nbins, MAX_ENERGY_BINS);
+            status |= setIntegerParam(i, hp.nevents, 0);
+            status |= setDoubleParam(i, hp.pubPeriod, 0.0);
+        }
     }
 
+    status |= setDoubleParam(P_pollSpecPeriod, 1.0);
+    status |= setDoubleParam(P_pollSpecIdlePeriod, 10.0);
+    status |= setDoubleParam(P_pollHVPeriod, 5.0);
+    status |= setDoubleParam(P_pollHVRampPeriod, 0.5);
+    status |= setDoubleParam(P_pollChanPeriod, 1.0);
+    status |= setDoubleParam(P_pollListsPeriod, 1.0);
+    status |= setDoubleParam(P_pollConfigPeriod, 60.0);
+    status |= setIntegerParam(P_configRefresh, 0);
+
         if (status) {
         printf("%s: unable to set CAENMCA parameters\n", functionName);
         return;
@@ -561,6 +683,16 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
     for(int i=0; i<2; ++i) {
         m_start_time[i] = epicsTime::getCurrent();
         m_stop_time[i] = epicsTime::getCurrent();
+        m_acq_running[i] = false;
+        m_pub_binning_changes[i] = 0;
+    }
+    for(int i=0; i<NUM_AD_ADDR; ++i) {
+        m_pRaw[i] = NULL;
+    }
+    m_config_names_buffer.resize(CONFIGSAVE_LIST_MAXLEN * CONFIGSAVE_FULLPATH_MAXLEN);
+    m_config_names.resize(CONFIGSAVE_LIST_MAXLEN);
+    for(int i=0; i<CONFIGSAVE_LIST_MAXLEN; ++i) {
+        m_config_names[i] = &(m_config_names_buffer[i * CONFIGSAVE_FULLPATH_MAXLEN]);
     }
     
 	setStringParam(P_deviceName, deviceName);
@@ -571,6 +703,14 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
 
     CAENMCA::getHandlesFromCollection(m_device_h, CAEN_MCA_HANDLE_CHANNEL, m_chan_h);
     CAENMCA::getHandlesFromCollection(m_device_h, CAEN_MCA_HANDLE_HVCHANNEL, m_hv_chan_h);
+    // the spectrum handles, and below the parameter handles read when polling, go into m_handles now
+    for(int i=0; i<m_chan_h.size(); ++i) {
+        getSpectrumHandle(i, 0);
+    }
+    // so autosave restores of values the device already holds are not written again
+    for(int i=0; i<m_chan_h.size(); ++i) {
+        readShadow(i);
+    }
 	
     getHVInfo(0);
     getHVInfo(1);
@@ -593,6 +733,9 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
     if (!deviceAddr_s.compare(0, ethPrefix.size(), ethPrefix)) {
         m_share_path = std::string("\\\\") + deviceAddr_s.substr(ethPrefix.size()) + "\\storage";
     }
+    if (CAENMCA::simulate) {
+        m_share_path = CAENMCASim::storagePath(m_device_h);
+    }
 
 	if (epicsThreadCreate("CAENMCADriverPoller",
 		epicsThreadPriorityMedium,
@@ -602,6 +745,77 @@ CAENMCADriver::CAENMCADriver(const char *portName, const char* deviceAddr, const
 		printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
 		return;
 	}
+    std::string spill_dir = eventSpillDirectory();
+    for(int i=0; i<2; ++i) {
+        m_list_mode[i].driver = this;
+        m_list_mode[i].channel_id = i;
+        m_list_mode[i].store.setSpillDirectory(spill_dir);
+	    if (epicsThreadCreate("CAENMCADriverIngest",
+		    epicsThreadPriorityMedium,
+		    epicsThreadGetStackSize(epicsThreadStackMedium),
+		    (EPICSTHREADFUNC)ingestTaskC, &(m_list_mode[i])) == 0 ||
+            epicsThreadCreate("CAENMCADriverHist",
+		    epicsThreadPriorityMedium,
+		    epicsThreadGetStackSize(epicsThreadStackMedium),
+		    (EPICSTHREADFUNC)histTaskC, &(m_list_mode[i])) == 0)
+	    {
+		    printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+		    return;
+	    }
+        for(int j=0; j<nworkers; ++j) {
+            ListModeWorker* w = new ListModeWorker;
+            w->lm = &(m_list_mode[i]);
+	        if (epicsThreadCreate("CAENMCADriverHistWorker",
+		        epicsThreadPriorityMedium,
+		        epicsThreadGetStackSize(epicsThreadStackMedium),
+		        (EPICSTHREADFUNC)histWorkerTaskC, w) == 0)
+	        {
+		        printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+                delete w;
+		        break;
+	        }
+            m_list_mode[i].workers.push_back(w);
+        }
+    }
+    for(int i=0; i<NUM_AD_ADDR; ++i) {
+        m_ad[i].driver = this;
+        m_ad[i].addr = i;
+	    if (epicsThreadCreate("CAENMCADriverImage",
+		    epicsThreadPriorityMedium,
+		    epicsThreadGetStackSize(epicsThreadStackMedium),
+		    (EPICSTHREADFUNC)imageTaskC, &(m_ad[i])) == 0)
+	    {
+		    printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+		    return;
+	    }
+    }
+}
+
+/// create asyn parameters for user gated histogram index, named e.g. GHIST0TMIN
+void CAENMCADriver::createGatedHistParams(int index, GatedHistParams& hp)
+{
+    static const struct { const char* name; asynParamType type; int GatedHistParams::* param; } pars[] = {
+        { "ENABLE", asynParamInt32, &GatedHistParams::enable },
+        { "TMIN", asynParamFloat64, &GatedHistParams::tmin },
+        { "TMAX", asynParamFloat64, &GatedHistParams::tmax },
+        { "EMIN", asynParamInt32, &GatedHistParams::emin },
+        { "EMAX", asynParamInt32, &GatedHistParams::emax },
+        { "FLAGMASK", asynParamInt32, &GatedHistParams::flagMask },
+        { "FLAGVAL", asynParamInt32, &GatedHistParams::flagValue },
+        { "AXIS", asynParamInt32, &GatedHistParams::axis },
+        { "XMIN", asynParamFloat64, &GatedHistParams::xmin },
+        { "XMAX", asynParamFloat64, &GatedHistParams::xmax },
+        { "NBINS", asynParamInt32, &GatedHistParams::nbins },
+        { "X", asynParamFloat64Array, &GatedHistParams::x },
+        { "Y", asynParamInt32Array, &GatedHistParams::y },
+        { "NEVENTS", asynParamInt32, &GatedHistParams::nevents },
+        { "PUBPERIOD", asynParamFloat64, &GatedHistParams::pubPeriod }
+    };
+    char name[64];
+    for(int i=0; i<sizeof(pars) / sizeof(pars[0]); ++i) {
+        epicsSnprintf(name, sizeof(name), P_gatedHistString, index, pars[i].name);
+        createParam(name, pars[i].type, &(hp.*(pars[i].param)));
+    }
 }
 
 void CAENMCADriver::setRunNumberFromIRunNumber()
@@ -621,14 +835,22 @@ void CAENMCADriver::setFileNames()
     g_drivers[0]->getStringParam(g_drivers[0]->P_runNumber, runNumber);
     getStringParam(P_deviceName, deviceName);
     getStringParam(P_fileDirPrefix, fileDirPrefix);
-    for(int i=0; i<2; ++i) {
-        epicsSnprintf(filename, sizeof(filename), "%s%s/%s_%s_ch%d.bin", fileDirPrefix.c_str(), m_file_dir.c_str(), deviceName.c_str(), runNumber.c_str(), i);
-        setStringParam(i, P_listFile, filename);
-        setListModeFilename(i, filename);
-        epicsSnprintf(filename, sizeof(filename), "%s%s/%s_%s_spec_ch%02d.spe", fileDirPrefix.c_str(), m_file_dir.c_str(), deviceName.c_str(), runNumber.c_str(), i);
-        setStringParam(i, P_energySpecFilename, filename);
-        setEnergySpectrumFilename(i, 0, filename);
+    beginParamBatch();
+    try {
+        for(int i=0; i<2; ++i) {
+            epicsSnprintf(filename, sizeof(filename), "%s%s/%s_%s_ch%d.bin", fileDirPrefix.c_str(), m_file_dir.c_str(), deviceName.c_str(), runNumber.c_str(), i);
+            setStringParam(i, P_listFile, filename);
+            setListModeFilename(i, filename);
+            epicsSnprintf(filename, sizeof(filename), "%s%s/%s_%s_spec_ch%02d.spe", fileDirPrefix.c_str(), m_file_dir.c_str(), deviceName.c_str(), runNumber.c_str(), i);
+            setStringParam(i, P_energySpecFilename, filename);
+            setEnergySpectrumFilename(i, 0, filename);
+        }
     }
+    catch(...) {
+        discardParamBatch();
+        throw;
+    }
+    applyParamBatch();
 }
 
 void CAENMCADriver::incrementRunNumber()
@@ -642,11 +864,14 @@ void CAENMCADriver::incrementRunNumber()
     }
 }
 
+/// close the list files of both channels, called without the driver lock as ingestTask() holds a
+/// channel lock for a whole pass
 void CAENMCADriver::closeListFiles()
 {
-    for(int channel_id=0; channel_id < m_file_fd.size(); ++channel_id) {
-        FILE*& f = std::get<0>(m_file_fd[channel_id]);
-        FILE*& f_ascii = std::get<1>(m_file_fd[channel_id]);
+    for(int channel_id=0; channel_id < 2; ++channel_id) {
+        epicsGuard<epicsMutex> _lock(m_list_mode[channel_id].lock);
+        FILE*& f = m_list_mode[channel_id].f;
+        FILE*& f_ascii = m_list_mode[channel_id].f_ascii;
         if (f != NULL) {
             fclose(f);
             f = NULL;
@@ -658,6 +883,19 @@ void CAENMCADriver::closeListFiles()
     } 
 }
 
+/// copy the event derived spectra of a channel for createTemplateNexusFile(), called without the
+/// driver lock for the same reason as closeListFiles()
+void CAENMCADriver::copyRunSpectra(int channel_id, RunSpectra& spectra)
+{
+    ListModeChannel& lm = m_list_mode[channel_id];
+    epicsGuard<epicsMutex> _lock(lm.lock);
+    spectra.energy_a = lm.hists.counts(ListModeChannel::HIST_ENERGY_A);
+    spectra.energy_b = lm.hists.counts(ListModeChannel::HIST_ENERGY_B);
+    m_event_spec_2d[channel_id].toDense(spectra.spec_2d);
+    spectra.nx = m_event_spec_2d[channel_id].nx(); // follows the board's energy bins
+    spectra.ny = m_event_spec_2d[channel_id].ny();
+}
+
 void CAENMCADriver::beginRun()
 {
     startAcquisition(0, 3);
@@ -765,29 +1003,52 @@ void CAENMCADriver::endRun()
     catch(const std::exception& ex) {
         std::cerr << "Cannot write " << journal_name << ": " << ex.what() << std::endl;
     }
-    closeListFiles();
 }    
 
+/// end the run on all drivers and write the NeXus file, called by writeInt32() with this driver locked
 void CAENMCADriver::endRunAll()
 {
-    epicsGuard<CAENMCADriver> _lock0(*(g_drivers[0]));
-    epicsGuard<CAENMCADriver> _lock1(*(g_drivers[1]));
     std::string oldRunNumber, filePrefix, copyDataArgs, dataFile;
-    g_drivers[0]->getStringParam(g_drivers[0]->P_runNumber, oldRunNumber);
-    g_drivers[0]->getStringParam(g_drivers[0]->P_filePrefix, filePrefix);
-    for(int j=0; j<g_drivers.size(); ++j) {
-        CAENMCADriver* driver = g_drivers[j];
-        driver->endRun();
-        for(int i=0; i<2; ++i) {
-            copyDataArgs += " ";
-            copyDataArgs += driver->makeCopyDataArgs(i);
+    std::vector<RunSpectra> spectra(2 * g_drivers.size());
+    {
+        epicsGuard<CAENMCADriver> _lock0(*(g_drivers[0]));
+        epicsGuard<CAENMCADriver> _lock1(*(g_drivers[1]));
+        g_drivers[0]->getStringParam(g_drivers[0]->P_runNumber, oldRunNumber);
+        g_drivers[0]->getStringParam(g_drivers[0]->P_filePrefix, filePrefix);
+        for(int j=0; j<g_drivers.size(); ++j) {
+            CAENMCADriver* driver = g_drivers[j];
+            driver->endRun();
+            for(int i=0; i<2; ++i) {
+                copyDataArgs += " ";
+                copyDataArgs += driver->makeCopyDataArgs(i);
+            }
+        }
+    }
+    // the channel locks are taken with no driver lock held, so a pass in progress on either
+    // driver holds up only this thread
+    unlock();
+    try
+    {
+        for(int j=0; j<g_drivers.size(); ++j) {
+            g_drivers[j]->closeListFiles();
+            for(int i=0; i<2; ++i) {
+                g_drivers[j]->copyRunSpectra(i, spectra[2 * j + i]);
+            }
         }
     }
+    catch(...)
+    {
+        lock();
+        throw;
+    }
+    lock();
+    epicsGuard<CAENMCADriver> _lock0(*(g_drivers[0]));
+    epicsGuard<CAENMCADriver> _lock1(*(g_drivers[1]));
     incrementRunNumber();
     for(auto driver : g_drivers) {
         driver->cycleAcquisition(); // we briefly start and stop to force pickup of new filename so we can move old ones
     }
-    dataFile = createTemplateNexusFile(filePrefix, oldRunNumber.c_str());
+    dataFile = createTemplateNexusFile(filePrefix, oldRunNumber.c_str(), spectra);
     copyData(dataFile, filePrefix, oldRunNumber.c_str(), copyDataArgs);
 }
 
@@ -844,11 +1105,12 @@ void CAENMCADriver::copyData(const std::string& dataFile, const std::string& fil
 
 void CAENMCADriver::getParameterInfo(CAEN_MCA_HANDLE handle, const char *name)
 {
-	CAEN_MCA_HANDLE parameter = CAENMCA::GetChildHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
+	CAEN_MCA_HANDLE parameter = childHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
 	getParameterInfo(parameter);
 }
 
-std::string CAENMCADriver::createTemplateNexusFile(const std::string& filePrefix, const char* runNumber)
+/// write the NeXus file of a run, spectra holds the event derived spectra of each driver's channels in turn
+std::string CAENMCADriver::createTemplateNexusFile(const std::string& filePrefix, const char* runNumber, const std::vector<RunSpectra>& spectra)
 {
     char filename[256], sefilename[256];
     std::string title, comment, startTime, stopTime, desc, rb_number, users, sample_geometry, sample_name, bl_geometry;
@@ -867,11 +1129,14 @@ std::string CAENMCADriver::createTemplateNexusFile(const std::string& filePrefix
     g_drivers[0]->getStringParam(g_drivers[0]->P_BLGeometry, bl_geometry);
     for(auto driver : g_drivers) {
         for(int i=0; i<2; ++i) {
+            const RunSpectra& run_spectra = spectra[k - 1];
             std::string event_energy_group_name = "detector_" + std::to_string(k) + "_energyA";
             hf::Group event_energy_group = createNeXusGroup(raw_data_1, event_energy_group_name, "NXdata");
             hf::Group detector = createNeXusGroup(instrument, "detector_" + std::to_string(k), "NXdetector");
-            hf::DataSet counts = event_energy_group.createDataSet("counts", driver->m_energy_spec_event[i]);
-            std::vector<double> event_energy_x(driver->m_energy_spec_event[i].size());
+            const std::vector<epicsInt32>& energy_spec_event = run_spectra.energy_a;
+            const std::vector<epicsInt32>& energy_spec2_event = run_spectra.energy_b;
+            hf::DataSet counts = event_energy_group.createDataSet("counts", energy_spec_event);
+            std::vector<double> event_energy_x(energy_spec_event.size());
             double scaleA = 0.0, scaleB = 0.0;
             driver->getDoubleParam(i, driver->P_energySpecScaleA, &scaleA);
             driver->getDoubleParam(i, driver->P_energySpecScaleB, &scaleB);
@@ -915,9 +1180,9 @@ std::string CAENMCADriver::createTemplateNexusFile(const std::string& filePrefix
 
             std::string event2_energy_group_name = "detector_" + std::to_string(k) + "_energyB";
             hf::Group event2_energy_group = createNeXusGroup(raw_data_1, event2_energy_group_name, "NXdata");
-            hf::DataSet counts2 = event2_energy_group.createDataSet("counts", driver->m_energy_spec2_event[i]);
+            hf::DataSet counts2 = event2_energy_group.createDataSet("counts", energy_spec2_event);
             counts2.createAttribute("signal", 1);
-            std::vector<double> event2_energy_x(driver->m_energy_spec2_event[i].size());
+            std::vector<double> event2_energy_x(energy_spec2_event.size());
             for(int j=0; j<event_energy_x.size(); ++j) {
                 event2_energy_x[j] = scaleA * j + scaleB;
             }
@@ -937,15 +1202,13 @@ std::string CAENMCADriver::createTemplateNexusFile(const std::string& filePrefix
             
             std::string event_energy2d_group_name = "detector_" + std::to_string(k) + "_energy2D";
             hf::Group event_energy2d_group = createNeXusGroup(raw_data_1, event_energy2d_group_name, "NXdata");
-            int eventSpec_2d_nTBins = 0, eventSpec_2d_engBinGroup = 1;
-            driver->getIntegerParam(i, driver->P_eventSpec_2DEnergyBinGroup, &eventSpec_2d_engBinGroup);
-            driver->getIntegerParam(i, driver->P_eventSpec_2DNTimeBins, &eventSpec_2d_nTBins);
-            size_t eventSpec_2d_nx = MAX_ENERGY_BINS / eventSpec_2d_engBinGroup;
-            size_t eventSpec_2d_ny = eventSpec_2d_nTBins;
+            const std::vector<epicsInt32>& event_spec_2d = run_spectra.spec_2d;
+            size_t eventSpec_2d_nx = run_spectra.nx;
+            size_t eventSpec_2d_ny = run_spectra.ny;
             std::vector<size_t> dims{eventSpec_2d_ny, eventSpec_2d_nx};
             hf::DataSet counts2d = event_energy2d_group.createDataSet<epicsInt32>("counts", hf::DataSpace(dims));
-            if (driver->m_event_spec_2d[i].size() > 0) {
-                counts2d.write_raw(driver->m_event_spec_2d[i].data());
+            if (event_spec_2d.size() > 0 && event_spec_2d.size() == eventSpec_2d_nx * eventSpec_2d_ny) {
+                counts2d.write_raw(event_spec_2d.data());
             }
             ++k;
         }
@@ -1067,8 +1330,9 @@ void CAENMCADriver::getParameterInfo(CAEN_MCA_HANDLE parameter)
 double CAENMCADriver::getParameterValue(CAEN_MCA_HANDLE handle, const char *name)
 {
 	double value;
-	CAEN_MCA_HANDLE parameter = CAENMCA::GetChildHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
+	CAEN_MCA_HANDLE parameter = childHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
 	CAENMCA::GetData(parameter, CAEN_MCA_DATA_PARAMETER_VALUE, DATAMASK_VALUE_NUMERIC, &value);
+    updateShadow(parameter, CAEN_MCA_DATA_PARAMETER_VALUE, DATAMASK_VALUE_NUMERIC, ShadowValue(value));
 	return value;
 }
 
@@ -1076,15 +1340,15 @@ double CAENMCADriver::getParameterValue(CAEN_MCA_HANDLE handle, const char *name
 std::string CAENMCADriver::getParameterValueList(CAEN_MCA_HANDLE handle, const char *name)
 {
 	std::vector<char> pvalue(PARAMINFO_NAME_MAXLEN, '\0');
-	CAEN_MCA_HANDLE parameter = CAENMCA::GetChildHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
+	CAEN_MCA_HANDLE parameter = childHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
     CAENMCA::GetData(parameter, CAEN_MCA_DATA_PARAMETER_VALUE, DATAMASK_VALUE_CODENAME, pvalue.data());
 	return pvalue.data();
 }
 
 void CAENMCADriver::setParameterValue(CAEN_MCA_HANDLE handle, const char *name, double value)
 {
-	CAEN_MCA_HANDLE parameter = CAENMCA::GetChildHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
-	CAENMCA::SetData(parameter, CAEN_MCA_DATA_PARAMETER_VALUE, DATAMASK_VALUE_NUMERIC, value);
+	CAEN_MCA_HANDLE parameter = childHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
+	setShadowed(parameter, CAEN_MCA_DATA_PARAMETER_VALUE, DATAMASK_VALUE_NUMERIC, ShadowValue(value));
 }
 
 // parameter of type list, which is basically a string enum
@@ -1094,7 +1358,7 @@ void CAENMCADriver::setParameterValueList(CAEN_MCA_HANDLE handle, const char *na
     // we create a local copy as that is what CAEN example did for a constant char* value
     std::vector<char> pvalue(PARAMINFO_NAME_MAXLEN, '\0');
     strncpy(pvalue.data(), value.c_str(), pvalue.size() - 1);
-    CAEN_MCA_HANDLE parameter = CAENMCA::GetChildHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
+    CAEN_MCA_HANDLE parameter = childHandleByName(handle, CAEN_MCA_HANDLE_PARAMETER, name);
     CAENMCA::SetData(parameter, CAEN_MCA_DATA_PARAMETER_VALUE, DATAMASK_VALUE_CODENAME, pvalue.data());
 }
 
@@ -1165,7 +1429,8 @@ bool CAENMCADriver::isAcqRunning(CAEN_MCA_HANDLE chan)
 	return (value != 0.0 ? true : false);
 }
 
-void CAENMCADriver::getHVInfo(uint32_t hv_chan_id)
+/// returns true if the output is still ramping towards its set voltage, or down to zero
+bool CAENMCADriver::getHVInfo(uint32_t hv_chan_id)
 {
     std::vector<char> hvrange_name(HVRANGEINFO_NAME_MAXLEN, '\0');
 	double vset_min, vset_max, vset_incr, vmax_max, vmax, vmon, imon;
@@ -1184,7 +1449,7 @@ void CAENMCADriver::getHVInfo(uint32_t hv_chan_id)
         
 	hv_active_range = getParameterValue(hvchannel, "PARAM_HVCH_ACTIVE_RANGE");
 
-	CAEN_MCA_HANDLE hvrange = CAENMCA::GetChildHandle(hvchannel, CAEN_MCA_HANDLE_HVRANGE, (int)hv_active_range);
+	CAEN_MCA_HANDLE hvrange = childHandle(hvchannel, CAEN_MCA_HANDLE_HVRANGE, (int)hv_active_range);
 	CAENMCA::GetData(
 		hvrange,
 		CAEN_MCA_DATA_HVRANGE_INFO,
@@ -1218,9 +1483,12 @@ void CAENMCADriver::getHVInfo(uint32_t hv_chan_id)
     setStringParam(hv_chan_id, P_hvRangeName, hvrange_name.data());
 	setIntegerParam(hv_chan_id, P_hvPolarity, hvpol); // CAEN_MCA_POLARITY_TYPE_POSITIVE=0, CAEN_MCA_POLARITY_TYPE_NEGATIVE=1
 	setIntegerParam(hv_chan_id, P_hvStatus, hvstat); 
-    setIntegerParam(hv_chan_id, P_hvOn, (isHVOn(hvchannel) ? 1 : 0));
+    bool hv_on = isHVOn(hvchannel);
+    setIntegerParam(hv_chan_id, P_hvOn, (hv_on ? 1 : 0));
 //	getParameterInfo(hvrange, "PARAM_HVRANGE_VMON");
 //	getParameterInfo(hvchannel, "PARAM_HVCH_STATUS");
+    double target = (hv_on ? vset : 0.0);
+    return fabs(vmon - target) > std::max(2.0, 0.01 * fabs(target));
 }
 
 
@@ -1298,11 +1566,29 @@ void CAENMCADriver::cycleAcquisition()
 void CAENMCADriver::controlAcquisition(int chan_mask, bool start)
 {
     CAEN_MCA_CommandType_t cmdtype = (start ? CAEN_MCA_CMD_ACQ_START : CAEN_MCA_CMD_ACQ_STOP);
+    if (start) {
+        // file names and list data masks go to the device in one batch before the start
+        // command, settings the device already holds are not written again
+        int list_mask = (m_famcode == CAEN_MCA_FAMILY_CODE_XXHEX ? chan_mask : 0x1);
+        beginParamBatch();
+        try {
+            setFileNames();
+            for (int i = 0; i < 2; ++i) {
+                if ((list_mask & (1 << i)) != 0) {
+                    setListsData(i, true, true, true);
+                }
+            }
+        }
+        catch(...) {
+            discardParamBatch();
+            throw;
+        }
+        applyParamBatch();
+    }
 
 	if (m_famcode == CAEN_MCA_FAMILY_CODE_XXHEX)
 	{
         if (start) {
-            setFileNames();
             setStartTime(chan_mask);
         } else {
             setStopTime(chan_mask);
@@ -1312,8 +1598,6 @@ void CAENMCADriver::controlAcquisition(int chan_mask, bool start)
             if (start) {
                 clearEnergySpectrum(0);
                 clearEnergySpectrum(1);
-                setListsData(0, true, true, true);
-                setListsData(1, true, true, true);
             }
 			CAENMCA::SendCommand(m_device_h, cmdtype, DATAMASK_CMD_NONE, DATAMASK_CMD_NONE);
             setADAcquire(0, (start ? 1 : 0));
@@ -1327,7 +1611,6 @@ void CAENMCADriver::controlAcquisition(int chan_mask, bool start)
 				{
                     if (start) {
                         clearEnergySpectrum(i);
-                        setListsData(i, true, true, true);
                     }
 					CAENMCA::SendCommand(m_chan_h[i], cmdtype, DATAMASK_CMD_NONE, DATAMASK_CMD_NONE);
                     setADAcquire(i, (start ? 1 : 0));
@@ -1338,10 +1621,8 @@ void CAENMCADriver::controlAcquisition(int chan_mask, bool start)
 	else
 	{
         if (start) {
-            setFileNames();
             setStartTime(0x1);
             clearEnergySpectrum(0);
-            setListsData(0, true, true, true);
         } else {
             setStopTime(0x1);
         }
@@ -1384,7 +1665,8 @@ void CAENMCADriver::writeRegisterMask(uint32_t address, uint32_t value, uint32_t
 		mask);
 }
 
-void CAENMCADriver::getChannelInfo(int32_t channel_id)
+/// returns whether acquisition is running on the channel
+bool CAENMCADriver::getChannelInfo(int32_t channel_id)
 {
 	CAEN_MCA_HANDLE channel = m_chan_h[channel_id];
 	uint32_t nEnergySpectra = 0;
@@ -1410,6 +1692,7 @@ void CAENMCADriver::getChannelInfo(int32_t channel_id)
         run_dur = m_stop_time[channel_id] - m_start_time[channel_id];
     }
     setIntegerParam(channel_id, P_runDuration, (run_dur > 0.0 ? (epicsInt32)run_dur : 0));
+    return acqRunning;
 }
 
 
@@ -1418,6 +1701,7 @@ void CAENMCADriver::getBoardInfo()
 
 	uint32_t channels, hvchannels, serialNum, pcbrev, nbits;
 	std::vector<char> modelName(MODEL_NAME_MAXLEN, '\0');
+    m_nbitsEnergy = 0; // in case it cannot be read, energyBins() then uses MAX_ENERGY_BINS
 
 	CAENMCA::GetData(
 		m_device_h,
@@ -1463,7 +1747,7 @@ void CAENMCADriver::setListsData(int32_t channel_id, bool timetag, bool energy,
 	if (timetag)	mask |= LIST_FILE_DATAMASK_TIMETAG;
 	if (energy)		mask |= LIST_FILE_DATAMASK_ENERGY;
 	if (extras)		mask |= LIST_FILE_DATAMASK_FLAGS;
-	CAENMCA::SetData(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILE_DATAMASK, mask);
+	setShadowed(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILE_DATAMASK, ShadowValue(mask));
 }
 
 void CAENMCADriver::loadConfiguration(const char* name) 
@@ -1477,16 +1761,21 @@ void CAENMCADriver::loadConfiguration(const char* name)
 	{
         CAENMCA::SendCommand(m_device_h, CAEN_MCA_CMD_CONFIGURATION_LOAD, DATAMASK_CMD_SAVE_NAME, DATAMASK_CMD_NONE, name);
 	}
+    m_handles.clear(); // a configuration may change the objects the handles refer to
+    m_shadow.clear();
+    for(int i=0; i<m_chan_h.size(); ++i) {
+        readShadow(i);
+    }
 }
 
 void CAENMCADriver::listConfigurations(std::vector<std::string>& configs)
 {
     uint32_t offset = 0;
     uint32_t cnt_found = 0;
-    std::vector<char*> savenames(CONFIGSAVE_LIST_MAXLEN, NULL);
 	configs.resize(0);
+    // the name buffers are allocated once in the constructor rather than on every call
     for (int32_t i = 0; i < CONFIGSAVE_LIST_MAXLEN; i++) {
-        savenames[i] = (char*)calloc(CONFIGSAVE_FULLPATH_MAXLEN, sizeof(*savenames[i]));
+        m_config_names[i][0] = '\0';
     }
     CAENMCA::SendCommand(
         m_device_h,
@@ -1496,14 +1785,11 @@ void CAENMCADriver::listConfigurations(std::vector<std::string>& configs)
         DATAMASK_CMD_SAVE_LIST_NAMES,
         offset,
         &cnt_found,
-        savenames.data()
+        m_config_names.data()
     );
-    for (uint32_t i = 0; i < cnt_found; i++) {
-	    configs.push_back(savenames[i]);
+    for (uint32_t i = 0; i < cnt_found && i < CONFIGSAVE_LIST_MAXLEN; i++) {
+	    configs.push_back(std::string(m_config_names[i], strnlen(m_config_names[i], CONFIGSAVE_FULLPATH_MAXLEN)));
 	}
-    for (int32_t i = 0; i < CONFIGSAVE_LIST_MAXLEN; i++) {
-        free(savenames[i]);
-    }
 }
 
 void CAENMCADriver::getEnergySpectrum(int32_t channel_id, int32_t spectrum_id, std::vector<epicsInt32>& data)
@@ -1546,6 +1832,8 @@ void CAENMCADriver::getEnergySpectrum(int32_t channel_id, int32_t spectrum_id, s
 		&autosaveperiod
 	);
 	uint32_t nbins = getParameterValue(spectrum, "PARAM_ENERGY_SPECTRUM_NBINS");
+    updateShadow(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, ShadowValue(filename.data()));
+    updateShadow(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD, ShadowValue(autosaveperiod));
 	setIntegerParam(channel_id, P_energySpecCounts, nentries);
     setIntegerParam(channel_id, P_energySpecNBins, nbins);
     setStringParam(channel_id, P_energySpecFilename, filename.data());
@@ -1558,41 +1846,234 @@ void CAENMCADriver::getEnergySpectrum(int32_t channel_id, int32_t spectrum_id, s
 
 	data.resize(nbins);
 }
+
+/// read energy spectrum 0 of a channel into #m_energy_spec, marking it for publication only if it has changed
+void CAENMCADriver::readEnergySpectrum(int32_t channel_id)
+{
+    std::vector<epicsInt32>& spec = m_energy_spec_read[channel_id];
+    getEnergySpectrum(channel_id, 0, spec);
+    if (spec != m_energy_spec[channel_id]) {
+        m_energy_spec[channel_id].swap(spec);
+        m_pub[channel_id][PUB_ENERGY_SPEC].touch();
+    }
+}
+
+/// send the energy spectrum to clients if it has changed and its minimum publish period has passed.
+/// Returns the time (s) until a change held back by that period can be sent
+double CAENMCADriver::publishEnergySpectrum(int32_t channel_id, const epicsTime& now)
+{
+    double min_period = 0.0;
+    ArrayPublishState& pub = m_pub[channel_id][PUB_ENERGY_SPEC];
+    getDoubleParam(channel_id, P_energySpecPubPeriod, &min_period);
+    if (pub.due(now, min_period)) {
+        doCallbacksInt32Array(m_energy_spec[channel_id].data(), m_energy_spec[channel_id].size(), P_energySpec, channel_id);
+        pub.done(now);
+    }
+    return (pub.generation != pub.published ? (pub.last + min_period) - now : 1.0e9);
+}
 	
 void CAENMCADriver::setListModeFilename(int32_t channel_id, const char* filename)
 {
     std::string current_filename = getListModeFilename(channel_id);
     if (current_filename != filename) {
         std::cerr << "Changing list mode filename for channel " << channel_id << " from \"" << current_filename << "\" to \"" << filename << "\"" << std::endl;
-	    CAENMCA::SetData(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME, filename);
+	    setShadowed(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME, ShadowValue(filename));
     }
 }
 
 std::string CAENMCADriver::getListModeFilename(int32_t channel_id)
 {
+    const ShadowValue* shadow = findShadow(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME);
+    if (shadow != NULL) {
+        return shadow->text;
+    }
     std::vector<char> buffer(LISTS_FULLPATH_MAXLEN, '\0');
 	CAENMCA::GetData(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME, buffer.data());
+    updateShadow(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME, ShadowValue(buffer.data()));
     return std::string(buffer.data());
 }
 
 void CAENMCADriver::setListModeType(int32_t channel_id,  CAEN_MCA_ListSaveMode_t mode)
 { 
-	CAENMCA::SetData(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_SAVEMODE, mode);
+	setShadowed(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_SAVEMODE, ShadowValue((uint32_t)mode));
 }
 
 void CAENMCADriver::setListModeEnable(int32_t channel_id,  bool enable)
 { 
-	CAENMCA::SetData(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_ENABLE, (uint32_t)(enable ? 1 : 0));
+	setShadowed(m_chan_h[channel_id], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_ENABLE, ShadowValue((uint32_t)(enable ? 1 : 0)));
+}
+
+/// look up a child handle by index, from #m_handles if it has been looked up before
+CAEN_MCA_HANDLE CAENMCADriver::childHandle(CAEN_MCA_HANDLE parent, CAEN_MCA_HandleType_t type, int32_t index)
+{
+    CAENHandleCache::IndexKey key(parent, type, index);
+    {
+        epicsGuard<epicsMutex> _lock(m_handles.lock);
+        std::map<CAENHandleCache::IndexKey, CAEN_MCA_HANDLE>::const_iterator it = m_handles.by_index.find(key);
+        if (it != m_handles.by_index.end())
+        {
+            ++m_handles.hits;
+            return it->second;
+        }
+        ++m_handles.misses;
+    }
+    CAEN_MCA_HANDLE h = CAENMCA::GetChildHandle(parent, type, index);
+    epicsGuard<epicsMutex> _lock(m_handles.lock);
+    m_handles.by_index[key] = h;
+    return h;
+}
+
+/// look up a child handle by name, from #m_handles if it has been looked up before
+CAEN_MCA_HANDLE CAENMCADriver::childHandleByName(CAEN_MCA_HANDLE parent, CAEN_MCA_HandleType_t type, const char* name)
+{
+    CAENHandleCache::NameKey key(parent, type, name);
+    {
+        epicsGuard<epicsMutex> _lock(m_handles.lock);
+        std::map<CAENHandleCache::NameKey, CAEN_MCA_HANDLE>::const_iterator it = m_handles.by_name.find(key);
+        if (it != m_handles.by_name.end())
+        {
+            ++m_handles.hits;
+            return it->second;
+        }
+        ++m_handles.misses;
+    }
+    CAEN_MCA_HANDLE h = CAENMCA::GetChildHandleByName(parent, type, name);
+    epicsGuard<epicsMutex> _lock(m_handles.lock);
+    m_handles.by_name[key] = h;
+    return h;
+}
+
+/// write a device setting unless #m_shadow shows the device already holds the value. Inside a
+/// batch the write is only recorded, a later write of the same setting replacing it
+void CAENMCADriver::setShadowed(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, const ShadowValue& value)
+{
+    CAENShadowCache::Key key(handle, dataType, dataMask);
+    if (m_shadow.batch_depth > 0)
+    {
+        for(size_t i=0; i<m_shadow.pending.size(); ++i)
+        {
+            if (m_shadow.pending[i].first == key)
+            {
+                m_shadow.pending[i].second = value;
+                return;
+            }
+        }
+        m_shadow.pending.push_back(std::make_pair(key, value));
+        return;
+    }
+    std::map<CAENShadowCache::Key, ShadowValue>::const_iterator it = m_shadow.values.find(key);
+    if (it != m_shadow.values.end() && it->second == value)
+    {
+        ++m_shadow.skipped;
+        return;
+    }
+    writeShadowed(key, value);
+}
+
+void CAENMCADriver::writeShadowed(const CAENShadowCache::Key& key, const ShadowValue& value)
+{
+    CAEN_MCA_HANDLE handle = std::get<0>(key);
+    CAEN_MCA_DataType_t dataType = static_cast<CAEN_MCA_DataType_t>(std::get<1>(key));
+    uint64_t dataMask = std::get<2>(key);
+    m_shadow.values.erase(key); // the device value is unknown if the write fails
+    switch(value.kind)
+    {
+        case ShadowValue::UINT32:
+            CAENMCA::SetData(handle, dataType, dataMask, (uint32_t)value.number);
+            break;
+        case ShadowValue::DOUBLE:
+            CAENMCA::SetData(handle, dataType, dataMask, value.number);
+            break;
+        case ShadowValue::TEXT:
+            CAENMCA::SetData(handle, dataType, dataMask, value.text.c_str());
+            break;
+    }
+    m_shadow.values[key] = value;
+    ++m_shadow.writes;
+}
+
+/// record a setting value just read from the device
+void CAENMCADriver::updateShadow(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, const ShadowValue& value)
+{
+    m_shadow.values[CAENShadowCache::Key(handle, dataType, dataMask)] = value;
+}
+
+/// the value the device is known to hold for a setting, or NULL if it needs to be read
+const ShadowValue* CAENMCADriver::findShadow(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask) const
+{
+    std::map<CAENShadowCache::Key, ShadowValue>::const_iterator it = m_shadow.values.find(CAENShadowCache::Key(handle, dataType, dataMask));
+    return (it != m_shadow.values.end() ? &(it->second) : NULL);
+}
+
+/// read the list mode and energy spectrum settings of a channel into #m_shadow in one call each
+void CAENMCADriver::readShadow(int32_t channel_id)
+{
+	uint32_t enabled, datamask, maxnevts, autosaveperiod;
+	CAEN_MCA_ListSaveMode_t savemode;
+	std::vector<char> filename(LISTS_FULLPATH_MAXLEN, '\0');
+    CAEN_MCA_HANDLE channel = m_chan_h[channel_id];
+	CAENMCA::GetData(channel, CAEN_MCA_DATA_LIST_MODE,
+		DATAMASK_LIST_ENABLE | DATAMASK_LIST_SAVEMODE | DATAMASK_LIST_FILENAME | DATAMASK_LIST_FILE_DATAMASK | DATAMASK_LIST_MAXNEVTS,
+		&enabled, &savemode, filename.data(), &datamask, &maxnevts);
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_ENABLE, ShadowValue(enabled));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_SAVEMODE, ShadowValue((uint32_t)savemode));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME, ShadowValue(filename.data()));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILE_DATAMASK, ShadowValue(datamask));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_MAXNEVTS, ShadowValue(maxnevts));
+    CAEN_MCA_HANDLE spectrum = getSpectrumHandle(channel, 0);
+    filename.assign(ENERGYSPECTRUM_FULLPATH_MAXLEN, '\0');
+	CAENMCA::GetData(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME | DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD,
+		filename.data(), &autosaveperiod);
+    updateShadow(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, ShadowValue(filename.data()));
+    updateShadow(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD, ShadowValue(autosaveperiod));
+    getParameterValue(spectrum, "PARAM_ENERGY_SPECTRUM_NBINS");
+    getParameterValue(channel, "PARAM_CH_ENABLED");
+}
+
+/// collect setting writes until the matching applyParamBatch(), batches can be nested
+void CAENMCADriver::beginParamBatch()
+{
+    ++m_shadow.batch_depth;
+}
+
+/// at the end of the outermost batch, write each setting whose final value the device does not already hold
+void CAENMCADriver::applyParamBatch()
+{
+    if (m_shadow.batch_depth <= 0 || --m_shadow.batch_depth > 0)
+    {
+        return;
+    }
+    std::vector< std::pair<CAENShadowCache::Key, ShadowValue> > pending;
+    pending.swap(m_shadow.pending);
+    for(size_t i=0; i<pending.size(); ++i)
+    {
+        std::map<CAENShadowCache::Key, ShadowValue>::const_iterator it = m_shadow.values.find(pending[i].first);
+        if (it != m_shadow.values.end() && it->second == pending[i].second)
+        {
+            ++m_shadow.skipped;
+        }
+        else
+        {
+            writeShadowed(pending[i].first, pending[i].second);
+        }
+    }
+}
+
+/// end the outermost batch without writing, e.g. when an error means it should not be applied
+void CAENMCADriver::discardParamBatch()
+{
+    m_shadow.batch_depth = 0;
+    m_shadow.pending.clear();
 }
 
 CAEN_MCA_HANDLE CAENMCADriver::getSpectrumHandle(int32_t channel_id, int32_t spectrum_id)
 {
-	return CAENMCA::GetChildHandle(m_chan_h[channel_id], CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
+	return childHandle(m_chan_h[channel_id], CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
 }
 
 CAEN_MCA_HANDLE CAENMCADriver::getSpectrumHandle(CAEN_MCA_HANDLE channel, int32_t spectrum_id)
 {
-	return CAENMCA::GetChildHandle(channel, CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
+	return childHandle(channel, CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
 }
 
 void CAENMCADriver::setEnergySpectrumFilename(int32_t channel_id, int32_t spectrum_id, const char* filename)
@@ -1600,20 +2081,27 @@ void CAENMCADriver::setEnergySpectrumFilename(int32_t channel_id, int32_t spectr
     std::string current_filename = getEnergySpectrumFilename(channel_id, spectrum_id);
     if (current_filename != filename) {
         std::cerr << "Changing energy spectrum filename for channel " << channel_id << " spectrum " << spectrum_id << " from \"" << current_filename << "\" to \"" << filename << "\"" << std::endl;
-	    CAENMCA::SetData(getSpectrumHandle(channel_id, spectrum_id), CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, filename);
+	    setShadowed(getSpectrumHandle(channel_id, spectrum_id), CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, ShadowValue(filename));
     }
 }
 
 std::string CAENMCADriver::getEnergySpectrumFilename(int32_t channel_id, int32_t spectrum_id)
 {
+    CAEN_MCA_HANDLE spectrum = getSpectrumHandle(channel_id, spectrum_id);
+    const ShadowValue* shadow = findShadow(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME);
+    if (shadow != NULL) {
+        return shadow->text;
+    }
     std::vector<char> buffer(ENERGYSPECTRUM_FULLPATH_MAXLEN, '\0');
-	CAENMCA::GetData(getSpectrumHandle(channel_id, spectrum_id), CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, buffer.data());
+	CAENMCA::GetData(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, buffer.data());
+    updateShadow(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_FILENAME, ShadowValue(buffer.data()));
     return std::string(buffer.data());
 }
 
 void CAENMCADriver::setEnergySpectrumAutosave(int32_t channel_id, int32_t spectrum_id, double period)
 {
-	CAENMCA::SetData(getSpectrumHandle(channel_id, spectrum_id), CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD, (uint32_t)(period * 1000.0 + 0.5));
+	setShadowed(getSpectrumHandle(channel_id, spectrum_id), CAEN_MCA_DATA_ENERGYSPECTRUM, DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD,
+	            ShadowValue((uint32_t)(period * 1000.0 + 0.5)));
 }
  
 void CAENMCADriver::setEnergySpectrumNumBins(int32_t channel_id, int32_t spectrum_id, int nbins)
@@ -1623,83 +2111,148 @@ void CAENMCADriver::setEnergySpectrumNumBins(int32_t channel_id, int32_t spectru
 
 void CAENMCADriver::setEnergySpectrumParameter(CAEN_MCA_HANDLE channel, int32_t spectrum_id, const char* parname, double value)
 {
-	CAEN_MCA_HANDLE spectrum = CAENMCA::GetChildHandle(channel, CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
+	CAEN_MCA_HANDLE spectrum = childHandle(channel, CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
 	setParameterValue(spectrum, parname, value);
 }
 
 template <typename T>
 void CAENMCADriver::energySpectrumSetProperty(CAEN_MCA_HANDLE channel, int32_t spectrum_id, int prop, T value)
 {
-	CAEN_MCA_HANDLE spectrum = CAENMCA::GetChildHandle(channel, CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
+	CAEN_MCA_HANDLE spectrum = childHandle(channel, CAEN_MCA_HANDLE_ENERGYSPECTRUM, spectrum_id);
 	CAENMCA::SetData(spectrum, CAEN_MCA_DATA_ENERGYSPECTRUM, prop, value);
 }
 
+/// device reads are grouped into items each read at its own period, see #PollItem. The energy
+/// spectrum and list mode data are read at their acquiring period while the channel runs and at the
+/// idle period otherwise, with an extra read when acquisition starts or stops. HV is read at the ramp
+/// period while the output is moving and the configuration list rarely. requestPoll() makes an item
+/// be read now, e.g. after a write that changes it
 void CAENMCADriver::pollerTask()
 {
-    bool new_data;
 	epicsThreadSleep(0.2); // to allow class constructror to complete
     lock();
     std::string deviceName;
     getStringParam(P_deviceName, deviceName);
     unlock();
+    double spec_period, spec_idle_period, hv_period, hv_ramp_period, chan_period, lists_period, config_period;
 	while(true)
 	{
 	    lock();
-        
+        epicsTime now(epicsTime::getCurrent());
+        getDoubleParam(P_pollSpecPeriod, &spec_period);
+        getDoubleParam(P_pollSpecIdlePeriod, &spec_idle_period);
+        getDoubleParam(P_pollHVPeriod, &hv_period);
+        getDoubleParam(P_pollHVRampPeriod, &hv_ramp_period);
+        getDoubleParam(P_pollChanPeriod, &chan_period);
+        getDoubleParam(P_pollListsPeriod, &lists_period);
+        getDoubleParam(P_pollConfigPeriod, &config_period);
+        bool chan_polled = false;
+        double pub_delay = 1.0e9;
+        // an item is rescheduled before it is read so a failing read is not retried straight away
         try {
-
-        //std::cerr << "hv0 on " << isHVOn(m_hv_chan_h[0]) << std::endl;
-        //std::cerr << "hv1 on " << isHVOn(m_hv_chan_h[1]) << std::endl;
-	
-	    //std::cerr << isAcqRunning() << " " << isAcqRunning(m_chan_h[0]) << " " << isAcqRunning(m_chan_h[1]) << std::endl;
 	    for(int i=0;i<2; ++i)
 		{
-	        getEnergySpectrum(i, 0, m_energy_spec[i]);
-		    doCallbacksInt32Array(m_energy_spec[i].data(), m_energy_spec[i].size(), P_energySpec, i);
-            getHVInfo(i);
-            getChannelInfo(i);
-		    getLists(i);
-            if (!isAcqRunning(m_chan_h[i])) {
-                setDoubleParam(i, P_eventSpecRate, 0.0);
-                setDoubleParam(i, P_eventsSpecTriggerRate, 0.0);
+            PollItem* poll = m_poll[i];
+            if (poll[POLL_CHANNEL].due(now)) {
+                poll[POLL_CHANNEL].done(now, chan_period);
+                chan_polled = true;
+                bool acq_running = getChannelInfo(i);
+                if (acq_running != m_acq_running[i]) {
+                    m_acq_running[i] = acq_running;
+                    poll[POLL_SPECTRUM].requested = poll[POLL_LISTS].requested = true;
+                }
+                if (!acq_running) {
+                    setDoubleParam(i, P_eventSpecRate, 0.0);
+                    setDoubleParam(i, P_eventsSpecTriggerRate, 0.0);
+                }
             }
-            new_data = processListFile(i);
-            setIntegerParam(i, P_loadDataStatus, 2);
-		    callParamCallbacks(i);
-			updateAD(i, new_data);
-		    doCallbacksFloat64Array(m_event_spec_x[i].data(), m_event_spec_x[i].size(), P_eventsSpecX, i);
-		    doCallbacksFloat64Array(m_event_spec_y[i].data(), m_event_spec_y[i].size(), P_eventsSpecY, i);
-		    doCallbacksInt32Array(m_energy_spec_event[i].data(), m_energy_spec_event[i].size(), P_energySpecEvent, i);
-		    doCallbacksInt32Array(m_energy_spec2_event[i].data(), m_energy_spec2_event[i].size(), P_energySpec2Event, i);
-            setIntegerParam(i, P_loadDataStatus, 0);
+            if (poll[POLL_SPECTRUM].due(now)) {
+                poll[POLL_SPECTRUM].done(now, (m_acq_running[i] ? spec_period : spec_idle_period));
+	            readEnergySpectrum(i);
+            }
+            pub_delay = std::min(pub_delay, publishEnergySpectrum(i, now));
+            if (poll[POLL_HV].due(now)) {
+                poll[POLL_HV].done(now, hv_period);
+                if (getHVInfo(i)) {
+                    poll[POLL_HV].done(now, hv_ramp_period);
+                }
+            }
+            if (poll[POLL_LISTS].due(now)) {
+                poll[POLL_LISTS].done(now, (m_acq_running[i] ? lists_period : spec_idle_period));
+		        getLists(i);
+            }
+            // list mode data is processed separately by ingestTask()
 		    callParamCallbacks(i);
 		}
-        bool acqRunning = isAcqRunning();
-        setIntegerParam(P_acqRunning, (acqRunning ? 1 : 0));
-		std::vector<std::string> configs_v;
-        listConfigurations(configs_v);
-        std::string configs;
+        if (chan_polled) {
+            bool acqRunning = isAcqRunning();
+            setIntegerParam(P_acqRunning, (acqRunning ? 1 : 0));
+        }
+        if (m_poll_configs.due(now)) {
+            m_poll_configs.done(now, config_period);
+		    std::vector<std::string> configs_v;
+            listConfigurations(configs_v);
+            std::string configs;
 
-        for(int i=0; i<configs_v.size(); ++i)
-        {
-            configs +=  configs_v[i];
-            if (i != configs_v.size() - 1)
+            for(int i=0; i<configs_v.size(); ++i)
             {
-                configs += ",";
-            }
-        }        
-        setStringParam(P_availableConfigurations, configs.c_str());        
+                configs +=  configs_v[i];
+                if (i != configs_v.size() - 1)
+                {
+                    configs += ",";
+                }
+            }        
+            setStringParam(P_availableConfigurations, configs.c_str());        
+        }
         }
         catch(const std::exception& ex) {
             std::cerr << "exception in pollerTask: " << deviceName << ": " << ex.what() << std::endl;
+            m_handles.clear(); // in case the error was from a handle that is no longer valid
+            m_shadow.clear(); // and the device may have been reset
             setParamStatus(0, P_eventsSpecNTriggers, asynError); // to flag an alarm in the DB
         }
 		callParamCallbacks(0);
+        // sleep until the next item is due, at most a second so period changes are picked up
+        double delay = std::min(std::min(1.0, pub_delay), m_poll_configs.next - now);
+        for(int i=0; i<2; ++i)
+        {
+            for(int j=0; j<NUM_POLL_ITEMS; ++j)
+            {
+                delay = std::min(delay, (m_poll[i][j].requested ? 0.0 : m_poll[i][j].next - now));
+            }
+        }
+        if (m_poll_configs.requested)
+        {
+            delay = 0.0;
+        }
 		unlock();
-		epicsThreadSleep(1.0);
+		m_poll_event.wait(std::max(delay, 0.02));
 	}
 }
 
+/// make pollerTask() read an item now rather than when it is next due. A channel_id < 0
+/// requests the item on both channels and an item < 0 requests all of them
+void CAENMCADriver::requestPoll(int channel_id, int item)
+{
+    for(int i=0; i<2; ++i)
+    {
+        for(int j=0; j<NUM_POLL_ITEMS; ++j)
+        {
+            if ((channel_id < 0 || channel_id == i) && (item < 0 || item == j))
+            {
+                m_poll[i][j].requested = true;
+            }
+        }
+    }
+    m_poll_event.signal();
+}
+
+void CAENMCADriver::requestConfigPoll()
+{
+    m_poll_configs.requested = true;
+    m_poll_event.signal();
+}
+
 asynStatus CAENMCADriver::readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason)
 {
     int function = pasynUser->reason;
@@ -1730,6 +2283,7 @@ asynStatus CAENMCADriver::writeOctet(asynUser *pasynUser, const char *value, siz
 	    if (function == P_listFile)
 	    {		
             setListModeFilename(addr, value_s.c_str());
+            requestPoll(addr, POLL_LISTS);
 	    }
 	    else if (function == P_filePrefix)
 	    {
@@ -1741,10 +2295,13 @@ asynStatus CAENMCADriver::writeOctet(asynUser *pasynUser, const char *value, siz
 	    else if (function == P_configuration)
 	    {
           loadConfiguration(value_s.c_str());
+          requestPoll(-1, -1);
+          requestConfigPoll();
 	    }
 	    else if (function == P_energySpecFilename)
 	    {
             setEnergySpectrumFilename(addr, 0, value_s.c_str()); 
+            requestPoll(addr, POLL_SPECTRUM);
 	    }
 		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
 			"%s:%s: function=%d, name=%s, value=%s\n",
@@ -1860,6 +2417,24 @@ asynStatus CAENMCADriver::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 	getParamName(function, &paramName);
 	int addr = 0;
 	getAddress(pasynUser, &addr);
+    if (function == P_pollSpecPeriod || function == P_pollSpecIdlePeriod || function == P_pollHVPeriod || function == P_pollHVRampPeriod ||
+        function == P_pollChanPeriod || function == P_pollListsPeriod || function == P_pollConfigPeriod)
+    {
+        // read everything once more so the new periods are used from now
+        requestPoll(-1, -1);
+        requestConfigPoll();
+    }
+    if (function == P_eventsSpecTMin || function == P_eventsSpecTMax || function == P_eventSpec_2DTimeMin ||
+        function == P_eventSpec_2DTimeMax || function == P_energySpecEventTMin || function == P_energySpecEventTMax ||
+        function == P_energySpec2EventTMin || function == P_energySpec2EventTMax || function == P_eventSpecRateTMin ||
+        function == P_eventSpecRateTMax)
+    {
+        wakeIngest(); // the spectra are derived with the new binning without waiting for more events
+    }
+    else if (isGatedHistDefParam(function))
+    {
+        wakeIngest(addr); // so a changed histogram is applied without waiting for more events
+    }
     if (function < FIRST_CAEN_PARAM) {
         return ADDriver::writeFloat64(pasynUser, value);
     } else {
@@ -1881,59 +2456,103 @@ asynStatus CAENMCADriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
         if (function == ADAcquire)
         {            
             setADAcquire(addr, value);
+            if (addr >= OVERVIEW_ADDR)
+            {
+                wakeIngest(); // so the pyramid the overview image is made from is built
+            }
             // fall through to next line to call base class
         }
 		if (function == P_startAcquisition)
 		{
 			startAcquisition(addr, value);
+            wakeIngest();
+            requestPoll(-1, POLL_CHANNEL);
 		}
 		else if (function == P_stopAcquisition)
 		{
 			stopAcquisition(addr, value);
+            requestPoll(-1, POLL_CHANNEL);
 		}
 		else if (function == P_hvOn)
         {
             setHVState(m_hv_chan_h[addr], (value != 0 ? true : false));
+            requestPoll(addr, POLL_HV);
         }
 		else if (function == P_listEnabled)
         {
             setListModeEnable(addr, (value != 0 ? true : false));
+            wakeIngest();
+            requestPoll(addr, POLL_LISTS);
         }
 		else if (function == P_chanEnabled)
         {
             setParameterValue(m_chan_h[addr], "PARAM_CH_ENABLED", (value != 0 ? 1 : 0));
+            requestPoll(addr, POLL_CHANNEL);
         }
 		else if (function == P_listSaveMode)
         {
             setListModeType(addr, static_cast<CAEN_MCA_ListSaveMode_t>(value));
+            wakeIngest();
+            requestPoll(addr, POLL_LISTS);
+        }
+		else if ((function == P_loadDataFile || function == P_reloadLiveData) && value != 0)
+        {
+            wakeIngest();
         }
 		else if (function == P_listMaxNEvents)
         {
-            CAENMCA::SetData(m_chan_h[addr], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_MAXNEVTS, value);
+            setShadowed(m_chan_h[addr], CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_MAXNEVTS, ShadowValue((uint32_t)value));
+            requestPoll(addr, POLL_LISTS);
         }
 		else if (function == P_energySpecNBins)
         {
             setEnergySpectrumNumBins(addr, 0, value);
+            requestPoll(addr, POLL_SPECTRUM);
         }
 		else if (function == P_energySpecClear)
         {
             clearEnergySpectrum(addr);
+            requestPoll(addr, POLL_SPECTRUM);
+        }
+		else if (function == P_configRefresh)
+        {
+            requestConfigPoll();
+        }
+		else if (function == P_specOverviewLevel || function == P_eventsSpecNBins || function == P_eventSpec_2DNTimeBins ||
+                 function == P_eventSpec_2DEnergyBinGroup)
+        {
+            wakeIngest();
+        }
+		else if (isGatedHistDefParam(function))
+        {
+            wakeIngest(addr); // so a changed histogram is applied without waiting for more events
+        }
+		else if (function == P_eventSpec_2DOvLevel && addr < OVERVIEW_ADDR)
+        {
+            updateAD(addr + OVERVIEW_ADDR, true);
         }
 		else if (function == P_endRun)
         {
             endRun();
+            unlock(); // see closeListFiles()
+            closeListFiles();
+            lock();
+            requestPoll(-1, POLL_CHANNEL);
         }
 		else if (function == P_endRunAll)
         {
             endRunAll();
+            requestPoll(-1, POLL_CHANNEL);
         }
 		else if (function == P_beginRun)
 		{
 			beginRun();
+            requestPoll(-1, POLL_CHANNEL);
 		}
 		else if (function == P_beginRunAll)
         {
             beginRunAll();
+            requestPoll(-1, POLL_CHANNEL);
         }
 		else if (function == P_iRunNumber)
         {
@@ -1946,6 +2565,10 @@ asynStatus CAENMCADriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
 		else if (function == P_restart)
         {
             CAENMCA::SendCommand(m_device_h, CAEN_MCA_CMD_RESTART , DATAMASK_CMD_NONE, DATAMASK_CMD_NONE);
+            m_handles.clear();
+            m_shadow.clear();
+            requestPoll(-1, -1);
+            requestConfigPoll();
         }
 		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
 			"%s:%s: function=%d, name=%s, value=%d\n",
@@ -2020,6 +2643,11 @@ void CAENMCADriver::getLists(uint32_t channel_id)
         dataflags.resize(nevts);
     }
 	
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_ENABLE, ShadowValue(enabled));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_SAVEMODE, ShadowValue((uint32_t)savemode));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILENAME, ShadowValue(filename.data()));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_FILE_DATAMASK, ShadowValue(datamask));
+    updateShadow(channel, CAEN_MCA_DATA_LIST_MODE, DATAMASK_LIST_MAXNEVTS, ShadowValue(maxnevts));
 	setIntegerParam(channel_id, P_nEvents, nevts);
 	setIntegerParam(channel_id, P_listMaxNEvents, maxnevts);
 	setStringParam(channel_id, P_listFile, filename.data());
@@ -2028,115 +2656,263 @@ void CAENMCADriver::getLists(uint32_t channel_id)
     // set a parameter to datamask	
 }
 
-static std::string describeFlags(unsigned flags)
+
+/// number of energy channels in the event derived energy spectra and 2D map of a channel, this is
+/// 2^(energy bit count) of the board. List mode energies are not rescaled to the hardware energy
+/// spectrum bins so that setting is not used here, events with a larger energy are counted as
+/// discarded by binEvents(). Called with the driver locked
+int CAENMCADriver::energyBins(int channel_id)
 {
-    std::string s;
-    if (flags & 0x1)
-    {
-        s += "First event after a dead time occurrence, ";
-        flags &= ~0x1;
-    }
-    if (flags & 0x2)
-    {
-        s += "Time tag rollover, ";
-        flags &= ~0x2;
-    }
-    if (flags & 0x4)
-    {
-        s += "Time tag reset, ";
-        flags &= ~0x4;
-    }
-    if (flags & 0x8)
-    {
-        s += "Fake event, ";
-        flags &= ~0x8;
-    }
-    if (flags & 0x80)
-    {
-        s += "Event energy saturated, ";
-        flags &= ~0x80;
-    }
-    if (flags & 0x400)
-    {
-        s += "Input dynamics saturated event, ";
-        flags &= ~0x400;
-    }
-    if (flags & 0x8000)
-    {
-        s += "Pile up event, ";
-        flags &= ~0x8000;
-    }
-    if (flags & 0x10000)
-    {
-        s += "Deadtime calc event, ";
-        flags &= ~0x10000;
-    }
-    if (flags & 0x20000)
-    {
-        s += "Event energy is outside the SCA interval, ";
-        flags &= ~0x20000;
-    }
-    if (flags & 0x40000)
-    {
-        s += "Event occurred during saturation inhibit, ";
-        flags &= ~0x40000;
-    }
-    if (flags != 0)
-    {
-        s += "Unknown flag";
+    int nbins = MAX_ENERGY_BINS;
+    if (m_nbitsEnergy > 0 && m_nbitsEnergy < 15) {
+        nbins = 1 << m_nbitsEnergy;
     }
-    return s;
+    return nbins;
 }
 
-bool CAENMCADriver::processListFile(int channel_id)
+/// copy the list mode settings for a channel from the asyn parameters, called with the driver lock held
+void CAENMCADriver::readListModeSettings(int channel_id, ListModeSettings& settings)
 {
-    std::string filename;
-    int enabled = 0, save_mode, load_data_file = 0, reload_live_data = 0;
-	getStringParam(channel_id, P_listFile, filename);
+    int enabled = 0, load_data_file = 0, reload_live_data = 0, index_sidecar = 0;
+	getStringParam(channel_id, P_listFile, settings.filename);
 	getIntegerParam(channel_id, P_listEnabled, &enabled);
-	getIntegerParam(channel_id, P_listSaveMode, &save_mode);
+	getIntegerParam(channel_id, P_listSaveMode, &settings.save_mode);
     getIntegerParam(channel_id, P_loadDataFile, &load_data_file);
     getIntegerParam(channel_id, P_reloadLiveData, &reload_live_data);
-    double eventSpec_2d_TMin = 0.0, eventSpec_2d_TMax = 0.0;
-    int eventSpec_2d_nTBins = 0, eventSpec_2d_engBinGroup = 1;
-	getDoubleParam(channel_id, P_eventSpec_2DTimeMax, &eventSpec_2d_TMax);
-	getDoubleParam(channel_id, P_eventSpec_2DTimeMin, &eventSpec_2d_TMin);
-	getIntegerParam(channel_id, P_eventSpec_2DNTimeBins, &eventSpec_2d_nTBins);
-	getIntegerParam(channel_id, P_eventSpec_2DEnergyBinGroup, &eventSpec_2d_engBinGroup);
-    double eventSpecRateTMin, eventSpecRateTMax;
-	getDoubleParam(channel_id, P_eventSpecRateTMin, &eventSpecRateTMin);
-	getDoubleParam(channel_id, P_eventSpecRateTMax, &eventSpecRateTMax);
-
-    uint64_t trigger_time = 0, frame_length = 0, max_event_time = 0;
-    int16_t energy;
-    uint32_t extras;
-    const size_t EVENT_SIZE = 14;
-    struct stat stat_struct;
-    bool new_data = false;
-    std::string filename_ascii = filename;
-    for(int i=0; i<filename_ascii.size(); ++i) {
-        if (filename_ascii[i] == '/' || filename_ascii[i] == '\\' || filename_ascii[i] == '.') {
-            filename_ascii[i] = '_';
-        }            
+    settings.enabled = (enabled != 0);
+    settings.load_data_file = (load_data_file != 0);
+    settings.reload_live_data = (reload_live_data != 0);
+    if (settings.load_data_file) {
+        getStringParam(channel_id, P_loadDataFileName, settings.load_filename);
+        getIntegerParam(channel_id, P_loadDataFirstFrame, &settings.load_first_frame);
+        getIntegerParam(channel_id, P_loadDataNFrames, &settings.load_nframes);
     }
-    filename_ascii = std::string("c:/Data/") + filename_ascii + ".txt";
-    FILE*& f = std::get<0>(m_file_fd[channel_id]);
-    FILE*& f_ascii = std::get<1>(m_file_fd[channel_id]);
-    if ( (sizeof(trigger_time) + sizeof(energy) + sizeof(extras)) != EVENT_SIZE )
-    {
-        std::cerr << "size error" << std::endl;
-        return new_data;
+	getDoubleParam(channel_id, P_eventSpec_2DTimeMax, &settings.ev2d_tmax);
+	getDoubleParam(channel_id, P_eventSpec_2DTimeMin, &settings.ev2d_tmin);
+	getIntegerParam(channel_id, P_eventSpec_2DNTimeBins, &settings.ev2d_ntbins);
+	getIntegerParam(channel_id, P_eventSpec_2DEnergyBinGroup, &settings.ev2d_eng_bin_group);
+    getDoubleParam(channel_id, P_eventsSpecTMin, &settings.ev_tmin);
+    getDoubleParam(channel_id, P_eventsSpecTMax, &settings.ev_tmax);
+    getIntegerParam(channel_id, P_eventsSpecNBins, &settings.ev_nbins);
+    settings.energy_bins = energyBins(channel_id);
+    setIntegerParam(channel_id, P_eventsEnergyBins, settings.energy_bins);
+    int ov_acquire = 0;
+    getIntegerParam(channel_id + OVERVIEW_ADDR, ADAcquire, &ov_acquire);
+    settings.ev2d_overview = (ov_acquire != 0);
+    settings.hists.resize(ListModeChannel::HIST_USER + ListModeChannel::MAX_USER_HISTS);
+    for(int i=0; i<settings.hists.size(); ++i) {
+        GatedHistogramDef& h = settings.hists[i];
+        h = GatedHistogramDef();
+        if (i < ListModeChannel::HIST_USER) {
+            h.enabled = true;
+            h.axis = GatedHistogramDef::AxisEnergy;
+            h.xmax = settings.energy_bins;
+            h.nbins = (i == ListModeChannel::HIST_RATE ? 0 : settings.energy_bins);
+        }
+        else {
+            const GatedHistParams& hp = P_gatedHist[i - ListModeChannel::HIST_USER];
+            int ival = 0;
+            getIntegerParam(channel_id, hp.enable, &ival);
+            h.enabled = (ival != 0);
+            getDoubleParam(channel_id, hp.tmin, &h.tmin);
+            getDoubleParam(channel_id, hp.tmax, &h.tmax);
+            getIntegerParam(channel_id, hp.emin, &h.emin);
+            getIntegerParam(channel_id, hp.emax, &h.emax);
+            getIntegerParam(channel_id, hp.flagMask, &ival);
+            h.flag_mask = ival;
+            getIntegerParam(channel_id, hp.flagValue, &ival);
+            h.flag_value = ival;
+            getIntegerParam(channel_id, hp.axis, &h.axis);
+            getDoubleParam(channel_id, hp.xmin, &h.xmin);
+            getDoubleParam(channel_id, hp.xmax, &h.xmax);
+            getIntegerParam(channel_id, hp.nbins, &h.nbins);
+        }
     }
-    if (reload_live_data != 0) {
+    GatedHistogramDef& ha = settings.hists[ListModeChannel::HIST_ENERGY_A];
+    GatedHistogramDef& hb = settings.hists[ListModeChannel::HIST_ENERGY_B];
+    GatedHistogramDef& hr = settings.hists[ListModeChannel::HIST_RATE];
+    getDoubleParam(channel_id, P_energySpecEventTMin, &ha.tmin);
+    getDoubleParam(channel_id, P_energySpecEventTMax, &ha.tmax);
+    getDoubleParam(channel_id, P_energySpec2EventTMin, &hb.tmin);
+    getDoubleParam(channel_id, P_energySpec2EventTMax, &hb.tmax);
+	getDoubleParam(channel_id, P_eventSpecRateTMin, &hr.tmin);
+	getDoubleParam(channel_id, P_eventSpecRateTMax, &hr.tmax);
+    getDoubleParam(channel_id, P_eventStoreMaxMem, &settings.store_max_mem);
+    getIntegerParam(channel_id, P_baseTBinWidth, &settings.base_tbinw);
+    getDoubleParam(channel_id, P_baseMaxMem, &settings.base_max_mem);
+    getIntegerParam(channel_id, P_histThreads, &settings.hist_threads);
+    getIntegerParam(channel_id, P_frameIndexStride, &settings.index_stride);
+    getIntegerParam(channel_id, P_frameIndexSidecar, &index_sidecar);
+    settings.index_sidecar = (index_sidecar != 0);
+    if (settings.reload_live_data) {
         setIntegerParam(channel_id, P_reloadLiveData, 0);
         std::cerr << "ReLoading live data..." << std::endl;
     }        
-    if (load_data_file != 0) {
+    if (settings.load_data_file) {
         setIntegerParam(channel_id, P_loadDataFile, 0);
         setADAcquire(channel_id, 1);
-    }        
-    else if (!enabled || save_mode != CAEN_MCA_SAVEMODE_FILE_BINARY)
-    {
+    }
+    double ev_binw = 0.0, ev2d_tbinw = 0.0;
+    if (settings.ev_tmax > settings.ev_tmin && settings.ev_nbins > 0) {
+        ev_binw = (settings.ev_tmax - settings.ev_tmin) / settings.ev_nbins;
+    }
+    setDoubleParam(channel_id, P_eventsSpecTBinWidth, ev_binw);
+    if (settings.ev2d_tmax > settings.ev2d_tmin && settings.ev2d_ntbins > 0) {
+        ev2d_tbinw = (settings.ev2d_tmax - settings.ev2d_tmin) / settings.ev2d_ntbins;
+    }
+    setDoubleParam(channel_id, P_eventSpec_2DTBinWidth, ev2d_tbinw);
+    if (settings.load_data_file || settings.reload_live_data) {
+        setIntegerParam(channel_id, P_loadDataStatus, 1);
+    }
+    callParamCallbacks(channel_id);
+}
+
+/// zero list mode spectra and counters, called by processListFile() with the channel lock held
+void CAENMCADriver::clearListModeSpectra(int channel_id)
+{
+    m_list_mode[channel_id].counters.reset();
+    std::fill(m_event_spec_y[channel_id].begin(), m_event_spec_y[channel_id].end(), 0.0);
+    m_list_mode[channel_id].hists.clear();
+    m_list_mode[channel_id].base.clear();
+    m_event_spec_2d[channel_id].clear();
+}
+
+/// replace the list mode spectra, binned with old_settings, with ones summed from the base histogram
+/// using the binning now in m_list_mode[channel_id].pass. Called by processListFile() with the
+/// channel lock held after the histograms have been configured, so those whose definition is
+/// unchanged keep their counts. Returns false, leaving the spectra untouched, if the base histogram
+/// does not hold all the events in the spectra, a changed histogram gates on event flags, or a
+/// base time bin would be split between bins of the new binning; the events must then be re-binned
+bool CAENMCADriver::deriveListModeSpectra(int channel_id, const ListModeSettings& old_settings)
+{
+    static const char* functionName = "deriveListModeSpectra";
+    ListModeChannel& lm = m_list_mode[channel_id];
+    const ListModePass& pass = lm.pass;
+    BaseHistogram& base = lm.base;
+    if (!base.complete() || pass.binner.ev2d_eng_bin_group <= 0)
+    {
+        return false;
+    }
+    std::vector<size_t> changed;
+    for(size_t j=0; j<lm.hists.size(); ++j)
+    {
+        const GatedHistogramDef& d = lm.hists.definition(j);
+        if (d.enabled && (j >= old_settings.hists.size() || d != old_settings.hists[j]))
+        {
+            if (!lm.hists.derivable(j))
+            {
+                return false;
+            }
+            changed.push_back(j);
+        }
+    }
+    epicsTimeStamp start, end;
+    epicsTimeGetCurrent(&start);
+    base.compact();
+    if (!base.complete())
+    {
+        return false;
+    }
+    const UniformBinner ev_tbin = pass.binner.ev_tbin, ev2d_tbin = pass.binner.ev2d_tbin;
+    if (base.timeBinWidth() > 1)
+    {
+        bool exact = true;
+        base.forEach([&](uint64_t t0, uint64_t t1, int, int32_t) {
+            exact = exact && ev_tbin.bin(t0) == ev_tbin.bin(t1) && ev2d_tbin.bin(t0) == ev2d_tbin.bin(t1);
+            for(size_t i=0; exact && i<changed.size(); ++i)
+            {
+                exact = lm.hists.sameTimeBin(changed[i], t0, t1);
+            }
+        });
+        if (!exact)
+        {
+            return false;
+        }
+    }
+    std::vector<double>& event_spec_y = m_event_spec_y[channel_id];
+    TiledHistogram2D& event_spec_2d = m_event_spec_2d[channel_id];
+    std::fill(event_spec_y.begin(), event_spec_y.end(), 0.0);
+    event_spec_2d.clear();
+    const int eng_bin_group = pass.binner.ev2d_eng_bin_group;
+    int64_t nevents_real_ev = 0;
+    base.forEach([&](uint64_t t0, uint64_t, int energy, int32_t count) {
+        int n = ev_tbin.bin(t0);
+        if (n >= 0)
+        {
+            event_spec_y[n] += count;
+            nevents_real_ev += count;
+        }
+        n = ev2d_tbin.bin(t0);
+        if (n >= 0)
+        {
+            event_spec_2d.add(energy / eng_bin_group, n, count);
+        }
+        for(size_t i=0; i<changed.size(); ++i)
+        {
+            lm.hists.add(changed[i], t0, energy, count);
+        }
+    });
+    lm.counters.nevents_real_ev = nevents_real_ev;
+    lm.counters.neventnotbinned = base.nevents() - nevents_real_ev;
+    epicsTimeGetCurrent(&end);
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: channel %d spectra derived from %lu base histogram bins in %.1f ms\n",
+        driverName, functionName, channel_id, (unsigned long)base.numBins(), 1000.0 * epicsTimeDiffInSeconds(&end, &start));
+    return true;
+}
+
+/// next free event ring slot for the reader, waits for the histogram thread if the ring is full
+static ListModeBatch* waitForRingSlot(ListModeChannel& lm)
+{
+    ListModeBatch* batch;
+    while( (batch = lm.ring.beginPush()) == NULL )
+    {
+        ++lm.ring_read_stalls;
+        lm.ring_space_event.wait(0.1);
+    }
+    return batch;
+}
+
+/// pass the slot from waitForRingSlot() to the histogram thread
+static void pushRingSlot(ListModeChannel& lm)
+{
+    lm.ring.endPush();
+    lm.ring_data_event.signal();
+    lm.ring_max_size = std::max(lm.ring_max_size, lm.ring.size());
+}
+
+// list mode events are read here without the driver lock, only the channel lock is held.
+// Decoded batches are passed to histTask() through the channel's event ring so file reads
+// and histogramming overlap, the pass ends when the ring has drained. At most MAX_PASS_BYTES
+// of a live file are processed per call so results are published regularly during a large
+// backlog, more_data is set if some remain  
+bool CAENMCADriver::processListFile(int channel_id, const ListModeSettings& settings, bool& more_data)
+{
+    static const int64_t MAX_PASS_BYTES = 64 * 1024 * 1024;
+    ListModeChannel& lm = m_list_mode[channel_id];
+    epicsGuard<epicsMutex> _lock(lm.lock);
+    std::string filename = settings.filename;
+    bool load_data_file = settings.load_data_file, reload_live_data = settings.reload_live_data;
+    const size_t EVENT_SIZE = ListModeDecoder::EVENT_SIZE;
+    struct stat stat_struct;
+    bool new_data = false;
+    more_data = false;
+    ListModePass& pass = lm.pass;
+    pass.nevents = pass.nframes = pass.nevents_cr = 0;
+    pass.max_event_time = 0;
+    lm.frame_length = 0;
+    lm.ring_max_size = 0;
+    std::string filename_ascii = filename;
+    for(int i=0; i<filename_ascii.size(); ++i) {
+        if (filename_ascii[i] == '/' || filename_ascii[i] == '\\' || filename_ascii[i] == '.') {
+            filename_ascii[i] = '_';
+        }            
+    }
+    filename_ascii = std::string("c:/Data/") + filename_ascii + ".txt";
+    FILE*& f = lm.f;
+    FILE*& f_ascii = lm.f_ascii;
+    if (!load_data_file && (!settings.enabled || settings.save_mode != CAEN_MCA_SAVEMODE_FILE_BINARY))
+    {
+        lm.live_filename.clear();
         if (f != NULL)
         {
             fclose(f);
@@ -2149,79 +2925,85 @@ bool CAENMCADriver::processListFile(int channel_id)
         }
         return new_data;
     }
-    int64_t frame = 0, last_pos, current_pos = 0, new_bytes, nevents;
-    m_energy_spec_event[channel_id].resize(MAX_ENERGY_BINS);
-    m_energy_spec2_event[channel_id].resize(MAX_ENERGY_BINS);
+    int64_t current_pos = 0, new_bytes, nevents, nread = 0;
+    ListModeDecoder load_decoder; // so loading a file does not disturb any partial record held for live data
+    ListModeDecoder& decoder = (load_data_file ? load_decoder : lm.decoder);
+    epicsTimeStamp decode_start, decode_end;
 	if (f != NULL)
 	{
 		current_pos = _ftelli64(f);
 	}
-    int nevents_real_ev = 0, ev_nbins = 0, nevents_real_es = 0, nevents_real_cr = 0;
-    int nevents_real_es2 = 0;
-    int ntimerollover = 0, ntimereset = 0, neventenergysat = 0;
-    int nfakeevent = 0, nimpdynamsatevent = 0, npileupevent = 0;
-    int neventenergyoutsca = 0, neventdursatinhibit = 0;
-    int nevent2dnotbinned = 0, neventnotbinned = 0, neventenergydiscard = 0, neventenergygt0 = 0;
-    double ev_tmin = 0.0, ev_tmax = 0.0;
     FILE* save_f = NULL;
-    int64_t save_event_file_last_pos = 0;
-    getDoubleParam(channel_id, P_eventsSpecTMin, &ev_tmin);
-    getDoubleParam(channel_id, P_eventsSpecTMax, &ev_tmax);
-    getIntegerParam(channel_id, P_eventsSpecNBins, &ev_nbins);
-    double ev_binw = 0.0;
-    if (ev_tmax > ev_tmin && ev_nbins > 0) {
-        ev_binw = (ev_tmax - ev_tmin) / ev_nbins;
+    int64_t save_event_file_last_pos = 0, load_end = -1;
+    pass.ev_tmin = settings.ev_tmin;
+    pass.ev_nbins = settings.ev_nbins;
+    pass.ev_binw = 0.0;
+    if (settings.ev_tmax > settings.ev_tmin && settings.ev_nbins > 0) {
+        pass.ev_binw = (settings.ev_tmax - settings.ev_tmin) / settings.ev_nbins;
     }
-    setDoubleParam(channel_id, P_eventsSpecTBinWidth, ev_binw);
-    m_event_spec_x[channel_id].resize(ev_nbins);
-    m_event_spec_y[channel_id].resize(ev_nbins);
-    int eventSpec_2d_nx = MAX_ENERGY_BINS / eventSpec_2d_engBinGroup;
-    int eventSpec_2d_ny = eventSpec_2d_nTBins;
-	m_event_spec_2d[channel_id].resize(eventSpec_2d_nx * eventSpec_2d_ny);
-    double ev2d_tbinw = 0.0;
-    if (eventSpec_2d_TMax > eventSpec_2d_TMin && eventSpec_2d_nTBins > 0) {
-        ev2d_tbinw = (eventSpec_2d_TMax - eventSpec_2d_TMin) / eventSpec_2d_nTBins;
+    pass.binner.ev_tbin.set(settings.ev_tmin, settings.ev_tmax, settings.ev_nbins);
+    m_event_spec_x[channel_id].resize(pass.ev_nbins);
+    m_event_spec_y[channel_id].resize(pass.ev_nbins);
+    pass.ev2d_ntbins = settings.ev2d_ntbins;
+    pass.binner.setEnergy(settings.energy_bins, settings.ev2d_eng_bin_group);
+	m_event_spec_2d[channel_id].resize(pass.binner.ev2d_nx, pass.ev2d_ntbins);
+    pass.binner.ev2d_tbin.set(settings.ev2d_tmin, settings.ev2d_tmax, settings.ev2d_ntbins);
+    lm.hists.configure(settings.hists);
+    pass.hist_threads = settings.hist_threads;
+    lm.store.setMaxMemory((size_t)(std::max(settings.store_max_mem, 0.0) * 1024.0 * 1024.0));
+    lm.base.configure(std::max(settings.base_tbinw, 1), (size_t)(std::max(settings.base_max_mem, 0.0) * 1024.0 * 1024.0));
+    // if the binning has changed the spectra are derived from the base histogram, failing that if the
+    // binning has changed, or live data is to be reloaded, and we hold a copy of all the events in the
+    // spectra then rebuild them from memory, failing that the list file is re-read
+    bool same_file = !load_data_file && f != NULL && filename == lm.old_list_filename && current_pos != -1 &&
+        current_pos == lm.event_file_last_pos;
+    bool binning_changed = !settings.sameBinning(lm.binning);
+    // the base histogram only holds energies below the old energy_bins
+    bool derived = same_file && !reload_live_data && binning_changed &&
+        settings.energy_bins == lm.binning.energy_bins && deriveListModeSpectra(channel_id, lm.binning);
+    bool rebuild = same_file && !derived && lm.store.complete() && lm.store.size() > 0 &&
+        ((reload_live_data && lm.store_live) || binning_changed);
+    if (binning_changed) {
+        ++lm.binning_changes;
     }
-    setDoubleParam(channel_id, P_eventSpec_2DTBinWidth, ev2d_tbinw);
-    if (f == NULL || load_data_file || reload_live_data || filename != m_old_list_filename[channel_id] ||
-        current_pos == -1 || current_pos != m_event_file_last_pos[channel_id])
+    lm.binning = settings;
+    if (derived)
+    {
+        new_data = true;
+    }
+    else if (rebuild)
+    {
+        new_data = true;
+        clearListModeSpectra(channel_id);
+        std::cerr << "Rebuilding spectra from " << lm.store.size() << " stored events" << std::endl;
+    }
+    else if (f == NULL || load_data_file || reload_live_data || binning_changed || filename != lm.old_list_filename ||
+        current_pos == -1 || current_pos != lm.event_file_last_pos)
     {
         new_data = true;
-        setIntegerParam(channel_id, P_nEventsProcessed, 0);
-        setIntegerParam(channel_id, P_energySpecEventNEvents, 0);
-        setIntegerParam(channel_id, P_energySpec2EventNEvents, 0);
-        setIntegerParam(channel_id, P_eventsSpecNEvents, 0);
-        setIntegerParam(channel_id, P_eventsSpecNTriggers, 0);
-        setIntegerParam(channel_id, P_eventsSpecNTimeTagRollover, 0);
-        setIntegerParam(channel_id, P_eventsSpecNTimeTagReset, 0);
-        setIntegerParam(channel_id, P_eventsSpecNEventEnergySat, 0);
-        setIntegerParam(channel_id, P_nFakeEvents, 0);
-        setIntegerParam(channel_id, P_nPileupEvent, 0);
-        setIntegerParam(channel_id, P_nEventEnergyOutSCA, 0);
-        setIntegerParam(channel_id, P_nEventDurSatInhibit, 0);
-        setIntegerParam(channel_id, P_nImpDynamSatEvent, 0);
-        setIntegerParam(channel_id, P_nEventEnergyDiscard, 0);
-        setIntegerParam(channel_id, P_nEventNotBinned, 0);
-        setIntegerParam(channel_id, P_nEventEnergyGt0, 0);
-        std::fill(m_event_spec_y[channel_id].begin(), m_event_spec_y[channel_id].end(), 0.0);
-        std::fill(m_energy_spec_event[channel_id].begin(), m_energy_spec_event[channel_id].end(), 0);
-        std::fill(m_energy_spec2_event[channel_id].begin(), m_energy_spec2_event[channel_id].end(), 0);
-        std::fill(m_event_spec_2d[channel_id].begin(), m_event_spec_2d[channel_id].end(), 0);
+        clearListModeSpectra(channel_id);
+        lm.store.clear();
+        lm.store_live = !load_data_file;
 
         std::string p_filename;
         if (load_data_file) {
-            getStringParam(channel_id, P_loadDataFileName, filename);
+            filename = settings.load_filename;
             p_filename = filename;
             std::cerr << "Loading data file \"" << p_filename << "\" ..." << std::endl;
             save_f = f;
-            save_event_file_last_pos = m_event_file_last_pos[channel_id];
+            save_event_file_last_pos = lm.event_file_last_pos;
         } else {
             p_filename = m_share_path + "\\" + filename;
         }
+#ifdef _WIN32
         std::replace(p_filename.begin(), p_filename.end(), '/', '\\'); 
+#else
+        std::replace(p_filename.begin(), p_filename.end(), '\\', '/');
+#endif /* _WIN32 */
         
         if (!load_data_file)
         {
+            lm.live_filename = p_filename;
             if (f != NULL) {
                 fclose(f);
                 f = NULL;
@@ -2242,14 +3024,47 @@ bool CAENMCADriver::processListFile(int channel_id)
         }
         if ( (f = _fsopen(p_filename.c_str(), "rbS", _SH_DENYNO)) == NULL )
         {
+            if (load_data_file) {
+                f = save_f;
+            }
             return new_data;
         }
         if (!load_data_file) {
-            m_old_list_filename[channel_id] = filename;
+            lm.old_list_filename = filename;
+            lm.index.clear();
+            lm.index.setStride(settings.index_stride);
+            lm.index_filename = p_filename;
+            lm.index_save_error = false;
         }
-        m_max_event_time[channel_id] = 0;
-        m_event_file_last_pos[channel_id] = 0;
+        lm.max_event_time = 0;
+        lm.event_file_last_pos = 0;
+        decoder.reset(0);
         current_pos = 0;
+        if (load_data_file && (settings.load_first_frame > 0 || settings.load_nframes > 0))
+        {
+            // seek to the requested frames using the live index or a sidecar file, or
+            // failing those an index built now, rather than processing the file from its start
+            FrameIndex load_index;
+            if (p_filename == lm.index_filename) {
+                load_index = lm.index;
+            } else {
+                load_index.load(FrameIndex::sidecarName(p_filename));
+            }
+            int64_t start = load_index.locateFrame(f, settings.load_first_frame);
+            if (start < 0) {
+                std::cerr << "Frame " << settings.load_first_frame << " not found in \"" << p_filename << "\"" << std::endl;
+                fclose(f);
+                f = save_f;
+                lm.event_file_last_pos = save_event_file_last_pos;
+                return new_data;
+            }
+            if (settings.load_nframes > 0) {
+                load_end = load_index.locateFrame(f, (int64_t)settings.load_first_frame + settings.load_nframes);
+            }
+            std::cerr << "Loading from frame " << settings.load_first_frame << " at byte offset " << start << std::endl;
+            lm.event_file_last_pos = start;
+            decoder.reset(start);
+        }
     }
     if (_fseeki64(f, 0, SEEK_END) != 0)
     {
@@ -2261,204 +3076,540 @@ bool CAENMCADriver::processListFile(int channel_id)
         std::cerr << "ftell curr error" << std::endl;
         return new_data;
     }
-    if (_fseeki64(f, m_event_file_last_pos[channel_id], SEEK_SET) != 0)
+    if (load_end >= 0 && load_end < current_pos)
+    {
+        current_pos = load_end;
+    }
+    if (_fseeki64(f, lm.event_file_last_pos, SEEK_SET) != 0)
     {
         std::cerr << "fseek back error" << std::endl;
         return new_data;
     }   
-    setDoubleParam(channel_id, 	P_listFileSize, (double)current_pos / (1024.0 * 1024.0)); // convert to MBytes
-    new_bytes = current_pos - m_event_file_last_pos[channel_id];
+    lm.file_size = current_pos;
+    new_bytes = current_pos - lm.event_file_last_pos;
 	if (new_bytes < 0)
 	{
 		fclose(f);
 		f = NULL;
 		return new_data;
 	}
-    nevents = new_bytes / EVENT_SIZE;
-    if (nevents == 0)
+    if (!load_data_file && new_bytes > MAX_PASS_BYTES)
+    {
+        new_bytes = MAX_PASS_BYTES;
+        more_data = true;
+    }
+    nevents = (new_bytes + decoder.pending()) / EVENT_SIZE;
+    if (nevents == 0 && !rebuild && !derived)
     {
-// cannot do this as buffer may still be filling up onhexagon and we get 0
-//        setDoubleParam(channel_id, P_eventSpecRate, 0.0);
-//        setDoubleParam(channel_id, P_eventsSpecTriggerRate, 0.0);
+        lm.decode_rate = 0.0;
         return new_data;
     }
     new_data = true;
-    setIntegerParam(channel_id, P_loadDataStatus, 1);
-    callParamCallbacks(channel_id);
-    for(int i=0; i<ev_nbins; ++i)
+    for(int i=0; i<pass.ev_nbins; ++i)
     {
-        m_event_spec_x[channel_id][i] = ev_tmin + i * ev_binw;
+        m_event_spec_x[channel_id][i] = pass.ev_tmin + i * pass.ev_binw;
     }
-    double es_tmin = 0.0, es_tmax = 0.0, es_tmin2 = 0.0, es_tmax2 = 0.0;
-    getDoubleParam(channel_id, P_energySpecEventTMin, &es_tmin);
-    getDoubleParam(channel_id, P_energySpecEventTMax, &es_tmax);
-    getDoubleParam(channel_id, P_energySpec2EventTMin, &es_tmin2);
-    getDoubleParam(channel_id, P_energySpec2EventTMax, &es_tmax2);
-    bool force_trigger, fake_trigger = false;
-    for(int i=0; i<nevents; ++i)
+    nevents = 0;
+    epicsTimeGetCurrent(&decode_start);
+    pass.nevents_cr_start = lm.hists.nevents(ListModeChannel::HIST_RATE);
+    lm.indexing = !load_data_file;
+    lm.reading = true;
+    for(size_t i=0; rebuild && i<lm.store.numChunks(); ++i)
     {
-        if (fread(&trigger_time, sizeof(trigger_time), 1, f) != 1)
+        ListModeBatch* batch = waitForRingSlot(lm);
+        if (!lm.store.readChunk(i, *batch))
         {
-            std::cerr << "fread time error" << std::endl;
-            return new_data;
+            std::cerr << "event store read error, list file will be reprocessed" << std::endl;
+            lm.old_list_filename.clear();
+            break;
         }
-        if (fread(&energy, sizeof(energy), 1, f) != 1)
+        nevents += batch->size();
+        pushRingSlot(lm);
+    }
+    while(new_bytes > 0)
+    {
+        ListModeBatch* batch = waitForRingSlot(lm);
+        if ( (nread = decoder.read(f, new_bytes, *batch)) <= 0 )
         {
-            std::cerr << "fread energy error" << std::endl;
-            return new_data;
+            break;
         }
-        if (fread(&extras, sizeof(extras), 1, f) != 1)
-        {
-            std::cerr << "fread extras error" << std::endl;
-            return new_data;
+        new_bytes -= nread;
+        nevents += batch->size();
+        lm.store.append(*batch);
+        pushRingSlot(lm);
+    }
+    lm.reading = false;
+    lm.ring_data_event.signal();
+    while(!lm.ring.empty())
+    {
+        lm.ring_space_event.wait(0.1);
+    }
+    reduceHistPartials(channel_id);
+    if (nread < 0)
+    {
+        std::cerr << "fread error" << std::endl;
+        return new_data;
+    }
+    epicsTimeGetCurrent(&decode_end);
+    double decode_time = epicsTimeDiffInSeconds(&decode_end, &decode_start);
+    lm.decode_rate = (decode_time > 0.0 ? nevents / decode_time : 0.0);
+    // checking if max_event_time > lm.max_event_time may not always be sensible
+    lm.max_event_time = pass.max_event_time;
+    lm.event_file_last_pos = _ftelli64(f);
+    if (!load_data_file) {
+        lm.index.setScanned(lm.event_file_last_pos - (int64_t)decoder.pending());
+        if (settings.index_sidecar && !lm.index_save_error && !lm.index.save(FrameIndex::sidecarName(lm.index_filename))) {
+            std::cerr << "Unable to write frame index \"" << FrameIndex::sidecarName(lm.index_filename) << "\"" << std::endl;
+            lm.index_save_error = true;
         }
-        if (f_ascii != NULL) {
-            fprintf(f_ascii, "%llu\t%d\t0x%08x\t\n", trigger_time, energy, extras);
+    }
+    lm.counters.nevents += nevents;
+    lm.counters.nframes += pass.nframes;
+    pass.nevents_cr = lm.hists.nevents(ListModeChannel::HIST_RATE) - pass.nevents_cr_start;
+    pass.nevents = nevents;
+    if (load_data_file) {
+        std::cerr << "Data file loaded" << std::endl;
+        fclose(f);
+        lm.event_file_last_pos = save_event_file_last_pos;
+        f = save_f;
+    }
+    if (reload_live_data) {
+        std::cerr << "ReLoading live data complete" << std::endl;
+    }        
+    if (f_ascii != NULL) {
+        fflush(f_ascii);
+    }
+    return new_data;
+}
+
+/// add a batch of events to the list mode spectra using the binning in m_list_mode[channel_id].pass,
+/// called from histTask() while the channel's ingestion thread holds the channel lock. Frame starts
+/// are found in a serial pass, the binning of large batches is then split across the channel's
+/// histogram workers which fill private partial spectra that are summed by reduceHistPartials()
+void CAENMCADriver::histogramBatch(int channel_id, const ListModeBatch& batch)
+{
+    static const size_t PARALLEL_MIN_EVENTS = 16384;
+    ListModeChannel& lm = m_list_mode[channel_id];
+    ListModePass& pass = lm.pass;
+    uint64_t trigger_time;
+    int16_t energy;
+    uint32_t extras;
+    bool force_trigger, fake_trigger = false;
+    size_t n = batch.size();
+    lm.tdiff.resize(n);
+    for(size_t i=0; i<n; ++i)
+    {
+        trigger_time = batch.trigger_time[i];
+        energy = batch.energy[i];
+        extras = batch.extras[i];
+        if (lm.f_ascii != NULL) {
+            fprintf(lm.f_ascii, "%llu\t%d\t0x%08x\t\n", trigger_time, energy, extras);
         }
         trigger_time /= 1000;  // convert from ps to ns
         force_trigger = false;
-        if (fake_trigger && ((trigger_time - m_frame_time[channel_id]) > 20000000))
+        if (fake_trigger && ((trigger_time - lm.frame_time) > 20000000))
         {
             force_trigger = true;
         }
-        if (force_trigger || (extras == 0x8 && energy == 0))
+        if (force_trigger || ListModeEvent::isFrameStart(energy, extras))
         {
-            ++frame;
-            if (trigger_time > m_frame_time[channel_id]) {
-                frame_length = trigger_time - m_frame_time[channel_id];
+            if (lm.indexing && !force_trigger && batch.file_offset >= 0)
+            {
+                lm.index.addFrame(batch.file_offset + i * ListModeDecoder::EVENT_SIZE, batch.trigger_time[i]);
+            }
+            ++pass.nframes;
+            if (trigger_time > lm.frame_time) {
+                lm.frame_length = trigger_time - lm.frame_time;
             }
-            m_frame_time[channel_id] = trigger_time;
+            lm.frame_time = trigger_time;
         }
-        if (extras & 0x2) {
-            ++ntimerollover;
+        uint64_t tdiff = trigger_time - lm.frame_time;
+        lm.tdiff[i] = tdiff;
+        if ( ListModeEvent::isDetector(energy, extras) && tdiff > pass.max_event_time )
+        {
+            pass.max_event_time = tdiff;
         }
-        if (extras & 0x4) {
-            ++ntimereset;
+        //std::cout << pass.nframes << ": " << trigger_time << "  " << tdiff << "  " << energy << "  (" << ListModeEvent::describeFlags(extras) << ")" << std::endl;
+    }
+    int nworkers = std::min<int>(pass.hist_threads, lm.workers.size());
+    if (nworkers <= 1 || n < PARALLEL_MIN_EVENTS)
+    {
+        binEvents(pass.binner, batch, lm.tdiff.data(), 0, n, m_event_spec_y[channel_id].data(), m_event_spec_2d[channel_id], lm.hists, lm.base, lm.counters);
+        return;
+    }
+    if (!lm.partials_used)
+    {
+        // the partial base histograms share what is left of the channel's base histogram memory limit,
+        // one going over it makes the channel's incomplete when they are merged by reduceHistPartials()
+        size_t base_used = lm.base.memoryUsed(), base_max = lm.base.maxMemory();
+        size_t base_share = (lm.base.complete() && base_max > base_used ? (base_max - base_used) / lm.workers.size() : 0);
+        for(int i=0; i<lm.workers.size(); ++i)
+        {
+            ListModePartial& p = lm.workers[i]->partial;
+            p.event_spec_y.assign(m_event_spec_y[channel_id].size(), 0.0);
+            p.event_spec_2d.resize(m_event_spec_2d[channel_id].nx(), m_event_spec_2d[channel_id].ny());
+            p.event_spec_2d.clear();
+            p.hists.configure(lm.hists.definitions());
+            p.hists.clear();
+            p.base.configure(lm.base.timeBinWidth(), base_share);
+            p.base.clear();
+            p.counters.reset();
         }
-        if (extras & 0x8) {
-            ++nfakeevent;
+        lm.partials_used = true;
+    }
+    lm.workers_busy = nworkers;
+    for(int i=0; i<nworkers; ++i)
+    {
+        ListModeWorker* w = lm.workers[i];
+        w->batch = &batch;
+        w->begin = i * n / nworkers;
+        w->end = (i + 1) * n / nworkers;
+        w->start_event.signal();
+    }
+    while(lm.workers_busy > 0)
+    {
+        lm.workers_done_event.wait(1.0);
+    }
+}
+
+/// add the histogram workers' partial spectra to the channel's spectra and zero them, called
+/// by processListFile() at the end of a pass once the event ring has drained. The sums are of
+/// integer counts so are exact and the result is identical to binning on a single thread
+void CAENMCADriver::reduceHistPartials(int channel_id)
+{
+    ListModeChannel& lm = m_list_mode[channel_id];
+    if (!lm.partials_used)
+    {
+        return;
+    }
+    std::vector<double>& event_spec_y = m_event_spec_y[channel_id];
+    for(int i=0; i<lm.workers.size(); ++i)
+    {
+        ListModePartial& p = lm.workers[i]->partial;
+        for(size_t j=0; j<event_spec_y.size() && j<p.event_spec_y.size(); ++j)
+        {
+            event_spec_y[j] += p.event_spec_y[j];
+        }
+        m_event_spec_2d[channel_id].merge(p.event_spec_2d);
+        lm.hists.merge(p.hists);
+        lm.base.merge(p.base);
+        lm.counters.add(p.counters);
+        std::fill(p.event_spec_y.begin(), p.event_spec_y.end(), 0.0);
+        p.event_spec_2d.clear();
+        p.hists.clear();
+        p.counters.reset();
+    }
+    lm.partials_used = false;
+}
+
+/// histogram worker thread, bins its share of a batch when started by histogramBatch()
+void CAENMCADriver::histWorkerTask(ListModeWorker* w)
+{
+    ListModeChannel& lm = *(w->lm);
+	while(true)
+	{
+        w->start_event.wait();
+        try {
+            ListModePartial& p = w->partial;
+            binEvents(lm.pass.binner, *(w->batch), lm.tdiff.data(), w->begin, w->end, p.event_spec_y.data(), p.event_spec_2d, p.hists, p.base, p.counters);
         }
-        if (extras & 0x80) {
-            ++neventenergysat;
+        catch(const std::exception& ex) {
+            std::cerr << "exception in histWorkerTask: channel " << lm.channel_id << ": " << ex.what() << std::endl;
+        }
+        if (--lm.workers_busy == 0)
+        {
+            lm.workers_done_event.signal();
+        }
+	}
+}
+
+/// list mode histogram thread for a channel, consumes batches pushed onto the event ring by processListFile()
+void CAENMCADriver::histTask(int channel_id)
+{
+    ListModeChannel& lm = m_list_mode[channel_id];
+    ListModeBatch* batch;
+	while(true)
+	{
+        if ( (batch = lm.ring.front()) == NULL )
+        {
+            if (lm.reading) {
+                ++lm.ring_hist_stalls;
+            }
+            lm.ring_data_event.wait(1.0);
+            continue;
         }
-        if (extras & 0x400) {
-            ++nimpdynamsatevent;
+        try {
+            histogramBatch(channel_id, *batch);
         }
-        if (extras & 0x8000) {
-            ++npileupevent;
+        catch(const std::exception& ex) {
+            std::cerr << "exception in histTask: channel " << channel_id << ": " << ex.what() << std::endl;
         }
-        if (extras & 0x20000) {
-            ++neventenergyoutsca;
+        lm.ring.pop();
+        lm.ring_space_event.signal();
+	}
+}
+
+/// bring the down binned levels of the event derived spectra up to date after an ingestion pass,
+/// called by ingestTask() without the driver lock. The 1D levels are small so are recomputed
+/// whenever the spectra change, the 2D levels only where the map has changed and only while the
+/// channel's overview image is acquiring
+void CAENMCADriver::updatePyramids(int channel_id, const ListModeSettings& settings, bool new_data)
+{
+    ListModeChannel& lm = m_list_mode[channel_id];
+    epicsGuard<epicsMutex> _lock(lm.lock);
+    if (new_data) {
+        lm.event_spec_pyr.update(m_event_spec_y[channel_id].data(), m_event_spec_y[channel_id].size());
+        for(int i=0; i<2; ++i) {
+            int j = ListModeChannel::HIST_ENERGY_A + i;
+            if (j < lm.hists.size()) {
+                lm.energy_spec_event_pyr[i].update(lm.hists.counts(j).data(), lm.hists.counts(j).size());
+            }
         }
-        if (extras & 0x40000) {
-            ++neventdursatinhibit;
+    }
+    if (!settings.ev2d_overview) {
+        lm.event_spec_2d_pyr.release();
+        m_event_spec_2d[channel_id].clearDirty();
+    }
+    else if (new_data || !lm.event_spec_2d_pyr.valid()) {
+        lm.event_spec_2d_pyr.update(m_event_spec_2d[channel_id]);
+        lm.overview_image_pending = true;
+    }
+}
+
+/// set asyn parameters and do array callbacks for the results of the last ingestion pass, called with the driver lock held
+void CAENMCADriver::publishListModeResults(int channel_id, bool new_data)
+{
+    ListModeChannel& lm = m_list_mode[channel_id];
+    bool overview_image = false;
+    {
+        epicsGuard<epicsMutex> _lock(lm.lock);
+        const ListModeCounters& counters = lm.counters;
+        setIntegerParam(channel_id, P_nEventsProcessed, counters.nevents);
+        setIntegerParam(channel_id, P_eventsSpecNEvents, counters.nevents_real_ev);
+        setIntegerParam(channel_id, P_energySpecEventNEvents, lm.hists.nevents(ListModeChannel::HIST_ENERGY_A));
+        setIntegerParam(channel_id, P_energySpec2EventNEvents, lm.hists.nevents(ListModeChannel::HIST_ENERGY_B));
+        setIntegerParam(channel_id, P_eventsSpecNTriggers, counters.nframes);
+        setIntegerParam(channel_id, P_eventsSpecNTimeTagRollover, counters.ntimerollover);
+        setIntegerParam(channel_id, P_eventsSpecNTimeTagReset, counters.ntimereset);
+        setIntegerParam(channel_id, P_eventsSpecNEventEnergySat, counters.neventenergysat);
+        setIntegerParam(channel_id, P_nFakeEvents, counters.nfakeevent);
+        setIntegerParam(channel_id, P_nPileupEvent, counters.npileupevent);
+        setIntegerParam(channel_id, P_nEventEnergyOutSCA, counters.neventenergyoutsca);
+        setIntegerParam(channel_id, P_nEventDurSatInhibit, counters.neventdursatinhibit);
+        setIntegerParam(channel_id, P_nImpDynamSatEvent, counters.nimpdynamsatevent);
+        setIntegerParam(channel_id, P_nEventEnergyDiscard, counters.neventenergydiscard);
+        setIntegerParam(channel_id, P_nEventEnergyGt0, counters.neventenergygt0);
+        setIntegerParam(channel_id, P_nEventNotBinned, counters.neventnotbinned);
+        setIntegerParam(channel_id, P_loadDataStatus, 2);
+        setDoubleParam(channel_id, P_listFileSize, (double)lm.file_size / (1024.0 * 1024.0)); // convert to MBytes
+        setDoubleParam(channel_id, P_eventsDecodeRate, lm.decode_rate);
+        setDoubleParam(channel_id, P_eventRingMaxOcc, 100.0 * lm.ring_max_size / lm.ring.capacity());
+        setIntegerParam(channel_id, P_eventRingReadStalls, lm.ring_read_stalls);
+        setIntegerParam(channel_id, P_eventRingHistStalls, lm.ring_hist_stalls);
+        setDoubleParam(channel_id, P_eventStoreMem, (double)lm.store.memoryUsed() / (1024.0 * 1024.0));
+        setDoubleParam(channel_id, P_eventStoreSpill, (double)lm.store.spillUsed() / (1024.0 * 1024.0));
+        setDoubleParam(channel_id, P_eventStoreNEvents, (double)lm.store.size());
+        setIntegerParam(channel_id, P_eventStoreSpillError, (lm.store.spillError() ? 1 : 0));
+        size_t base_mem = lm.base.memoryUsed();
+        for(int i=0; i<lm.workers.size(); ++i) {
+            base_mem += lm.workers[i]->partial.base.memoryUsed();
         }
-        if ( energy > 0 && (!(extras & 0x8)) )
-        {
-            uint64_t tdiff = trigger_time - m_frame_time[channel_id];
-            if (tdiff > max_event_time) {
-                max_event_time = tdiff;
+        setDoubleParam(channel_id, P_baseMem, (double)base_mem / (1024.0 * 1024.0));
+        setDoubleParam(channel_id, P_eventSpec_2DMem, (double)(m_event_spec_2d[channel_id].memoryUsed() + lm.event_spec_2d_pyr.memoryUsed()) / (1024.0 * 1024.0));
+        setIntegerParam(channel_id, P_frameIndexNFrames, (int)lm.index.numFrames());
+        // only update rates if we saw events, buffer may still be filling up on hexagon
+        if (lm.pass.nevents > 0) {
+            if (lm.pass.nframes > 0) {
+                setDoubleParam(channel_id, P_eventSpecRate, (double)lm.pass.nevents_cr / (double)lm.pass.nframes);
+            } else {
+                setDoubleParam(channel_id, P_eventSpecRate, 0.0);
             }
-            ++neventenergygt0;
-            if (energy != 32767) {
-                int n = (ev_binw != 0.0) ? ((tdiff - ev_tmin) / ev_binw) : -1;
-                if (n >= 0 && n < ev_nbins)
-                {
-                    m_event_spec_y[channel_id][n] += 1.0;
-                    ++nevents_real_ev;
-                }
-                else
-                {
-                    ++neventnotbinned;
-                }
-                n = (ev2d_tbinw != 0.0) ? ((tdiff - eventSpec_2d_TMin) / ev2d_tbinw) : -1;
-                if (n >= 0 && n < eventSpec_2d_nTBins)
-                {
-					m_event_spec_2d[channel_id][n * eventSpec_2d_nx + energy / eventSpec_2d_engBinGroup] += 1;
-                }
-                else
-                {
-                    ++nevent2dnotbinned;
-                }
-                if ((es_tmin >= es_tmax) || (tdiff >= es_tmin && tdiff <= es_tmax))
-                {
-                    ++nevents_real_es;
-                    ++(m_energy_spec_event[channel_id][energy]);
-                }
-                if ((es_tmin2 >= es_tmax2) || (tdiff >= es_tmin2 && tdiff <= es_tmax2))
-                {
-                    ++nevents_real_es2;
-                    ++(m_energy_spec2_event[channel_id][energy]);
-                }
-                if ((eventSpecRateTMin >= eventSpecRateTMax) ||
-                    (tdiff >= eventSpecRateTMin && tdiff <= eventSpecRateTMax))
-                {
-                    ++nevents_real_cr;
-                }
+            if (lm.frame_length > 0) {
+                setDoubleParam(channel_id, P_eventsSpecTriggerRate, 1.0e9 / (double)lm.frame_length); // frame length units is nano seconds
             } else {
-                ++neventenergydiscard;
+                setDoubleParam(channel_id, P_eventsSpecTriggerRate, 0.0);
             }
+            setDoubleParam(channel_id, P_eventsSpecMaxEventTime, lm.max_event_time);
         }
-        //std::cout << frame << ": " << trigger_time << "  " << trigger_time - m_frame_time[channel_id] << "  " << energy << "  (" << describeFlags(extras) << ")" << std::endl;
-    }
-    // checking if max_event_time > m_max_event_time[channel_id] may not always be sensible
-    m_max_event_time[channel_id] = max_event_time;
-    m_event_file_last_pos[channel_id] = _ftelli64(f);
-    incrIntParam(channel_id, P_nEventsProcessed, nevents);
-    incrIntParam(channel_id, P_eventsSpecNEvents, nevents_real_ev);
-    incrIntParam(channel_id, P_energySpecEventNEvents, nevents_real_es);
-    incrIntParam(channel_id, P_energySpec2EventNEvents, nevents_real_es2);
-    incrIntParam(channel_id, P_eventsSpecNTriggers, frame);
-    incrIntParam(channel_id, P_eventsSpecNTimeTagRollover, ntimerollover);
-    incrIntParam(channel_id, P_eventsSpecNTimeTagReset, ntimereset);
-    incrIntParam(channel_id, P_eventsSpecNEventEnergySat, neventenergysat);
-    incrIntParam(channel_id, P_nFakeEvents, nfakeevent);
-    incrIntParam(channel_id, P_nPileupEvent, npileupevent);
-    incrIntParam(channel_id, P_nEventEnergyOutSCA, neventenergyoutsca);
-    incrIntParam(channel_id, P_nEventDurSatInhibit, neventdursatinhibit);
-    incrIntParam(channel_id, P_nImpDynamSatEvent, nimpdynamsatevent);
-    incrIntParam(channel_id, P_nEventEnergyDiscard, neventenergydiscard);
-    incrIntParam(channel_id, P_nEventEnergyGt0, neventenergygt0);
-    incrIntParam(channel_id, P_nEventNotBinned, neventnotbinned);
-    if (frame > 0) {
-        setDoubleParam(channel_id, P_eventSpecRate, (double)nevents_real_cr / (double)frame);
-    } else {
-        setDoubleParam(channel_id, P_eventSpecRate, 0.0);
+        overview_image = lm.overview_image_pending;
+        lm.overview_image_pending = false;
     }
-    if (frame_length > 0) {
-        setDoubleParam(channel_id, P_eventsSpecTriggerRate, 1.0e9 / (double)frame_length); // frame length units is nano seconds
-    } else {
-        setDoubleParam(channel_id, P_eventsSpecTriggerRate, 0.0);
-    }
-    setDoubleParam(channel_id, P_eventsSpecMaxEventTime, m_max_event_time[channel_id]);
-    if (load_data_file) {
-        std::cerr << "Data file loaded" << std::endl;
-//        setADAcquire(channel_id, 0);
-        m_event_file_last_pos[channel_id] = save_event_file_last_pos;
-        f = save_f;
+    callParamCallbacks(channel_id);
+    updateAD(channel_id, new_data);
+    updateAD(channel_id + OVERVIEW_ADDR, overview_image);
+    {
+        epicsGuard<epicsMutex> _lock(lm.lock);
+        // arrays are only sent to clients when a pass has changed them, and then at most once per
+        // their minimum publish period, a change held back is sent by a later pass
+        ArrayPublishState* pub = m_pub[channel_id];
+        if (new_data || lm.binning_changes != m_pub_binning_changes[channel_id]) {
+            m_pub_binning_changes[channel_id] = lm.binning_changes;
+            for(int i=0; i<NUM_PUB_ARRAYS; ++i) {
+                if (i != PUB_ENERGY_SPEC) {
+                    pub[i].touch();
+                }
+            }
+        }
+        int ov_level = 0;
+        getIntegerParam(channel_id, P_specOverviewLevel, &ov_level);
+        ov_level = std::max(1, std::min(ov_level, (int)HistPyramid1D<double>::NLEVELS));
+        if (ov_level != lm.spec_ov_level) {
+            lm.spec_ov_level = ov_level;
+            pub[PUB_SPEC_OVERVIEW].touch();
+        }
+        epicsTime now(epicsTime::getCurrent());
+        double min_period = 0.0;
+        std::vector<double> x;
+        getDoubleParam(channel_id, P_eventsSpecPubPeriod, &min_period);
+        if (pub[PUB_EVENTS_SPEC].due(now, min_period)) {
+	        doCallbacksFloat64Array(m_event_spec_x[channel_id].data(), m_event_spec_x[channel_id].size(), P_eventsSpecX, channel_id);
+	        doCallbacksFloat64Array(m_event_spec_y[channel_id].data(), m_event_spec_y[channel_id].size(), P_eventsSpecY, channel_id);
+            pub[PUB_EVENTS_SPEC].done(now);
+        }
+        getDoubleParam(channel_id, P_energySpecEventPubPeriod, &min_period);
+        if (pub[PUB_ENERGY_SPEC_EVENT].due(now, min_period)) {
+            const std::vector<epicsInt32>& energy_spec_event = lm.hists.counts(ListModeChannel::HIST_ENERGY_A);
+	        doCallbacksInt32Array(const_cast<epicsInt32*>(energy_spec_event.data()), energy_spec_event.size(), P_energySpecEvent, channel_id);
+            pub[PUB_ENERGY_SPEC_EVENT].done(now);
+        }
+        getDoubleParam(channel_id, P_energySpec2EventPubPeriod, &min_period);
+        if (pub[PUB_ENERGY_SPEC2_EVENT].due(now, min_period)) {
+            const std::vector<epicsInt32>& energy_spec2_event = lm.hists.counts(ListModeChannel::HIST_ENERGY_B);
+	        doCallbacksInt32Array(const_cast<epicsInt32*>(energy_spec2_event.data()), energy_spec2_event.size(), P_energySpec2Event, channel_id);
+            pub[PUB_ENERGY_SPEC2_EVENT].done(now);
+        }
+        // the overview spectra have a bin for each 2^ov_level bins of the event derived spectra,
+        // they are limited to the event spectrum publish period
+        getDoubleParam(channel_id, P_eventsSpecPubPeriod, &min_period);
+        if (pub[PUB_SPEC_OVERVIEW].due(now, min_period)) {
+            const std::vector<double>& y = lm.event_spec_pyr.level(ov_level);
+            const std::vector<double>& x_full = m_event_spec_x[channel_id];
+            x.resize(y.size());
+            for(size_t i=0; i<x.size(); ++i) {
+                x[i] = ((i << ov_level) < x_full.size() ? x_full[i << ov_level] : 0.0);
+            }
+	        doCallbacksFloat64Array(x.data(), x.size(), P_eventsSpecOvX, channel_id);
+	        doCallbacksFloat64Array(const_cast<epicsFloat64*>(y.data()), y.size(), P_eventsSpecOvY, channel_id);
+            const std::vector<epicsInt32>& e1 = lm.energy_spec_event_pyr[0].level(ov_level);
+            const std::vector<epicsInt32>& e2 = lm.energy_spec_event_pyr[1].level(ov_level);
+	        doCallbacksInt32Array(const_cast<epicsInt32*>(e1.data()), e1.size(), P_energySpecEventOv, channel_id);
+	        doCallbacksInt32Array(const_cast<epicsInt32*>(e2.data()), e2.size(), P_energySpec2EventOv, channel_id);
+            pub[PUB_SPEC_OVERVIEW].done(now);
+        }
+        for(int i=0; i<ListModeChannel::MAX_USER_HISTS; ++i) {
+            int j = ListModeChannel::HIST_USER + i;
+            const GatedHistParams& hp = P_gatedHist[i];
+            if (j >= lm.hists.size() || !lm.hists.definition(j).enabled) {
+                continue;
+            }
+            setIntegerParam(channel_id, hp.nevents, lm.hists.nevents(j));
+            getDoubleParam(channel_id, hp.pubPeriod, &min_period);
+            if (pub[PUB_GATED_HIST + i].due(now, min_period)) {
+                const std::vector<epicsInt32>& y = lm.hists.counts(j);
+                lm.hists.binEdges(j, x);
+	            doCallbacksFloat64Array(x.data(), x.size(), hp.x, channel_id);
+	            doCallbacksInt32Array(const_cast<epicsInt32*>(y.data()), y.size(), hp.y, channel_id);
+                pub[PUB_GATED_HIST + i].done(now);
+            }
+        }
     }
-    if (reload_live_data) {
-        std::cerr << "ReLoading live data complete" << std::endl;
-    }        
-    if (f_ascii != NULL) {
-        fflush(f_ascii);
+    setIntegerParam(channel_id, P_loadDataStatus, 0);
+    callParamCallbacks(channel_id);
+}
+
+/// list mode ingestion thread for a channel, runs independently of pollerTask() so a large
+/// backlog of events on one channel does not hold up device polling or the other channel.
+/// Between passes it sleeps until the list file changes, see #FileWatcher
+void CAENMCADriver::ingestTask(int channel_id)
+{
+    ListModeChannel& lm = m_list_mode[channel_id];
+    ListModeSettings settings;
+    bool new_data, more_data;
+	epicsThreadSleep(0.2); // to allow class constructror to complete
+	while(true)
+	{
+        more_data = false;
+        try {
+            {
+                epicsGuard<CAENMCADriver> _lock(*this);
+                readListModeSettings(channel_id, settings);
+            }
+            new_data = processListFile(channel_id, settings, more_data);
+            updatePyramids(channel_id, settings, new_data);
+            {
+                epicsGuard<CAENMCADriver> _lock(*this);
+                publishListModeResults(channel_id, new_data);
+            }
+        }
+        catch(const std::exception& ex) {
+            std::cerr << "exception in ingestTask: channel " << channel_id << ": " << ex.what() << std::endl;
+        }
+        if (!more_data) {
+            lm.watcher.watch(lm.live_filename);
+            lm.watcher.wait(lm.pass.nevents > 0);
+        }
+	}
+}
+
+/// start an ingestion pass on channel_id, or on every channel if that is not a channel, now rather
+/// than when its list file next changes
+void CAENMCADriver::wakeIngest(int channel_id)
+{
+    for(int i=0; i<2; ++i)
+    {
+        if (channel_id < 0 || channel_id >= 2 || channel_id == i)
+        {
+            m_list_mode[i].watcher.wake();
+        }
     }
-    // we do not reset P_loadDataStatus that is done by caller
-    return new_data;
 }
 
-void CAENMCADriver::incrIntParam(int channel_id, int param, int incr)
+/// function is one of the asyn parameters that define a user gated histogram, so a write to it changes the histogram binning
+bool CAENMCADriver::isGatedHistDefParam(int function) const
 {
-    int old_val = 0;
-    if (getIntegerParam(channel_id, param, &old_val) == asynSuccess) {
-        setIntegerParam(channel_id, param, old_val + incr);
+    for(int i=0; i<ListModeChannel::MAX_USER_HISTS; ++i)
+    {
+        const GatedHistParams& hp = P_gatedHist[i];
+        if (function == hp.enable || function == hp.tmin || function == hp.tmax || function == hp.emin ||
+            function == hp.emax || function == hp.flagMask || function == hp.flagValue || function == hp.axis ||
+            function == hp.xmin || function == hp.xmax || function == hp.nbins)
+        {
+            return true;
+        }
     }
+    return false;
 }
 
+/// note the results of a list mode pass for imageTask(), called with the driver lock held
 void CAENMCADriver::updateAD(int addr, bool new_data)
 {
-    static const char* functionName = "updateAD";
-	int acquiring;
+    ADImageChannel& ad = m_ad[addr];
+    int acquiring = 0;
+    getIntegerParam(addr, ADAcquire, &acquiring);
+    if (acquiring == 0)
+    {
+        ad.old_acquiring = false;
+    }
+    else if (!ad.old_acquiring)
+    {
+        setIntegerParam(addr, ADNumImagesCounter, 0);
+        ad.old_acquiring = true;
+    }
+    if (new_data)
+    {
+        ad.pending = true;
+        ad.wake_event.signal();
+    }
+}
+
+/// areaDetector image thread for an address, makes an image of the 2D spectrum and does the
+/// NDArray callbacks each time updateAD() signals new data, at most once per ADAcquirePeriod
+void CAENMCADriver::imageTask(int addr)
+{
+    static const char* functionName = "imageTask";
+    ADImageChannel& ad = m_ad[addr];
+    int channel_id = imageChannel(addr);
+    ListModeChannel& lm = m_list_mode[channel_id];
     int status = asynSuccess;
     int imageCounter;
     int numImages, numImagesCounter;
@@ -2468,31 +3619,22 @@ void CAENMCADriver::updateAD(int addr, bool new_data)
     double acquireTime, acquirePeriod, delay, updateTime;
     epicsTimeStamp startTime, endTime;
     double elapsedTime;
-    static std::vector<int> old_acquiring(maxAddr, 0);
-	static std::vector<epicsTimeStamp> last_update(maxAddr, {0,0});
-    int eventSpec_2d_nTBins = 0, eventSpec_2d_engBinGroup = 1;
-    getIntegerParam(addr, P_eventSpec_2DEnergyBinGroup, &eventSpec_2d_engBinGroup);
-    getIntegerParam(addr, P_eventSpec_2DNTimeBins, &eventSpec_2d_nTBins);
-    int eventSpec_2d_nx = MAX_ENERGY_BINS / eventSpec_2d_engBinGroup;
-    int eventSpec_2d_ny = eventSpec_2d_nTBins;
+    int nx, ny, ov_level;
+	epicsThreadSleep(0.2); // to allow class constructror to complete
+    lock();
+	while(true)
+	{
+        if (!ad.pending)
+        {
+            unlock();
+            ad.wake_event.wait();
+            lock();
+            continue;
+        }
+        ad.pending = false;
 			try 
 			{
-				acquiring = 0;
-				getIntegerParam(addr, ADAcquire, &acquiring);
 				getDoubleParam(addr, ADAcquirePeriod, &acquirePeriod);
-				
-				if (acquiring == 0)
-				{
-					old_acquiring[addr] = acquiring;
-				}
-				else if (old_acquiring[addr] == 0 && acquiring == 1)
-				{
-					setIntegerParam(addr, ADNumImagesCounter, 0);
-					old_acquiring[addr] = acquiring;
-				}
-			    if (!new_data) {
-                    return;
-                }
 				setIntegerParam(addr, ADStatus, ADStatusAcquire); 
 				epicsTimeGetCurrent(&startTime);
 				getIntegerParam(addr, ADImageMode, &imageMode);
@@ -2503,7 +3645,41 @@ void CAENMCADriver::updateAD(int addr, bool new_data)
 				setShutter(addr, ADShutterOpen);
 				callParamCallbacks(addr, addr);
 				
-				status = computeImage(addr, m_event_spec_2d[addr], eventSpec_2d_nx, eventSpec_2d_ny);
+                getIntegerParam(channel_id, P_eventSpec_2DOvLevel, &ov_level);
+                ov_level = std::max(1, std::min(ov_level, (int)HistPyramid2D::NLEVELS));
+                // the ingestion thread holds the channel lock for a whole pass, so the dense
+                // copy is taken without the driver lock to leave polling and writes free meanwhile.
+                // An overview address images a level of the pyramid kept by updatePyramids()
+                unlock();
+				try
+				{
+                    epicsGuard<epicsMutex> _lock(lm.lock);
+                    if (addr < OVERVIEW_ADDR) {
+                        m_event_spec_2d[addr].toDense(m_event_spec_2d_dense[addr]);
+                        nx = m_event_spec_2d[addr].nx();
+                        ny = m_event_spec_2d[addr].ny();
+                    } else if (lm.event_spec_2d_pyr.valid()) {
+                        m_event_spec_2d_dense[addr] = lm.event_spec_2d_pyr.level(ov_level);
+                        nx = lm.event_spec_2d_pyr.nx(ov_level);
+                        ny = lm.event_spec_2d_pyr.ny(ov_level);
+                    } else {
+                        nx = ny = 0;
+                    }
+                }
+                catch(...)
+                {
+                    lock();
+                    throw;
+                }
+                lock();
+                if (nx == 0 || ny == 0)
+                {
+                    setShutter(addr, ADShutterClosed);
+                    setIntegerParam(addr, ADStatus, ADStatusIdle);
+                    callParamCallbacks(addr, addr);
+                    continue;
+                }
+				status = computeImage(addr, m_event_spec_2d_dense[addr], nx, ny);
 
 	//            if (status) continue;
 
@@ -2519,7 +3695,7 @@ void CAENMCADriver::updateAD(int addr, bool new_data)
 				pImage = this->pArrays[addr];
 				if (pImage == NULL)
 				{
-					return;
+					continue;
 				}
 
 				/* Get the current parameters */
@@ -2552,15 +3728,15 @@ void CAENMCADriver::updateAD(int addr, bool new_data)
 				}
 				epicsTimeGetCurrent(&endTime);
 				elapsedTime = epicsTimeDiffInSeconds(&endTime, &startTime);
-				updateTime = epicsTimeDiffInSeconds(&endTime, &(last_update[addr]));
-				last_update[addr] = endTime;
+				updateTime = epicsTimeDiffInSeconds(&endTime, &(ad.last_update));
+				ad.last_update = endTime;
 				/* Call the callbacks to update any changes */
 				callParamCallbacks(addr, addr);
 				/* sleep for the acquire period minus elapsed time. */
 				delay = acquirePeriod - elapsedTime;
 				asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-						"%s:%s: delay=%f\n",
-						driverName, functionName, delay);
+						"%s:%s: addr %d delay=%f, %f since last image\n",
+						driverName, functionName, addr, delay, updateTime);
 				if (delay >= 0.0) {
 					/* We set the status to waiting to indicate we are in the period delay */
 					setIntegerParam(addr, ADStatus, ADStatusWaiting);
@@ -2576,12 +3752,13 @@ void CAENMCADriver::updateAD(int addr, bool new_data)
 			}
 			catch(const std::exception& ex)
 			{
-				std::cerr << "Exception in updateAD:" << ex.what() << std::endl;
+				std::cerr << "Exception in imageTask:" << ex.what() << std::endl;
 			}
 			catch(...)
 			{
-				std::cerr << "Exception in updateAD" << std::endl;
+				std::cerr << "Exception in imageTask" << std::endl;
 			}
+	}
 }
 
 /** Computes the new image data */
@@ -2718,82 +3895,105 @@ int CAENMCADriver::computeImage(int addr, const std::vector<epicsType>& data, in
             break;
     }
 
-// we could be more efficient
-//    if (resetImage) {
-    /* Free the previous raw buffer */
-        if (m_pRaw) m_pRaw->release();
-        /* Allocate the raw buffer we use to compute images. */
-        dims[xDim] = maxSizeX;
-        dims[yDim] = maxSizeY;
-        if (ndims > 2) dims[colorDim] = 3;
-        m_pRaw = this->pNDArrayPool->alloc(ndims, dims, dataType, 0, NULL);
-
-        if (!m_pRaw) {
+    // with no ROI, binning or reversal the image is written straight into a new output array
+    // in one pass. Otherwise the full size image is made in the raw buffer kept for the address,
+    // which is only reallocated when its shape or type changes, and convert() extracts the ROI
+    bool direct = (minX == 0 && minY == 0 && sizeX == maxSizeX && sizeY == maxSizeY &&
+                   binX == 1 && binY == 1 && reverseX == 0 && reverseY == 0);
+    dims[xDim] = maxSizeX;
+    dims[yDim] = maxSizeY;
+    if (ndims > 2) dims[colorDim] = 3;
+    NDArray*& pRaw = m_pRaw[addr];
+    if (direct) {
+        if (pRaw) {
+            pRaw->release();
+            pRaw = NULL;
+        }
+    }
+    else if (pRaw == NULL || pRaw->ndims != ndims || pRaw->dataType != dataType ||
+             pRaw->dims[xDim].size != dims[xDim] || pRaw->dims[yDim].size != dims[yDim] ||
+             (ndims > 2 && pRaw->dims[colorDim].size != dims[colorDim])) {
+        if (pRaw) pRaw->release();
+        pRaw = this->pNDArrayPool->alloc(ndims, dims, dataType, 0, NULL);
+        if (!pRaw) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s:%s: error allocating raw buffer\n",
                       driverName, functionName);
-            return(status);
+            return(asynError);
+        }
+    }
+
+    /* We save the most recent image buffer so it can be used in the read() function.
+     * Now release it before getting a new version. */	 
+    if (this->pArrays[addr]) {
+        this->pArrays[addr]->release();
+        this->pArrays[addr] = NULL;
+    }
+    NDArray* pTarget = pRaw;
+    if (direct) {
+        pTarget = this->pArrays[addr] = this->pNDArrayPool->alloc(ndims, dims, dataType, 0, NULL);
+        if (!pTarget) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s: error allocating image buffer\n",
+                      driverName, functionName);
+            return(asynError);
         }
-//    }
+    }
 
     switch (dataType) {
         case NDInt8:
-            status |= computeArray<epicsInt8>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsInt8>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDUInt8:
-            status |= computeArray<epicsUInt8>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsUInt8>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDInt16:
-            status |= computeArray<epicsInt16>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsInt16>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDUInt16:
-            status |= computeArray<epicsUInt16>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsUInt16>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDInt32:
-            status |= computeArray<epicsInt32>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsInt32>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDUInt32:
-            status |= computeArray<epicsUInt32>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsUInt32>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDInt64:
-            status |= computeArray<epicsInt64>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsInt64>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDUInt64:
-            status |= computeArray<epicsUInt64>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsUInt64>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDFloat32:
-            status |= computeArray<epicsFloat32>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsFloat32>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
         case NDFloat64:
-            status |= computeArray<epicsFloat64>(addr, data, maxSizeX, maxSizeY);
+            status |= computeArray<epicsFloat64>(addr, data, maxSizeX, maxSizeY, pTarget);
             break;
     }
 
-    /* Extract the region of interest with binning.
-     * If the entire image is being used (no ROI or binning) that's OK because
-     * convertImage detects that case and is very efficient */
-    m_pRaw->initDimension(&dimsOut[xDim], sizeX);
-    m_pRaw->initDimension(&dimsOut[yDim], sizeY);
-    if (ndims > 2) m_pRaw->initDimension(&dimsOut[colorDim], 3);
-    dimsOut[xDim].binning = binX;
-    dimsOut[xDim].offset  = minX;
-    dimsOut[xDim].reverse = reverseX;
-    dimsOut[yDim].binning = binY;
-    dimsOut[yDim].offset  = minY;
-    dimsOut[yDim].reverse = reverseY;
-
-    /* We save the most recent image buffer so it can be used in the read() function.
-     * Now release it before getting a new version. */	 
-    if (this->pArrays[addr]) this->pArrays[addr]->release();
-    status = this->pNDArrayPool->convert(m_pRaw,
-                                         &this->pArrays[addr],
-                                         dataType,
-                                         dimsOut);
-    if (status) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s:%s: error allocating buffer in convert()\n",
-                    driverName, functionName);
-        return(status);
+    if (!direct) {
+        /* Extract the region of interest with binning. */
+        pRaw->initDimension(&dimsOut[xDim], sizeX);
+        pRaw->initDimension(&dimsOut[yDim], sizeY);
+        if (ndims > 2) pRaw->initDimension(&dimsOut[colorDim], 3);
+        dimsOut[xDim].binning = binX;
+        dimsOut[xDim].offset  = minX;
+        dimsOut[xDim].reverse = reverseX;
+        dimsOut[yDim].binning = binY;
+        dimsOut[yDim].offset  = minY;
+        dimsOut[yDim].reverse = reverseY;
+        status = this->pNDArrayPool->convert(pRaw,
+                                             &this->pArrays[addr],
+                                             dataType,
+                                             dimsOut);
+        if (status) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                        "%s:%s: error allocating buffer in convert()\n",
+                        driverName, functionName);
+            return(status);
+        }
     }
     pImage = this->pArrays[addr];
     pImage->getInfo(&arrayInfo);
@@ -2807,95 +4007,60 @@ int CAENMCADriver::computeImage(int addr, const std::vector<epicsType>& data, in
     return(status);
 }
 
-template <typename epicsType>
-static epicsType transFunc(epicsType value, int trans_mode)
-{
-    switch(trans_mode)
-    {
-        case 0:
-            return value;
-            break;
-        case 1:
-            return static_cast<epicsType>(sqrt(value));
-            break;
-        case 2:
-            return static_cast<epicsType>(log(1.0 + value));
-            break;
-        default:
-            return value;
-            break;
-    }
-}
-
 // supplied array of x,y,t
 template <typename epicsTypeOut, typename epicsTypeIn> 
-int CAENMCADriver::computeArray(int addr, const std::vector<epicsTypeIn>& data, int sizeX, int sizeY)
+int CAENMCADriver::computeArray(int addr, const std::vector<epicsTypeIn>& data, int sizeX, int sizeY, NDArray* pArray)
 {
     epicsTypeOut *pMono=NULL, *pRed=NULL, *pGreen=NULL, *pBlue=NULL;
     int columnStep=0, rowStep=0, colorMode;
     int status = asynSuccess;
     double exposureTime, gain;
-    int i, j, k, trans_mode = 0;
+    int trans_mode = 0;
 
     status = getDoubleParam (ADGain,        &gain);
     status = getIntegerParam(NDColorMode,   &colorMode);
     status = getDoubleParam (ADAcquireTime, &exposureTime);
-    status = getIntegerParam(addr, P_eventSpec_2DTransMode, &trans_mode);
+    status = getIntegerParam(imageChannel(addr), P_eventSpec_2DTransMode, &trans_mode);
 
 
     switch (colorMode) {
         case NDColorModeMono:
-            pMono = (epicsTypeOut *)m_pRaw->pData;
+            pMono = (epicsTypeOut *)pArray->pData;
             break;
         case NDColorModeRGB1:
             columnStep = 3;
             rowStep = 0;
-            pRed   = (epicsTypeOut *)m_pRaw->pData;
-            pGreen = (epicsTypeOut *)m_pRaw->pData+1;
-            pBlue  = (epicsTypeOut *)m_pRaw->pData+2;
+            pRed   = (epicsTypeOut *)pArray->pData;
+            pGreen = (epicsTypeOut *)pArray->pData+1;
+            pBlue  = (epicsTypeOut *)pArray->pData+2;
             break;
         case NDColorModeRGB2:
             columnStep = 1;
             rowStep = 2 * sizeX;
-            pRed   = (epicsTypeOut *)m_pRaw->pData;
-            pGreen = (epicsTypeOut *)m_pRaw->pData + sizeX;
-            pBlue  = (epicsTypeOut *)m_pRaw->pData + 2*sizeX;
+            pRed   = (epicsTypeOut *)pArray->pData;
+            pGreen = (epicsTypeOut *)pArray->pData + sizeX;
+            pBlue  = (epicsTypeOut *)pArray->pData + 2*sizeX;
             break;
         case NDColorModeRGB3:
             columnStep = 1;
             rowStep = 0;
-            pRed   = (epicsTypeOut *)m_pRaw->pData;
-            pGreen = (epicsTypeOut *)m_pRaw->pData + sizeX*sizeY;
-            pBlue  = (epicsTypeOut *)m_pRaw->pData + 2*sizeX*sizeY;
+            pRed   = (epicsTypeOut *)pArray->pData;
+            pGreen = (epicsTypeOut *)pArray->pData + sizeX*sizeY;
+            pBlue  = (epicsTypeOut *)pArray->pData + 2*sizeX*sizeY;
+            break;
+    }
+    pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+    // the kernels write every pixel of every plane so the buffer is not cleared first
+    switch (colorMode) {
+        case NDColorModeMono:
+            transformMono(data.data(), (size_t)sizeX * sizeY, gain, trans_mode, pMono);
+            break;
+        case NDColorModeRGB1:
+        case NDColorModeRGB2:
+        case NDColorModeRGB3:
+            transformRGB(data.data(), sizeX, sizeY, gain, trans_mode, pRed, pGreen, pBlue, columnStep, rowStep);
             break;
     }
-    m_pRaw->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
-	memset(m_pRaw->pData, 0, m_pRaw->dataSize);
-    k = 0;
-	for (i=0; i<sizeY; i++) {
-		switch (colorMode) {
-			case NDColorModeMono:
-				for (j=0; j<sizeX; j++) {
-					pMono[k] = transFunc(static_cast<epicsTypeOut>(gain * data[k]), trans_mode);
-                    ++k;
-				}
-				break;
-			case NDColorModeRGB1:
-			case NDColorModeRGB2:
-			case NDColorModeRGB3:
-				for (j=0; j<sizeX; j++) {
-					pRed[k] = pGreen[k] = pBlue[k] = transFunc(static_cast<epicsTypeOut>(gain * data[k]), trans_mode);
-					pRed   += columnStep;
-					pGreen += columnStep;
-					pBlue  += columnStep;
-					++k;
-				}
-				pRed   += rowStep;
-				pGreen += rowStep;
-				pBlue  += rowStep;
-				break;
-		}
-	}
     return(status);
 }
 
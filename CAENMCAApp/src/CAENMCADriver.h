@@ -10,7 +10,320 @@
 #ifndef CAENMCADRIVER_H
 #define CAENMCADRIVER_H
 
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <string>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsEvent.h>
+
 #include "ADDriver.h"
+#include "listmode.h"
+#include "eventring.h"
+#include "eventstore.h"
+#include "histengine.h"
+#include "tiledhist.h"
+#include "histpyramid.h"
+#include "basehist.h"
+#include "binning.h"
+#include "frameindex.h"
+#include "flagstats.h"
+#include "eventbin.h"
+#include "imagekernel.h"
+#include "filewatch.h"
+
+class CAENMCADriver;
+
+/// list mode settings, copied from asyn parameters under the driver lock at the start of each ingestion pass
+struct ListModeSettings
+{
+    std::string filename;       ///< list file name, relative to the hexagon share
+    std::string load_filename;  ///< full path of file to process if load_data_file is set
+    bool enabled;
+    int save_mode;
+    bool load_data_file;
+    bool reload_live_data;
+    double ev_tmin, ev_tmax;    ///< event time spectrum
+    int ev_nbins;
+    double ev2d_tmin, ev2d_tmax; ///< 2D time v energy spectrum
+    int ev2d_ntbins;
+    int ev2d_eng_bin_group;
+    int energy_bins;            ///< energy channels in event spectra, see CAENMCADriver::energyBins()
+    std::vector<GatedHistogramDef> hists; ///< gated histograms, indexed by ListModeChannel::HIST_* 
+    double store_max_mem;       ///< event store memory limit (MB)
+    int hist_threads;           ///< maximum histogram worker threads to use
+    int index_stride;           ///< frame index holds every index_stride'th frame of the list file
+    bool index_sidecar;         ///< write the frame index to a sidecar file next to the list file
+    int load_first_frame;       ///< first frame of load_filename to process
+    int load_nframes;           ///< number of frames of load_filename to process, 0 for all
+    bool ev2d_overview;         ///< the overview image of the 2D spectrum is acquiring, so its pyramid is kept
+    int base_tbinw;             ///< time bin width (ns) of the base histogram the event spectra are derived from
+    double base_max_mem;        ///< base histogram memory limit (MB)
+    ListModeSettings() : enabled(false), save_mode(0), load_data_file(false), reload_live_data(false),
+        ev_tmin(0.0), ev_tmax(0.0), ev_nbins(0), ev2d_tmin(0.0), ev2d_tmax(0.0), ev2d_ntbins(0), ev2d_eng_bin_group(1),
+        energy_bins(0), store_max_mem(0.0), hist_threads(1), index_stride(100), index_sidecar(false),
+        load_first_frame(0), load_nframes(0), ev2d_overview(false), base_tbinw(1), base_max_mem(0.0) { }
+    /// true if the event spectra would be binned the same way with these settings 
+    bool sameBinning(const ListModeSettings& s) const
+    {
+        return ev_tmin == s.ev_tmin && ev_tmax == s.ev_tmax && ev_nbins == s.ev_nbins &&
+               ev2d_tmin == s.ev2d_tmin && ev2d_tmax == s.ev2d_tmax && ev2d_ntbins == s.ev2d_ntbins &&
+               ev2d_eng_bin_group == s.ev2d_eng_bin_group && energy_bins == s.energy_bins && hists == s.hists &&
+               base_tbinw == s.base_tbinw;
+    }
+};
+
+/// histogram binning for an ingestion pass and the results of that pass
+struct ListModePass
+{
+    double ev_tmin, ev_binw;    ///< event time spectrum
+    int ev_nbins;
+    int ev2d_ntbins;            ///< 2D time v energy spectrum
+    EventBinning binner;        ///< how events are binned into the event spectra
+    int hist_threads;
+    int64_t nevents;            ///< records histogrammed in this pass
+    int64_t nframes;
+    int64_t nevents_cr;         ///< events in the event rate time window
+    int64_t nevents_cr_start;   ///< rate window count at start of pass
+    uint64_t max_event_time;    ///< ns
+    ListModePass() { memset(this, 0, sizeof(ListModePass)); }
+};
+
+struct ListModeChannel;
+
+/// partial spectra filled by one histogram worker thread during a pass
+struct ListModePartial
+{
+    std::vector<double> event_spec_y;
+    TiledHistogram2D event_spec_2d;
+    GatedHistogramEngine hists;
+    BaseHistogram base;
+    ListModeCounters counters;
+};
+
+/// a histogram worker thread, bins events [begin, end) of batch into #partial when #start_event is signalled
+struct ListModeWorker
+{
+    ListModeChannel* lm;
+    epicsEvent start_event;
+    ListModePartial partial;
+    const ListModeBatch* batch;
+    size_t begin, end;
+    ListModeWorker() : lm(NULL), batch(NULL), begin(0), end(0) { }
+};
+
+/// list mode ingestion state for one channel. The list file is read by the channel's ingestion
+/// thread and the decoded batches passed through #ring to its histogram thread. Other threads
+/// must hold #lock to access this or the channel's event spectra, the ingestion thread holds it
+/// for a whole pass and waits for the ring to drain before releasing it. 
+/// Lock ordering is driver lock before channel lock.
+struct ListModeChannel
+{
+    static const size_t RING_BATCHES = 8;
+    static const int MAX_USER_HISTS = 8; ///< user defined gated histograms per channel
+    static const int MAX_HIST_WORKERS = 8; ///< histogram worker threads per channel
+    enum { HIST_ENERGY_A = 0, HIST_ENERGY_B, HIST_RATE, HIST_USER }; ///< fixed entries in #hists, user histograms follow
+    CAENMCADriver* driver;
+    int channel_id;
+    epicsMutex lock;
+    FILE* f;
+    FILE* f_ascii;
+    ListModeDecoder decoder;    ///< holds any partial record at end of file
+    std::string old_list_filename;
+    int64_t event_file_last_pos;
+    int64_t file_size;
+    uint64_t frame_time;        ///< ns
+    uint64_t max_event_time;    ///< ns
+    uint64_t frame_length;      ///< ns
+    ListModeCounters counters;
+    ListModePass pass;
+    GatedHistogramEngine hists;   ///< time gated energy spectra, rate window and user histograms
+    double decode_rate;
+    SPSCRing<ListModeBatch> ring; ///< decoded batches waiting to be histogrammed
+    epicsEvent ring_data_event;   ///< signalled by reader after a push
+    epicsEvent ring_space_event;  ///< signalled by histogrammer after a pop
+    std::atomic<bool> reading;    ///< reader is in a pass and may push more batches
+    std::atomic<int> ring_read_stalls; ///< reader found ring full, histogramming is the bottleneck
+    std::atomic<int> ring_hist_stalls; ///< histogrammer found ring empty during a pass, reading is the bottleneck
+    size_t ring_max_size;         ///< peak number of batches in ring during last pass
+    EventStore store;             ///< copy of all events in the current spectra
+    BaseHistogram base;           ///< all events in the current spectra binned finely, so changed binning can be derived from it. Off unless EVENTSPEC:BASE:MAXMEM is set as it slows binning
+    bool store_live;              ///< store holds the live list file from its start, rather than a loaded file
+    ListModeSettings binning;     ///< settings the current spectra were binned with
+    uint64_t binning_changes;     ///< incremented each time #binning changes, so the spectra are republished
+    FrameIndex index;             ///< frame starts of the live list file
+    std::string index_filename;   ///< list file #index refers to
+    std::string live_filename;    ///< full path of the live list file, empty if list mode is off
+    FileWatcher watcher;          ///< wakes the ingestion thread when #live_filename changes
+    bool index_save_error;        ///< writing the sidecar file of #index has failed
+    bool indexing;                ///< batches being histogrammed are from the live list file so go in #index
+    std::vector<uint64_t> tdiff;  ///< time since frame start (ns) of each event in the batch being histogrammed
+    std::vector<ListModeWorker*> workers;
+    std::atomic<int> workers_busy;
+    epicsEvent workers_done_event;
+    bool partials_used;           ///< worker partial spectra hold events not yet added to the channel spectra
+    HistPyramid1D<double> event_spec_pyr;           ///< down binned event time spectrum
+    HistPyramid1D<int32_t> energy_spec_event_pyr[2]; ///< down binned #HIST_ENERGY_A and #HIST_ENERGY_B
+    HistPyramid2D event_spec_2d_pyr; ///< down binned 2D spectrum, only kept while the overview image is acquiring
+    bool overview_image_pending;  ///< #event_spec_2d_pyr has changed since the overview image was last woken
+    int spec_ov_level;            ///< pyramid level of the overview spectra last published
+    ListModeChannel() : driver(NULL), channel_id(0), f(NULL), f_ascii(NULL), event_file_last_pos(0), file_size(0),
+        frame_time(0), max_event_time(0), frame_length(0), decode_rate(0.0), ring(RING_BATCHES), reading(false),
+        ring_read_stalls(0), ring_hist_stalls(0), ring_max_size(0), store_live(false), binning_changes(0), index_save_error(false), indexing(false), workers_busy(0), partials_used(false),
+        overview_image_pending(false), spec_ov_level(0) { }
+};
+
+/// copy of a channel's event derived spectra taken at the end of a run for the NeXus file
+struct RunSpectra
+{
+    std::vector<epicsInt32> energy_a;   ///< ListModeChannel::HIST_ENERGY_A
+    std::vector<epicsInt32> energy_b;   ///< ListModeChannel::HIST_ENERGY_B
+    std::vector<epicsInt32> spec_2d;    ///< dense 2D time v energy spectrum
+    size_t nx, ny;
+    RunSpectra() : nx(0), ny(0) { }
+};
+
+/// areaDetector image state for one address. Images of the 2D spectrum are made by the address's
+/// CAENMCADriver::imageTask() thread, woken by updateAD() when new list mode results are published,
+/// so waiting out ADAcquirePeriod holds up neither list mode ingestion nor device polling.
+/// Members other than #wake_event are accessed with the driver lock held
+struct ADImageChannel
+{
+    CAENMCADriver* driver;
+    int addr;
+    epicsEvent wake_event;      ///< signalled by updateAD()
+    bool pending;               ///< new data since the last image
+    bool old_acquiring;         ///< ADAcquire when updateAD() was last called, to reset the image count on start
+    epicsTimeStamp last_update; ///< when the last image was sent
+    ADImageChannel() : driver(NULL), addr(0), pending(false), old_acquiring(false)
+    {
+        last_update.secPastEpoch = last_update.nsec = 0;
+    }
+};
+
+/// a group of device reads done by pollerTask() at its own period
+struct PollItem
+{
+    epicsTime next;     ///< when the next read is due
+    bool requested;     ///< read on the next cycle whatever the period
+    PollItem() : next(epicsTime::getCurrent()), requested(true) { }
+    bool due(const epicsTime& now) const { return requested || now - next >= 0.0; }
+    /// schedule the next read, a period <= 0 means only read on request
+    void done(const epicsTime& now, double period)
+    {
+        requested = false;
+        next = now + (period > 0.0 ? period : 1.0e9);
+    }
+};
+
+/// publication state of an array parameter on one address, so the array is only sent to clients
+/// when its contents have changed, and then at most once per its minimum publish period
+struct ArrayPublishState
+{
+    uint64_t generation;    ///< incremented each time the array contents change
+    uint64_t published;     ///< #generation last sent to clients
+    epicsTime last;         ///< when it was last sent
+    ArrayPublishState() : generation(1), published(0) { }
+    void touch() { ++generation; }
+    /// a period <= 0 means publish every change
+    bool due(const epicsTime& now, double min_period) const
+    {
+        return generation != published && (min_period <= 0.0 || now - last >= min_period);
+    }
+    void done(const epicsTime& now)
+    {
+        published = generation;
+        last = now;
+    }
+};
+
+/// child handles of CAEN library objects, e.g. spectra and parameters, keyed by parent, type and
+/// index or name so each is only looked up through the library once. The handles stay valid while
+/// the device is connected, clear() drops them all when that may no longer be so, e.g. after a
+/// configuration load. Lookups are done by CAENMCADriver::childHandle() and childHandleByName()
+struct CAENHandleCache
+{
+    typedef std::tuple<CAEN_MCA_HANDLE, int, int32_t> IndexKey;
+    typedef std::tuple<CAEN_MCA_HANDLE, int, std::string> NameKey;
+    std::map<IndexKey, CAEN_MCA_HANDLE> by_index;
+    std::map<NameKey, CAEN_MCA_HANDLE> by_name;
+    epicsMutex lock;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t clears;
+    CAENHandleCache() : hits(0), misses(0), clears(0) { }
+    void clear()
+    {
+        epicsGuard<epicsMutex> _lock(lock);
+        by_index.clear();
+        by_name.clear();
+        ++clears;
+    }
+};
+
+/// value of a device setting as passed to CAEN_MCA_SetData(), see #CAENShadowCache
+struct ShadowValue
+{
+    enum Kind { UINT32, DOUBLE, TEXT };
+    Kind kind;
+    double number;      ///< #UINT32 or #DOUBLE value
+    std::string text;   ///< #TEXT value
+    ShadowValue() : kind(DOUBLE), number(0.0) { }
+    explicit ShadowValue(uint32_t value) : kind(UINT32), number(value) { }
+    explicit ShadowValue(double value) : kind(DOUBLE), number(value) { }
+    explicit ShadowValue(const char* value) : kind(TEXT), number(0.0), text(value) { }
+    bool operator==(const ShadowValue& v) const
+    {
+        return kind == v.kind && (kind == TEXT ? text == v.text : number == v.number);
+    }
+    bool operator!=(const ShadowValue& v) const { return !(*this == v); }
+};
+
+/// copy of the device settings the driver last wrote or read, keyed by the handle, data type and
+/// data mask given to SetData, so a write of the value the device already holds can be skipped.
+/// Entries are refreshed by the polled reads and dropped when the device may have changed them
+/// itself, e.g. on a configuration load or restart. Between CAENMCADriver::beginParamBatch() and
+/// CAENMCADriver::applyParamBatch() writes are only collected, so a setting changed several times
+/// or changed back costs at most one device call. Only accessed with the driver lock held
+struct CAENShadowCache
+{
+    typedef std::tuple<CAEN_MCA_HANDLE, int, uint64_t> Key;
+    std::map<Key, ShadowValue> values;
+    std::vector< std::pair<Key, ShadowValue> > pending; ///< batched writes, in the order first made
+    int batch_depth;
+    uint64_t writes;
+    uint64_t skipped;
+    uint64_t clears;
+    CAENShadowCache() : batch_depth(0), writes(0), skipped(0), clears(0) { }
+    void clear()
+    {
+        values.clear();
+        ++clears;
+    }
+};
+
+/// asyn parameters for a user defined gated histogram, see #GatedHistogramDef
+struct GatedHistParams
+{
+    int enable; // int
+    int tmin; // double
+    int tmax; // double
+    int emin; // int
+    int emax; // int
+    int flagMask; // int
+    int flagValue; // int
+    int axis; // int
+    int xmin; // double
+    int xmax; // double
+    int nbins; // int
+    int x; // double array
+    int y; // int array
+    int nevents; // int
+    int pubPeriod; // double
+};
 
 /// EPICS Asyn port driver class. 
 class epicsShareClass CAENMCADriver : public ADDriver 
@@ -30,36 +343,51 @@ public:
 	virtual void report(FILE* fp, int details);
 
 private:
+    /// areaDetector addresses, 0 and 1 are the channels' 2D spectra and 2 and 3 their overview images
+    enum { OVERVIEW_ADDR = 2, NUM_AD_ADDR = 4 };
+    static int imageChannel(int addr) { return (addr >= OVERVIEW_ADDR ? addr - OVERVIEW_ADDR : addr); }
     void updateAD(int addr, bool new_events);
     void clearEnergySpectrum(int channel_id);
-    NDArray* m_pRaw;
+    NDArray* m_pRaw[NUM_AD_ADDR]; ///< full size image per address that ROI, binning and reversal are taken from, kept between images
     void setADAcquire(int addr, int acquire);
     template <typename epicsType>
         int computeImage(int addr, const std::vector<epicsType>& data, int nx, int ny);
     template <typename epicsTypeOut, typename epicsTypeIn> 
-        int computeArray(int addr, const std::vector<epicsTypeIn>& data, int maxSizeX, int maxSizeY);
+        int computeArray(int addr, const std::vector<epicsTypeIn>& data, int maxSizeX, int maxSizeY, NDArray* pArray);
     CAEN_MCA_HANDLE m_device_h;
     epicsTime m_start_time[2];
     epicsTime m_stop_time[2];
     std::vector<CAEN_MCA_HANDLE> m_chan_h;
     std::vector<CAEN_MCA_HANDLE> m_hv_chan_h;
+    CAENHandleCache m_handles;
+    CAENShadowCache m_shadow;
 	std::vector<epicsInt32> m_energy_spec[2];
-	std::vector<epicsInt32> m_energy_spec_event[2];
-	std::vector<epicsInt32> m_energy_spec2_event[2];
-	std::vector<epicsInt32> m_event_spec_2d[2];
+	TiledHistogram2D m_event_spec_2d[2];
+	std::vector<epicsInt32> m_event_spec_2d_dense[NUM_AD_ADDR]; ///< dense copy of #m_event_spec_2d, or a level of its pyramid, for computeImage(), used by imageTask()
+    ADImageChannel m_ad[NUM_AD_ADDR];
 	std::vector<epicsFloat64> m_event_spec_x[2];
 	std::vector<epicsFloat64> m_event_spec_y[2];
-    std::vector<std::string> m_old_list_filename;
-    std::vector<std::tuple<FILE*,FILE*>> m_file_fd;
-    std::vector<int64_t> m_event_file_last_pos;
-    std::vector<uint64_t> m_frame_time; 
-    std::vector<uint64_t> m_max_event_time; 
+    ListModeChannel m_list_mode[2];
 	CAEN_MCA_BoardFamilyCode_t m_famcode;
     uint32_t m_nbitsEnergy;
     uint32_t m_tsample; // picoseconds
     std::string m_share_path; // hexagon windows share path
     std::string m_file_dir;
     std::map<int, std::string> m_detNameMap;
+    enum { POLL_CHANNEL = 0, POLL_SPECTRUM, POLL_HV, POLL_LISTS, NUM_POLL_ITEMS }; ///< per channel reads done by pollerTask()
+    PollItem m_poll[2][NUM_POLL_ITEMS];
+    PollItem m_poll_configs;    ///< saved configuration list
+    bool m_acq_running[2];      ///< channel acquisition state at its last poll
+    epicsEvent m_poll_event;    ///< signalled to make pollerTask() do a requested read now
+    std::vector<char> m_config_names_buffer; ///< storage for the names returned by listConfigurations()
+    std::vector<char*> m_config_names;
+    enum { PUB_ENERGY_SPEC = 0, PUB_EVENTS_SPEC, PUB_ENERGY_SPEC_EVENT, PUB_ENERGY_SPEC2_EVENT, PUB_SPEC_OVERVIEW, PUB_GATED_HIST,
+           NUM_PUB_ARRAYS = PUB_GATED_HIST + ListModeChannel::MAX_USER_HISTS }; ///< per channel arrays, see #ArrayPublishState
+    ArrayPublishState m_pub[2][NUM_PUB_ARRAYS];
+    uint64_t m_pub_binning_changes[2]; ///< ListModeChannel::binning_changes when the list mode arrays were last marked changed
+    std::vector<epicsInt32> m_energy_spec_read[2]; ///< energy spectrum read from the device, compared with #m_energy_spec
+    void requestPoll(int channel_id, int item);
+    void requestConfigPoll();
 
 
 	double getParameterValue(CAEN_MCA_HANDLE handle, const char *name);
@@ -77,20 +405,32 @@ private:
 	void stopAcquisition(int addr, int value);
 	void controlAcquisition(int chan_mask, bool start);
 	void getBoardInfo();
-	void getChannelInfo(int32_t channel_id);
+	bool getChannelInfo(int32_t channel_id);
     void loadConfiguration(const char* name);
     void listConfigurations(std::vector<std::string>& configs);
 	void readRegister(uint32_t address, uint32_t& value);
 	void writeRegister(uint32_t address, uint32_t value);
 	void writeRegisterMask(uint32_t address, uint32_t value, uint32_t mask);
-	void getHVInfo(uint32_t hv_chan_id);
+	bool getHVInfo(uint32_t hv_chan_id);
 	void getLists(uint32_t channel_id);
     void setListModeFilename(int32_t channel_id, const char* filename);	
 	template <typename T> void setData(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, T value);
 	void setListsData(int32_t channel_id, bool timetag, bool energy, bool extras);
 	void setEnergySpectrumParameter(CAEN_MCA_HANDLE channel, int32_t spectrum_id, const char* parname, double value);
 	void getEnergySpectrum(int32_t channel_id, int32_t spectrum_id, std::vector<epicsInt32>& data);
+    void readEnergySpectrum(int32_t channel_id);
+    double publishEnergySpectrum(int32_t channel_id, const epicsTime& now);
 	template <typename T> void energySpectrumSetProperty(CAEN_MCA_HANDLE channel, int32_t spectrum_id, int prop, T value);
+    CAEN_MCA_HANDLE childHandle(CAEN_MCA_HANDLE parent, CAEN_MCA_HandleType_t type, int32_t index);
+    CAEN_MCA_HANDLE childHandleByName(CAEN_MCA_HANDLE parent, CAEN_MCA_HandleType_t type, const char* name);
+    void setShadowed(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, const ShadowValue& value);
+    void writeShadowed(const CAENShadowCache::Key& key, const ShadowValue& value);
+    void updateShadow(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, const ShadowValue& value);
+    const ShadowValue* findShadow(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask) const;
+    void readShadow(int32_t channel_id);
+    void beginParamBatch();
+    void applyParamBatch();
+    void discardParamBatch();
     CAEN_MCA_HANDLE getSpectrumHandle(int32_t channel_id, int32_t spectrum_id);
     CAEN_MCA_HANDLE getSpectrumHandle(CAEN_MCA_HANDLE channel, int32_t spectrum_id);
     void setEnergySpectrumFilename(int32_t channel_id, int32_t spectrum_id, const char* filename);
@@ -98,12 +438,19 @@ private:
     void setListModeType(int32_t channel_id,  CAEN_MCA_ListSaveMode_t mode);
     void setEnergySpectrumAutosave(int32_t channel_id, int32_t spectrum_id, double period);
     void setListModeEnable(int32_t channel_id,  bool enable);
-    bool processListFile(int channel_id);
-    void incrIntParam(int channel_id, int param, int incr);
+    int energyBins(int channel_id);
+    void readListModeSettings(int channel_id, ListModeSettings& settings);
+    bool processListFile(int channel_id, const ListModeSettings& settings, bool& more_data);
+    void updatePyramids(int channel_id, const ListModeSettings& settings, bool new_data);
+    void publishListModeResults(int channel_id, bool new_data);
+    void histogramBatch(int channel_id, const ListModeBatch& batch);
+    void clearListModeSpectra(int channel_id);
+    bool deriveListModeSpectra(int channel_id, const ListModeSettings& old_settings);
+    void reduceHistPartials(int channel_id);
     void setFileNames();
     static void incrementRunNumber();
     void endRun();
-    static void endRunAll();
+    void endRunAll();
     void beginRun();
     static void beginRunAll();
     void setStartTime(int chan_mask);
@@ -113,11 +460,13 @@ private:
     std::string makeCopyDataArgs(int addr);
     static void copyData(const std::string& dataFile, const std::string& filePrefix, const char* runNumber, const std::string& copyDataArgs);
     static void setRunNumberFromIRunNumber();
+    void createGatedHistParams(int index, GatedHistParams& hp);
     bool setTimingRegisters();
     bool checkTimingRegisters();
     void cycleAcquisition();
     void closeListFiles();
-    static std::string createTemplateNexusFile(const std::string& filePrefix, const char* runNumber);
+    void copyRunSpectra(int channel_id, RunSpectra& spectra);
+    static std::string createTemplateNexusFile(const std::string& filePrefix, const char* runNumber, const std::vector<RunSpectra>& spectra);
 
 #define FIRST_CAEN_PARAM P_deviceName
 
@@ -171,6 +520,23 @@ private:
  	int P_eventsSpecNTimeTagReset; // int
  	int P_eventsSpecNEventEnergySat; // int
     int P_eventsSpecMaxEventTime; // double
+    int P_eventsDecodeRate; // double
+    int P_eventRingMaxOcc; // double
+    int P_eventRingReadStalls; // int
+    int P_eventRingHistStalls; // int
+    int P_eventStoreMaxMem; // double
+    int P_eventStoreMem; // double
+    int P_eventStoreSpill; // double
+    int P_eventStoreNEvents; // double
+    int P_eventStoreSpillError; // int
+    int P_histThreads; // int
+    int P_eventSpec_2DMem; // double
+    int P_histWorkers; // int
+    int P_eventsEnergyBins; // int
+    int P_frameIndexStride; // int
+    int P_frameIndexSidecar; // int
+    int P_frameIndexNFrames; // int
+    GatedHistParams P_gatedHist[ListModeChannel::MAX_USER_HISTS];
     int P_eventSpec_2DTimeMin; // double
     int P_eventSpec_2DTimeMax; // double
     int P_eventSpec_2DNTimeBins; // int
@@ -189,6 +555,8 @@ private:
     int P_loadDataFile; // int
     int P_loadDataStatus; // int
     int P_reloadLiveData; // int
+    int P_loadDataFirstFrame; // int
+    int P_loadDataNFrames; // int
     int P_runNumber; // string
     int P_iRunNumber; // int
     int P_filePrefix; // string
@@ -241,6 +609,27 @@ private:
     int P_sampleGeometry; // string
     int P_sampleName; // string
     int P_fileDirPrefix; // string
+    int P_pollSpecPeriod; // double
+    int P_pollSpecIdlePeriod; // double
+    int P_pollHVPeriod; // double
+    int P_pollHVRampPeriod; // double
+    int P_pollChanPeriod; // double
+    int P_pollListsPeriod; // double
+    int P_pollConfigPeriod; // double
+    int P_configRefresh; // int
+    int P_energySpecPubPeriod; // double
+    int P_eventsSpecPubPeriod; // double
+    int P_energySpecEventPubPeriod; // double
+    int P_energySpec2EventPubPeriod; // double
+    int P_specOverviewLevel; // int
+    int P_eventsSpecOvX; // double array
+    int P_eventsSpecOvY; // double array
+    int P_energySpecEventOv; // int array
+    int P_energySpec2EventOv; // int array
+    int P_eventSpec_2DOvLevel; // int
+    int P_baseTBinWidth; // int
+    int P_baseMaxMem; // double
+    int P_baseMem; // double
  	int P_startAcquisition; // int
 	int P_stopAcquisition; // int
 
@@ -253,6 +642,32 @@ private:
 		driver->pollerTask();	    
 	}
 	void pollerTask();
+	static void ingestTaskC(void* arg)
+	{
+	    ListModeChannel* lm = static_cast<ListModeChannel*>(arg);
+		lm->driver->ingestTask(lm->channel_id);
+	}
+	void ingestTask(int channel_id);
+    void wakeIngest(int channel_id = -1);
+    bool isGatedHistDefParam(int function) const;
+	static void histTaskC(void* arg)
+	{
+	    ListModeChannel* lm = static_cast<ListModeChannel*>(arg);
+		lm->driver->histTask(lm->channel_id);
+	}
+	void histTask(int channel_id);
+	static void histWorkerTaskC(void* arg)
+	{
+	    ListModeWorker* w = static_cast<ListModeWorker*>(arg);
+		w->lm->driver->histWorkerTask(w);
+	}
+	void histWorkerTask(ListModeWorker* w);
+	static void imageTaskC(void* arg)
+	{
+	    ADImageChannel* ad = static_cast<ADImageChannel*>(arg);
+		ad->driver->imageTask(ad->addr);
+	}
+	void imageTask(int addr);
 };
 
 #define P_deviceNameString "DEVICENAME"
@@ -325,6 +740,23 @@ private:
 #define P_eventsSpecNTimeTagResetString "EVENTSPECNTTRESET"
 #define P_eventsSpecNEventEnergySatString "EVENTSPECNENGSAT"
 #define P_eventsSpecMaxEventTimeString "EVENTSPECMAXEVENTTIME"
+#define P_eventsDecodeRateString "EVENTSDECODERATE"
+#define P_eventRingMaxOccString "EVENTRINGMAXOCC"
+#define P_eventRingReadStallsString "EVENTRINGREADSTALLS"
+#define P_eventRingHistStallsString "EVENTRINGHISTSTALLS"
+#define P_eventStoreMaxMemString "EVENTSTOREMAXMEM"
+#define P_eventStoreMemString "EVENTSTOREMEM"
+#define P_eventStoreSpillString "EVENTSTORESPILL"
+#define P_eventStoreNEventsString "EVENTSTORENEVENTS"
+#define P_eventStoreSpillErrorString "EVENTSTORESPILLERR"
+#define P_histThreadsString "HISTTHREADS"
+#define P_eventSpec_2DMemString "EVENTSPEC_2DMEM"
+#define P_histWorkersString "HISTWORKERS"
+#define P_eventsEnergyBinsString "EVENTSENERGYBINS"
+#define P_frameIndexStrideString "FRAMEINDEXSTRIDE"
+#define P_frameIndexSidecarString "FRAMEINDEXSIDECAR"
+#define P_frameIndexNFramesString "FRAMEINDEXNFRAMES"
+#define P_gatedHistString "GHIST%d%s" // e.g. GHIST0TMIN
 #define P_nFakeEventsString         "NFAKEEVENTS"
 #define P_nImpDynamSatEventString   "NIMPDYNAMSATEVENT"
 #define P_nPileupEventString        "NPILEUPEVENT"
@@ -342,6 +774,8 @@ private:
 #define P_loadDataFileString              "LOADDATAFILE"
 #define P_loadDataStatusString        "LOADDATASTATUS"
 #define P_reloadLiveDataString          "RELOADLIVEDATA"
+#define P_loadDataFirstFrameString        "LOADDATAFIRSTFRAME"
+#define P_loadDataNFramesString           "LOADDATANFRAMES"
 #define P_eventSpec_2DTransModeString      "EVENTSPEC_2DTRANSMODE"
 #define P_runTitleString "RUNTITLE"
 #define P_runCommentString "RUNCOMMENT"
@@ -370,6 +804,27 @@ private:
 #define P_sampleGeometryString "SAMPLEGEOMETRY"
 #define P_sampleNameString "SAMPLENAME"
 #define P_fileDirPrefixString "FILEDIRPREFIX"
+#define P_pollSpecPeriodString "POLLSPECPERIOD"
+#define P_pollSpecIdlePeriodString "POLLSPECIDLEPERIOD"
+#define P_pollHVPeriodString "POLLHVPERIOD"
+#define P_pollHVRampPeriodString "POLLHVRAMPPERIOD"
+#define P_pollChanPeriodString "POLLCHANPERIOD"
+#define P_pollListsPeriodString "POLLLISTSPERIOD"
+#define P_pollConfigPeriodString "POLLCONFIGPERIOD"
+#define P_configRefreshString "CONFIGREFRESH"
+#define P_energySpecPubPeriodString "ENERGYSPECPUBPERIOD"
+#define P_eventsSpecPubPeriodString "EVENTSPECPUBPERIOD"
+#define P_energySpecEventPubPeriodString "ENERGYSPECEVENTPUBPERIOD"
+#define P_energySpec2EventPubPeriodString "ENERGYSPEC2EVENTPUBPERIOD"
+#define P_specOverviewLevelString "SPECOVLEVEL"
+#define P_eventsSpecOvXString "EVENTSPECOVX"
+#define P_eventsSpecOvYString "EVENTSPECOVY"
+#define P_energySpecEventOvString "ENERGYSPECEVENTOV"
+#define P_energySpec2EventOvString "ENERGYSPEC2EVENTOV"
+#define P_eventSpec_2DOvLevelString "EVENTSPEC_2DOVLEVEL"
+#define P_baseTBinWidthString "BASETBINW"
+#define P_baseMaxMemString "BASEMAXMEM"
+#define P_baseMemString "BASEMEM"
 
 
 #endif /* CAENMCADRIVER_H */
@@ -0,0 +1,1332 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file CAENMCASim.cpp In process simulation of a CAEN Hexagon.
+
+#ifdef _WIN32
+#include <direct.h>
+#include <share.h>
+#else
+#include <sys/stat.h>
+#define _fsopen(a,b,c) fopen(a,b)
+#endif /* _WIN32 */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <iocsh.h>
+
+#include <CAENMCA.h>
+
+#include "listmode.h"
+#include "listsynth.h"
+
+#include <epicsExport.h>
+
+#include "CAENMCASim.h"
+
+#define SIM_NCHANNELS       2
+#define SIM_NHVCHANNELS     2
+#define SIM_NHVRANGES       2
+#define SIM_NSPECTRA        2
+#define SIM_ENERGY_BITS     15
+#define SIM_DEADTIME_NS     800     /* dead time per detector event, sets live time */
+
+class SimDevice;
+
+/// a simulated CAEN object, the handles given to the driver point at one of these
+struct SimObject
+{
+    CAEN_MCA_HandleType_t type;
+    int32_t index;
+    std::string name;
+    SimDevice* device;
+    SimObject* parent;
+    double value;                       ///< value of a parameter
+    std::string codename;               ///< value of a parameter set by code name, empty if set numerically
+    std::vector<SimObject*> members;    ///< handles of a collection, owned by the collection parent
+    std::map<std::string, SimObject*> parameters;
+    std::map<std::pair<int, int32_t>, SimObject*> children;
+
+    SimObject(CAEN_MCA_HandleType_t type_, int32_t index_, const std::string& name_, SimDevice* device_, SimObject* parent_) :
+        type(type_), index(index_), name(name_), device(device_), parent(parent_), value(0.0) { }
+    ~SimObject()
+    {
+        for(std::map<std::string, SimObject*>::iterator it = parameters.begin(); it != parameters.end(); ++it)
+        {
+            delete it->second;
+        }
+        for(std::map<std::pair<int, int32_t>, SimObject*>::iterator it = children.begin(); it != children.end(); ++it)
+        {
+            delete it->second;
+        }
+    }
+    SimObject* child(CAEN_MCA_HandleType_t child_type, int32_t child_index, const std::string& child_name)
+    {
+        SimObject*& c = children[std::make_pair((int)child_type, child_index)];
+        if (c == NULL)
+        {
+            c = new SimObject(child_type, child_index, child_name, device, this);
+        }
+        return c;
+    }
+private:
+    SimObject(const SimObject&);
+    SimObject& operator=(const SimObject&);
+};
+
+/// defaults and limits of the parameters the driver uses, others are created as an unbounded range starting at 0
+struct SimParameterDef
+{
+    const char* name;
+    double value;
+    double min;
+    double max;
+    double incr;
+    const char* uom;
+    bool readonly;
+};
+
+static const SimParameterDef sim_parameters[] = {
+    { "PARAM_ACQRUNNING",               0.0,    0.0,    1.0,    1.0,    "",     true },
+    { "PARAM_CH_ACQ_RUN",               0.0,    0.0,    1.0,    1.0,    "",     true },
+    { "PARAM_CH_ENABLED",               1.0,    0.0,    1.0,    1.0,    "",     false },
+    { "PARAM_CH_POLARITY",              0.0,    0.0,    1.0,    1.0,    "",     false },
+    { "PARAM_CH_ACQ_INIT",              1.0,    0.0,    1.0,    1.0,    "",     false },
+    { "PARAM_CH_STARTMODE",             0.0,    0.0,    3.0,    1.0,    "",     false },
+    { "PARAM_CH_MEMORY_FULL",           0.0,    0.0,    1.0,    1.0,    "",     true },
+    { "PARAM_CH_MEMORY_EMPTY",          1.0,    0.0,    1.0,    1.0,    "",     true },
+    { "PARAM_ENERGY_SPECTRUM_NBINS",    16384.0, 128.0, 32768.0, 1.0,   "",     false },
+    { "PARAM_HVCH_ACTIVE_RANGE",        0.0,    0.0,    SIM_NHVRANGES - 1, 1.0, "", false },
+    { "PARAM_HVCH_POLARITY",            0.0,    0.0,    1.0,    1.0,    "",     true },
+    { "PARAM_HVCH_STATUS",              0.0,    0.0,    65535.0, 1.0,   "",     true },
+    { "PARAM_HVRANGE_VSET",             1000.0, 0.0,    1300.0, 0.1,    "V",    false },
+    { "PARAM_HVRANGE_ISET",             10.0,   0.0,    100.0,  0.01,   "uA",   false },
+    { "PARAM_HVRANGE_VMAX",             1300.0, 0.0,    1300.0, 0.1,    "V",    false },
+    { "PARAM_HVRANGE_RAMPUP",           50.0,   1.0,    500.0,  1.0,    "V/s",  false },
+    { "PARAM_HVRANGE_RAMPDOWN",         50.0,   1.0,    500.0,  1.0,    "V/s",  false },
+    { "PARAM_HVRANGE_VMON",             0.0,    0.0,    1300.0, 0.01,   "V",    true },
+    { "PARAM_HVRANGE_IMON",             0.0,    0.0,    100.0,  0.001,  "uA",   true },
+    { "PARAM_HVRANGE_TMON",             25.0,   -50.0,  150.0,  0.1,    "C",    true }
+};
+
+static const SimParameterDef* findParameterDef(const std::string& name)
+{
+    for(size_t i=0; i<sizeof(sim_parameters) / sizeof(SimParameterDef); ++i)
+    {
+        if (name == sim_parameters[i].name)
+        {
+            return &(sim_parameters[i]);
+        }
+    }
+    return NULL;
+}
+
+static void copyString(char* dest, const std::string& src, size_t maxlen)
+{
+    strncpy(dest, src.c_str(), maxlen - 1);
+    dest[maxlen - 1] = '\0';
+}
+
+/// create the directories leading up to a file, ignoring any that already exist
+static void makeDirectories(const std::string& filename)
+{
+    for(size_t pos = filename.find_first_of("/\\", 1); pos != std::string::npos; pos = filename.find_first_of("/\\", pos + 1))
+    {
+        std::string dir = filename.substr(0, pos);
+        if (dir.empty() || dir[dir.size() - 1] == ':')
+        {
+            continue;
+        }
+#ifdef _WIN32
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0777);
+#endif /* _WIN32 */
+    }
+}
+
+struct SimSpectrum
+{
+    std::vector<uint32_t> counts;
+    uint32_t nbins;
+    uint64_t realtime;      ///< ns
+    uint64_t livetime;      ///< ns
+    uint64_t deadtime;      ///< ns
+    uint32_t overflows;
+    uint32_t underflows;
+    uint64_t nentries;
+    std::string filename;
+    uint32_t autosave_period;   ///< ms
+    SimSpectrum() : counts(ENERGYSPECTRUM_MAXLEN, 0), nbins(16384), autosave_period(0) { clear(); }
+    void clear()
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        realtime = livetime = deadtime = nentries = 0;
+        overflows = underflows = 0;
+    }
+};
+
+struct SimChannel
+{
+    SimObject* handle;
+    bool acquiring;
+    epicsTime start_time;
+    int64_t nframes;            ///< frames generated since acquisition start
+    uint32_t list_enabled;
+    CAEN_MCA_ListSaveMode_t savemode;
+    std::string list_filename;
+    uint32_t file_datamask;
+    uint32_t getfake;
+    uint32_t maxnevts;
+    uint32_t nevts;
+    std::vector<uint64_t> mem_timetag;  ///< events held when saving to memory
+    std::vector<uint32_t> mem_energy;
+    std::vector<uint16_t> mem_flags;
+    SimSpectrum spectra[SIM_NSPECTRA];
+    std::unique_ptr<ListModeSynth> synth;
+    std::string synth_filename;     ///< list file the time tags of synth continue in
+    FILE* f;
+    std::vector<char> data;
+    SimChannel() : handle(NULL), acquiring(false), nframes(0), list_enabled(1), savemode(CAEN_MCA_SAVEMODE_FILE_BINARY),
+        file_datamask(LIST_FILE_DATAMASK_TIMETAG | LIST_FILE_DATAMASK_ENERGY | LIST_FILE_DATAMASK_FLAGS),
+        getfake(1), maxnevts(0), nevts(0), f(NULL) { }
+};
+
+struct SimHVChannel
+{
+    SimObject* handle;
+    bool on;
+    double v_from;          ///< output voltage when on was last changed
+    epicsTime changed;
+    SimHVChannel() : handle(NULL), on(false), v_from(0.0), changed(epicsTime::getCurrent()) { }
+};
+
+/// a simulated board, all state is guarded by lock
+class SimDevice
+{
+public:
+    SimDevice(const std::string& path, const CAENMCASim::Settings& settings, uint32_t serial);
+    ~SimDevice();
+    const CAENMCASim::Settings settings;
+    SimObject* root;
+    void delay() const
+    {
+        if (settings.latency > 0.0)
+        {
+            epicsThreadSleep(settings.latency);
+        }
+    }
+    int32_t getData(SimObject* obj, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list* ap);
+    int32_t setData(SimObject* obj, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list* ap);
+    int32_t sendCommand(SimObject* obj, CAEN_MCA_CommandType_t cmdType, uint64_t cmdMaskIn, uint64_t cmdMaskOut, va_list* ap);
+    SimObject* childHandle(SimObject* obj, CAEN_MCA_HandleType_t handleType, int32_t index);
+    SimObject* parameterHandle(SimObject* obj, const std::string& name);
+private:
+    epicsMutex m_lock;
+    std::string m_path;
+    uint32_t m_serial;
+    SimChannel m_channels[SIM_NCHANNELS];
+    SimHVChannel m_hv[SIM_NHVCHANNELS];
+    std::map<uint32_t, uint32_t> m_registers;
+    std::vector<std::string> m_configurations;
+    bool m_stop;
+    epicsEvent m_wake;
+    epicsEvent m_done;
+
+    bool getBoardInfo(uint64_t bit, va_list* ap);
+    bool getHandleInfo(SimObject* obj, uint64_t bit, va_list* ap);
+    bool getParameterInfo(SimObject* obj, uint64_t bit, va_list* ap);
+    bool getHVRangeInfo(SimObject* obj, uint64_t bit, va_list* ap);
+    bool getSpectrum(SimSpectrum& spec, uint64_t bit, va_list* ap);
+    bool getListMode(SimChannel& chan, uint64_t bit, va_list* ap);
+    bool setListMode(SimChannel& chan, uint64_t bit, va_list* ap);
+    double parameterValue(SimObject* param);
+    bool setParameterValue(SimObject* param, double value);
+    double hvOutput(const SimHVChannel& hv, SimObject* range);
+    SimSpectrum* spectrum(SimObject* obj);
+    void startAcquisition(SimChannel& chan);
+    void stopAcquisition(SimChannel& chan);
+    void generate(SimChannel& chan, const epicsTime& now);
+    void simTask();
+    static void simTaskC(void* arg) { static_cast<SimDevice*>(arg)->simTask(); }
+};
+
+SimDevice::SimDevice(const std::string& path, const CAENMCASim::Settings& settings_, uint32_t serial) :
+    settings(settings_), root(NULL), m_path(path), m_serial(serial), m_stop(false)
+{
+    root = new SimObject(CAEN_MCA_HANDLE_DEVICE, 0, path, this, NULL);
+    SimObject* chan_coll = root->child(CAEN_MCA_HANDLE_COLLECTION, CAEN_MCA_HANDLE_CHANNEL, "CHANNELS");
+    SimObject* hv_coll = root->child(CAEN_MCA_HANDLE_COLLECTION, CAEN_MCA_HANDLE_HVCHANNEL, "HVCHANNELS");
+    for(int i=0; i<SIM_NCHANNELS; ++i)
+    {
+        m_channels[i].handle = root->child(CAEN_MCA_HANDLE_CHANNEL, i, "CH" + std::to_string(i));
+        chan_coll->members.push_back(m_channels[i].handle);
+    }
+    for(int i=0; i<SIM_NHVCHANNELS; ++i)
+    {
+        m_hv[i].handle = root->child(CAEN_MCA_HANDLE_HVCHANNEL, i, "HVCH" + std::to_string(i));
+        hv_coll->members.push_back(m_hv[i].handle);
+    }
+    // timing registers checked by the driver, see CAENMCADriver::checkTimingRegisters()
+    m_registers[0x10B8] = 0x2;
+    m_registers[0x11B8] = 0x2;
+    m_configurations.push_back("default");
+    if (epicsThreadCreate("CAENMCASim", epicsThreadPriorityLow,
+            epicsThreadGetStackSize(epicsThreadStackMedium), simTaskC, this) == 0)
+    {
+        std::cerr << "CAENMCASim: unable to create acquisition thread for " << path << std::endl;
+        m_done.signal();
+    }
+}
+
+SimDevice::~SimDevice()
+{
+    m_stop = true;
+    m_wake.signal();
+    m_done.wait();
+    for(int i=0; i<SIM_NCHANNELS; ++i)
+    {
+        stopAcquisition(m_channels[i]);
+    }
+    delete root;
+}
+
+SimObject* SimDevice::childHandle(SimObject* obj, CAEN_MCA_HandleType_t handleType, int32_t index)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (handleType == CAEN_MCA_HANDLE_ENERGYSPECTRUM && obj->type == CAEN_MCA_HANDLE_CHANNEL && index >= 0 && index < SIM_NSPECTRA)
+    {
+        return obj->child(handleType, index, "SPECTRUM" + std::to_string(index));
+    }
+    if (handleType == CAEN_MCA_HANDLE_HVRANGE && obj->type == CAEN_MCA_HANDLE_HVCHANNEL && index >= 0 && index < SIM_NHVRANGES)
+    {
+        return obj->child(handleType, index, "HVRANGE" + std::to_string(index));
+    }
+    // the device children are created with it, as are its collections whose index is the member handle type
+    std::map<std::pair<int, int32_t>, SimObject*>::const_iterator it = obj->children.find(std::make_pair((int)handleType, index));
+    return (it != obj->children.end() ? it->second : NULL);
+}
+
+SimObject* SimDevice::parameterHandle(SimObject* obj, const std::string& name)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    SimObject*& param = obj->parameters[name];
+    if (param == NULL)
+    {
+        const SimParameterDef* def = findParameterDef(name);
+        param = new SimObject(CAEN_MCA_HANDLE_PARAMETER, (int32_t)obj->parameters.size() - 1, name, this, obj);
+        param->value = (def != NULL ? def->value : 0.0);
+    }
+    return param;
+}
+
+/// spectrum state for a spectrum handle, NULL if it is not one
+SimSpectrum* SimDevice::spectrum(SimObject* obj)
+{
+    if (obj->type != CAEN_MCA_HANDLE_ENERGYSPECTRUM || obj->parent == NULL || obj->parent->type != CAEN_MCA_HANDLE_CHANNEL)
+    {
+        return NULL;
+    }
+    return &(m_channels[obj->parent->index].spectra[obj->index]);
+}
+
+/// high voltage output ramping towards the set point, or down to zero when off, at the range ramp rates
+double SimDevice::hvOutput(const SimHVChannel& hv, SimObject* range)
+{
+    double target = (hv.on ? parameterValue(parameterHandle(range, "PARAM_HVRANGE_VSET")) : 0.0);
+    double rate = parameterValue(parameterHandle(range, (target > hv.v_from ? "PARAM_HVRANGE_RAMPUP" : "PARAM_HVRANGE_RAMPDOWN")));
+    double step = rate * (epicsTime::getCurrent() - hv.changed);
+    if (target > hv.v_from)
+    {
+        return std::min(target, hv.v_from + step);
+    }
+    return std::max(target, hv.v_from - step);
+}
+
+double SimDevice::parameterValue(SimObject* param)
+{
+    SimObject* owner = param->parent;
+    const std::string& name = param->name;
+    if (name == "PARAM_ACQRUNNING")
+    {
+        for(int i=0; i<SIM_NCHANNELS; ++i)
+        {
+            if (m_channels[i].acquiring)
+            {
+                return 1.0;
+            }
+        }
+        return 0.0;
+    }
+    if (owner->type == CAEN_MCA_HANDLE_CHANNEL)
+    {
+        const SimChannel& chan = m_channels[owner->index];
+        if (name == "PARAM_CH_ACQ_RUN")
+        {
+            return (chan.acquiring ? 1.0 : 0.0);
+        }
+        if (name == "PARAM_CH_MEMORY_EMPTY")
+        {
+            return (chan.mem_timetag.empty() ? 1.0 : 0.0);
+        }
+        if (name == "PARAM_CH_MEMORY_FULL")
+        {
+            return (chan.maxnevts > 0 && chan.mem_timetag.size() >= chan.maxnevts ? 1.0 : 0.0);
+        }
+    }
+    if (owner->type == CAEN_MCA_HANDLE_HVCHANNEL && name == "PARAM_HVCH_STATUS")
+    {
+        return (m_hv[owner->index].on ? 1.0 : 0.0);
+    }
+    if (owner->type == CAEN_MCA_HANDLE_HVRANGE)
+    {
+        const SimHVChannel& hv = m_hv[owner->parent->index];
+        if (name == "PARAM_HVRANGE_VMON")
+        {
+            double v = hvOutput(hv, owner);
+            return (v > 0.0 ? v + 0.05 * sin(epicsTime::getCurrent() - hv.changed) : 0.0);
+        }
+        if (name == "PARAM_HVRANGE_IMON")
+        {
+            return 0.002 * hvOutput(hv, owner);
+        }
+        if (name == "PARAM_HVRANGE_TMON")
+        {
+            return 25.0 + 0.002 * hvOutput(hv, owner);
+        }
+    }
+    return param->value;
+}
+
+bool SimDevice::setParameterValue(SimObject* param, double value)
+{
+    const SimParameterDef* def = findParameterDef(param->name);
+    if (def != NULL && (def->readonly || value < def->min || value > def->max))
+    {
+        return false;
+    }
+    if (param->name == "PARAM_HVRANGE_VSET" || param->name == "PARAM_HVRANGE_RAMPUP" || param->name == "PARAM_HVRANGE_RAMPDOWN")
+    {
+        // restart the ramp from the present output
+        SimHVChannel& hv = m_hv[param->parent->parent->index];
+        hv.v_from = hvOutput(hv, param->parent);
+        hv.changed = epicsTime::getCurrent();
+    }
+    param->value = value;
+    param->codename.clear();
+    SimSpectrum* spec = spectrum(param->parent);
+    if (spec != NULL && param->name == "PARAM_ENERGY_SPECTRUM_NBINS")
+    {
+        spec->nbins = std::min((uint32_t)value, (uint32_t)ENERGYSPECTRUM_MAXLEN);
+        spec->clear();
+    }
+    return true;
+}
+
+bool SimDevice::getBoardInfo(uint64_t bit, va_list* ap)
+{
+    if (bit == DATAMASK_BRDINFO_FAMCODE)
+    {
+        *va_arg(*ap, CAEN_MCA_BoardFamilyCode_t*) = CAEN_MCA_FAMILY_CODE_XXHEX;
+    }
+    else if (bit == DATAMASK_BRDINFO_MODELNAME)
+    {
+        copyString(va_arg(*ap, char*), "Hexagon (simulated)", MODEL_NAME_MAXLEN);
+    }
+    else if (bit == DATAMASK_BRDINFO_NCHANNELS)
+    {
+        *va_arg(*ap, uint32_t*) = SIM_NCHANNELS;
+    }
+    else if (bit == DATAMASK_BRDINFO_SERIALNUM)
+    {
+        *va_arg(*ap, uint32_t*) = m_serial;
+    }
+    else if (bit == DATAMASK_BRDINFO_NHVCHANNELS)
+    {
+        *va_arg(*ap, uint32_t*) = SIM_NHVCHANNELS;
+    }
+    else if (bit == DATAMASK_BRDINFO_PCBREV)
+    {
+        *va_arg(*ap, uint32_t*) = 1;
+    }
+    else if (bit == DATAMASK_BRDINFO_ADC_BIT_COUNT)
+    {
+        *va_arg(*ap, uint32_t*) = 14;
+    }
+    else if (bit == DATAMASK_BRDINFO_TSAMPLE_PS)
+    {
+        *va_arg(*ap, uint32_t*) = 10000;
+    }
+    else if (bit == DATAMASK_BRDINFO_ENERGY_BIT_COUNT)
+    {
+        *va_arg(*ap, uint32_t*) = SIM_ENERGY_BITS;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::getHandleInfo(SimObject* obj, uint64_t bit, va_list* ap)
+{
+    if (bit == DATAMASK_HANDLE_TYPE)
+    {
+        *va_arg(*ap, int32_t*) = obj->type;
+    }
+    else if (bit == DATAMASK_HANDLE_INDEX)
+    {
+        *va_arg(*ap, int32_t*) = obj->index;
+    }
+    else if (bit == DATAMASK_HANDLE_NAME)
+    {
+        copyString(va_arg(*ap, char*), obj->name, HANDLE_NAME_MAXLEN);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::getParameterInfo(SimObject* obj, uint64_t bit, va_list* ap)
+{
+    const SimParameterDef* def = findParameterDef(obj->name);
+    const char* uom = (def != NULL ? def->uom : "");
+    bool is_list = !obj->codename.empty();
+    if (bit == DATAMASK_PARAMINFO_NAME || bit == DATAMASK_PARAMINFO_CODENAME)
+    {
+        copyString(va_arg(*ap, char*), obj->name, PARAMINFO_NAME_MAXLEN);
+    }
+    else if (bit == DATAMASK_PARAMINFO_INFOMASK)
+    {
+        *va_arg(*ap, uint32_t*) = 0;
+    }
+    else if (bit == DATAMASK_PARAMINFO_UOM_NAME || bit == DATAMASK_PARAMINFO_UOM_CODENAME)
+    {
+        copyString(va_arg(*ap, char*), uom, PARAMINFO_NAME_MAXLEN);
+    }
+    else if (bit == DATAMASK_PARAMINFO_UOM_POWER)
+    {
+        *va_arg(*ap, int32_t*) = 0;
+    }
+    else if (bit == DATAMASK_PARAMINFO_TYPE)
+    {
+        *va_arg(*ap, CAEN_MCA_ParameterType_t*) = (is_list ? CAEN_MCA_PARAMETER_TYPE_LIST : CAEN_MCA_PARAMETER_TYPE_RANGE);
+    }
+    else if (bit == DATAMASK_PARAMINFO_MIN)
+    {
+        *va_arg(*ap, double*) = (def != NULL ? def->min : 0.0);
+    }
+    else if (bit == DATAMASK_PARAMINFO_MAX)
+    {
+        *va_arg(*ap, double*) = (def != NULL ? def->max : 1.0e9);
+    }
+    else if (bit == DATAMASK_PARAMINFO_INCR)
+    {
+        *va_arg(*ap, double*) = (def != NULL ? def->incr : 1.0);
+    }
+    else if (bit == DATAMASK_PARAMINFO_NALLOWED_VALUES)
+    {
+        *va_arg(*ap, uint32_t*) = (is_list ? 1 : 0);
+    }
+    else if (bit == DATAMASK_PARAMINFO_ALLOWED_VALUES)
+    {
+        double* values = va_arg(*ap, double*);
+        if (is_list)
+        {
+            values[0] = obj->value;
+        }
+    }
+    else if (bit == DATAMASK_PARAMINFO_ALLOWED_VALUE_CODENAMES || bit == DATAMASK_PARAMINFO_ALLOWED_VALUE_NAMES)
+    {
+        char** names = va_arg(*ap, char**);
+        if (is_list)
+        {
+            copyString(names[0], obj->codename, PARAMINFO_NAME_MAXLEN);
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::getHVRangeInfo(SimObject* obj, uint64_t bit, va_list* ap)
+{
+    // range 0 is the full range, the others a low voltage range with finer setting
+    double vmax = (obj->index == 0 ? 1300.0 : 200.0);
+    if (bit == DATAMASK_HVRANGEINFO_VSET_MIN)
+    {
+        *va_arg(*ap, double*) = 0.0;
+    }
+    else if (bit == DATAMASK_HVRANGEINFO_VSET_MAX || bit == DATAMASK_HVRANGEINFO_VMAX_MAX)
+    {
+        *va_arg(*ap, double*) = vmax;
+    }
+    else if (bit == DATAMASK_HVRANGEINFO_VSET_INCR)
+    {
+        *va_arg(*ap, double*) = (obj->index == 0 ? 0.1 : 0.01);
+    }
+    else if (bit == DATAMASK_HVRANGEINFO_NAME)
+    {
+        copyString(va_arg(*ap, char*), (obj->index == 0 ? "HV_1300V" : "HV_200V"), HVRANGEINFO_NAME_MAXLEN);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::getSpectrum(SimSpectrum& spec, uint64_t bit, va_list* ap)
+{
+    if (bit == DATAMASK_ENERGY_SPECTRUM_ARRAY)
+    {
+        uint32_t* data = va_arg(*ap, uint32_t*);
+        std::copy(spec.counts.begin(), spec.counts.begin() + spec.nbins, data);
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_RTIME)
+    {
+        *va_arg(*ap, uint64_t*) = spec.realtime;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_LTIME)
+    {
+        *va_arg(*ap, uint64_t*) = spec.livetime;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_DTIME)
+    {
+        *va_arg(*ap, uint64_t*) = spec.deadtime;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_OVERFLOW)
+    {
+        *va_arg(*ap, uint32_t*) = spec.overflows;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_UNDERFLOW)
+    {
+        *va_arg(*ap, uint32_t*) = spec.underflows;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_NENTRIES)
+    {
+        *va_arg(*ap, uint64_t*) = spec.nentries;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_NROIS)
+    {
+        *va_arg(*ap, uint32_t*) = 0;
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_FILENAME)
+    {
+        copyString(va_arg(*ap, char*), spec.filename, ENERGYSPECTRUM_FULLPATH_MAXLEN);
+    }
+    else if (bit == DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD)
+    {
+        *va_arg(*ap, uint32_t*) = spec.autosave_period;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::getListMode(SimChannel& chan, uint64_t bit, va_list* ap)
+{
+    if (bit == DATAMASK_LIST_ENABLE)
+    {
+        *va_arg(*ap, uint32_t*) = chan.list_enabled;
+    }
+    else if (bit == DATAMASK_LIST_SAVEMODE)
+    {
+        *va_arg(*ap, CAEN_MCA_ListSaveMode_t*) = chan.savemode;
+    }
+    else if (bit == DATAMASK_LIST_FILENAME)
+    {
+        copyString(va_arg(*ap, char*), chan.list_filename, LISTS_FULLPATH_MAXLEN);
+    }
+    else if (bit == DATAMASK_LIST_FILE_DATAMASK)
+    {
+        *va_arg(*ap, uint32_t*) = chan.file_datamask;
+    }
+    else if (bit == DATAMASK_LIST_GETFAKEEVTS)
+    {
+        *va_arg(*ap, uint32_t*) = chan.getfake;
+    }
+    else if (bit == DATAMASK_LIST_MAXNEVTS)
+    {
+        *va_arg(*ap, uint32_t*) = chan.maxnevts;
+    }
+    else if (bit == DATAMASK_LIST_NEVTS)
+    {
+        *va_arg(*ap, uint32_t*) = chan.nevts;
+    }
+    // reading the event data empties the memory buffer, as on the board the
+    // data arguments follow NEVTS so the count returned matches the data
+    else if (bit == DATAMASK_LIST_DATA_TIMETAG)
+    {
+        std::copy(chan.mem_timetag.begin(), chan.mem_timetag.end(), va_arg(*ap, uint64_t*));
+        chan.mem_timetag.clear();
+    }
+    else if (bit == DATAMASK_LIST_DATA_ENERGY)
+    {
+        std::copy(chan.mem_energy.begin(), chan.mem_energy.end(), va_arg(*ap, uint32_t*));
+        chan.mem_energy.clear();
+    }
+    else if (bit == DATAMASK_LIST_DATA_FLAGS_DATAMASK)
+    {
+        std::copy(chan.mem_flags.begin(), chan.mem_flags.end(), va_arg(*ap, uint16_t*));
+        chan.mem_flags.clear();
+        if (chan.savemode == CAEN_MCA_SAVEMODE_MEMORY)
+        {
+            chan.nevts = 0;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::setListMode(SimChannel& chan, uint64_t bit, va_list* ap)
+{
+    if (bit == DATAMASK_LIST_ENABLE)
+    {
+        chan.list_enabled = va_arg(*ap, uint32_t);
+    }
+    else if (bit == DATAMASK_LIST_SAVEMODE)
+    {
+        chan.savemode = static_cast<CAEN_MCA_ListSaveMode_t>(va_arg(*ap, int));
+    }
+    else if (bit == DATAMASK_LIST_FILENAME)
+    {
+        chan.list_filename = va_arg(*ap, const char*);
+    }
+    else if (bit == DATAMASK_LIST_FILE_DATAMASK)
+    {
+        chan.file_datamask = va_arg(*ap, uint32_t);
+    }
+    else if (bit == DATAMASK_LIST_GETFAKEEVTS)
+    {
+        chan.getfake = va_arg(*ap, uint32_t);
+    }
+    else if (bit == DATAMASK_LIST_MAXNEVTS)
+    {
+        chan.maxnevts = va_arg(*ap, uint32_t);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/// the library takes the arguments of a data or command mask in increasing bit order
+#define FOR_EACH_MASK_BIT(__bit, __mask) \
+    for(uint64_t __bit = 1; __bit != 0 && __bit <= (__mask); __bit <<= 1) \
+        if (((__mask) & __bit) != 0)
+
+int32_t SimDevice::getData(SimObject* obj, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list* ap)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    SimSpectrum* spec = spectrum(obj);
+    double value = 0.0;
+    if (dataType == CAEN_MCA_DATA_PARAMETER_VALUE && obj->type == CAEN_MCA_HANDLE_PARAMETER)
+    {
+        value = parameterValue(obj);
+    }
+    FOR_EACH_MASK_BIT(bit, dataMask)
+    {
+        bool ok = false;
+        switch(dataType)
+        {
+        case CAEN_MCA_DATA_BOARD_INFO:
+            ok = (obj->type == CAEN_MCA_HANDLE_DEVICE && getBoardInfo(bit, ap));
+            break;
+        case CAEN_MCA_DATA_HANDLE_INFO:
+            ok = getHandleInfo(obj, bit, ap);
+            break;
+        case CAEN_MCA_DATA_COLLECTION:
+            if (obj->type != CAEN_MCA_HANDLE_COLLECTION)
+            {
+                break;
+            }
+            ok = true;
+            if (bit == DATAMASK_COLLECTION_LENGTH)
+            {
+                *va_arg(*ap, uint32_t*) = (uint32_t)obj->members.size();
+            }
+            else if (bit == DATAMASK_COLLECTION_HANDLES)
+            {
+                CAEN_MCA_HANDLE* handles = va_arg(*ap, CAEN_MCA_HANDLE*);
+                for(size_t i=0; i<obj->members.size(); ++i)
+                {
+                    handles[i] = obj->members[i];
+                }
+            }
+            else
+            {
+                ok = false;
+            }
+            break;
+        case CAEN_MCA_DATA_CHANNEL_INFO:
+            ok = (obj->type == CAEN_MCA_HANDLE_CHANNEL && bit == DATAMASK_CHANNELINFO_NENERGYSPECTRA);
+            if (ok)
+            {
+                *va_arg(*ap, uint32_t*) = SIM_NSPECTRA;
+            }
+            break;
+        case CAEN_MCA_DATA_HVCHANNEL_INFO:
+            if (obj->type != CAEN_MCA_HANDLE_HVCHANNEL)
+            {
+                break;
+            }
+            ok = true;
+            if (bit == DATAMASK_HVCHANNELINFO_NRANGES)
+            {
+                *va_arg(*ap, uint32_t*) = SIM_NHVRANGES;
+            }
+            else if (bit == DATAMASK_HVCHANNELINFO_POLARITY)
+            {
+                *va_arg(*ap, int32_t*) = CAEN_MCA_POLARITY_TYPE_POSITIVE;
+            }
+            else
+            {
+                ok = false;
+            }
+            break;
+        case CAEN_MCA_DATA_HVRANGE_INFO:
+            ok = (obj->type == CAEN_MCA_HANDLE_HVRANGE && getHVRangeInfo(obj, bit, ap));
+            break;
+        case CAEN_MCA_DATA_PARAMETER_INFO:
+            ok = (obj->type == CAEN_MCA_HANDLE_PARAMETER && getParameterInfo(obj, bit, ap));
+            break;
+        case CAEN_MCA_DATA_PARAMETER_VALUE:
+            if (obj->type != CAEN_MCA_HANDLE_PARAMETER)
+            {
+                break;
+            }
+            ok = true;
+            if (bit == DATAMASK_VALUE_NUMERIC)
+            {
+                *va_arg(*ap, double*) = value;
+            }
+            else if (bit == DATAMASK_VALUE_CODENAME)
+            {
+                char buffer[64];
+                epicsSnprintf(buffer, sizeof(buffer), "%g", value);
+                copyString(va_arg(*ap, char*), (obj->codename.empty() ? std::string(buffer) : obj->codename), PARAMINFO_NAME_MAXLEN);
+            }
+            else
+            {
+                ok = false;
+            }
+            break;
+        case CAEN_MCA_DATA_ENERGYSPECTRUM:
+            ok = (spec != NULL && getSpectrum(*spec, bit, ap));
+            break;
+        case CAEN_MCA_DATA_LIST_MODE:
+            ok = (obj->type == CAEN_MCA_HANDLE_CHANNEL && getListMode(m_channels[obj->index], bit, ap));
+            break;
+        default:
+            break;
+        }
+        if (!ok)
+        {
+            std::cerr << "CAENMCASim: unsupported GetData of type " << dataType << " mask 0x" << std::hex << bit << std::dec
+                      << " for handle \"" << obj->name << "\"" << std::endl;
+            return CAEN_MCA_RetCode_Argument;
+        }
+    }
+    return CAEN_MCA_RetCode_Success;
+}
+
+int32_t SimDevice::setData(SimObject* obj, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list* ap)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    SimSpectrum* spec = spectrum(obj);
+    FOR_EACH_MASK_BIT(bit, dataMask)
+    {
+        bool ok = false;
+        if (dataType == CAEN_MCA_DATA_PARAMETER_VALUE && obj->type == CAEN_MCA_HANDLE_PARAMETER)
+        {
+            if (bit == DATAMASK_VALUE_NUMERIC)
+            {
+                ok = setParameterValue(obj, va_arg(*ap, double));
+            }
+            else if (bit == DATAMASK_VALUE_CODENAME)
+            {
+                obj->codename = va_arg(*ap, const char*);
+                ok = true;
+            }
+        }
+        else if (dataType == CAEN_MCA_DATA_ENERGYSPECTRUM && spec != NULL)
+        {
+            ok = true;
+            if (bit == DATAMASK_ENERGY_SPECTRUM_FILENAME)
+            {
+                spec->filename = va_arg(*ap, const char*);
+            }
+            else if (bit == DATAMASK_ENERGY_SPECTRUM_AUTOSAVE_PERIOD)
+            {
+                spec->autosave_period = va_arg(*ap, uint32_t);
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else if (dataType == CAEN_MCA_DATA_LIST_MODE && obj->type == CAEN_MCA_HANDLE_CHANNEL)
+        {
+            ok = setListMode(m_channels[obj->index], bit, ap);
+        }
+        if (!ok)
+        {
+            std::cerr << "CAENMCASim: unsupported or invalid SetData of type " << dataType << " mask 0x" << std::hex << bit << std::dec
+                      << " for handle \"" << obj->name << "\"" << std::endl;
+            return CAEN_MCA_RetCode_Argument;
+        }
+    }
+    return CAEN_MCA_RetCode_Success;
+}
+
+int32_t SimDevice::sendCommand(SimObject* obj, CAEN_MCA_CommandType_t cmdType, uint64_t cmdMaskIn, uint64_t cmdMaskOut, va_list* ap)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    uint32_t reg_addr = 0, reg_data = 0, reg_mask = 0xffffffff, list_offset = 0;
+    std::string save_name;
+    FOR_EACH_MASK_BIT(bit, cmdMaskIn)
+    {
+        if (bit == DATAMASK_CMD_REG_ADDR)
+        {
+            reg_addr = va_arg(*ap, uint32_t);
+        }
+        else if (bit == DATAMASK_CMD_REG_DATA)
+        {
+            reg_data = va_arg(*ap, uint32_t);
+        }
+        else if (bit == DATAMASK_CMD_REG_MASK)
+        {
+            reg_mask = va_arg(*ap, uint32_t);
+        }
+        else if (bit == DATAMASK_CMD_SAVE_NAME)
+        {
+            save_name = va_arg(*ap, const char*);
+        }
+        else if (bit == DATAMASK_CMD_SAVE_LIST_OFFSET)
+        {
+            list_offset = va_arg(*ap, uint32_t);
+        }
+        else
+        {
+            std::cerr << "CAENMCASim: unsupported command " << cmdType << " input mask 0x" << std::hex << bit << std::dec << std::endl;
+            return CAEN_MCA_RetCode_Argument;
+        }
+    }
+    SimHVChannel* hv = (obj->type == CAEN_MCA_HANDLE_HVCHANNEL ? &(m_hv[obj->index]) : NULL);
+    SimSpectrum* spec = spectrum(obj);
+    switch(cmdType)
+    {
+    case CAEN_MCA_CMD_ACQ_START:
+    case CAEN_MCA_CMD_ACQ_STOP:
+        for(int i=0; i<SIM_NCHANNELS; ++i)
+        {
+            if (obj == root || obj == m_channels[i].handle)
+            {
+                (cmdType == CAEN_MCA_CMD_ACQ_START ? startAcquisition(m_channels[i]) : stopAcquisition(m_channels[i]));
+            }
+        }
+        break;
+    case CAEN_MCA_CMD_RESTART:
+        std::cerr << "CAENMCASim: restarting " << m_path << std::endl;
+        for(int i=0; i<SIM_NCHANNELS; ++i)
+        {
+            stopAcquisition(m_channels[i]);
+        }
+        break;
+    case CAEN_MCA_CMD_ENERGYSPECTRUM_CLEAR:
+        if (spec == NULL)
+        {
+            return CAEN_MCA_RetCode_Handle;
+        }
+        spec->clear();
+        break;
+    case CAEN_MCA_CMD_HV_ON:
+    case CAEN_MCA_CMD_HV_OFF:
+        if (hv == NULL)
+        {
+            return CAEN_MCA_RetCode_Handle;
+        }
+        hv->v_from = hvOutput(*hv, childHandle(obj, CAEN_MCA_HANDLE_HVRANGE, (int32_t)parameterHandle(obj, "PARAM_HVCH_ACTIVE_RANGE")->value));
+        hv->changed = epicsTime::getCurrent();
+        hv->on = (cmdType == CAEN_MCA_CMD_HV_ON);
+        break;
+    case CAEN_MCA_CMD_HV_ONOFF:
+        if (hv == NULL)
+        {
+            return CAEN_MCA_RetCode_Handle;
+        }
+        break;
+    case CAEN_MCA_CMD_REGISTER_READ:
+        break;
+    case CAEN_MCA_CMD_REGISTER_WRITE:
+        m_registers[reg_addr] = (m_registers[reg_addr] & ~reg_mask) | (reg_data & reg_mask);
+        break;
+    case CAEN_MCA_CMD_CONFIGURATION_LOAD:
+        if (!save_name.empty() && std::find(m_configurations.begin(), m_configurations.end(), save_name) == m_configurations.end())
+        {
+            std::cerr << "CAENMCASim: no configuration \"" << save_name << "\"" << std::endl;
+            return CAEN_MCA_RetCode_Argument;
+        }
+        std::cerr << "CAENMCASim: loaded configuration \"" << (save_name.empty() ? m_configurations.back() : save_name) << "\"" << std::endl;
+        break;
+    case CAEN_MCA_CMD_CONFIGURATION_LIST:
+        break;
+    default:
+        std::cerr << "CAENMCASim: unsupported command " << cmdType << " for handle \"" << obj->name << "\"" << std::endl;
+        return CAEN_MCA_RetCode_Argument;
+    }
+    FOR_EACH_MASK_BIT(bit, cmdMaskOut)
+    {
+        if (bit == DATAMASK_CMD_REG_DATA)
+        {
+            *va_arg(*ap, uint32_t*) = m_registers[reg_addr];
+        }
+        else if (bit == DATAMASK_CMD_HVOUTPUT_STATUS && hv != NULL)
+        {
+            *va_arg(*ap, uint32_t*) = (hv->on ? 1 : 0);
+        }
+        else if (bit == DATAMASK_CMD_SAVE_LIST_COUNT)
+        {
+            *va_arg(*ap, uint32_t*) = (list_offset < m_configurations.size() ? (uint32_t)(m_configurations.size() - list_offset) : 0);
+        }
+        else if (bit == DATAMASK_CMD_SAVE_LIST_NAMES)
+        {
+            char** names = va_arg(*ap, char**);
+            for(size_t i=list_offset; i<m_configurations.size() && i - list_offset < CONFIGSAVE_LIST_MAXLEN; ++i)
+            {
+                copyString(names[i - list_offset], m_configurations[i], CONFIGSAVE_FULLPATH_MAXLEN);
+            }
+        }
+        else
+        {
+            std::cerr << "CAENMCASim: unsupported command " << cmdType << " output mask 0x" << std::hex << bit << std::dec << std::endl;
+            return CAEN_MCA_RetCode_Argument;
+        }
+    }
+    return CAEN_MCA_RetCode_Success;
+}
+
+/// called with the lock held. The list file is created afresh when its name has changed since the last
+/// acquisition, otherwise acquisition continues to append to it with the time tags carrying on
+void SimDevice::startAcquisition(SimChannel& chan)
+{
+    if (chan.acquiring)
+    {
+        return;
+    }
+    chan.acquiring = true;
+    chan.start_time = epicsTime::getCurrent();
+    chan.nframes = 0;
+    chan.nevts = 0;
+    if (!chan.list_enabled || chan.savemode != CAEN_MCA_SAVEMODE_FILE_BINARY || chan.list_filename.empty())
+    {
+        return;
+    }
+    bool append = (chan.synth && chan.synth_filename == chan.list_filename);
+    if (!append)
+    {
+        ListModeSynthSettings synth_settings = settings.synth;
+        synth_settings.seed = settings.synth.seed + m_serial * SIM_NCHANNELS + chan.handle->index;
+        chan.synth.reset(new ListModeSynth(synth_settings));
+        chan.synth_filename = chan.list_filename;
+    }
+    std::string filename = settings.storage + "/" + chan.list_filename;
+#ifdef _WIN32
+    std::replace(filename.begin(), filename.end(), '/', '\\');
+#else
+    std::replace(filename.begin(), filename.end(), '\\', '/');
+#endif /* _WIN32 */
+    makeDirectories(filename);
+    if ( (chan.f = _fsopen(filename.c_str(), (append ? "ab" : "wb"), _SH_DENYNO)) == NULL )
+    {
+        std::cerr << "CAENMCASim: unable to open list file \"" << filename << "\": " << strerror(errno) << std::endl;
+    }
+}
+
+void SimDevice::stopAcquisition(SimChannel& chan)
+{
+    chan.acquiring = false;
+    if (chan.f != NULL)
+    {
+        fclose(chan.f);
+        chan.f = NULL;
+    }
+}
+
+/// generate the frames that would have arrived by now, called with the lock held. At most half a
+/// second of frames is made in one go so a slow host falls behind rather than holding the lock
+void SimDevice::generate(SimChannel& chan, const epicsTime& now)
+{
+    const ListModeSynthSettings& ss = settings.synth;
+    int64_t nframes_due = (int64_t)((now - chan.start_time) * ss.frame_rate) - chan.nframes;
+    nframes_due = std::min(nframes_due, (int64_t)(0.5 * ss.frame_rate) + 1);
+    if (nframes_due <= 0)
+    {
+        return;
+    }
+    if (!chan.synth)
+    {
+        // not writing a file, still make events for the spectra and memory list mode
+        ListModeSynthSettings synth_settings = ss;
+        synth_settings.seed = ss.seed + m_serial * SIM_NCHANNELS + chan.handle->index;
+        chan.synth.reset(new ListModeSynth(synth_settings));
+        chan.synth_filename.clear();
+    }
+    size_t data_size = 0;
+    uint64_t nevents = 0;
+    for(int64_t i=0; i<nframes_due; ++i)
+    {
+        nevents += chan.synth->appendFrame(chan.data, data_size);
+    }
+    chan.nframes += nframes_due;
+    uint64_t elapsed_ns = (uint64_t)(nframes_due * chan.synth->framePeriod() / 1000);
+    uint64_t dead_ns = std::min(elapsed_ns, nevents * SIM_DEADTIME_NS);
+    size_t maxnevts = (chan.maxnevts > 0 ? std::min((size_t)chan.maxnevts, (size_t)LISTS_DATA_MAXLEN) : (size_t)LISTS_DATA_MAXLEN);
+    bool to_memory = (chan.list_enabled && chan.savemode == CAEN_MCA_SAVEMODE_MEMORY);
+    for(int s=0; s<SIM_NSPECTRA; ++s)
+    {
+        SimSpectrum& spec = chan.spectra[s];
+        spec.realtime += elapsed_ns;
+        spec.deadtime += dead_ns;
+        spec.livetime = spec.realtime - spec.deadtime;
+    }
+    for(const char* p = chan.data.data(); p < chan.data.data() + data_size; p += ListModeDecoder::EVENT_SIZE)
+    {
+        uint64_t trigger_time;
+        int16_t energy;
+        uint32_t extras;
+        memcpy(&trigger_time, p, sizeof(trigger_time));
+        memcpy(&energy, p + 8, sizeof(energy));
+        memcpy(&extras, p + 10, sizeof(extras));
+        ListModeEvent::Type type = ListModeEvent::classify(energy, extras);
+        if (to_memory && (chan.getfake || type != ListModeEvent::FRAME_START) && chan.mem_timetag.size() < maxnevts)
+        {
+            chan.mem_timetag.push_back(trigger_time);
+            chan.mem_energy.push_back((uint32_t)energy);
+            chan.mem_flags.push_back((uint16_t)extras);
+        }
+        if (type == ListModeEvent::FRAME_START)
+        {
+            continue;
+        }
+        for(int s=0; s<SIM_NSPECTRA; ++s)
+        {
+            SimSpectrum& spec = chan.spectra[s];
+            ++spec.nentries;
+            if (type == ListModeEvent::DETECTOR)
+            {
+                ++spec.counts[((uint32_t)energy * spec.nbins) >> SIM_ENERGY_BITS];
+            }
+            else if (type == ListModeEvent::DETECTOR_OVERFLOW)
+            {
+                ++spec.overflows;
+            }
+            else
+            {
+                ++spec.underflows;
+            }
+        }
+    }
+    if (to_memory)
+    {
+        chan.nevts = (uint32_t)chan.mem_timetag.size();
+    }
+    else if (chan.f != NULL)
+    {
+        if (fwrite(chan.data.data(), 1, data_size, chan.f) != data_size)
+        {
+            std::cerr << "CAENMCASim: list file write error" << std::endl;
+        }
+        fflush(chan.f);
+        chan.nevts += (uint32_t)nevents;
+    }
+}
+
+void SimDevice::simTask()
+{
+    while (!m_stop)
+    {
+        m_wake.wait(0.01);
+        epicsGuard<epicsMutex> _lock(m_lock);
+        epicsTime now(epicsTime::getCurrent());
+        for(int i=0; i<SIM_NCHANNELS && !m_stop; ++i)
+        {
+            if (m_channels[i].acquiring)
+            {
+                generate(m_channels[i], now);
+            }
+        }
+    }
+    m_done.signal();
+}
+
+CAENMCASim::Settings& CAENMCASim::settings()
+{
+    static Settings s;
+    return s;
+}
+
+CAEN_MCA_HANDLE CAENMCASim::OpenDevice(const std::string& path, int32_t* retcode, int32_t* index)
+{
+    static uint32_t serial = 90000;
+    SimDevice* device = new SimDevice(path, settings(), ++serial);
+    if (retcode != NULL)
+    {
+        *retcode = CAEN_MCA_RetCode_Success;
+    }
+    if (index != NULL)
+    {
+        *index = 0;
+    }
+    return device->root;
+}
+
+void CAENMCASim::CloseDevice(CAEN_MCA_HANDLE handle)
+{
+    SimObject* obj = static_cast<SimObject*>(handle);
+    if (obj != NULL)
+    {
+        delete obj->device;
+    }
+}
+
+int32_t CAENMCASim::GetDataV(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list args)
+{
+    SimObject* obj = static_cast<SimObject*>(handle);
+    if (obj == NULL)
+    {
+        return CAEN_MCA_RetCode_Handle;
+    }
+    obj->device->delay();
+    va_list ap;
+    va_copy(ap, args);
+    int32_t retcode = obj->device->getData(obj, dataType, dataMask, &ap);
+    va_end(ap);
+    return retcode;
+}
+
+int32_t CAENMCASim::SetDataV(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list args)
+{
+    SimObject* obj = static_cast<SimObject*>(handle);
+    if (obj == NULL)
+    {
+        return CAEN_MCA_RetCode_Handle;
+    }
+    obj->device->delay();
+    va_list ap;
+    va_copy(ap, args);
+    int32_t retcode = obj->device->setData(obj, dataType, dataMask, &ap);
+    va_end(ap);
+    return retcode;
+}
+
+int32_t CAENMCASim::SendCommandV(CAEN_MCA_HANDLE handle, CAEN_MCA_CommandType_t cmdType, uint64_t cmdMaskIn, uint64_t cmdMaskOut, va_list args)
+{
+    SimObject* obj = static_cast<SimObject*>(handle);
+    if (obj == NULL)
+    {
+        return CAEN_MCA_RetCode_Handle;
+    }
+    obj->device->delay();
+    va_list ap;
+    va_copy(ap, args);
+    int32_t retcode = obj->device->sendCommand(obj, cmdType, cmdMaskIn, cmdMaskOut, &ap);
+    va_end(ap);
+    return retcode;
+}
+
+CAEN_MCA_HANDLE CAENMCASim::GetChildHandle(CAEN_MCA_HANDLE handle, CAEN_MCA_HandleType_t handleType, int32_t index)
+{
+    SimObject* obj = static_cast<SimObject*>(handle);
+    return (obj != NULL ? obj->device->childHandle(obj, handleType, index) : NULL);
+}
+
+CAEN_MCA_HANDLE CAENMCASim::GetChildHandleByName(CAEN_MCA_HANDLE handle, CAEN_MCA_HandleType_t handleType, const char* name)
+{
+    SimObject* obj = static_cast<SimObject*>(handle);
+    if (obj == NULL || handleType != CAEN_MCA_HANDLE_PARAMETER || name == NULL)
+    {
+        return NULL;
+    }
+    return obj->device->parameterHandle(obj, name);
+}
+
+std::string CAENMCASim::storagePath(CAEN_MCA_HANDLE device)
+{
+    SimObject* obj = static_cast<SimObject*>(device);
+    return (obj != NULL ? obj->device->settings.storage : std::string());
+}
+
+extern "C" {
+
+	/// set up devices created afterwards by CAENMCAConfigure with simulate set
+	int CAENMCASimConfigure(double latencyMs, double eventRate, double frameRate, const char* storage)
+	{
+		CAENMCASim::Settings& s = CAENMCASim::settings();
+		s.latency = (latencyMs > 0.0 ? latencyMs / 1000.0 : 0.0);
+		if (eventRate > 0.0)
+		{
+			s.synth.event_rate = eventRate;
+		}
+		if (frameRate > 0.0)
+		{
+			s.synth.frame_rate = frameRate;
+		}
+		if (storage != NULL && *storage != '\0')
+		{
+			s.storage = storage;
+		}
+		return 0;
+	}
+
+	static const iocshArg simArg0 = { "latencyMs", iocshArgDouble };		///< delay added to each simulated data or command call
+	static const iocshArg simArg1 = { "eventRate", iocshArgDouble };		///< mean detector events per second per channel
+	static const iocshArg simArg2 = { "frameRate", iocshArgDouble };		///< frame triggers per second
+	static const iocshArg simArg3 = { "storage", iocshArgString };			///< directory simulated list files are written under
+
+	static const iocshArg * const simArgs[] = { &simArg0, &simArg1, &simArg2, &simArg3 };
+
+	static const iocshFuncDef simFuncDef = { "CAENMCASimConfigure", sizeof(simArgs) / sizeof(iocshArg*), simArgs };
+
+	static void simCallFunc(const iocshArgBuf *args)
+	{
+		CAENMCASimConfigure(args[0].dval, args[1].dval, args[2].dval, args[3].sval);
+	}
+
+	static void CAENMCASimRegister(void)
+	{
+		iocshRegister(&simFuncDef, simCallFunc);
+	}
+
+	epicsExportRegistrar(CAENMCASimRegister);
+}
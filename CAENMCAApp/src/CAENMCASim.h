@@ -0,0 +1,55 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file CAENMCASim.h In process simulation of a CAEN Hexagon.
+///
+/// Provides the subset of the CAEN MCA library the driver uses, with the same calling conventions
+/// and return codes, so CAENMCA can route calls here when simulating. A simulated device keeps its
+/// parameter, register, high voltage and list mode state, and while acquisition is running it
+/// generates list mode data at the configured rates, appending it to the channel list file under
+/// the storage directory and accumulating it into the energy spectra. Each data and command call
+/// can be delayed to mimic the network round trip to a real board.
+
+#ifndef CAENMCASIM_H
+#define CAENMCASIM_H
+
+#include <string>
+#include <cstdarg>
+#include <cstdint>
+
+#include <CAENMCA.h>
+
+#include "listsynth.h"
+
+class CAENMCASim
+{
+public:
+    /// configuration of simulated devices, applied to devices opened after it is changed
+    struct Settings
+    {
+        double latency;                 ///< seconds added to every data or command call
+        std::string storage;            ///< directory list files are written under, stands in for the board storage share
+        ListModeSynthSettings synth;    ///< shape of the generated list mode data
+        Settings() : latency(0.0), storage(".")
+        {
+            synth.event_rate = 1.0e5;
+        }
+    };
+    static Settings& settings();
+
+    static CAEN_MCA_HANDLE OpenDevice(const std::string& path, int32_t* retcode, int32_t* index);
+    static void CloseDevice(CAEN_MCA_HANDLE handle);
+    static int32_t GetDataV(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list args);
+    static int32_t SetDataV(CAEN_MCA_HANDLE handle, CAEN_MCA_DataType_t dataType, uint64_t dataMask, va_list args);
+    static int32_t SendCommandV(CAEN_MCA_HANDLE handle, CAEN_MCA_CommandType_t cmdType, uint64_t cmdMaskIn, uint64_t cmdMaskOut, va_list args);
+    static CAEN_MCA_HANDLE GetChildHandle(CAEN_MCA_HANDLE handle, CAEN_MCA_HandleType_t handleType, int32_t index);
+    static CAEN_MCA_HANDLE GetChildHandleByName(CAEN_MCA_HANDLE handle, CAEN_MCA_HandleType_t handleType, const char* name);
+    /// directory the list file names of the device are relative to
+    static std::string storagePath(CAEN_MCA_HANDLE device);
+};
+
+#endif /* CAENMCASIM_H */
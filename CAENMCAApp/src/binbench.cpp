@@ -0,0 +1,125 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file binbench.cpp Compare event rates of floating point and integer time binning.
+///
+/// usage: binbench [nevents] [repeats] [energy bin group]
+///
+/// Synthetic events with times since frame start spread over 20ms are binned into a time spectrum
+/// and a 2D time v energy map, once with the floating point division previously used in the
+/// event loop and once with #UniformBinner, for several axes. Events per second for each method
+/// and the number of events given a different bin are printed.
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+
+#include <epicsTime.h>
+
+#include "binning.h"
+
+struct BenchAxis
+{
+    const char* desc;
+    double tmin, tmax;
+    int nbins;
+};
+
+static const BenchAxis axes[] = {
+    { "20ms in 1024 bins of 19531.25ns", 0.0, 20000000.0, 1024 },
+    { "20ms in 10000 bins of 2000ns", 0.0, 20000000.0, 10000 },
+    { "16.78ms in 4096 bins of 4096ns", 0.0, 16777216.0, 4096 },
+    { "1000ns to 2ms in 4000 bins of 499.75ns", 1000.0, 2000000.0, 4000 },
+    { "0 to 1000ns in 3 bins of 333.3ns", 0.0, 1000.0, 3 }
+};
+
+int main(int argc, char* argv[])
+{
+    size_t nevents = (argc > 1 ? atol(argv[1]) : 10000000);
+    int repeats = (argc > 2 ? atoi(argv[2]) : 5);
+    int eng_bin_group = (argc > 3 ? atoi(argv[3]) : 16);
+    if (eng_bin_group <= 0)
+    {
+        eng_bin_group = 1;
+    }
+    int nx = 32768 / eng_bin_group;
+    std::vector<uint64_t> tdiff(nevents);
+    std::vector<int16_t> energy(nevents);
+    srand(1);
+    for(size_t i=0; i<nevents; ++i)
+    {
+        tdiff[i] = ((uint64_t)rand() * (RAND_MAX + 1ULL) + rand()) % 20000000;
+        energy[i] = 1 + rand() % 32766;
+    }
+    for(size_t a=0; a<sizeof(axes) / sizeof(axes[0]); ++a)
+    {
+        const BenchAxis& ax = axes[a];
+        double binw = (ax.tmax - ax.tmin) / ax.nbins;
+        std::vector<double> spec_float(ax.nbins), spec_int(ax.nbins);
+        std::vector<int32_t> map_float(nx * ax.nbins), map_int(nx * ax.nbins);
+        UniformBinner tbin;
+        tbin.set(ax.tmin, ax.tmax, ax.nbins);
+        int eng_shift = -1;
+        for(int i=0; i<16; ++i)
+        {
+            if (eng_bin_group == (1 << i))
+            {
+                eng_shift = i;
+            }
+        }
+        epicsTimeStamp t0, t1, t2;
+        epicsTimeGetCurrent(&t0);
+        for(int r=0; r<repeats; ++r)
+        {
+            for(size_t i=0; i<nevents; ++i)
+            {
+                int n = (int)((tdiff[i] - ax.tmin) / binw);
+                if (n >= 0 && n < ax.nbins)
+                {
+                    spec_float[n] += 1.0;
+                    int ne = energy[i] / eng_bin_group;
+                    if (ne < nx)
+                    {
+                        ++(map_float[n * nx + ne]);
+                    }
+                }
+            }
+        }
+        epicsTimeGetCurrent(&t1);
+        const UniformBinner tb = tbin;
+        for(int r=0; r<repeats; ++r)
+        {
+            for(size_t i=0; i<nevents; ++i)
+            {
+                int n = tb.bin(tdiff[i]);
+                if (n >= 0)
+                {
+                    spec_int[n] += 1.0;
+                    int ne = (eng_shift >= 0 ? energy[i] >> eng_shift : energy[i] / eng_bin_group);
+                    if (ne < nx)
+                    {
+                        ++(map_int[n * nx + ne]);
+                    }
+                }
+            }
+        }
+        epicsTimeGetCurrent(&t2);
+        double nev = (double)nevents * repeats;
+        double float_rate = nev / epicsTimeDiffInSeconds(&t1, &t0), int_rate = nev / epicsTimeDiffInSeconds(&t2, &t1);
+        double ndiff = 0.0;
+        for(int i=0; i<ax.nbins; ++i)
+        {
+            ndiff += fabs(spec_float[i] - spec_int[i]);
+        }
+        printf("%s (binner mode %d): float %.1f Mevents/s, integer %.1f Mevents/s, speedup %.2f, bin differences %.0f\n",
+               ax.desc, tbin.mode(), float_rate / 1.0e6, int_rate / 1.0e6, int_rate / float_rate, ndiff / repeats);
+    }
+    return 0;
+}
@@ -4,12 +4,14 @@
 #include <string>
 #include <cstdio>
 #include <cstring>
-#include <epicsThread.h>
 
 #include <highfive/highfive.hpp>
 namespace hf = HighFive;
 
 #include "h5nexus.h"
+#include "listmode.h"
+#include "flagstats.h"
+#include "filewatch.h"
 
 #ifndef _WIN32
 #define _fsopen(a,b,c) fopen(a,b)
@@ -17,19 +19,6 @@ namespace hf = HighFive;
 #define _fseeki64 fseek
 #endif /* ndef _WIN32 */
 
-static std::string describeFlags(unsigned flags);
-
-// add n items to dataset that already contains n_total
-template <typename T>
-void appendData(size_t n, size_t n_total, hf::DataSet& dset, T* data)
-{
-    if (n == 0)
-    {
-        return;
-    }
-    dset.resize({n_total + n});
-    dset.select({n_total}, {n}).write_raw(data);    
-}
 
 static const char* getArgStr(int arg, int argc, char* argv[], const char* default_arg)
 {
@@ -65,8 +54,9 @@ static void addDetector(hf::Group& parent, int index, const std::string& input_f
     std::vector<int32_t> event_energy_raw(NEVENTS_READ);
     std::vector<double> event_energy(NEVENTS_READ);
     std::vector<uint32_t> event_flags(NEVENTS_READ);
+    FlagCounts flag_counts;
     
-    const size_t EVENT_SIZE = 14;
+    const size_t EVENT_SIZE = ListModeDecoder::EVENT_SIZE;
 
     if ( (sizeof(trigger_time) + sizeof(energy_raw) + sizeof(extras)) != EVENT_SIZE )
     {
@@ -92,71 +82,33 @@ static void addDetector(hf::Group& parent, int index, const std::string& input_f
 
     // wait for file access
     FILE* f = NULL;
-    while( (f = _fsopen((input_filedir + "\\" + input_filename).c_str(), "rb", _SH_DENYNO)) == NULL )
+    FileWatcher watcher;
+    watcher.watch(input_filedir + "\\" + input_filename);
+    while( (f = _fsopen(watcher.path().c_str(), "rb", _SH_DENYNO)) == NULL )
     {
-        epicsThreadSleep(1.0);
+        watcher.wait(false);
     }
 
     int frame = -1;
-    int64_t last_pos, current_pos, new_bytes, nevents = 0;
+    int64_t nread;
     size_t nevents_total = 0, nevents_raw_total = 0, nframes_total = 0;
     uint64_t frame_start = 0;
-    while(true)
+    ListModeDecoder decoder(NEVENTS_READ * ListModeDecoder::EVENT_SIZE);
+    ListModeBatch batch;
+    while( (nread = decoder.read(f, INT64_MAX, batch)) > 0 )
     {
-        if ( (last_pos = _ftelli64(f)) == -1 )
-        {
-            std::cerr << "ftell last error" << std::endl;
-            return;
-        }
-        if (_fseeki64(f, 0, SEEK_END) != 0)
-        {
-            std::cerr << "fseek forward error" << std::endl;
-            return;
-        }   
-        if ( (current_pos = _ftelli64(f)) == -1)
-        {
-            std::cerr << "ftell curr error" << std::endl;
-            return;
-        }
-        if (_fseeki64(f, last_pos, SEEK_SET) != 0)
-        {
-            std::cerr << "fseek back error" << std::endl;
-            return;
-        }   
-        new_bytes = current_pos - last_pos;
-        nevents = new_bytes / EVENT_SIZE;
-        if (nevents > NEVENTS_READ)
+        size_t n = 0, nf = 0, nevents = batch.size();
+        for(size_t j=0; j<nevents; ++j)
         {
-            nevents = NEVENTS_READ;
-        }
-        if (nevents == 0)
-        {
-            break;
-        }   
-        size_t n = 0, nf = 0;
-        for(int j=0; j<nevents; ++j)
-        {            
-            if (fread(&trigger_time, sizeof(trigger_time), 1, f) != 1)
-            {
-                std::cerr << "fread time error" << std::endl;
-                return;
-            }
-            if (fread(&energy_raw, sizeof(energy_raw), 1, f) != 1)
-            {
-                std::cerr << "fread energy error" << std::endl;
-                return;
-            }
-            if (fread(&extras, sizeof(extras), 1, f) != 1)
-            {
-                std::cerr << "fread extras error" << std::endl;
-                return;
-            }
+            trigger_time = batch.trigger_time[j];
+            energy_raw = batch.energy[j];
+            extras = batch.extras[j];
             // reference to time of first event
             if (!reference_time_set) {
                 reference_time = trigger_time;
                 reference_time_set = true;
             }
-            if (extras == 0x8 && energy_raw == 0)
+            if (ListModeEvent::isFrameStart(energy_raw, extras))
             {
                 ++frame;
                 frame_start = trigger_time;
@@ -172,7 +124,7 @@ static void addDetector(hf::Group& parent, int index, const std::string& input_f
             if (frame < 0) {
                 continue; // skip events until see first frame
             }
-            if ( energy_raw > 0 && energy_raw != 32767 && !(extras & 0x8) )
+            if ( ListModeEvent::isValid(energy_raw, extras) )
             {
                 event_energy_raw[n] = energy_raw;
                 event_energy[n] = energy_a * energy_raw + energy_b;
@@ -186,6 +138,7 @@ static void addDetector(hf::Group& parent, int index, const std::string& input_f
                 ++n; // real event
             }
         }
+        flag_counts.count(batch.extras.data(), nevents);
         appendData(nf, nframes_total, dset_event_frame_number, event_frame_number.data());
         appendData(nf, nframes_total, dset_event_index, event_index.data());
         appendData(nf, nframes_total, dset_event_time_zero, event_time_zero.data());
@@ -198,11 +151,15 @@ static void addDetector(hf::Group& parent, int index, const std::string& input_f
         nframes_total += nf;
         nevents_raw_total += nevents;
     }
+    if (nread < 0) {
+        std::cerr << "fread error" << std::endl;
+    }
     fclose(f);
     if (nframes_total != frame + 1) {
         std::cerr << "frame total error" << std::endl;
     }
     std::cout << "Processed " << nframes_total << " frames with "<< nevents_total << " detector events and " << nevents_raw_total - nevents_total - nframes_total << " other events" << std::endl; 
+    flag_counts.print(std::cout);
 }
 
 // args: output_filename file_prefix run_number { dev_name addr hex_dir hex_file a b } * 4
@@ -221,62 +178,3 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-static std::string describeFlags(unsigned flags)
-{
-    std::string s;
-    if (flags & 0x1)
-    {
-        s += "First event after a dead time occurrence, ";
-        flags &= ~0x1;
-    }
-    if (flags & 0x2)
-    {
-        s += "Time tag rollover, ";
-        flags &= ~0x2;
-    }
-    if (flags & 0x4)
-    {
-        s += "Time tag reset, ";
-        flags &= ~0x4;
-    }
-    if (flags & 0x8)
-    {
-        s += "Fake event, ";
-        flags &= ~0x8;
-    }
-    if (flags & 0x80)
-    {
-        s += "Event energy saturated, ";
-        flags &= ~0x80;
-    }
-    if (flags & 0x400)
-    {
-        s += "Input dynamics saturated event, ";
-        flags &= ~0x400;
-    }
-    if (flags & 0x8000)
-    {
-        s += "Pile up event, ";
-        flags &= ~0x8000;
-    }
-    if (flags & 0x10000)
-    {
-        s += "Deadtime calc event, ";
-        flags &= ~0x10000;
-    }
-    if (flags & 0x20000)
-    {
-        s += "Event outside SCA interval, ";
-        flags &= ~0x20000;
-    }
-    if (flags & 0x40000)
-    {
-        s += "Event occurred during saturation inhibit, ";
-        flags &= ~0x40000;
-    }
-    if (flags != 0)
-    {
-        s += "Unknown flag";
-    }
-    return s;
-}
@@ -1,3 +1,15 @@
 hf::Group createNeXusGroup(hf::File& current, const std::string& name, const std::string& nxclass);
 hf::Group createNeXusGroup(hf::Group& current, const std::string& name, const std::string& nxclass);
 void createNeXusStructure(const std::string&filename, hf::File& out_file);
+
+// add n items to dataset that already contains n_total
+template <typename T>
+void appendData(size_t n, size_t n_total, hf::DataSet& dset, T* data)
+{
+    if (n == 0)
+    {
+        return;
+    }
+    dset.resize({n_total + n});
+    dset.select({n_total}, {n}).write_raw(data);    
+}
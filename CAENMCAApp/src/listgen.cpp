@@ -0,0 +1,189 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file listgen.cpp Generate a synthetic Hexagon binary list mode file.
+///
+/// usage: listgen output_file [name=value ...]
+///
+/// Frames start with a frame sync fake event (extras 0x8, energy 0) at the trigger rate. Each frame
+/// holds a Poisson distributed number of detector events whose times since the frame start follow
+/// an exponential decay, on top of a flat background, and whose energies are drawn from a line spectrum.
+/// Pile up, saturation and time tag rollover flags are injected at the given rates.
+///
+///   seconds=10            length of run to generate, in seconds of time tag
+///   frame_rate=50         frame triggers per second
+///   event_rate=1e6        mean detector events per second
+///   decay_ns=2e6          decay time constant of the event time structure, 0 for flat
+///   flat=0.1              fraction of events spread uniformly over the frame
+///   lines=1000:20:1,5000:50:0.5,12000:80:0.2   energy lines as channel:sigma:weight
+///   continuum=0.2         fraction of energies spread uniformly over the ADC range
+///   pileup=0.01           probability of an event being flagged pile up (0x8000), with summed energy
+///   saturated=0.001       probability of an event being saturated (0x80, energy 32767)
+///   rollover_s=0          time tag rollover (0x2) flagged on the first event every rollover_s seconds, 0 for none
+///   realtime=0            if 1, append frames to the file at the rate they would arrive from the board
+///   append=0              if 1, add to the end of an existing file continuing on from its last time tag
+///   seed=1                random number seed, the same seed always gives the same file
+///
+/// The real time mode writes and flushes a block of frames every 10 ms, so the IOC tailing the file
+/// or fileconverter see it grow as they would during a run, and reports if it falls behind.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "listmode.h"
+#include "listsynth.h"
+
+#ifndef _WIN32
+#define _fsopen(a,b,c) fopen(a,b)
+#define _ftelli64 ftello
+#define _fseeki64 fseeko
+#endif /* ndef _WIN32 */
+
+static double getOption(const std::map<std::string, std::string>& options, const char* name, double default_value)
+{
+    std::map<std::string, std::string>::const_iterator it = options.find(name);
+    return (it != options.end() ? atof(it->second.c_str()) : default_value);
+}
+
+/// time tag (ps) of the last complete record of an existing list file, or 0 if there is none
+static uint64_t lastTimeTag(const char* filename)
+{
+    uint64_t trigger_time = 0;
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    if (_fseeki64(f, 0, SEEK_END) == 0)
+    {
+        int64_t size = _ftelli64(f);
+        int64_t nrec = size / (int64_t)ListModeDecoder::EVENT_SIZE;
+        if (nrec > 0 && _fseeki64(f, (nrec - 1) * ListModeDecoder::EVENT_SIZE, SEEK_SET) == 0 &&
+            fread(&trigger_time, sizeof(trigger_time), 1, f) != 1)
+        {
+            trigger_time = 0;
+        }
+    }
+    fclose(f);
+    return trigger_time;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: listgen output_file [name=value ...], see listgen.cpp for options" << std::endl;
+        return 1;
+    }
+    const char* output_filename = argv[1];
+    std::map<std::string, std::string> options;
+    for(int i=2; i<argc; ++i)
+    {
+        const char* eq = strchr(argv[i], '=');
+        if (eq == NULL)
+        {
+            std::cerr << "ignoring argument \"" << argv[i] << "\", expected name=value" << std::endl;
+            continue;
+        }
+        options[std::string(argv[i], eq - argv[i])] = eq + 1;
+    }
+    ListModeSynthSettings settings;
+    double seconds = getOption(options, "seconds", 10.0);
+    settings.frame_rate = getOption(options, "frame_rate", settings.frame_rate);
+    settings.event_rate = getOption(options, "event_rate", settings.event_rate);
+    settings.decay_ns = getOption(options, "decay_ns", settings.decay_ns);
+    settings.flat = getOption(options, "flat", settings.flat);
+    settings.continuum = getOption(options, "continuum", settings.continuum);
+    settings.pileup = getOption(options, "pileup", settings.pileup);
+    settings.saturated = getOption(options, "saturated", settings.saturated);
+    settings.rollover_s = getOption(options, "rollover_s", settings.rollover_s);
+    settings.seed = (unsigned)getOption(options, "seed", 1.0);
+    if (options.count("lines") > 0)
+    {
+        settings.lines = ListModeSynthSettings::parseLines(options["lines"]);
+    }
+    bool realtime = (getOption(options, "realtime", 0.0) != 0.0);
+    bool append = (getOption(options, "append", 0.0) != 0.0);
+    if (settings.frame_rate <= 0.0 || settings.event_rate < 0.0 || seconds <= 0.0)
+    {
+        std::cerr << "frame_rate and seconds must be > 0 and event_rate >= 0" << std::endl;
+        return 1;
+    }
+
+    const int64_t nframes = (int64_t)(seconds * settings.frame_rate);
+    uint64_t first_frame = (append ? lastTimeTag(output_filename) + (uint64_t)(1.0e12 / settings.frame_rate) : 0);
+    ListModeSynth synth(settings, first_frame);
+    FILE* f = _fsopen(output_filename, (append ? "ab" : "wb"), _SH_DENYNO);
+    if (f == NULL)
+    {
+        std::cerr << "Unable to open \"" << output_filename << "\"" << std::endl;
+        return 1;
+    }
+
+    std::vector<char> data;
+    size_t data_size = 0;
+    int64_t nevents_total = 0, nframes_written = 0, nlate = 0;
+    const double block_seconds = 0.01; // real time mode writes this much data at a time
+    const size_t MAX_BLOCK_BYTES = 16 * 1024 * 1024;
+    double next_write_s = block_seconds;
+    epicsTimeStamp start_time, now;
+    epicsTimeGetCurrent(&start_time);
+    for(int64_t frame=0; frame<nframes; ++frame)
+    {
+        nevents_total += synth.appendFrame(data, data_size);
+        ++nframes_written;
+        double frame_end_s = (double)(frame + 1) / settings.frame_rate;
+        if (data_size < MAX_BLOCK_BYTES && frame + 1 < nframes && (!realtime || frame_end_s < next_write_s))
+        {
+            continue;
+        }
+        if (realtime)
+        {
+            // hold the block until the wall clock reaches the end of its last frame
+            next_write_s = frame_end_s + block_seconds;
+            epicsTimeGetCurrent(&now);
+            double ahead = frame_end_s - epicsTimeDiffInSeconds(&now, &start_time);
+            if (ahead > 0.0)
+            {
+                epicsThreadSleep(ahead);
+            }
+            else if (ahead < -0.1)
+            {
+                ++nlate;
+            }
+        }
+        if (fwrite(data.data(), 1, data_size, f) != data_size)
+        {
+            std::cerr << "write error" << std::endl;
+            fclose(f);
+            return 1;
+        }
+        fflush(f);
+        data_size = 0;
+    }
+    fclose(f);
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &start_time);
+    std::cout << "Wrote " << nframes_written << " frames with " << nevents_total << " detector events in " << elapsed << " seconds ("
+              << (elapsed > 0.0 ? nevents_total / elapsed / 1.0e6 : 0.0) << " M events/s)" << std::endl;
+    if (nlate > 0)
+    {
+        std::cout << "Fell behind real time in " << nlate << " blocks" << std::endl;
+    }
+    return 0;
+}
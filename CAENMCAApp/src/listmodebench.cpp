@@ -0,0 +1,409 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file listmodebench.cpp Micro-benchmarks of the list mode event and image hot paths.
+///
+/// usage: listmodebench [nevents] [repeats] [baseline file] [hdf5 scratch file]
+///
+/// A synthetic list file of nevents records is generated in memory from a fixed seed, so every
+/// run sees the same input, and then put through record decode, event classification, flag
+/// statistics, 1D, 2D and gated binning, image generation for each NDDataType and HDF5 batch
+/// writes as done by fileconverter. Each benchmark is run repeats times and the fastest run is
+/// reported as items (events, or pixels for the image benchmarks) per second and ns per item.
+/// The output can be saved and given as the baseline file of a later run, which then also prints
+/// the ratio of each rate to its baseline, above 1 being faster.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <epicsTypes.h>
+
+#include <highfive/highfive.hpp>
+namespace hf = HighFive;
+
+#include "h5nexus.h"
+#include "listmode.h"
+#include "flagstats.h"
+#include "binning.h"
+#include "tiledhist.h"
+#include "histengine.h"
+#include "imagekernel.h"
+#include "histpyramid.h"
+#include "basehist.h"
+
+/// times benchmarks and prints their rates, optionally against a previous run
+class BenchRunner
+{
+public:
+    BenchRunner(int repeats, const char* baseline_file) : m_repeats(repeats > 0 ? repeats : 1)
+    {
+        if (baseline_file != NULL)
+        {
+            readBaseline(baseline_file);
+        }
+    }
+    /// time func(), which processes nitems items, and print the fastest of the repeats
+    template <typename Func>
+    void run(const std::string& name, size_t nitems, Func func)
+    {
+        double best = 0.0;
+        for(int r=0; r<m_repeats; ++r)
+        {
+            epicsTimeStamp t0, t1;
+            epicsTimeGetCurrent(&t0);
+            func();
+            epicsTimeGetCurrent(&t1);
+            double t = epicsTimeDiffInSeconds(&t1, &t0);
+            if (r == 0 || t < best)
+            {
+                best = t;
+            }
+        }
+        double rate = (best > 0.0 ? nitems / best : 0.0);
+        printf("%s\t%.2f\t%.3f", name.c_str(), rate / 1.0e6, (nitems > 0 ? 1.0e9 * best / nitems : 0.0));
+        std::map<std::string, double>::const_iterator it = m_baseline.find(name);
+        if (it != m_baseline.end() && it->second > 0.0)
+        {
+            printf("\t%.2f", rate / 1.0e6 / it->second);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+private:
+    int m_repeats;
+    std::map<std::string, double> m_baseline; ///< Mitems/s of each benchmark in the baseline run
+
+    void readBaseline(const char* filename)
+    {
+        std::ifstream fs(filename);
+        std::string line;
+        if (!fs.good())
+        {
+            std::cerr << "Unable to read baseline \"" << filename << "\"" << std::endl;
+            return;
+        }
+        while(std::getline(fs, line))
+        {
+            size_t tab = line.find('\t');
+            if (line.empty() || line[0] == '#' || tab == std::string::npos)
+            {
+                continue;
+            }
+            m_baseline[line.substr(0, tab)] = atof(line.c_str() + tab + 1);
+        }
+    }
+};
+
+/// xorshift64 generator, so the synthetic input is the same on every platform
+class BenchRandom
+{
+public:
+    explicit BenchRandom(uint64_t seed) : m_state(seed != 0 ? seed : 1) { }
+    uint64_t next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+    /// uniform in [0, n)
+    uint64_t below(uint64_t n) { return next() % n; }
+private:
+    uint64_t m_state;
+};
+
+static void appendRecord(std::vector<char>& data, uint64_t trigger_time, int16_t energy, uint32_t extras)
+{
+    char rec[ListModeDecoder::EVENT_SIZE];
+    memcpy(rec, &trigger_time, sizeof(trigger_time));
+    memcpy(rec + 8, &energy, sizeof(energy));
+    memcpy(rec + 10, &extras, sizeof(extras));
+    data.insert(data.end(), rec, rec + sizeof(rec));
+}
+
+/// a list file of nevents records: 20ms frames of about 1000 events, mostly valid detector events
+/// with a few pile up, saturated, outside SCA and time tag rollover flags set
+static void makeListFile(size_t nevents, std::vector<char>& data)
+{
+    static const uint64_t FRAME_PS = 20000000000ULL;
+    BenchRandom rnd(12345);
+    uint64_t frame_start = 0;
+    data.clear();
+    data.reserve(nevents * ListModeDecoder::EVENT_SIZE);
+    for(size_t i=0; i<nevents; ++i)
+    {
+        if (i % 1000 == 0)
+        {
+            frame_start += FRAME_PS;
+            appendRecord(data, frame_start, 0, ListModeEvent::FAKE_EVENT);
+            continue;
+        }
+        uint64_t r = rnd.below(1000);
+        int16_t energy = (int16_t)(1 + rnd.below(32766));
+        uint32_t extras = 0;
+        if (r < 10)
+        {
+            extras = 0x8000; // pile up
+        }
+        else if (r < 12)
+        {
+            extras = 0x80; // energy saturated
+            energy = ListModeEvent::ENERGY_OVERFLOW;
+        }
+        else if (r < 15)
+        {
+            extras = 0x20000; // outside SCA
+        }
+        else if (r == 15)
+        {
+            extras = 0x2; // rollover
+        }
+        appendRecord(data, frame_start + rnd.below(FRAME_PS), energy, extras);
+    }
+}
+
+/// time since frame start (ns) of each event, as found by histogramBatch()
+static void frameTimes(const ListModeBatch& batch, std::vector<uint64_t>& tdiff)
+{
+    uint64_t frame_time = 0;
+    tdiff.resize(batch.size());
+    for(size_t i=0; i<batch.size(); ++i)
+    {
+        uint64_t t = batch.trigger_time[i] / 1000;
+        if (ListModeEvent::isFrameStart(batch.energy[i], batch.extras[i]))
+        {
+            frame_time = t;
+        }
+        tdiff[i] = t - frame_time;
+    }
+}
+
+template <typename epicsTypeOut>
+static void benchImage(BenchRunner& runner, const char* type_name, const std::vector<epicsInt32>& map)
+{
+    static const char* trans_names[] = { "none", "sqrt", "log" };
+    std::vector<epicsTypeOut> image(map.size());
+    for(int trans_mode=0; trans_mode<3; ++trans_mode)
+    {
+        runner.run(std::string("image mono ") + type_name + " " + trans_names[trans_mode], map.size(), [&]() {
+            transformMono(map.data(), map.size(), 1.0, trans_mode, image.data());
+        });
+        runner.run(std::string("image mono ") + type_name + " " + trans_names[trans_mode] + " gain", map.size(), [&]() {
+            transformMono(map.data(), map.size(), 0.5, trans_mode, image.data());
+        });
+    }
+}
+
+template <typename T>
+static void benchAppend(BenchRunner& runner, hf::File& out_file, const char* type_name, size_t nevents, size_t batch_size)
+{
+    static int ndset = 0;
+    std::vector<T> values(batch_size);
+    for(size_t i=0; i<batch_size; ++i)
+    {
+        values[i] = static_cast<T>(i % 32768);
+    }
+    hf::DataSetCreateProps props;
+    props.add(hf::Chunking(std::vector<hsize_t>{batch_size}));
+    hf::DataSpace dataspace = hf::DataSpace({0}, {hf::DataSpace::UNLIMITED});
+    runner.run(std::string("hdf5 appendData ") + type_name, nevents, [&]() {
+        hf::DataSet dset = out_file.createDataSet(std::string(type_name) + std::to_string(ndset++), dataspace, hf::create_datatype<T>(), props);
+        size_t n_total = 0;
+        while (n_total < nevents)
+        {
+            size_t n = std::min(batch_size, nevents - n_total);
+            appendData(n, n_total, dset, values.data());
+            n_total += n;
+        }
+        out_file.flush();
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nevents = (argc > 1 ? atol(argv[1]) : 10000000);
+    int repeats = (argc > 2 ? atoi(argv[2]) : 5);
+    const char* baseline_file = (argc > 3 && strlen(argv[3]) > 0 ? argv[3] : NULL);
+    std::string h5_filename = (argc > 4 ? argv[4] : "listmodebench.h5");
+    if (nevents < 1000)
+    {
+        nevents = 1000;
+    }
+    std::vector<char> data;
+    makeListFile(nevents, data);
+    BenchRunner runner(repeats, baseline_file);
+    printf("# listmodebench nevents=%llu repeats=%d avx2=%d image_avx2=%d\n", (unsigned long long)nevents, repeats, (FlagCounts::usingAVX2() ? 1 : 0),
+           (imageKernelUsingAVX2() ? 1 : 0));
+    printf("# name\tMitems/s\tns/item\tratio to baseline\n");
+
+    // record decode, in the 1MB blocks read by processListFile()
+    ListModeBatch batch;
+    const size_t block = (1024 * 1024 / ListModeDecoder::EVENT_SIZE) * ListModeDecoder::EVENT_SIZE;
+    runner.run("decode", nevents, [&]() {
+        for(size_t offset=0; offset<data.size(); offset+=block)
+        {
+            batch.clear();
+            ListModeDecoder::decode(data.data() + offset, std::min(block, data.size() - offset), batch);
+        }
+    });
+    batch.clear();
+    ListModeDecoder::decode(data.data(), data.size(), batch);
+
+    // classification and flag statistics
+    std::vector<uint8_t> types;
+    std::vector<size_t> starts;
+    runner.run("classify", nevents, [&]() {
+        ListModeEvent::classify(batch, 0, batch.size(), types);
+    });
+    runner.run("find frame starts", nevents, [&]() {
+        starts.clear();
+        ListModeEvent::findFrameStarts(batch, 0, batch.size(), starts);
+    });
+    runner.run("flag counts", nevents, [&]() {
+        FlagCounts flags;
+        flags.count(batch.extras.data(), batch.size());
+    });
+    std::vector<uint64_t> tdiff;
+    runner.run("frame times", nevents, [&]() {
+        frameTimes(batch, tdiff);
+    });
+
+    // binning, with the default axes of the event spectra
+    std::vector<double> spec(10000);
+    UniformBinner tbin;
+    tbin.set(0.0, 20000000.0, (int)spec.size());
+    runner.run("bin 1D time", nevents, [&]() {
+        for(size_t i=0; i<batch.size(); ++i)
+        {
+            if (ListModeEvent::isValid(batch.energy[i], batch.extras[i]))
+            {
+                int n = tbin.bin(tdiff[i]);
+                if (n >= 0)
+                {
+                    spec[n] += 1.0;
+                }
+            }
+        }
+    });
+    const int eng_shift = 4, nx = 32768 >> eng_shift, ny = 1000;
+    TiledHistogram2D map2d;
+    map2d.resize(nx, ny);
+    UniformBinner tbin2d;
+    tbin2d.set(0.0, 20000000.0, ny);
+    runner.run("bin 2D time v energy", nevents, [&]() {
+        for(size_t i=0; i<batch.size(); ++i)
+        {
+            if (ListModeEvent::isValid(batch.energy[i], batch.extras[i]))
+            {
+                int n = tbin2d.bin(tdiff[i]);
+                if (n >= 0)
+                {
+                    map2d.add(batch.energy[i] >> eng_shift, n);
+                }
+            }
+        }
+    });
+    std::vector<GatedHistogramDef> defs(4);
+    for(size_t i=0; i<defs.size(); ++i)
+    {
+        defs[i].enabled = true;
+        defs[i].xmin = 0.0;
+        defs[i].xmax = 32768.0;
+        defs[i].nbins = 32768;
+    }
+    defs[1].tmin = 1000000.0;    // time gated energy spectrum
+    defs[1].tmax = 5000000.0;
+    defs[2].flag_mask = 0x8000;  // pile up energy spectrum
+    defs[2].flag_value = 0x8000;
+    defs[3].axis = GatedHistogramDef::AxisTime; // energy gated time spectrum
+    defs[3].emin = 1000;
+    defs[3].emax = 2000;
+    defs[3].xmax = 20000000.0;
+    defs[3].nbins = 10000;
+    GatedHistogramEngine hists;
+    hists.configure(defs);
+    runner.run("bin gated x4", nevents, [&]() {
+        for(size_t i=0; i<batch.size(); ++i)
+        {
+            if (ListModeEvent::isValid(batch.energy[i], batch.extras[i]))
+            {
+                hists.add(tdiff[i], batch.energy[i], batch.extras[i]);
+            }
+        }
+    });
+
+    // the 1 ns base histogram the spectra are derived from on a binning change, and deriving the 1D time spectrum from it
+    BaseHistogram base;
+    base.configure(1, (size_t)1024 * 1024 * 1024);
+    runner.run("bin base 1ns", nevents, [&]() {
+        base.clear();
+        for(size_t i=0; i<batch.size(); ++i)
+        {
+            if (ListModeEvent::isValid(batch.energy[i], batch.extras[i]))
+            {
+                base.add(tdiff[i], batch.energy[i]);
+            }
+        }
+        base.compact();
+    });
+    runner.run("derive 1D time", base.numBins(), [&]() {
+        std::fill(spec.begin(), spec.end(), 0.0);
+        base.forEach([&](uint64_t t0, uint64_t, int, int32_t count) {
+            int n = tbin.bin(t0);
+            if (n >= 0)
+            {
+                spec[n] += count;
+            }
+        });
+    });
+
+    HistPyramid2D pyramid;
+    runner.run("2D pyramid build", map2d.size(), [&]() {
+        pyramid.release();
+        pyramid.update(map2d);
+    });
+
+    // image generation from the dense 2D map, for each NDDataType
+    std::vector<epicsInt32> dense;
+    map2d.toDense(dense);
+    benchImage<epicsInt8>(runner, "Int8", dense);
+    benchImage<epicsUInt8>(runner, "UInt8", dense);
+    benchImage<epicsInt16>(runner, "Int16", dense);
+    benchImage<epicsUInt16>(runner, "UInt16", dense);
+    benchImage<epicsInt32>(runner, "Int32", dense);
+    benchImage<epicsUInt32>(runner, "UInt32", dense);
+    benchImage<epicsInt64>(runner, "Int64", dense);
+    benchImage<epicsUInt64>(runner, "UInt64", dense);
+    benchImage<epicsFloat32>(runner, "Float32", dense);
+    benchImage<epicsFloat64>(runner, "Float64", dense);
+
+    // NeXus event data writes, in the batches used by fileconverter
+    try
+    {
+        hf::File out_file(h5_filename, hf::File::Truncate);
+        benchAppend<double>(runner, out_file, "double", nevents, 100000);
+        benchAppend<int32_t>(runner, out_file, "int32", nevents, 100000);
+        benchAppend<uint32_t>(runner, out_file, "uint32", nevents, 100000);
+    }
+    catch(const std::exception& ex)
+    {
+        std::cerr << "HDF5 benchmarks failed: " << ex.what() << std::endl;
+    }
+    remove(h5_filename.c_str());
+    return 0;
+}
@@ -25,6 +25,7 @@ $(APPNAME)_DBD += CAENMCA.dbd
 
 # Add all the support libraries needed by this IOC
 $(APPNAME)_LIBS += CAENMCASup
+$(APPNAME)_LIBS += CAENMCACore
 $(APPNAME)_LIBS += asyn
 $(APPNAME)_LIBS += $(MYSQLLIB)
 